@@ -63,10 +63,14 @@
 #define KCOM_M_NETIF_DESTROY    12 /* Destroy network interface */
 #define KCOM_M_NETIF_LIST       13 /* Get list of network interface IDs */
 #define KCOM_M_NETIF_GET        14 /* Get network interface info */
+#define KCOM_M_NETIF_RATE_SET   15 /* Set network interface Rx rate limit */
+#define KCOM_M_NETIF_RATE_GET   16 /* Get network interface Rx rate limit */
 #define KCOM_M_FILTER_CREATE    21 /* Create Rx filter */
 #define KCOM_M_FILTER_DESTROY   22 /* Destroy Rx filter */
 #define KCOM_M_FILTER_LIST      23 /* Get list of Rx filter IDs */
 #define KCOM_M_FILTER_GET       24 /* Get Rx filter info */
+#define KCOM_M_FILTER_RATE_SET  25 /* Set Rx filter rate limit */
+#define KCOM_M_FILTER_RATE_GET  26 /* Get Rx filter rate limit */
 #define KCOM_M_DMA_INFO         31 /* Tx/Rx DMA info */
 #define KCOM_M_DBGPKT_SET       41 /* Enbale debug packet function */
 #define KCOM_M_DBGPKT_GET       42 /* Get debug packet function info */
@@ -564,6 +568,28 @@ typedef struct kcom_msg_filter_get_s {
     kcom_filter_t filter;
 } kcom_msg_filter_get_t;
 
+/*
+ * Rx rate limit of a network interface or packet filter. The object
+ * ID is passed in the message header. Packets exceeding the rate are
+ * dropped after filtering, before they are delivered. A rate of zero
+ * removes the limit, and a burst size of zero selects rate_max/10.
+ */
+typedef struct kcom_rate_s {
+    uint32 rate_max;                    /* Packets per second */
+    uint32 burst_max;                   /* Burst size in packets */
+    uint64 drops;                       /* Packets dropped (get only) */
+} kcom_rate_t;
+
+typedef struct kcom_msg_netif_rate_s {
+    kcom_msg_hdr_t hdr;
+    kcom_rate_t rate;
+} kcom_msg_netif_rate_t;
+
+typedef struct kcom_msg_filter_rate_s {
+    kcom_msg_hdr_t hdr;
+    kcom_rate_t rate;
+} kcom_msg_filter_rate_t;
+
 /*
  * DMA info
  */
@@ -597,10 +623,12 @@ typedef union kcom_msg_s {
     kcom_msg_netif_destroy_t netif_destroy;
     kcom_msg_netif_list_t netif_list;
     kcom_msg_netif_get_t netif_get;
+    kcom_msg_netif_rate_t netif_rate;
     kcom_msg_filter_create_t filter_create;
     kcom_msg_filter_destroy_t filter_destroy;
     kcom_msg_filter_list_t filter_list;
     kcom_msg_filter_get_t filter_get;
+    kcom_msg_filter_rate_t filter_rate;
     kcom_msg_dma_info_t dma_info;
     kcom_msg_dbg_pkt_set_t dbg_pkt_set;
     kcom_msg_dbg_pkt_get_t dbg_pkt_get;
@@ -897,6 +897,8 @@ struct pdma_dev {
 #define PDMA_VNET_DOCKED    (1 << 5)
     /*! Abort PDMA mode for suspend and resume */
 #define PDMA_ABORT          (1 << 6)
+    /*! Rx buffers from page pools */
+#define PDMA_RX_PAGE_POOL   (1 << 7)
 
     /*! Device mode */
     dev_mode_t mode;
@@ -50,6 +50,9 @@ enum buf_mode {
     /*! Kernel buffer mapped to user space */
     PDMA_BUF_MODE_MAPPED,
 
+    /*! Page pool buffer in kernel */
+    PDMA_BUF_MODE_POOL,
+
     /*! MAX mode */
     PDMA_BUF_MODE_MAX
 };
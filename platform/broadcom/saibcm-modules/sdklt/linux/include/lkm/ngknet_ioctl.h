@@ -50,6 +50,7 @@
 #define NGKNET_DEV_HNET_WAKE    _IOWR(NGKNET_IOC_MAGIC, 0xb5, unsigned int)
 #define NGKNET_DEV_VNET_DOCK    _IOWR(NGKNET_IOC_MAGIC, 0xb6, unsigned int)
 #define NGKNET_DEV_VNET_UNDOCK  _IOWR(NGKNET_IOC_MAGIC, 0xb7, unsigned int)
+#define NGKNET_DEV_VNET_MMAP    _IOWR(NGKNET_IOC_MAGIC, 0xb8, unsigned int)
 #define NGKNET_QUEUE_CONFIG     _IOWR(NGKNET_IOC_MAGIC, 0xc0, unsigned int)
 #define NGKNET_QUEUE_QUERY      _IOR(NGKNET_IOC_MAGIC,  0xc1, unsigned int)
 #define NGKNET_RCPU_CONFIG      _IOWR(NGKNET_IOC_MAGIC, 0xc2, unsigned int)
@@ -83,6 +84,111 @@ struct ngknet_ioc_data_xmit {
     uint32_t len;
 };
 
+/*! VNET shared area magic ("VNET") */
+#define NGKNET_VNET_MAP_MAGIC   0x564e4554
+
+/*! VNET shared area layout version */
+#define NGKNET_VNET_MAP_VERSION 1
+
+/*!
+ * \brief VNET shared area configuration.
+ *
+ * Passed with NGKNET_DEV_VNET_MMAP to create the VNET shared area of
+ * a HNET device. The area is destroyed if \c nb_desc is 0.
+ */
+struct ngknet_vnet_map_cfg {
+    /*! Number of descriptors per ring */
+    uint32_t nb_desc;
+
+    /*! Descriptor size in bytes */
+    uint32_t desc_size;
+
+    /*! Number of packet buffers, 0 for one per descriptor of all rings */
+    uint32_t nb_buf;
+
+    /*! Packet buffer size in bytes */
+    uint32_t buf_size;
+
+    /*! Eventfd to signal VNET, -1 if not used */
+    int32_t eventfd;
+
+    /*! Reserved */
+    uint32_t rsvd;
+
+    /*! Size of the area to be mapped (returned) */
+    uint64_t mmap_size;
+};
+
+/*!
+ * \brief VNET shared area header.
+ *
+ * The shared area is mapped with mmap() on the NGKNET device at page
+ * offset of the device number. It starts with this header, followed
+ * by one descriptor ring per Rx queue, one per Tx queue and the packet
+ * buffers. All of it is DMA memory, so the rings can be docked with
+ * NGKNET_DEV_VNET_DOCK using addresses relative to \c dma_addr and
+ * the switch device transmits directly from the packet buffers.
+ *
+ * Before sleeping on its eventfd, VNET sets \c vnet_wakeup and checks
+ * its Rx and Tx rings again. HNET sets \c hnet_wakeup when it goes to
+ * sleep, and VNET only needs NGKNET_DEV_HNET_WAKE while it is set.
+ */
+struct ngknet_vnet_map_hdr {
+    /*! Magic number */
+    uint32_t magic;
+
+    /*! Layout version */
+    uint32_t version;
+
+    /*! DMA address of the shared area */
+    uint64_t dma_addr;
+
+    /*! Size of the shared area */
+    uint64_t size;
+
+    /*! Number of Rx rings */
+    uint32_t nb_rxq;
+
+    /*! Number of Tx rings */
+    uint32_t nb_txq;
+
+    /*! Number of descriptors per ring */
+    uint32_t nb_desc;
+
+    /*! Descriptor size in bytes */
+    uint32_t desc_size;
+
+    /*! Offset of the first Rx ring */
+    uint32_t rx_ring_offset;
+
+    /*! Offset of the first Tx ring */
+    uint32_t tx_ring_offset;
+
+    /*! Offset between rings */
+    uint32_t ring_size;
+
+    /*! Offset of the first packet buffer */
+    uint32_t buf_offset;
+
+    /*! Number of packet buffers */
+    uint32_t nb_buf;
+
+    /*! Offset between packet buffers */
+    uint32_t buf_size;
+
+    /*! Set by VNET to be signaled through its eventfd */
+    volatile uint32_t vnet_wakeup;
+
+    /*! Set by HNET when it sleeps */
+    volatile uint32_t hnet_wakeup;
+
+    /*! Number of eventfd signals to VNET */
+    volatile uint64_t vnet_events;
+
+    /*! Number of wakeups of HNET */
+    volatile uint64_t hnet_wakes;
+};
+
 /*! IOCTL operations */
 union ngknet_ioc_op {
     /*! Get module info */
@@ -48,6 +48,137 @@ bcmcnet_ring_buf_free(struct pdma_dev *dev, uint32_t size, void *addr, dma_addr_
     dma_free_coherent(kdev->dev, size, addr, dma);
 }
 
+#ifdef KAL_PAGE_POOL_SUPPORT
+/*!
+ * Create page pool for Rx queue
+ *
+ * Pool pages stay DMA mapped and are recycled when the network stack
+ * frees the SKB built around them. One packet buffer per pool page,
+ * which may be a compound page for large buffers.
+ */
+static struct page_pool *
+bcmcnet_rx_pool_create(struct pdma_dev *dev, struct pdma_rx_queue *rxq, uint32_t len)
+{
+    struct ngknet_dev *kdev = (struct ngknet_dev *)dev->priv;
+    struct ngknet_rx_pool *rxp = &kdev->rx_pool[rxq->chan_id];
+    struct page_pool_params pp;
+    struct page_pool *pool;
+    int order = get_order(PDMA_RXB_SIZE(len));
+
+    if (rxp->pool) {
+        if (rxp->pool->p.order == order) {
+            return rxp->pool;
+        }
+        /* Buffer size changed, the queue has released its buffers */
+        page_pool_destroy(rxp->pool);
+        rxp->pool = NULL;
+    }
+
+    memset(&pp, 0, sizeof(pp));
+    pp.flags = PP_FLAG_DMA_MAP | PP_FLAG_DMA_SYNC_DEV;
+    pp.order = order;
+    pp.pool_size = rxq->nb_desc * 2;
+    pp.nid = NUMA_NO_NODE;
+    pp.dev = kdev->dev;
+    pp.dma_dir = DMA_FROM_DEVICE;
+    pp.offset = PDMA_RXB_RESV;
+    pp.max_len = (PAGE_SIZE << order) - PDMA_SKB_RESV;
+
+    pool = page_pool_create(&pp);
+    if (IS_ERR(pool)) {
+        printk(KERN_WARNING "ngknet: failed to create Rx%d page pool (%ld)\n",
+               rxq->chan_id, PTR_ERR(pool));
+        return NULL;
+    }
+    rxp->pool = pool;
+    rxp->allocs = 0;
+    rxp->no_pages = 0;
+
+    return pool;
+}
+
+/*!
+ * Destroy page pools
+ */
+void
+bcmcnet_rx_pool_destroy(struct pdma_dev *dev)
+{
+    struct ngknet_dev *kdev = (struct ngknet_dev *)dev->priv;
+    int ci;
+
+    for (ci = 0; ci < NUM_Q_MAX; ci++) {
+        if (kdev->rx_pool[ci].pool) {
+            /* Pages still held by the network stack are released later */
+            page_pool_destroy(kdev->rx_pool[ci].pool);
+            kdev->rx_pool[ci].pool = NULL;
+        }
+    }
+}
+
+/*!
+ * Allocate Rx buffer from page pool
+ */
+static int
+bcmcnet_rx_pool_alloc(struct pdma_dev *dev, struct pdma_rx_queue *rxq,
+                      struct pdma_rx_buf *pbuf)
+{
+    struct ngknet_dev *kdev = (struct ngknet_dev *)dev->priv;
+    struct ngknet_rx_pool *rxp = &kdev->rx_pool[rxq->chan_id];
+    struct page *page;
+
+    page = page_pool_dev_alloc_pages(rxp->pool);
+    if (unlikely(!page)) {
+        rxp->no_pages++;
+        return SHR_E_MEMORY;
+    }
+    rxp->allocs++;
+    pbuf->dma = page_pool_get_dma_addr(page);
+    pbuf->page = page;
+    pbuf->page_offset = 0;
+
+    return SHR_E_NONE;
+}
+
+/*!
+ * Build SKB around page pool Rx buffer
+ */
+static struct sk_buff *
+bcmcnet_rx_pool_build_skb(struct pdma_dev *dev, struct pdma_rx_queue *rxq,
+                          struct pdma_rx_buf *pbuf, int len)
+{
+    struct ngknet_dev *kdev = (struct ngknet_dev *)dev->priv;
+    struct page_pool *pool = kdev->rx_pool[rxq->chan_id].pool;
+    unsigned int truesize = PAGE_SIZE << pool->p.order;
+    struct sk_buff *skb;
+
+    dma_sync_single_range_for_cpu(kdev->dev, pbuf->dma, PDMA_RXB_RESV + pbuf->adj,
+                                  len, DMA_FROM_DEVICE);
+    if (in_serving_softirq() && !in_hardirq()) {
+        /* NAPI poll, use the per-CPU SKB cache */
+        skb = napi_build_skb(page_address(pbuf->page), truesize);
+    } else {
+        skb = build_skb(page_address(pbuf->page), truesize);
+    }
+    if (unlikely(!skb)) {
+        /* The page stays with the descriptor */
+        return NULL;
+    }
+    skb_reserve(skb, PDMA_RXB_ALIGN);
+    skb_mark_for_recycle(skb);
+
+    /* The page now belongs to the SKB */
+    pbuf->dma = 0;
+    pbuf->page = NULL;
+
+    return skb;
+}
+#else
+void
+bcmcnet_rx_pool_destroy(struct pdma_dev *dev)
+{
+}
+#endif /* KAL_PAGE_POOL_SUPPORT */
+
 /*!
  * Allocate Rx buffer
  */
@@ -60,6 +191,12 @@ bcmcnet_rx_buf_alloc(struct pdma_dev *dev, struct pdma_rx_queue *rxq,
     struct page *page;
     struct sk_buff *skb;
 
+#ifdef KAL_PAGE_POOL_SUPPORT
+    if (rxq->mode == PDMA_BUF_MODE_POOL) {
+        return bcmcnet_rx_pool_alloc(dev, rxq, pbuf);
+    }
+#endif
+
     if (rxq->mode == PDMA_BUF_MODE_PAGE) {
         page = kal_dev_alloc_page();
         if (unlikely(!page)) {
@@ -99,7 +236,7 @@ static void
 bcmcnet_rx_buf_dma(struct pdma_dev *dev, struct pdma_rx_queue *rxq,
                    struct pdma_rx_buf *pbuf, dma_addr_t *addr)
 {
-    if (rxq->mode == PDMA_BUF_MODE_PAGE) {
+    if (rxq->mode == PDMA_BUF_MODE_PAGE || rxq->mode == PDMA_BUF_MODE_POOL) {
         *addr = pbuf->dma + pbuf->page_offset + PDMA_RXB_RESV + pbuf->adj;
     } else {
         *addr = pbuf->dma;
@@ -113,7 +250,7 @@ static bool
 bcmcnet_rx_buf_avail(struct pdma_dev *dev, struct pdma_rx_queue *rxq,
                      struct pdma_rx_buf *pbuf)
 {
-    if (rxq->mode == PDMA_BUF_MODE_PAGE) {
+    if (rxq->mode == PDMA_BUF_MODE_PAGE || rxq->mode == PDMA_BUF_MODE_POOL) {
         pbuf->skb = NULL;
     }
 
@@ -130,6 +267,23 @@ bcmcnet_rx_buf_get(struct pdma_dev *dev, struct pdma_rx_queue *rxq,
     struct ngknet_dev *kdev = (struct ngknet_dev *)dev->priv;
     struct sk_buff *skb;
 
+#ifdef KAL_PAGE_POOL_SUPPORT
+    if (rxq->mode == PDMA_BUF_MODE_POOL) {
+        if (pbuf->skb) {
+            return &pbuf->pkb->pkh;
+        }
+        skb = bcmcnet_rx_pool_build_skb(dev, rxq, pbuf, len);
+        if (unlikely(!skb)) {
+            return NULL;
+        }
+        pbuf->skb = skb;
+        pbuf->pkb = (struct pkt_buf *)skb->data;
+        skb_put(skb, PKT_HDR_SIZE + pbuf->adj + len);
+
+        return &pbuf->pkb->pkh;
+    }
+#endif
+
     if (rxq->mode == PDMA_BUF_MODE_PAGE) {
         if (pbuf->skb) {
             return &pbuf->pkb->pkh;
@@ -180,7 +334,8 @@ bcmcnet_rx_buf_put(struct pdma_dev *dev, struct pdma_rx_queue *rxq,
     dma_addr_t dma;
     struct sk_buff *skb;
 
-    if (rxq->mode == PDMA_BUF_MODE_PAGE) {
+    if (rxq->mode == PDMA_BUF_MODE_PAGE || rxq->mode == PDMA_BUF_MODE_POOL) {
+        /* Pool pages go back to the pool */
         dev_kfree_skb_any(pbuf->skb);
     } else {
         skb = pbuf->skb;
@@ -211,6 +366,11 @@ bcmcnet_rx_buf_free(struct pdma_dev *dev, struct pdma_rx_queue *rxq,
 {
     struct ngknet_dev *kdev = (struct ngknet_dev *)dev->priv;
 
+#ifdef KAL_PAGE_POOL_SUPPORT
+    if (rxq->mode == PDMA_BUF_MODE_POOL) {
+        page_pool_put_full_page(kdev->rx_pool[rxq->chan_id].pool, pbuf->page, false);
+    } else
+#endif
     if (rxq->mode == PDMA_BUF_MODE_PAGE) {
         dma_unmap_single(kdev->dev, pbuf->dma, PAGE_SIZE, DMA_FROM_DEVICE);
         __free_page(pbuf->page);
@@ -236,6 +396,11 @@ bcmcnet_rx_buf_mode(struct pdma_dev *dev, struct pdma_rx_queue *rxq)
     uint32_t len;
 
     len = dev->rx_ph_size ? rxq->buf_size : rxq->buf_size + PDMA_RXB_META;
+#ifdef KAL_PAGE_POOL_SUPPORT
+    if (dev->flags & PDMA_RX_PAGE_POOL && bcmcnet_rx_pool_create(dev, rxq, len)) {
+        return PDMA_BUF_MODE_POOL;
+    }
+#endif
     if (PDMA_RXB_SIZE(len) <= PDMA_PAGE_BUF_MAX && PAGE_SIZE < 8192 &&
         kal_support_paged_skb()) {
         return PDMA_BUF_MODE_PAGE;
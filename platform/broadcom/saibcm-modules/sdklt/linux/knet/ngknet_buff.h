@@ -79,5 +79,15 @@ struct pdma_tx_buf {
     uint32_t adj;
 };
 
+/*!
+ * \brief Destroy Rx page pools.
+ *
+ * The Rx queues must have released their buffers.
+ *
+ * \param [in] dev Device structure point.
+ */
+extern void
+bcmcnet_rx_pool_destroy(struct pdma_dev *dev);
+
 #endif /* NGKNET_BUFF_H */
 
@@ -43,9 +43,15 @@
 #include <linux/delay.h>
 #include <linux/bitops.h>
 #include <linux/time.h>
+#include <linux/percpu.h>
+#include <linux/jhash.h>
+#include <linux/rcupdate.h>
+#include <linux/random.h>
+#include <linux/ktime.h>
 
 #include <lkm/ngknet_dev.h>
 #include <bcmcnet/bcmcnet_core.h>
+#include <bcmcnet/bcmcnet_rxtx.h>
 #include "ngknet_main.h"
 #include "ngknet_extra.h"
 #include "ngknet_callback.h"
@@ -53,11 +59,479 @@
 /*! Defalut Rx tick for Rx rate limit control. */
 #define NGKNET_EXTRA_RATE_LIMIT_DEFAULT_RX_TICK 10
 
+/*! Maximum tokens (packets) a CPU takes from a queue bucket at once. */
+#define NGKNET_EXTRA_RATE_LIMIT_CPU_BATCH 16
+
 static struct ngknet_rl_ctrl rl_ctrl;
 
+/*! Filter key. */
+union ngknet_filter_key {
+    uint8_t b[NGKNET_FILTER_BYTES_MAX];
+    uint32_t w[NGKNET_FILTER_WORDS_MAX];
+};
+
+static inline uint32_t
+ngknet_filter_key_hash(uint32_t *key, int wsize)
+{
+    return jhash2(key, wsize, 0);
+}
+
+/*!
+ * Compare masked OOB data and packet data with filter data.
+ */
+static int
+ngknet_filter_data_match(ngknet_filter_t *filt, uint8_t *oob, uint8_t *pkt)
+{
+    union ngknet_filter_key scratch;
+    int wsize;
+    int idx;
+
+    memcpy(&scratch.b[0],
+           &oob[filt->oob_data_offset], filt->oob_data_size);
+    memcpy(&scratch.b[filt->oob_data_size],
+           &pkt[filt->pkt_data_offset], filt->pkt_data_size);
+    wsize = NGKNET_BYTES2WORDS(filt->oob_data_size + filt->pkt_data_size);
+    for (idx = 0; idx < wsize; idx++) {
+        scratch.w[idx] &= filt->mask.w[idx];
+        if (scratch.w[idx] != filt->data.w[idx]) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*!
+ * Check a filter whose data matched. Callback filters are recorded and
+ * the search goes on. Returns 1 if the filter takes the packet.
+ */
+static int
+ngknet_filter_accept(struct filt_ctrl *fc, int chan_id, struct filt_ctrl **cb_fc)
+{
+    ngknet_filter_t *filt = &fc->filt;
+
+    if (filt->flags & NGKNET_FILTER_F_ANY_DATA) {
+        return 1;
+    }
+    if (filt->flags & NGKNET_FILTER_F_MATCH_CHAN && filt->chan != chan_id) {
+        return 0;
+    }
+    if (filt->dest_type == NGKNET_FILTER_DEST_T_CB) {
+        *cb_fc = fc;
+        return 0;
+    }
+
+    return 1;
+}
+
+/*!
+ * Match packet by walking the filter list.
+ * Must be called with the device lock held.
+ */
+static struct filt_ctrl *
+ngknet_filter_match_linear(struct ngknet_dev *dev, uint8_t *oob, uint8_t *pkt,
+                           int chan_id, struct filt_ctrl **cb_fc)
+{
+    struct filt_ctrl *fc = NULL;
+    struct list_head *list = NULL;
+    ngknet_filter_t *filt = NULL;
+
+    list_for_each(list, &dev->filt_list) {
+        fc = (struct filt_ctrl *)list;
+        filt = &fc->filt;
+        if (!(filt->flags & NGKNET_FILTER_F_ANY_DATA) &&
+            !ngknet_filter_data_match(filt, oob, pkt)) {
+            continue;
+        }
+        if (ngknet_filter_accept(fc, chan_id, cb_fc)) {
+            return fc;
+        }
+    }
+
+    return NULL;
+}
+
+/*!
+ * Check if filter fits a table: mask and data must be confined to the
+ * matched bytes, and data must not have bits outside the mask (such a
+ * filter never matches, and is left to the linear filters).
+ */
+static int
+ngknet_filter_table_usable(ngknet_filter_t *filt)
+{
+    int size, idx;
+
+    if (filt->flags & NGKNET_FILTER_F_ANY_DATA) {
+        return 0;
+    }
+    size = filt->oob_data_size + filt->pkt_data_size;
+    if (size > NGKNET_FILTER_BYTES_MAX) {
+        return 0;
+    }
+    for (idx = size; idx < NGKNET_BYTES2WORDS(size) * 4; idx++) {
+        if (filt->mask.b[idx] != 0) {
+            return 0;
+        }
+    }
+    for (idx = 0; idx < NGKNET_BYTES2WORDS(size); idx++) {
+        if (filt->data.w[idx] & ~filt->mask.w[idx]) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static int
+ngknet_filter_table_same(struct ngknet_filter_table *tbl, ngknet_filter_t *filt)
+{
+    return tbl->oob_data_offset == filt->oob_data_offset &&
+           tbl->oob_data_size == filt->oob_data_size &&
+           tbl->pkt_data_offset == filt->pkt_data_offset &&
+           tbl->pkt_data_size == filt->pkt_data_size &&
+           memcmp(tbl->mask, filt->mask.w, tbl->wsize * 4) == 0;
+}
+
+/*!
+ * Add entry to table, entries with equal key are kept in list order.
+ */
+static void
+ngknet_filter_table_add(struct ngknet_filter_table *tbl,
+                        struct ngknet_filter_ent *ent)
+{
+    struct ngknet_filter_ent **head, *last;
+    uint32_t *data = ent->fc->filt.data.w;
+
+    ent->key_hash = ngknet_filter_key_hash(data, tbl->wsize);
+
+    head = &tbl->bucket[ent->key_hash & (NGKNET_FILTER_HASH_SIZE - 1)];
+    for (; *head != NULL; head = &(*head)->hash_next) {
+        if ((*head)->key_hash == ent->key_hash &&
+            memcmp((*head)->fc->filt.data.w, data, tbl->wsize * 4) == 0) {
+            /* Entries are added in list order, append */
+            for (last = *head; last->key_next; last = last->key_next);
+            last->key_next = ent;
+            tbl->filters++;
+            return;
+        }
+    }
+    *head = ent;
+    tbl->filters++;
+}
+
+static void
+ngknet_filter_cls_free(struct ngknet_filter_cls *cls)
+{
+    int idx;
+
+    for (idx = 0; idx < cls->num_tables; idx++) {
+        kfree(cls->tables[idx]);
+    }
+    free_percpu(cls->stats);
+    kfree(cls->linear);
+    kfree(cls->ents);
+    kfree(cls);
+}
+
+static void
+ngknet_filter_cls_free_rcu(struct rcu_head *head)
+{
+    ngknet_filter_cls_free(container_of(head, struct ngknet_filter_cls, rcu));
+}
+
+void
+ngknet_filter_table_stats_get(struct ngknet_filter_cls *cls, int idx,
+                              struct ngknet_filter_table_stats *stats)
+{
+    struct ngknet_filter_table_stats *cpu_stats;
+    int cpu, si;
+
+    if (idx < cls->num_tables) {
+        *stats = cls->tables[idx]->base;
+        si = idx;
+    } else {
+        *stats = cls->linear_base;
+        si = NGKNET_FILTER_TABLE_MAX;
+    }
+    for_each_possible_cpu(cpu) {
+        cpu_stats = per_cpu_ptr(cls->stats, cpu) + si;
+        stats->lookups += cpu_stats->lookups;
+        stats->hits += cpu_stats->hits;
+        stats->matches += cpu_stats->matches;
+    }
+}
+
+void
+ngknet_filter_table_stats_clear(struct ngknet_dev *dev)
+{
+    struct ngknet_filter_cls *cls;
+    int cpu, idx;
+
+    rcu_read_lock();
+    cls = rcu_dereference(dev->filt_cls);
+    if (cls) {
+        for (idx = 0; idx < cls->num_tables; idx++) {
+            memset(&cls->tables[idx]->base, 0, sizeof(cls->tables[idx]->base));
+        }
+        memset(&cls->linear_base, 0, sizeof(cls->linear_base));
+        for_each_possible_cpu(cpu) {
+            memset(per_cpu_ptr(cls->stats, cpu), 0,
+                   sizeof(struct ngknet_filter_table_stats) *
+                   (NGKNET_FILTER_TABLE_MAX + 1));
+        }
+    }
+    rcu_read_unlock();
+}
+
+/*!
+ * Compile the filter list into tables. Counters of tables found in the
+ * old compiled filters are carried over. Returns NULL on failure, in
+ * which case filters are matched linearly.
+ */
+static struct ngknet_filter_cls *
+ngknet_filter_cls_compile(struct ngknet_dev *dev, struct ngknet_filter_cls *old)
+{
+    struct ngknet_filter_cls *cls = NULL;
+    struct ngknet_filter_table *tbl = NULL, *otbl = NULL;
+    struct ngknet_filter_ent *ent = NULL;
+    struct list_head *list = NULL;
+    ngknet_filter_t *filt = NULL;
+    int num = 0;
+    int idx, oidx;
+
+    list_for_each(list, &dev->filt_list) {
+        num++;
+    }
+
+    cls = kzalloc(sizeof(*cls), GFP_ATOMIC);
+    if (!cls) {
+        return NULL;
+    }
+    cls->ents = kcalloc(num, sizeof(*cls->ents), GFP_ATOMIC);
+    cls->linear = kcalloc(num, sizeof(*cls->linear), GFP_ATOMIC);
+    cls->stats = __alloc_percpu_gfp(sizeof(struct ngknet_filter_table_stats) *
+                                    (NGKNET_FILTER_TABLE_MAX + 1),
+                                    __alignof__(struct ngknet_filter_table_stats),
+                                    GFP_ATOMIC);
+    if (!cls->ents || !cls->linear || !cls->stats) {
+        ngknet_filter_cls_free(cls);
+        return NULL;
+    }
+
+    num = 0;
+    list_for_each(list, &dev->filt_list) {
+        ent = &cls->ents[num];
+        ent->fc = (struct filt_ctrl *)list;
+        ent->order = num++;
+        filt = &ent->fc->filt;
+
+        tbl = NULL;
+        if (ngknet_filter_table_usable(filt)) {
+            for (idx = 0; idx < cls->num_tables; idx++) {
+                if (ngknet_filter_table_same(cls->tables[idx], filt)) {
+                    tbl = cls->tables[idx];
+                    break;
+                }
+            }
+            if (!tbl && cls->num_tables < NGKNET_FILTER_TABLE_MAX) {
+                tbl = kzalloc(sizeof(*tbl), GFP_ATOMIC);
+                if (!tbl) {
+                    ngknet_filter_cls_free(cls);
+                    return NULL;
+                }
+                tbl->oob_data_offset = filt->oob_data_offset;
+                tbl->oob_data_size = filt->oob_data_size;
+                tbl->pkt_data_offset = filt->pkt_data_offset;
+                tbl->pkt_data_size = filt->pkt_data_size;
+                tbl->wsize = NGKNET_BYTES2WORDS(filt->oob_data_size +
+                                                filt->pkt_data_size);
+                memcpy(tbl->mask, filt->mask.w, tbl->wsize * 4);
+                /* Tables are created in list order */
+                tbl->min_order = ent->order;
+                cls->tables[cls->num_tables++] = tbl;
+            }
+        }
+
+        if (tbl) {
+            ngknet_filter_table_add(tbl, ent);
+        } else {
+            cls->linear[cls->num_linear++] = ent;
+        }
+    }
+
+    if (old) {
+        for (idx = 0; idx < cls->num_tables; idx++) {
+            tbl = cls->tables[idx];
+            for (oidx = 0; oidx < old->num_tables; oidx++) {
+                otbl = old->tables[oidx];
+                if (otbl->wsize == tbl->wsize &&
+                    otbl->oob_data_offset == tbl->oob_data_offset &&
+                    otbl->oob_data_size == tbl->oob_data_size &&
+                    otbl->pkt_data_offset == tbl->pkt_data_offset &&
+                    otbl->pkt_data_size == tbl->pkt_data_size &&
+                    memcmp(otbl->mask, tbl->mask, tbl->wsize * 4) == 0) {
+                    ngknet_filter_table_stats_get(old, oidx, &tbl->base);
+                    break;
+                }
+            }
+        }
+        ngknet_filter_table_stats_get(old, old->num_tables, &cls->linear_base);
+    }
+
+    return cls;
+}
+
+/*!
+ * Recompile filters after the filter list changed.
+ * Must be called with the device lock held. Returns the old compiled
+ * filters, which are to be freed by the caller with call_rcu().
+ */
+static struct ngknet_filter_cls *
+ngknet_filter_cls_update(struct ngknet_dev *dev)
+{
+    struct ngknet_filter_cls *old, *cls = NULL;
+
+    old = rcu_dereference_protected(dev->filt_cls, lockdep_is_held(&dev->lock));
+    if (!list_empty(&dev->filt_list)) {
+        cls = ngknet_filter_cls_compile(dev, old);
+        if (!cls) {
+            printk(KERN_WARNING "ngknet: failed to compile filters of device%d, "
+                   "using linear match\n", dev->dev_no);
+        }
+    }
+    rcu_assign_pointer(dev->filt_cls, cls);
+
+    return old;
+}
+
+/*!
+ * Look up packet in table, returns the first entry with matching key.
+ */
+static struct ngknet_filter_ent *
+ngknet_filter_table_lookup(struct ngknet_filter_table *tbl, uint8_t *oob,
+                           uint8_t *pkt, struct ngknet_filter_table_stats *stats)
+{
+    union ngknet_filter_key key;
+    struct ngknet_filter_ent *ent;
+    uint32_t hash;
+    int idx;
+
+    stats->lookups++;
+
+    if (tbl->wsize) {
+        key.w[tbl->wsize - 1] = 0;
+    }
+    memcpy(&key.b[0], &oob[tbl->oob_data_offset], tbl->oob_data_size);
+    memcpy(&key.b[tbl->oob_data_size],
+           &pkt[tbl->pkt_data_offset], tbl->pkt_data_size);
+    for (idx = 0; idx < tbl->wsize; idx++) {
+        key.w[idx] &= tbl->mask[idx];
+    }
+
+    hash = ngknet_filter_key_hash(key.w, tbl->wsize);
+    ent = tbl->bucket[hash & (NGKNET_FILTER_HASH_SIZE - 1)];
+    for (; ent != NULL; ent = ent->hash_next) {
+        if (ent->key_hash == hash &&
+            memcmp(ent->fc->filt.data.w, key.w, tbl->wsize * 4) == 0) {
+            stats->hits++;
+            return ent;
+        }
+    }
+
+    return NULL;
+}
+
+/*!
+ * Match packet with compiled filters, with the same result as walking
+ * the filter list. Must be called under RCU read lock.
+ */
+static struct filt_ctrl *
+ngknet_filter_match_cls(struct ngknet_filter_cls *cls, uint8_t *oob, uint8_t *pkt,
+                        int chan_id, struct filt_ctrl **cb_fc,
+                        struct ngknet_filter_table_stats *stats)
+{
+    struct ngknet_filter_ent *cand[NGKNET_FILTER_TABLE_MAX];
+    struct ngknet_filter_ent *best, *ent;
+    ngknet_filter_t *filt;
+    int num_looked_up = 0;
+    int linear_idx = 0;
+    int best_idx;
+    int idx;
+
+    while (1) {
+        /* Best candidate of tables looked up so far */
+        best = NULL;
+        best_idx = -1;
+        for (idx = 0; idx < num_looked_up; idx++) {
+            if (cand[idx] && (!best || cand[idx]->order < best->order)) {
+                best = cand[idx];
+                best_idx = idx;
+            }
+        }
+
+        /* Look up tables which may contain a filter preceding best */
+        while (num_looked_up < cls->num_tables &&
+               (!best || cls->tables[num_looked_up]->min_order < best->order)) {
+            idx = num_looked_up++;
+            cand[idx] = ngknet_filter_table_lookup(cls->tables[idx],
+                                                   oob, pkt, &stats[idx]);
+            if (cand[idx] && (!best || cand[idx]->order < best->order)) {
+                best = cand[idx];
+                best_idx = idx;
+            }
+        }
+
+        /* Linear filters preceding best */
+        while (linear_idx < cls->num_linear &&
+               (!best || cls->linear[linear_idx]->order < best->order)) {
+            ent = cls->linear[linear_idx];
+            filt = &ent->fc->filt;
+            stats[NGKNET_FILTER_TABLE_MAX].lookups++;
+            if (filt->flags & NGKNET_FILTER_F_ANY_DATA ||
+                ngknet_filter_data_match(filt, oob, pkt)) {
+                stats[NGKNET_FILTER_TABLE_MAX].hits++;
+                best = ent;
+                best_idx = -1;
+                break;
+            }
+            linear_idx++;
+        }
+
+        if (!best) {
+            return NULL;
+        }
+
+        /* Advance past best for the next round */
+        if (best_idx < 0) {
+            linear_idx++;
+        } else {
+            cand[best_idx] = best->key_next;
+        }
+
+        if (ngknet_filter_accept(best->fc, chan_id, cb_fc)) {
+            stats[best_idx < 0 ? NGKNET_FILTER_TABLE_MAX : best_idx].matches++;
+            return best->fc;
+        }
+    }
+}
+
+static void
+ngknet_filter_free(struct filt_ctrl *fc)
+{
+    free_percpu(fc->hits);
+    kfree(fc);
+}
+
+static void
+ngknet_filter_free_rcu(struct rcu_head *head)
+{
+    ngknet_filter_free(container_of(head, struct filt_ctrl, rcu));
+}
+
 int
 ngknet_filter_create(struct ngknet_dev *dev, ngknet_filter_t *filter)
 {
+    struct ngknet_filter_cls *old = NULL;
     struct filt_ctrl *fc = NULL;
     struct list_head *list = NULL;
     ngknet_filter_t *filt = NULL;
@@ -81,6 +555,16 @@ ngknet_filter_create(struct ngknet_dev *dev, ngknet_filter_t *filter)
         return SHR_E_UNAVAIL;
     }
 
+    fc = kzalloc(sizeof(*fc), GFP_KERNEL);
+    if (!fc) {
+        return SHR_E_MEMORY;
+    }
+    fc->hits = alloc_percpu(uint64_t);
+    if (!fc->hits) {
+        kfree(fc);
+        return SHR_E_MEMORY;
+    }
+
     spin_lock_irqsave(&dev->lock, flags);
 
     num = (long)dev->fc[0];
@@ -91,15 +575,10 @@ ngknet_filter_create(struct ngknet_dev *dev, ngknet_filter_t *filter)
     }
     if (id > NUM_FILTER_MAX) {
         spin_unlock_irqrestore(&dev->lock, flags);
+        ngknet_filter_free(fc);
         return SHR_E_RESOURCE;
     }
 
-    fc = kzalloc(sizeof(*fc), GFP_KERNEL);
-    if (!fc) {
-        spin_unlock_irqrestore(&dev->lock, flags);
-        return SHR_E_MEMORY;
-    }
-
     dev->fc[id] = fc;
     num += id == (num + 1) ? 1 : 0;
     dev->fc[0] = (void *)(long)num;
@@ -135,14 +614,21 @@ ngknet_filter_create(struct ngknet_dev *dev, ngknet_filter_t *filter)
 
     filter->id = fc->filt.id;
 
+    old = ngknet_filter_cls_update(dev);
+
     spin_unlock_irqrestore(&dev->lock, flags);
 
+    if (old) {
+        call_rcu(&old->rcu, ngknet_filter_cls_free_rcu);
+    }
+
     return SHR_E_NONE;
 }
 
 int
 ngknet_filter_destroy(struct ngknet_dev *dev, int id)
 {
+    struct ngknet_filter_cls *old = NULL;
     struct filt_ctrl *fc = NULL;
     unsigned long flags;
     int num;
@@ -160,7 +646,8 @@ ngknet_filter_destroy(struct ngknet_dev *dev, int id)
     }
 
     list_del(&fc->list);
-    kfree(fc);
+    old = ngknet_filter_cls_update(dev);
+    call_rcu(&fc->rcu, ngknet_filter_free_rcu);
 
     dev->fc[id] = NULL;
     num = (long)dev->fc[0];
@@ -173,6 +660,10 @@ ngknet_filter_destroy(struct ngknet_dev *dev, int id)
 
     spin_unlock_irqrestore(&dev->lock, flags);
 
+    if (old) {
+        call_rcu(&old->rcu, ngknet_filter_cls_free_rcu);
+    }
+
     return SHR_E_NONE;
 }
 
@@ -184,7 +675,7 @@ ngknet_filter_destroy_all(struct ngknet_dev *dev)
 
     for (id = 1; id <= NUM_FILTER_MAX; id++) {
         rv = ngknet_filter_destroy(dev, id);
-        if (SHR_FAILURE(rv)) {
+        if (SHR_FAILURE(rv) && rv != SHR_E_NOT_FOUND) {
             return rv;
         }
     }
@@ -247,23 +738,162 @@ ngknet_filter_get_next(struct ngknet_dev *dev, ngknet_filter_t *filter)
     return ngknet_filter_get(dev, filter->next, filter);
 }
 
+uint64_t
+ngknet_filter_hits_get(struct filt_ctrl *fc)
+{
+    uint64_t hits = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        hits += *per_cpu_ptr(fc->hits, cpu);
+    }
+
+    return hits;
+}
+
+/*!
+ * Build a self-test packet. Most packets are built to match a filter
+ * picked at random, the others are left random.
+ */
+static void
+ngknet_filter_selftest_pkt(struct ngknet_dev *dev, uint8_t *oob, int oob_len,
+                           uint8_t *pkt, int pkt_len, int *chan_id)
+{
+    struct filt_ctrl *fc = NULL;
+    ngknet_filter_t *filt = NULL;
+    unsigned long flags;
+    uint32_t rnd;
+    int num, idx;
+
+    get_random_bytes(oob, oob_len);
+    get_random_bytes(pkt, pkt_len);
+    get_random_bytes(&rnd, sizeof(rnd));
+    *chan_id = rnd % 4;
+    if ((rnd >> 8) % 4 == 0) {
+        return;
+    }
+
+    spin_lock_irqsave(&dev->lock, flags);
+    num = (long)dev->fc[0];
+    if (num) {
+        fc = (struct filt_ctrl *)dev->fc[1 + (rnd >> 16) % num];
+    }
+    if (fc) {
+        filt = &fc->filt;
+        if (filt->flags & NGKNET_FILTER_F_MATCH_CHAN && (rnd >> 12) % 2) {
+            *chan_id = filt->chan;
+        }
+        for (idx = 0; idx < filt->oob_data_size + filt->pkt_data_size &&
+                      idx < NGKNET_FILTER_BYTES_MAX; idx++) {
+            uint8_t *byte = idx < filt->oob_data_size ?
+                            &oob[filt->oob_data_offset + idx] :
+                            &pkt[filt->pkt_data_offset + idx - filt->oob_data_size];
+            *byte = (*byte & ~filt->mask.b[idx]) |
+                    (filt->data.b[idx] & filt->mask.b[idx]);
+        }
+    }
+    spin_unlock_irqrestore(&dev->lock, flags);
+}
+
 int
-ngknet_rx_pkt_filter(struct ngknet_dev *dev, struct sk_buff *skb, struct net_device **ndev,
-                     struct net_device **mndev, struct sk_buff **mskb)
+ngknet_filter_selftest(struct ngknet_dev *dev, int pkts)
+{
+    struct ngknet_filter_table_stats *stats = NULL;
+    struct ngknet_filter_cls *cls = NULL;
+    struct filt_ctrl *fc, *fc_linear, *fc_cls, *cb_linear, *cb_cls;
+    struct list_head *list = NULL;
+    uint64_t ns_linear = 0, ns_cls = 0, start;
+    uint8_t *oob = NULL, *pkt = NULL;
+    unsigned long flags;
+    int oob_len = 1, pkt_len = 1;
+    int mismatches = 0;
+    int chan_id, idx;
+
+    /* Packets must cover the data matched by every filter */
+    spin_lock_irqsave(&dev->lock, flags);
+    list_for_each(list, &dev->filt_list) {
+        fc = (struct filt_ctrl *)list;
+        oob_len = max(oob_len, fc->filt.oob_data_offset + fc->filt.oob_data_size);
+        pkt_len = max(pkt_len, fc->filt.pkt_data_offset + fc->filt.pkt_data_size);
+    }
+    spin_unlock_irqrestore(&dev->lock, flags);
+    pkt_len += NGKNET_FILTER_BYTES_MAX;
+
+    oob = kmalloc(oob_len + pkt_len, GFP_KERNEL);
+    stats = kcalloc(NGKNET_FILTER_TABLE_MAX + 1, sizeof(*stats), GFP_KERNEL);
+    if (!oob || !stats) {
+        kfree(oob);
+        kfree(stats);
+        return SHR_E_MEMORY;
+    }
+    pkt = oob + oob_len;
+
+    for (idx = 0; idx < pkts; idx++) {
+        ngknet_filter_selftest_pkt(dev, oob, oob_len, pkt, pkt_len, &chan_id);
+
+        cb_linear = NULL;
+        start = ktime_get_ns();
+        spin_lock_irqsave(&dev->lock, flags);
+        fc_linear = ngknet_filter_match_linear(dev, oob, pkt, chan_id, &cb_linear);
+        spin_unlock_irqrestore(&dev->lock, flags);
+        ns_linear += ktime_get_ns() - start;
+
+        cb_cls = NULL;
+        fc_cls = NULL;
+        start = ktime_get_ns();
+        rcu_read_lock();
+        cls = rcu_dereference(dev->filt_cls);
+        if (cls) {
+            fc_cls = ngknet_filter_match_cls(cls, oob, pkt, chan_id, &cb_cls, stats);
+        } else {
+            spin_lock_irqsave(&dev->lock, flags);
+            fc_cls = ngknet_filter_match_linear(dev, oob, pkt, chan_id, &cb_cls);
+            spin_unlock_irqrestore(&dev->lock, flags);
+        }
+        rcu_read_unlock();
+        ns_cls += ktime_get_ns() - start;
+
+        if (fc_linear != fc_cls || (fc_linear && cb_linear != cb_cls)) {
+            if (mismatches++ < 8) {
+                printk(KERN_WARNING "ngknet: filter self-test device%d packet %d: "
+                       "linear filter %d (cb %d), compiled filter %d (cb %d)\n",
+                       dev->dev_no, idx,
+                       fc_linear ? fc_linear->filt.id : 0, cb_linear ? cb_linear->filt.id : 0,
+                       fc_cls ? fc_cls->filt.id : 0, cb_cls ? cb_cls->filt.id : 0);
+            }
+        }
+        cond_resched();
+    }
+
+    printk("ngknet: filter self-test device%d: %d packets, %d mismatches, "
+           "linear %llu ns, compiled %llu ns\n", dev->dev_no, pkts, mismatches,
+           (unsigned long long)ns_linear, (unsigned long long)ns_cls);
+
+    kfree(oob);
+    kfree(stats);
+
+    return mismatches;
+}
+
+/*!
+ * Filter packet, called under RCU read lock.
+ */
+static int
+ngknet_rx_pkt_filter_rcu(struct ngknet_dev *dev, struct sk_buff *skb, struct net_device **ndev,
+                         struct net_device **mndev, struct sk_buff **mskb)
 {
     struct pkt_buf *pkb = (struct pkt_buf *)skb->data;
     struct net_device *dest_ndev = NULL, *mirror_ndev = NULL;
     struct sk_buff *mirror_skb = NULL;
     struct ngknet_private *priv = NULL;
-    struct filt_ctrl *fc = NULL;
-    struct list_head *list = NULL;
-    ngknet_filter_t scratch, *filt = NULL, *filt_cb = NULL;
-    uint8_t *oob = &pkb->data, *data = NULL;
+    struct ngknet_filter_cls *cls = NULL;
+    struct filt_ctrl *fc = NULL, *cb_fc = NULL;
+    ngknet_filter_t *filt = NULL, *filt_cb = NULL;
+    uint8_t *oob = &pkb->data, *pkt = NULL, *data = NULL;
     uint16_t tpid;
     unsigned long flags;
-    int wsize;
     int chan_id;
-    int rv, idx, match = 0, match_cb = 0;
+    int rv, match_cb = 0;
 
     rv = bcmcnet_pdma_dev_queue_to_chan(&dev->pdma_dev, pkb->pkh.queue_id,
                                         PDMA_Q_RX, &chan_id);
@@ -271,108 +901,81 @@ ngknet_rx_pkt_filter(struct ngknet_dev *dev, struct sk_buff *skb, struct net_dev
         return rv;
     }
 
-    spin_lock_irqsave(&dev->lock, flags);
-
-    dest_ndev = dev->bdev[chan_id];
+    dest_ndev = rcu_dereference(dev->bdev[chan_id]);
     if (dest_ndev) {
         skb->dev = dest_ndev;
         priv = netdev_priv(dest_ndev);
-        priv->users++;
+        atomic_inc(&priv->users);
         *ndev = dest_ndev;
-        spin_unlock_irqrestore(&dev->lock, flags);
         return SHR_E_NONE;
     }
 
-    if (list_empty(&dev->filt_list)) {
+    pkt = &pkb->data + pkb->pkh.meta_len;
+    cls = rcu_dereference(dev->filt_cls);
+    if (cls) {
+        fc = ngknet_filter_match_cls(cls, oob, pkt, chan_id, &cb_fc,
+                                     this_cpu_ptr(cls->stats));
+    } else if (!list_empty(&dev->filt_list)) {
+        /* Filters could not be compiled */
+        spin_lock_irqsave(&dev->lock, flags);
+        fc = ngknet_filter_match_linear(dev, oob, pkt, chan_id, &cb_fc);
         spin_unlock_irqrestore(&dev->lock, flags);
+    }
+    if (!fc) {
         return SHR_E_NONE;
     }
+    filt = &fc->filt;
+    if (cb_fc) {
+        filt_cb = &cb_fc->filt;
+        match_cb = 1;
+    }
 
-    list_for_each(list, &dev->filt_list) {
-        fc = (struct filt_ctrl *)list;
-        filt = &fc->filt;
-        if (filt->flags & NGKNET_FILTER_F_ANY_DATA) {
-            match = 1;
-            break;
-        }
-        if (filt->flags & NGKNET_FILTER_F_MATCH_CHAN && filt->chan != chan_id) {
-            continue;
-        }
-        memcpy(&scratch.data.b[0],
-               &oob[filt->oob_data_offset], filt->oob_data_size);
-        memcpy(&scratch.data.b[filt->oob_data_size],
-               &pkb->data + pkb->pkh.meta_len + filt->pkt_data_offset,
-               filt->pkt_data_size);
-        wsize = NGKNET_BYTES2WORDS(filt->oob_data_size + filt->pkt_data_size);
-        for (idx = 0; idx < wsize; idx++) {
-            scratch.data.w[idx] &= filt->mask.w[idx];
-            if (scratch.data.w[idx] != filt->data.w[idx]) {
-                break;
-            }
+    this_cpu_inc(*fc->hits);
+    if (filt->dest_type == NGKNET_FILTER_DEST_T_CB) {
+        struct ngknet_callback_desc *cbd = NGKNET_SKB_CB(skb);
+        struct pkt_hdr *pkh = (struct pkt_hdr *)skb->data;
+        if (!dev->cbc->filter_cb) {
+            return SHR_E_UNAVAIL;
         }
-        if (idx == wsize) {
-            if (NGKNET_FILTER_DEST_T_CB == filt->dest_type) {
-                match_cb = 1;
-                filt_cb = filt;
-                continue;
-            }
-            match = 1;
-            break;
+        cbd->dev_no = dev->dev_no;
+        cbd->dev_id = dev->pdma_dev.dev_id;
+        cbd->type_str = dev->type_str;
+        cbd->pmd = skb->data + PKT_HDR_SIZE;
+        cbd->pmd_len = pkh->meta_len;
+        cbd->pkt_len = pkh->data_len;
+        cbd->filt = filt;
+        spin_lock_irqsave(&dev->lock, flags);
+        skb = dev->cbc->filter_cb(skb, &filt);
+        spin_unlock_irqrestore(&dev->lock, flags);
+        if (!skb || !filt) {
+            return SHR_E_UNAVAIL;
         }
     }
-
-    if (match) {
-        fc->hits++;
-        if (filt->dest_type == NGKNET_FILTER_DEST_T_CB) {
-            struct ngknet_callback_desc *cbd = NGKNET_SKB_CB(skb);
-            struct pkt_hdr *pkh = (struct pkt_hdr *)skb->data;
-            if (!dev->cbc->filter_cb) {
-                spin_unlock_irqrestore(&dev->lock, flags);
-                return SHR_E_UNAVAIL;
-            }
-            cbd->dev_no = dev->dev_no;
-            cbd->dev_id = dev->pdma_dev.dev_id;
-            cbd->type_str = dev->type_str;
-            cbd->pmd = skb->data + PKT_HDR_SIZE;
-            cbd->pmd_len = pkh->meta_len;
-            cbd->pkt_len = pkh->data_len;
-            cbd->filt = filt;
-            skb = dev->cbc->filter_cb(skb, &filt);
-            if (!skb || !filt) {
-                spin_unlock_irqrestore(&dev->lock, flags);
-                return SHR_E_UNAVAIL;
-            }
+    switch (filt->dest_type) {
+    case NGKNET_FILTER_DEST_T_NETIF:
+        if (filt->dest_id == 0) {
+            dest_ndev = dev->net_dev;
+        } else {
+            dest_ndev = rcu_dereference(dev->vdev[filt->dest_id]);
         }
-        switch (filt->dest_type) {
-        case NGKNET_FILTER_DEST_T_NETIF:
-            if (filt->dest_id == 0) {
-                dest_ndev = dev->net_dev;
-            } else {
-                dest_ndev = dev->vdev[filt->dest_id];
-            }
-            if (dest_ndev) {
-                skb->dev = dest_ndev;
-                if (filt->dest_proto) {
-                    pkb->pkh.attrs |= PDMA_RX_SET_PROTO;
-                    skb->protocol = filt->dest_proto;
-                }
-                priv = netdev_priv(dest_ndev);
-                priv->users++;
+        if (dest_ndev) {
+            skb->dev = dest_ndev;
+            if (filt->dest_proto) {
+                pkb->pkh.attrs |= PDMA_RX_SET_PROTO;
+                skb->protocol = filt->dest_proto;
             }
-            break;
-        case NGKNET_FILTER_DEST_T_VNET:
-            pkb->pkh.attrs |= PDMA_RX_TO_VNET;
-            spin_unlock_irqrestore(&dev->lock, flags);
-            return SHR_E_NO_HANDLER;
-        case NGKNET_FILTER_DEST_T_NULL:
-        default:
-            spin_unlock_irqrestore(&dev->lock, flags);
-            return SHR_E_UNAVAIL;
+            priv = netdev_priv(dest_ndev);
+            atomic_inc(&priv->users);
         }
+        break;
+    case NGKNET_FILTER_DEST_T_VNET:
+        pkb->pkh.attrs |= PDMA_RX_TO_VNET;
+        return SHR_E_NO_HANDLER;
+    case NGKNET_FILTER_DEST_T_NULL:
+    default:
+        return SHR_E_UNAVAIL;
     }
 
-    spin_unlock_irqrestore(&dev->lock, flags);
-
     if (!dest_ndev) {
         return SHR_E_NONE;
     } else {
@@ -401,11 +1004,10 @@ ngknet_rx_pkt_filter(struct ngknet_dev *dev, struct sk_buff *skb, struct net_dev
     }
 
     if (filt->mirror_type == NGKNET_FILTER_DEST_T_NETIF) {
-        spin_lock_irqsave(&dev->lock, flags);
         if (filt->mirror_id == 0) {
             mirror_ndev = dev->net_dev;
         } else {
-            mirror_ndev = dev->vdev[filt->mirror_id];
+            mirror_ndev = rcu_dereference(dev->vdev[filt->mirror_id]);
         }
         if (mirror_ndev) {
             mirror_skb = pskb_copy(skb, GFP_ATOMIC);
@@ -419,35 +1021,77 @@ ngknet_rx_pkt_filter(struct ngknet_dev *dev, struct sk_buff *skb, struct net_dev
                     NGKNET_SKB_CB(mirror_skb)->filt = filt;
                 }
                 priv = netdev_priv(mirror_ndev);
-                priv->users++;
+                atomic_inc(&priv->users);
                 *mndev = mirror_ndev;
                 *mskb = mirror_skb;
             }
         }
-        spin_unlock_irqrestore(&dev->lock, flags);
     }
 
     return SHR_E_NONE;
 }
 
+int
+ngknet_rx_pkt_filter(struct ngknet_dev *dev, struct sk_buff *skb, struct net_device **ndev,
+                     struct net_device **mndev, struct sk_buff **mskb)
+{
+    int rv;
+
+    /*
+     * Compiled filters and matched filters are freed, and virtual network
+     * devices are destroyed, after RCU grace period
+     */
+    rcu_read_lock();
+    rv = ngknet_rx_pkt_filter_rcu(dev, skb, ndev, mndev, mskb);
+    rcu_read_unlock();
+
+    return rv;
+}
+
+/*!
+ * Refill the token bucket of a queue and resume the queue if it got tokens.
+ * Must be called with the queue lock held.
+ */
+static void
+ngknet_rl_queue_refill(struct ngknet_dev *dev, int queue, struct ngknet_rl_queue *rq)
+{
+    int ticks = rl_ctrl.rx_ticks;
+
+    if (rq->limit >= 0) {
+        rq->tokens += rq->limit;
+        if (rq->tokens > max(rq->limit, ticks)) {
+            rq->tokens = max(rq->limit, ticks);
+        }
+    }
+    rq->gen++;
+
+    if (rq->paused && (rq->limit < 0 || rq->tokens > 0)) {
+        bcmcnet_pdma_rx_queue_resume(&dev->pdma_dev, queue);
+        rq->paused = 0;
+    }
+}
+
 static void
 ngknet_rl_process(timer_context_t data)
 {
     struct ngknet_rl_ctrl *rc = timer_arg(rc, data, timer);
+    struct ngknet_rl_queue *rq;
     struct ngknet_dev *dev;
     unsigned long flags;
-    int idx;
+    int idx, qi;
 
-    spin_lock_irqsave(&rc->lock, flags);
-    rc->rx_pkts = 0;
     for (idx = 0; idx < NUM_PDMA_DEV_MAX; idx++) {
         dev = &rc->devs[idx];
-        if (rc->dev_active[idx] && rc->dev_paused[idx]) {
-            bcmcnet_pdma_dev_rx_resume(&dev->pdma_dev);
-            rl_ctrl.dev_paused[dev->dev_no] = 0;
+        if (!rc->dev_active[idx]) {
+            continue;
+        }
+        for (qi = 0; qi < dev->pdma_dev.ctrl.nb_rxq && qi < NUM_Q_MAX; qi++) {
+            rq = &rc->queue[idx][qi];
+            spin_lock_irqsave(&rq->lock, flags);
+            ngknet_rl_queue_refill(dev, qi, rq);
+            spin_unlock_irqrestore(&rq->lock, flags);
         }
     }
-    spin_unlock_irqrestore(&rc->lock, flags);
 
     rc->timer.expires = jiffies + HZ / rc->rx_ticks;
     add_timer(&rc->timer);
@@ -456,8 +1100,20 @@ ngknet_rl_process(timer_context_t data)
 void
 ngknet_rx_rate_limit_init(struct ngknet_dev *devs)
 {
+    int idx, qi;
+
     sal_memset(&rl_ctrl, 0, sizeof(rl_ctrl));
     rl_ctrl.rx_ticks = NGKNET_EXTRA_RATE_LIMIT_DEFAULT_RX_TICK;
+    for (idx = 0; idx < NUM_PDMA_DEV_MAX; idx++) {
+        for (qi = 0; qi < NUM_Q_MAX; qi++) {
+            spin_lock_init(&rl_ctrl.queue[idx][qi].lock);
+            rl_ctrl.queue[idx][qi].limit = -1;
+        }
+    }
+    /* Without per-CPU caches every packet takes its token from the bucket */
+    rl_ctrl.cache = __alloc_percpu(sizeof(struct ngknet_rl_cache) *
+                                   NUM_PDMA_DEV_MAX * NUM_Q_MAX,
+                                   __alignof__(struct ngknet_rl_cache));
     setup_timer(&rl_ctrl.timer, ngknet_rl_process, (timer_context_t)&rl_ctrl);
     spin_lock_init(&rl_ctrl.lock);
     rl_ctrl.devs = devs;
@@ -467,6 +1123,10 @@ void
 ngknet_rx_rate_limit_cleanup(void)
 {
     del_timer_sync(&rl_ctrl.timer);
+    if (rl_ctrl.cache) {
+        free_percpu(rl_ctrl.cache);
+        rl_ctrl.cache = NULL;
+    }
 }
 
 int
@@ -482,48 +1142,131 @@ ngknet_rx_rate_limit_start(struct ngknet_dev *dev)
 
     spin_lock_irqsave(&rl_ctrl.lock, flags);
     rl_ctrl.dev_active[dev->dev_no] = 1;
-    spin_unlock_irqrestore(&rl_ctrl.lock, flags);
-
     if (!rl_ctrl.started) {
         rl_ctrl.started = 1;
         rl_ctrl.timer.expires = jiffies + HZ / rl_ctrl.rx_ticks;
         add_timer(&rl_ctrl.timer);
     }
+    spin_unlock_irqrestore(&rl_ctrl.lock, flags);
 }
 
 void
 ngknet_rx_rate_limit_stop(struct ngknet_dev *dev)
 {
+    struct ngknet_rl_queue *rq;
     unsigned long flags;
+    int qi;
 
     spin_lock_irqsave(&rl_ctrl.lock, flags);
     rl_ctrl.dev_active[dev->dev_no] = 0;
     spin_unlock_irqrestore(&rl_ctrl.lock, flags);
+
+    for (qi = 0; qi < NUM_Q_MAX; qi++) {
+        rq = &rl_ctrl.queue[dev->dev_no][qi];
+        spin_lock_irqsave(&rq->lock, flags);
+        if (rq->paused) {
+            bcmcnet_pdma_rx_queue_resume(&dev->pdma_dev, qi);
+            rq->paused = 0;
+        }
+        rq->limit = -1;
+        rq->tokens = 0;
+        rq->gen++;
+        spin_unlock_irqrestore(&rq->lock, flags);
+    }
 }
 
 void
-ngknet_rx_rate_limit(struct ngknet_dev *dev, int limit)
+ngknet_rx_rate_limit_reset(void)
 {
+    struct ngknet_rl_queue *rq;
+    struct ngknet_dev *dev;
     unsigned long flags;
+    int idx, qi;
 
-    /* To support lower rate, we should use smaller tick (larger interval). */
-    if (limit < 1000) {
-        rl_ctrl.rx_ticks = (limit + 99) / 100;
-    } else {
-        rl_ctrl.rx_ticks = NGKNET_EXTRA_RATE_LIMIT_DEFAULT_RX_TICK;
+    for (idx = 0; idx < NUM_PDMA_DEV_MAX; idx++) {
+        dev = &rl_ctrl.devs[idx];
+        for (qi = 0; qi < NUM_Q_MAX; qi++) {
+            rq = &rl_ctrl.queue[idx][qi];
+            spin_lock_irqsave(&rq->lock, flags);
+            /* The new limit is picked up by the next packet */
+            rq->limit = -1;
+            rq->tokens = 0;
+            ngknet_rl_queue_refill(dev, qi, rq);
+            spin_unlock_irqrestore(&rq->lock, flags);
+        }
     }
+}
 
-    spin_lock_irqsave(&rl_ctrl.lock, flags);
-    if ((++rl_ctrl.rx_pkts + rl_ctrl.rx_overruns > limit / rl_ctrl.rx_ticks) &&
-        !rl_ctrl.dev_paused[dev->dev_no] && rl_ctrl.dev_active[dev->dev_no]) {
-        rl_ctrl.dev_paused[dev->dev_no] = 1;
-        rl_ctrl.rx_overruns = 0;
-        bcmcnet_pdma_dev_rx_suspend(&dev->pdma_dev);
+void
+ngknet_rx_rate_limit(struct ngknet_dev *dev, int queue, int limit)
+{
+    struct ngknet_rl_queue *rq;
+    struct ngknet_rl_cache *cache = NULL;
+    unsigned long flags;
+    int ticks = rl_ctrl.rx_ticks;
+    int grant;
+
+    if (limit < 0 || queue < 0 || queue >= NUM_Q_MAX ||
+        !rl_ctrl.dev_active[dev->dev_no]) {
+        return;
     }
-    if (rl_ctrl.dev_paused[dev->dev_no]) {
-        rl_ctrl.rx_overruns++;
+    rq = &rl_ctrl.queue[dev->dev_no][queue];
+
+    /* Consume a token cached by this CPU, no locking needed */
+    if (rl_ctrl.cache) {
+        cache = this_cpu_ptr(rl_ctrl.cache) + dev->dev_no * NUM_Q_MAX + queue;
+        if (cache->tokens > 0 && cache->gen == READ_ONCE(rq->gen)) {
+            cache->tokens--;
+            return;
+        }
     }
-    spin_unlock_irqrestore(&rl_ctrl.lock, flags);
+
+    spin_lock_irqsave(&rq->lock, flags);
+    if (rq->limit != limit) {
+        /* Limit changed, start with a full bucket */
+        rq->limit = limit;
+        rq->tokens = max(limit, ticks);
+        rq->gen++;
+    }
+
+    grant = rq->tokens / ticks;
+    if (grant > 0) {
+        if (!cache) {
+            grant = 1;
+        } else if (grant > NGKNET_EXTRA_RATE_LIMIT_CPU_BATCH) {
+            grant = NGKNET_EXTRA_RATE_LIMIT_CPU_BATCH;
+        }
+        rq->tokens -= grant * ticks;
+        if (cache) {
+            cache->tokens = grant - 1;
+            cache->gen = rq->gen;
+        }
+    } else {
+        /* Charge the packet to the next interval and suspend the queue */
+        rq->tokens -= ticks;
+        rq->overruns++;
+        if (!rq->paused) {
+            rq->paused = 1;
+            rq->throttles++;
+            bcmcnet_pdma_rx_queue_suspend(&dev->pdma_dev, queue);
+        }
+    }
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+void
+ngknet_rx_rate_limit_stats_get(struct ngknet_dev *dev, int queue,
+                               struct ngknet_rl_queue_stats *stats)
+{
+    struct ngknet_rl_queue *rq = &rl_ctrl.queue[dev->dev_no][queue];
+    unsigned long flags;
+
+    spin_lock_irqsave(&rq->lock, flags);
+    stats->limit = rq->limit;
+    stats->paused = rq->paused;
+    stats->throttles = rq->throttles;
+    stats->overruns = rq->overruns;
+    spin_unlock_irqrestore(&rq->lock, flags);
 }
 
 void
@@ -33,11 +33,131 @@ struct filt_ctrl {
     /*! Device number */
     int dev_no;
 
-    /*! Number of hits */
-    uint64_t hits;
+    /*! Number of hits, per CPU so that Rx needs no lock to count */
+    uint64_t __percpu *hits;
 
     /*! Filter description */
     ngknet_filter_t filt;
+
+    /*! RCU head, filters are freed after Rx lookups are done with them */
+    struct rcu_head rcu;
+};
+
+/*! Maximum number of filter tables */
+#define NGKNET_FILTER_TABLE_MAX     32
+
+/*! Number of hash buckets of a filter table */
+#define NGKNET_FILTER_HASH_SIZE     64
+
+/*!
+ * \brief Compiled filter entry.
+ */
+struct ngknet_filter_ent {
+    /*! Filter control */
+    struct filt_ctrl *fc;
+
+    /*! Position in the filter list */
+    int order;
+
+    /*! Hash of the masked filter data */
+    uint32_t key_hash;
+
+    /*! Next entry in the hash bucket */
+    struct ngknet_filter_ent *hash_next;
+
+    /*! Next entry with the same key, in list order */
+    struct ngknet_filter_ent *key_next;
+};
+
+/*!
+ * \brief Filter table counters.
+ */
+struct ngknet_filter_table_stats {
+    /*! Packets looked up in the table */
+    uint64_t lookups;
+
+    /*! Lookups finding a key */
+    uint64_t hits;
+
+    /*! Packets matched by the table */
+    uint64_t matches;
+};
+
+/*!
+ * \brief Filter table.
+ *
+ * Filters using the same OOB/packet data offsets, sizes and mask share a
+ * table, which is a hash table keyed by the masked filter data.
+ */
+struct ngknet_filter_table {
+    /*! OOB data offset */
+    uint16_t oob_data_offset;
+
+    /*! OOB data size */
+    uint16_t oob_data_size;
+
+    /*! Packet data offset */
+    uint16_t pkt_data_offset;
+
+    /*! Packet data size */
+    uint16_t pkt_data_size;
+
+    /*! Key size in 32-bit words */
+    int wsize;
+
+    /*! Position of the first filter in the filter list */
+    int min_order;
+
+    /*! Number of filters */
+    int filters;
+
+    /*! Mask */
+    uint32_t mask[NGKNET_FILTER_WORDS_MAX];
+
+    /*! Hash buckets */
+    struct ngknet_filter_ent *bucket[NGKNET_FILTER_HASH_SIZE];
+
+    /*! Counters carried over from previously compiled tables */
+    struct ngknet_filter_table_stats base;
+};
+
+/*!
+ * \brief Compiled filters.
+ *
+ * Filters are compiled into tables on filter create and destroy. A packet
+ * is matched with one key extraction and one hash lookup per table. Tables
+ * are looked up in the list order of their first filter, and the lookup
+ * stops when no remaining filter can precede the best match found so far.
+ * Filters which don't fit a table, such as the ones matching any data, are
+ * matched linearly in list order as before.
+ *
+ * The compiled filters are published with RCU, so Rx lookups take no lock.
+ * They are replaced as a whole on every filter change.
+ */
+struct ngknet_filter_cls {
+    /*! Number of tables */
+    int num_tables;
+
+    /*! Tables, sorted by the position of their first filter */
+    struct ngknet_filter_table *tables[NGKNET_FILTER_TABLE_MAX];
+
+    /*! Number of linear filters */
+    int num_linear;
+
+    /*! Linear filters, sorted by list order */
+    struct ngknet_filter_ent **linear;
+
+    /*! Entries of all the filters */
+    struct ngknet_filter_ent *ents;
+
+    /*! Linear filter counters carried over from previously compiled filters */
+    struct ngknet_filter_table_stats linear_base;
+
+    /*! Per-CPU counters of the tables, followed by the linear filters */
+    struct ngknet_filter_table_stats __percpu *stats;
+
+    /*! RCU head */
+    struct rcu_head rcu;
 };
 
 /*!
@@ -100,6 +220,50 @@ ngknet_filter_get(struct ngknet_dev *dev, int id, ngknet_filter_t *filter);
 extern int
 ngknet_filter_get_next(struct ngknet_dev *dev, ngknet_filter_t *filter);
 
+/*!
+ * \brief Get the number of hits of a filter.
+ *
+ * \param [in] fc Filter control.
+ *
+ * \retval Hits summed over all CPUs.
+ */
+extern uint64_t
+ngknet_filter_hits_get(struct filt_ctrl *fc);
+
+/*!
+ * \brief Get compiled filter table counters.
+ *
+ * \param [in] cls Compiled filters.
+ * \param [in] idx Table index, num_tables for the linear filters.
+ * \param [out] stats Table counters.
+ */
+extern void
+ngknet_filter_table_stats_get(struct ngknet_filter_cls *cls, int idx,
+                              struct ngknet_filter_table_stats *stats);
+
+/*!
+ * \brief Clear compiled filter table counters.
+ *
+ * \param [in] dev Device structure point.
+ */
+extern void
+ngknet_filter_table_stats_clear(struct ngknet_dev *dev);
+
+/*!
+ * \brief Check compiled filters against the filter list.
+ *
+ * Replay generated packets through compiled and linear filter matching of
+ * the installed filters and compare the results.
+ *
+ * \param [in] dev Device structure point.
+ * \param [in] pkts Number of packets.
+ *
+ * \retval Number of packets matched differently.
+ * \retval SHR_E_XXXX Operation failed.
+ */
+extern int
+ngknet_filter_selftest(struct ngknet_dev *dev, int pkts);
+
 /*!
  * \brief Filter packet.
  *
@@ -115,38 +279,100 @@ extern int
 ngknet_rx_pkt_filter(struct ngknet_dev *dev, struct sk_buff *skb, struct net_device **ndev,
                      struct net_device **mndev, struct sk_buff **mskb);
 
+/*!
+ * \brief Rx rate limit queue.
+ *
+ * Token bucket of one Rx queue. Tokens are kept in units of 1/rx_ticks
+ * packet so that the bucket can be refilled by the rate limit timer with
+ * the full pps limit at every tick, which keeps low rates accurate.
+ */
+struct ngknet_rl_queue {
+    /*! Queue lock */
+    spinlock_t lock;
+
+    /*! Rate limit (pps), -1 if the queue has not been limited yet */
+    int limit;
+
+    /*! Tokens, negative if packets were received over the limit */
+    int tokens;
+
+    /*! Token generation, advanced at every refill */
+    unsigned int gen;
+
+    /*! Queue is suspended due to no tokens */
+    int paused;
+
+    /*! Number of times the queue was suspended */
+    unsigned long throttles;
+
+    /*! Packets received over the limit */
+    unsigned long overruns;
+};
+
+/*!
+ * \brief Rx rate limit per-CPU token cache.
+ *
+ * A CPU takes tokens from a queue bucket in small batches and then
+ * consumes them without locking. Cached tokens are only valid for the
+ * bucket generation they were taken from.
+ */
+struct ngknet_rl_cache {
+    /*! Cached tokens (packets) */
+    int tokens;
+
+    /*! Bucket generation of the cached tokens */
+    unsigned int gen;
+};
+
+/*!
+ * \brief Rx rate limit queue statistics.
+ */
+struct ngknet_rl_queue_stats {
+    /*! Rate limit (pps), -1 if not limited */
+    int limit;
+
+    /*! Queue is suspended due to no tokens */
+    int paused;
+
+    /*! Number of times the queue was suspended */
+    unsigned long throttles;
+
+    /*! Packets received over the limit */
+    unsigned long overruns;
+};
+
 /*!
  * \brief Rx rate limit control.
  *
  * This contains all the control information for Rx rate limit such as
- * the number of Rx packets, status related to Rx rate limit, etc.
+ * the token buckets of all the Rx queues, the per-CPU token caches, etc.
  *
- * The rate limit is kernel-oriented, i.e. all the Rx packets from any
- * device/channel will be accounted for. Once the received packets reach
- * the limit value in an 1-Sec interval, the driver API XXXX_rx_suspend()
- * will be called to suspend Rx. The 1-Sec basis timer will call the driver
- * API XXXX_rx_resume() to resume Rx and reset rate-related status/counters
- * at the begin of the next 1-Sec interval.
+ * The rate limit is queue-oriented, i.e. every Rx queue of every device
+ * has its own token bucket. Once a queue runs out of tokens, the driver
+ * API bcmcnet_pdma_rx_queue_suspend() will be called to suspend only this
+ * queue. The rate limit timer refills the buckets rx_ticks times per
+ * second and calls bcmcnet_pdma_rx_queue_resume() to resume the queues
+ * which got tokens again. Other queues, e.g. the ones carrying control
+ * traffic, keep running while a queue is suspended.
  *
  * The NGKNET module parameter 'rx_rate_limit' is used to decide the maximum
- * Rx rate. Disable Rx rate limit if set 0. It can be set when inserting
- * NGKNET module or modified using its SYSFS attributions.
+ * Rx rate of each low priority queue, and 'rx_rate_limit_hi' the maximum
+ * Rx rate of each high priority queue selected by 'rx_hi_queues'. A queue
+ * is not limited if its limit is -1. They can be set when inserting NGKNET
+ * module or modified using its PROCFS entry rate_limit.
  */
 struct ngknet_rl_ctrl {
-    /*! Rx packets */
-    int rx_pkts;
-
-    /*! Rx overruns */
-    int rx_overruns;
-
     /*! Rx ticks */
     int rx_ticks;
 
     /*! Active devices under rate control */
     int dev_active[NUM_PDMA_DEV_MAX];
 
-    /*! Paused devices due to no Rx credit */
-    int dev_paused[NUM_PDMA_DEV_MAX];
+    /*! Rx queues token buckets */
+    struct ngknet_rl_queue queue[NUM_PDMA_DEV_MAX][NUM_Q_MAX];
+
+    /*! Per-CPU token caches of all the Rx queues */
+    struct ngknet_rl_cache __percpu *cache;
 
     /*! Rate limit timer */
     struct timer_list timer;
@@ -192,18 +418,42 @@ ngknet_rx_rate_limit_start(struct ngknet_dev *dev);
 /*!
  * \brief Stop Rx rate limit.
  *
+ * Suspended queues of the device are resumed.
+ *
  * \param [in] dev Device structure point.
  */
 extern void
 ngknet_rx_rate_limit_stop(struct ngknet_dev *dev);
 
+/*!
+ * \brief Reset Rx rate limit.
+ *
+ * Refill all the token buckets and resume the suspended queues, so that
+ * new limits take effect at once.
+ */
+extern void
+ngknet_rx_rate_limit_reset(void);
+
 /*!
  * \brief Limit Rx rate.
  *
  * \param [in] dev Device structure point.
+ * \param [in] queue Rx queue number.
+ * \param [in] limit Rx rate limit (pps) of the queue, -1 for no limit.
+ */
+extern void
+ngknet_rx_rate_limit(struct ngknet_dev *dev, int queue, int limit);
+
+/*!
+ * \brief Get Rx rate limit statistics of a queue.
+ *
+ * \param [in] dev Device structure point.
+ * \param [in] queue Rx queue number.
+ * \param [out] stats Rx rate limit queue statistics.
  */
 extern void
-ngknet_rx_rate_limit(struct ngknet_dev *dev, int limit);
+ngknet_rx_rate_limit_stats_get(struct ngknet_dev *dev, int queue,
+                               struct ngknet_rl_queue_stats *stats);
 
 /*!
  * \brief Schedule Tx queue.
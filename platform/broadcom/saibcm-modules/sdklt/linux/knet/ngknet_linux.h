@@ -93,6 +93,31 @@ kal_build_skb(void *data, unsigned int frag_size)
 }
 #endif /* KERNEL_VERSION(3,6,0) */
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,1,0)
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,6,0)
+#include <net/page_pool/helpers.h>
+#else
+#include <net/page_pool.h>
+#endif
+/*! Rx buffers can be recycled through page pools */
+#define KAL_PAGE_POOL_SUPPORT
+#endif /* KERNEL_VERSION(6,1,0) */
+
+#include <linux/eventfd.h>
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,8,0)
+static inline void
+kal_eventfd_signal(struct eventfd_ctx *ctx)
+{
+    eventfd_signal(ctx, 1);
+}
+#else
+static inline void
+kal_eventfd_signal(struct eventfd_ctx *ctx)
+{
+    eventfd_signal(ctx);
+}
+#endif /* KERNEL_VERSION(6,8,0) */
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(4,7,0)
 static inline void
 kal_netif_trans_update(struct net_device *dev)
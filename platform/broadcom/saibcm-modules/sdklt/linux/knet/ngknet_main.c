@@ -52,6 +52,16 @@
  * it can also be changed dynamically through the proc file
  * system (syntax is described in function header comment).
  *
+ * In HNET mode, the descriptor rings and packet buffers of the user
+ * space VNET driver can be placed in a DMA area created with the
+ * NGKNET_DEV_VNET_MMAP command and mapped with mmap() on this device
+ * (see struct ngknet_vnet_map_hdr). Packets are then transmitted by
+ * the switch device directly from user space buffers, and both sides
+ * only notify each other (VNET through an eventfd, HNET through the
+ * NGKNET_DEV_HNET_WAKE command) when the other side asked for it. A
+ * sample consumer and loopback benchmark is provided in
+ * tools/ngknet-vnet.c.
+ *
  * For a list of supported module parameters, please see below.
  */
 
@@ -80,6 +90,8 @@
 #include <linux/interrupt.h>
 #include <linux/spinlock.h>
 #include <linux/delay.h>
+#include <linux/mutex.h>
+#include <linux/kref.h>
 #include <linux/bitops.h>
 #include <linux/time.h>
 #include <linux/random.h>
@@ -89,6 +101,7 @@
 #include <lkm/ngknet_ioctl.h>
 #include <bcmcnet/bcmcnet_core.h>
 #include "ngknet_main.h"
+#include "ngknet_buff.h"
 #include "ngknet_extra.h"
 #include "ngknet_procfs.h"
 #include "ngknet_callback.h"
@@ -139,9 +152,26 @@ MODULE_PARM_DESC(rx_buffer_size,
 static int rx_rate_limit = -1;
 MODULE_PARAM(rx_rate_limit, int, 0);
 MODULE_PARM_DESC(rx_rate_limit,
-"Rx rate limit (pps, default -1 no limit)");
+"Rx rate limit per low priority queue (pps, default -1 no limit)");
+/*! \endcond */
+
+/*! \cond */
+static int rx_rate_limit_hi = -1;
+MODULE_PARAM(rx_rate_limit_hi, int, 0);
+MODULE_PARM_DESC(rx_rate_limit_hi,
+"Rx rate limit per high priority queue (pps, default -1 no limit)");
 /*! \endcond */
 
+/*! \cond */
+static unsigned long long rx_hi_queues = 0;
+MODULE_PARAM(rx_hi_queues, ullong, 0);
+MODULE_PARM_DESC(rx_hi_queues,
+"Bitmap of high priority Rx queues (default 0 none)");
+/*! \endcond */
+
+/*! Rx rate limit is configured for any queue */
+#define RX_RATE_LIMITED     (rx_rate_limit >= 0 || rx_rate_limit_hi >= 0)
+
 /*! \cond */
 static int tx_polling = 0;
 MODULE_PARAM(tx_polling, int, 0);
@@ -156,6 +186,13 @@ MODULE_PARM_DESC(rx_batching,
 "Rx batching mode (default 0 in single fill mode)");
 /*! \endcond */
 
+/*! \cond */
+static int rx_page_pool = 0;
+MODULE_PARAM(rx_page_pool, int, 0);
+MODULE_PARM_DESC(rx_page_pool,
+"Rx buffers recycled through page pools (default 0 not used)");
+/*! \endcond */
+
 typedef int (*drv_ops_attach)(struct pdma_dev *dev);
 
 struct bcmcnet_drv_ops {
@@ -439,7 +476,7 @@ ngknet_netif_recv(struct net_device *ndev, struct sk_buff *skb)
     struct pkt_hdr *pkh = (struct pkt_hdr *)skb->data;
     struct napi_struct *napi = NULL;
     uint16_t proto;
-    int chan_id, gi, qi, skb_len;
+    int chan_id, gi, qi, rxq, skb_len;
     int rv;
 
     /* Handle one incoming packet */
@@ -477,9 +514,10 @@ ngknet_netif_recv(struct net_device *ndev, struct sk_buff *skb)
         skb->protocol = proto;
     }
 
-    skb_record_rx_queue(skb, pkh->queue_id);
+    rxq = pkh->queue_id;
+    skb_record_rx_queue(skb, rxq);
 
-    rv = bcmcnet_pdma_dev_queue_to_chan(pdev, pkh->queue_id, PDMA_Q_RX, &chan_id);
+    rv = bcmcnet_pdma_dev_queue_to_chan(pdev, rxq, PDMA_Q_RX, &chan_id);
     if (SHR_FAILURE(rv)) {
         return rv;
     }
@@ -488,7 +526,7 @@ ngknet_netif_recv(struct net_device *ndev, struct sk_buff *skb)
     if (pdev->flags & PDMA_GROUP_INTR) {
         napi = (struct napi_struct *)pdev->ctrl.grp[gi].intr_hdl[0].priv;
     } else {
-        qi = pkh->queue_id;
+        qi = rxq;
         napi = (struct napi_struct *)pdev->ctrl.grp[gi].intr_hdl[qi].priv;
     }
 
@@ -501,11 +539,13 @@ ngknet_netif_recv(struct net_device *ndev, struct sk_buff *skb)
     priv->stats.rx_bytes += skb_len;
 
     /* Rate limit */
-    if (rx_rate_limit >= 0) {
+    if (RX_RATE_LIMITED) {
         if (!ngknet_rx_rate_limit_started()) {
             ngknet_rx_rate_limit_start(dev);
         }
-        ngknet_rx_rate_limit(dev, rx_rate_limit);
+        ngknet_rx_rate_limit(dev, rxq,
+                             rx_hi_queues & (1ULL << rxq) ?
+                             rx_rate_limit_hi : rx_rate_limit);
     }
 
     return SHR_E_NONE;
@@ -529,7 +569,6 @@ ngknet_frame_recv(struct pdma_dev *pdev, int queue, void *buf)
     struct sk_buff *skb = (struct sk_buff *)buf, *mskb = NULL;
     struct net_device *ndev = NULL, *mndev = NULL;
     struct ngknet_private *priv = NULL;
-    unsigned long flags;
     int rv;
 
     DBG_VERB(("Rx packet (%d bytes).\n", skb->len));
@@ -554,12 +593,10 @@ ngknet_frame_recv(struct pdma_dev *pdev, int queue, void *buf)
         rv = SHR_E_UNAVAIL;
     }
 
-    spin_lock_irqsave(&dev->lock, flags);
-    priv->users--;
-    if (!priv->users && priv->wait) {
+    /* Value returning atomics are full barriers, as waitqueue_active() needs */
+    if (atomic_dec_and_test(&priv->users) && waitqueue_active(&dev->wq)) {
         wake_up(&dev->wq);
     }
-    spin_unlock_irqrestore(&dev->lock, flags);
 
     /* Handle mirrored packet */
     if (mndev && mskb) {
@@ -570,12 +607,9 @@ ngknet_frame_recv(struct pdma_dev *pdev, int queue, void *buf)
             priv->stats.rx_dropped++;
             dev_kfree_skb_any(mskb);
         }
-        spin_lock_irqsave(&dev->lock, flags);
-        priv->users--;
-        if (!priv->users && priv->wait) {
+        if (atomic_dec_and_test(&priv->users) && waitqueue_active(&dev->wq)) {
             wake_up(&dev->wq);
         }
-        spin_unlock_irqrestore(&dev->lock, flags);
     }
 
     /* Measure speed */
@@ -1050,6 +1084,22 @@ ngknet_dev_hnet_work(struct pdma_dev *pdev)
     }
 }
 
+/*!
+ * Hypervisor network transmit of all the VNET Tx rings
+ */
+static void
+ngknet_dev_hnet_xmit(struct pdma_dev *pdev)
+{
+    int qi;
+    int rv;
+
+    for (qi = 0; qi < pdev->ctrl.nb_txq; qi++) {
+        do {
+            rv = pdev->pkt_xmit(pdev, qi, 0);
+        } while (rv == SHR_E_NONE);
+    }
+}
+
 /*!
  * Hypervisor network wait handler
  */
@@ -1057,8 +1107,8 @@ static int
 ngknet_dev_hnet_wait(struct pdma_dev *pdev)
 {
     struct ngknet_dev *dev = (struct ngknet_dev *)pdev->priv;
-    int qi;
-    int rv;
+    struct ngknet_vnet_map *map = NULL;
+    int mapped;
 
     while (!kthread_should_stop()) {
         wait_event_interruptible(dev->hnet_wq,
@@ -1068,11 +1118,24 @@ ngknet_dev_hnet_wait(struct pdma_dev *pdev)
             continue;
         }
         atomic_set(&dev->hnet_active, 0);
-        for (qi = 0; qi < pdev->ctrl.nb_txq; qi++) {
-            do {
-                rv = pdev->pkt_xmit(pdev, qi, 0);
-            } while (rv == SHR_E_NONE);
+        ngknet_dev_hnet_xmit(pdev);
+
+        /*
+         * Ask a mapped VNET for a wakeup before going to sleep, and
+         * check its Tx rings once more for what it posted meanwhile.
+         */
+        rcu_read_lock();
+        map = rcu_dereference(dev->vnet_map);
+        mapped = map != NULL;
+        if (mapped) {
+            map->hdr->hnet_wakeup = 1;
+            smp_mb();
+        }
+        rcu_read_unlock();
+        if (mapped) {
+            ngknet_dev_hnet_xmit(pdev);
         }
+
         schedule_work(&dev->hnet_work);
     }
 
@@ -1086,10 +1149,25 @@ static int
 ngknet_dev_vnet_wake(struct pdma_dev *pdev)
 {
     struct ngknet_dev *dev = (struct ngknet_dev *)pdev->priv;
+    struct ngknet_vnet_map *map = NULL;
 
     atomic_set(&dev->vnet_active, 1);
     wake_up_interruptible(&dev->vnet_wq);
 
+    /* Signal a mapped VNET only if it is about to sleep */
+    rcu_read_lock();
+    map = rcu_dereference(dev->vnet_map);
+    if (map && map->efd) {
+        /* Pairs with VNET setting vnet_wakeup before checking its rings */
+        smp_mb();
+        if (map->hdr->vnet_wakeup) {
+            map->hdr->vnet_wakeup = 0;
+            map->hdr->vnet_events++;
+            kal_eventfd_signal(map->efd);
+        }
+    }
+    rcu_read_unlock();
+
     return SHR_E_NONE;
 }
 
@@ -1113,12 +1191,196 @@ ngknet_dev_hnet_schedule(struct work_struct *work)
     ngknet_dev_hnet_work(&dev->pdma_dev);
 }
 
+/*! Maximum size of VNET shared area */
+#define NGKNET_VNET_MAP_SIZE_MAX    (64 * 1024 * 1024)
+
+/*! Serializes VNET shared area create/destroy against mmap and dock */
+static DEFINE_MUTEX(ngknet_vnet_map_mutex);
+
+/*!
+ * Free VNET shared area after the last reference is dropped
+ */
+static void
+ngknet_vnet_map_release(struct kref *ref)
+{
+    struct ngknet_vnet_map *map = container_of(ref, struct ngknet_vnet_map, ref);
+
+    dma_free_coherent(map->dev, map->size, map->hdr, map->dma);
+    kfree(map);
+}
+
+/*!
+ * \brief Create VNET shared area.
+ *
+ * The area holds one ring per configured Rx and Tx queue and the
+ * requested packet buffers. Called with ngknet_vnet_map_mutex held.
+ *
+ * \param [in] dev NGKNET device structure point.
+ * \param [in,out] cfg VNET shared area configuration.
+ *
+ * \retval SHR_E_NONE No errors.
+ * \retval SHR_E_XXXX Operation failed.
+ */
+static int
+ngknet_vnet_map_create(struct ngknet_dev *dev, struct ngknet_vnet_map_cfg *cfg)
+{
+    struct pdma_dev *pdev = &dev->pdma_dev;
+    struct ngknet_vnet_map *map = NULL;
+    struct ngknet_vnet_map_hdr *hdr = NULL;
+    uint64_t ring_size, buf_size, nb_buf;
+    uint64_t rx_ring_offset, tx_ring_offset, buf_offset, size;
+
+    if (rcu_access_pointer(dev->vnet_map)) {
+        return SHR_E_EXISTS;
+    }
+
+    /* Keep the sizes below from overflowing before the total is checked */
+    if (!cfg->desc_size || cfg->desc_size > PAGE_SIZE ||
+        cfg->nb_desc > NGKNET_VNET_MAP_SIZE_MAX / cfg->desc_size ||
+        cfg->buf_size < ETH_ZLEN || cfg->buf_size > NGKNET_VNET_MAP_SIZE_MAX) {
+        return SHR_E_PARAM;
+    }
+    ring_size = ALIGN((uint64_t)cfg->nb_desc * cfg->desc_size, SMP_CACHE_BYTES);
+    buf_size = ALIGN((uint64_t)cfg->buf_size, SMP_CACHE_BYTES);
+    rx_ring_offset = ALIGN(sizeof(*hdr), SMP_CACHE_BYTES);
+    tx_ring_offset = rx_ring_offset + pdev->ctrl.nb_rxq * ring_size;
+    buf_offset = PAGE_ALIGN(tx_ring_offset + pdev->ctrl.nb_txq * ring_size);
+    nb_buf = cfg->nb_buf;
+    if (!nb_buf) {
+        nb_buf = (uint64_t)(pdev->ctrl.nb_rxq + pdev->ctrl.nb_txq) * cfg->nb_desc;
+    }
+    size = PAGE_ALIGN(buf_offset + nb_buf * buf_size);
+    if (size > NGKNET_VNET_MAP_SIZE_MAX) {
+        return SHR_E_PARAM;
+    }
+
+    map = kzalloc(sizeof(*map), GFP_KERNEL);
+    if (!map) {
+        return SHR_E_MEMORY;
+    }
+    map->dev = dev->dev;
+    map->size = size;
+    map->hdr = dma_alloc_coherent(map->dev, map->size, &map->dma, GFP_KERNEL);
+    if (!map->hdr) {
+        kfree(map);
+        return SHR_E_MEMORY;
+    }
+    memset(map->hdr, 0, map->size);
+    kref_init(&map->ref);
+    if (cfg->eventfd >= 0) {
+        map->efd = eventfd_ctx_fdget(cfg->eventfd);
+        if (IS_ERR(map->efd)) {
+            kref_put(&map->ref, ngknet_vnet_map_release);
+            return SHR_E_PARAM;
+        }
+    }
+
+    hdr = map->hdr;
+    hdr->magic = NGKNET_VNET_MAP_MAGIC;
+    hdr->version = NGKNET_VNET_MAP_VERSION;
+    hdr->dma_addr = map->dma;
+    hdr->size = map->size;
+    hdr->nb_rxq = pdev->ctrl.nb_rxq;
+    hdr->nb_txq = pdev->ctrl.nb_txq;
+    hdr->nb_desc = cfg->nb_desc;
+    hdr->desc_size = cfg->desc_size;
+    hdr->rx_ring_offset = rx_ring_offset;
+    hdr->tx_ring_offset = tx_ring_offset;
+    hdr->ring_size = ring_size;
+    hdr->buf_offset = buf_offset;
+    hdr->nb_buf = nb_buf;
+    hdr->buf_size = buf_size;
+    hdr->hnet_wakeup = 1;
+
+    rcu_assign_pointer(dev->vnet_map, map);
+
+    cfg->mmap_size = map->size;
+
+    return SHR_E_NONE;
+}
+
+/*!
+ * \brief Destroy VNET shared area.
+ *
+ * The DMA memory is freed when user space has unmapped it too.
+ * Called with ngknet_vnet_map_mutex held.
+ *
+ * \param [in] dev NGKNET device structure point.
+ *
+ * \retval SHR_E_NONE No errors.
+ * \retval SHR_E_XXXX Operation failed.
+ */
+static int
+ngknet_vnet_map_destroy(struct ngknet_dev *dev)
+{
+    struct ngknet_vnet_map *map = NULL;
+
+    map = rcu_dereference_protected(dev->vnet_map,
+                                    lockdep_is_held(&ngknet_vnet_map_mutex));
+    if (!map) {
+        return SHR_E_NOT_FOUND;
+    }
+
+    /* The rings are in use until VNET undocks */
+    if (dev->pdma_dev.flags & PDMA_VNET_DOCKED) {
+        return SHR_E_BUSY;
+    }
+
+    RCU_INIT_POINTER(dev->vnet_map, NULL);
+    synchronize_rcu();
+
+    if (map->efd) {
+        eventfd_ctx_put(map->efd);
+    }
+    kref_put(&map->ref, ngknet_vnet_map_release);
+
+    return SHR_E_NONE;
+}
+
+static void
+ngknet_vnet_map_vm_open(struct vm_area_struct *vma)
+{
+    struct ngknet_vnet_map *map = vma->vm_private_data;
+
+    kref_get(&map->ref);
+}
+
+static void
+ngknet_vnet_map_vm_close(struct vm_area_struct *vma)
+{
+    struct ngknet_vnet_map *map = vma->vm_private_data;
+
+    kref_put(&map->ref, ngknet_vnet_map_release);
+}
+
+static const struct vm_operations_struct ngknet_vnet_map_vm_ops = {
+    .open = ngknet_vnet_map_vm_open,
+    .close = ngknet_vnet_map_vm_close,
+};
+
 /*!
  * Convert physical address to virtual address
+ *
+ * Addresses in the VNET shared area stay valid while VNET is docked,
+ * as the area can not be destroyed until then.
  */
 static void *
 ngknet_sys_p2v(struct pdma_dev *pdev, uint64_t paddr)
 {
+    struct ngknet_dev *dev = (struct ngknet_dev *)pdev->priv;
+    struct ngknet_vnet_map *map = NULL;
+    void *vaddr = NULL;
+
+    rcu_read_lock();
+    map = rcu_dereference(dev->vnet_map);
+    if (map && paddr >= map->dma && paddr - map->dma < map->size) {
+        vaddr = (uint8_t *)map->hdr + (paddr - map->dma);
+    }
+    rcu_read_unlock();
+    if (vaddr) {
+        return vaddr;
+    }
+
     return ngbde_kapi_dma_bus_to_virt(pdev->unit, (dma_addr_t)paddr);
 }
 
@@ -1128,6 +1390,21 @@ ngknet_sys_p2v(struct pdma_dev *pdev, uint64_t paddr)
 static uint64_t
 ngknet_sys_v2p(struct pdma_dev *pdev, void *vaddr)
 {
+    struct ngknet_dev *dev = (struct ngknet_dev *)pdev->priv;
+    struct ngknet_vnet_map *map = NULL;
+    uint64_t paddr = 0;
+
+    rcu_read_lock();
+    map = rcu_dereference(dev->vnet_map);
+    if (map && (uint8_t *)vaddr >= (uint8_t *)map->hdr &&
+        (uint8_t *)vaddr - (uint8_t *)map->hdr < map->size) {
+        paddr = map->dma + ((uint8_t *)vaddr - (uint8_t *)map->hdr);
+    }
+    rcu_read_unlock();
+    if (paddr) {
+        return paddr;
+    }
+
     return (uint64_t)ngbde_kapi_dma_virt_to_bus(pdev->unit, vaddr);
 }
 
@@ -1162,7 +1439,7 @@ ngknet_enet_open(struct net_device *ndev)
         }
 
         /* Start rate limit */
-        if (rx_rate_limit >= 0) {
+        if (RX_RATE_LIMITED) {
             ngknet_rx_rate_limit_start(dev);
         }
 
@@ -1231,7 +1508,7 @@ ngknet_enet_stop(struct net_device *ndev)
 
     if (priv->id <= 0) {
         /* Stop rate limit */
-        if (rx_rate_limit >= 0) {
+        if (RX_RATE_LIMITED) {
             ngknet_rx_rate_limit_stop(dev);
         }
 
@@ -1701,6 +1978,9 @@ ngknet_pdev_init(struct ngknet_dev *dev)
     if (rx_batching || pdev->mode == DEV_MODE_HNET) {
         pdev->flags |= PDMA_RX_BATCHING;
     }
+    if (rx_page_pool) {
+        pdev->flags |= PDMA_RX_PAGE_POOL;
+    }
 
     /* Attach PDMA driver */
     rv = drv_ops[pdev->dev_type]->drv_attach(pdev);
@@ -1831,7 +2111,7 @@ ngknet_dev_probe(int dn, ngknet_netif_t *netif)
     memcpy(netif->name, ndev->name, sizeof(netif->name) - 1);
 
     if (priv->flags & NGKNET_NETIF_F_BIND_CHAN) {
-        dev->bdev[priv->chan] = ndev;
+        rcu_assign_pointer(dev->bdev[priv->chan], ndev);
     }
 
     /* Register for napi */
@@ -1855,6 +2135,7 @@ ngknet_dev_probe(int dn, ngknet_netif_t *netif)
     ngknet_callback_control_get(&dev->cbc);
 
     INIT_LIST_HEAD(&dev->filt_list);
+    RCU_INIT_POINTER(dev->filt_cls, NULL);
     spin_lock_init(&dev->lock);
     init_waitqueue_head(&dev->wq);
     if (pdev->mode == DEV_MODE_HNET) {
@@ -1970,6 +2251,15 @@ ngknet_dev_remove(int dn)
     /* Clean up PDMA device */
     bcmcnet_pdma_dev_cleanup(pdev);
 
+    /* Destroy Rx page pools */
+    bcmcnet_rx_pool_destroy(pdev);
+
+    /* Destroy VNET shared area */
+    mutex_lock(&ngknet_vnet_map_mutex);
+    pdev->flags &= ~PDMA_VNET_DOCKED;
+    ngknet_vnet_map_destroy(dev);
+    mutex_unlock(&ngknet_vnet_map_mutex);
+
     /* Detach PDMA driver */
     rv = drv_ops[pdev->dev_type]->drv_detach(pdev);
     if (SHR_FAILURE(rv)) {
@@ -2024,6 +2314,20 @@ ngknet_netif_create(struct ngknet_dev *dev, ngknet_netif_t *netif)
         return rv;
     }
 
+    priv = netdev_priv(ndev);
+    priv->net_dev = ndev;
+    priv->bkn_dev = dev;
+    priv->type = netif->type;
+    if (priv->type == NGKNET_NETIF_T_PORT) {
+        priv->meta_off = netif->meta_off;
+        priv->meta_len = netif->meta_len;
+        memcpy(priv->meta_data, netif->meta_data, priv->meta_len);
+    }
+    priv->flags = netif->flags;
+    priv->vlan = netif->vlan;
+    priv->chan = netif->chan;
+    memcpy(priv->user_data, netif->user_data, sizeof(priv->user_data));
+
     spin_lock_irqsave(&dev->lock, flags);
 
     num = (long)dev->vdev[0];
@@ -2039,36 +2343,23 @@ ngknet_netif_create(struct ngknet_dev *dev, ngknet_netif_t *netif)
         return SHR_E_RESOURCE;
     }
 
-    dev->vdev[id] = ndev;
+    /* Publish the device to Rx only after it is set up */
+    priv->id = id;
+    rcu_assign_pointer(dev->vdev[id], ndev);
     num += id == (num + 1) ? 1 : 0;
     dev->vdev[0] = (struct net_device *)(long)num;
 
-    spin_unlock_irqrestore(&dev->lock, flags);
-
-    priv = netdev_priv(ndev);
-    priv->net_dev = ndev;
-    priv->bkn_dev = dev;
-    priv->id = id;
-    priv->type = netif->type;
-    if (priv->type == NGKNET_NETIF_T_PORT) {
-        priv->meta_off = netif->meta_off;
-        priv->meta_len = netif->meta_len;
-        memcpy(priv->meta_data, netif->meta_data, priv->meta_len);
+    if (priv->flags & NGKNET_NETIF_F_BIND_CHAN) {
+        rcu_assign_pointer(dev->bdev[priv->chan], ndev);
     }
-    priv->flags = netif->flags;
-    priv->vlan = netif->vlan;
-    priv->chan = netif->chan;
-    memcpy(priv->user_data, netif->user_data, sizeof(priv->user_data));
+
+    spin_unlock_irqrestore(&dev->lock, flags);
 
     netif->id = priv->id;
     memcpy(netif->macaddr, ndev->dev_addr, ETH_ALEN);
     netif->mtu = ndev->mtu;
     memcpy(netif->name, ndev->name, sizeof(netif->name) - 1);
 
-    if (priv->flags & NGKNET_NETIF_F_BIND_CHAN) {
-        dev->bdev[priv->chan] = ndev;
-    }
-
     /* Optional netif create callback handle */
     if (dev->cbc->netif_create_cb) {
         rv = dev->cbc->netif_create_cb(ndev);
@@ -2089,7 +2380,6 @@ ngknet_netif_destroy(struct ngknet_dev *dev, int id)
     struct ngknet_private *priv = NULL;
     unsigned long flags;
     int num;
-    DECLARE_WAITQUEUE(wait, current);
 
     if (id <= 0 || id > NUM_VDEV_MAX) {
         return SHR_E_PARAM;
@@ -2104,23 +2394,11 @@ ngknet_netif_destroy(struct ngknet_dev *dev, int id)
     }
     priv = netdev_priv(ndev);
 
-    add_wait_queue(&dev->wq, &wait);
-
-    while (priv->users) {
-        priv->wait = 1;
-        set_current_state(TASK_INTERRUPTIBLE);
-        spin_unlock_irqrestore(&dev->lock, flags);
-        schedule();
-        spin_lock_irqsave(&dev->lock, flags);
-        priv->wait = 0;
-        set_current_state(TASK_RUNNING);
-    }
-
     if (priv->flags & NGKNET_NETIF_F_BIND_CHAN) {
-        dev->bdev[priv->chan] = NULL;
+        RCU_INIT_POINTER(dev->bdev[priv->chan], NULL);
     }
 
-    dev->vdev[id] = NULL;
+    RCU_INIT_POINTER(dev->vdev[id], NULL);
     num = (long)dev->vdev[0];
     while (num-- == id--) {
         if (dev->vdev[id]) {
@@ -2131,7 +2409,13 @@ ngknet_netif_destroy(struct ngknet_dev *dev, int id)
 
     spin_unlock_irqrestore(&dev->lock, flags);
 
-    remove_wait_queue(&dev->wq, &wait);
+    /*
+     * Rx looks the device up under RCU read lock and takes a user before
+     * unlocking, so after a grace period no new users can come.
+     */
+    synchronize_rcu();
+
+    wait_event(dev->wq, !atomic_read(&priv->users));
 
     /* Optional netif destroy callback handle */
     if (dev->cbc->netif_destroy_cb) {
@@ -2230,6 +2514,23 @@ void
 ngknet_rx_rate_limit_set(int rate_limit)
 {
     rx_rate_limit = rate_limit;
+    ngknet_rx_rate_limit_reset();
+}
+
+int
+ngknet_rx_rate_limit_hi_get(uint64_t *hi_queues)
+{
+    *hi_queues = rx_hi_queues;
+
+    return rx_rate_limit_hi;
+}
+
+void
+ngknet_rx_rate_limit_hi_set(int rate_limit, uint64_t hi_queues)
+{
+    rx_rate_limit_hi = rate_limit;
+    rx_hi_queues = hi_queues;
+    ngknet_rx_rate_limit_reset();
 }
 
 /*!
@@ -2260,11 +2561,14 @@ ngknet_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
         ngknet_chan_cfg_t chan_cfg;
         ngknet_netif_t netif;
         ngknet_filter_t filter;
+        struct ngknet_vnet_map_cfg map_cfg;
     } iod;
     ngknet_dev_cfg_t *dev_cfg = &iod.dev_cfg;
     ngknet_chan_cfg_t *chan_cfg = &iod.chan_cfg;
     ngknet_netif_t *netif = &iod.netif;
     ngknet_filter_t *filter = &iod.filter;
+    struct ngknet_vnet_map_cfg *map_cfg = &iod.map_cfg;
+    struct ngknet_vnet_map *map = NULL;
     char *data = NULL;
     int dt, gi, qi;
 
@@ -2464,7 +2768,7 @@ ngknet_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
         break;
     case NGKNET_DEV_SUSPEND:
         DBG_CMD(("NGKNET_DEV_SUSPEND\n"));
-        if (rx_rate_limit >= 0) {
+        if (RX_RATE_LIMITED) {
             ngknet_rx_rate_limit_stop(dev);
         }
         if (ioc.iarg[0]) {
@@ -2478,7 +2782,7 @@ ngknet_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
     case NGKNET_DEV_RESUME:
         DBG_CMD(("NGKNET_DEV_RESUME\n"));
         ioc.rc = bcmcnet_pdma_dev_resume(pdev);
-        if (rx_rate_limit >= 0) {
+        if (RX_RATE_LIMITED) {
             ngknet_rx_rate_limit_start(dev);
         }
         break;
@@ -2498,6 +2802,13 @@ ngknet_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
             ioc.rc = SHR_E_UNAVAIL;
             break;
         }
+        rcu_read_lock();
+        map = rcu_dereference(dev->vnet_map);
+        if (map) {
+            map->hdr->hnet_wakeup = 0;
+            map->hdr->hnet_wakes++;
+        }
+        rcu_read_unlock();
         atomic_set(&dev->hnet_active, 1);
         wake_up_interruptible(&dev->hnet_wq);
         break;
@@ -2511,7 +2822,12 @@ ngknet_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
                                sizeof(pdev->ctrl.vsync), ioc.op.data.len)) {
             return -EFAULT;
         }
+        mutex_lock(&ngknet_vnet_map_mutex);
         ioc.rc = bcmcnet_pdma_dev_dock(pdev);
+        if (SHR_SUCCESS((int)ioc.rc)) {
+            pdev->flags |= PDMA_VNET_DOCKED;
+        }
+        mutex_unlock(&ngknet_vnet_map_mutex);
         break;
     case NGKNET_DEV_VNET_UNDOCK:
         DBG_CMD(("NGKNET_DEV_VNET_UNDOCK\n"));
@@ -2520,7 +2836,32 @@ ngknet_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
             break;
         }
         ngknet_dev_vnet_wake(pdev);
+        mutex_lock(&ngknet_vnet_map_mutex);
         ioc.rc = bcmcnet_pdma_dev_undock(pdev);
+        pdev->flags &= ~PDMA_VNET_DOCKED;
+        mutex_unlock(&ngknet_vnet_map_mutex);
+        break;
+    case NGKNET_DEV_VNET_MMAP:
+        DBG_CMD(("NGKNET_DEV_VNET_MMAP\n"));
+        if (pdev->mode != DEV_MODE_HNET) {
+            ioc.rc = SHR_E_UNAVAIL;
+            break;
+        }
+        if (kal_copy_from_user(map_cfg, (void *)(unsigned long)ioc.op.data.buf,
+                               sizeof(*map_cfg), ioc.op.data.len)) {
+            return -EFAULT;
+        }
+        mutex_lock(&ngknet_vnet_map_mutex);
+        if (map_cfg->nb_desc) {
+            ioc.rc = ngknet_vnet_map_create(dev, map_cfg);
+        } else {
+            ioc.rc = ngknet_vnet_map_destroy(dev);
+        }
+        mutex_unlock(&ngknet_vnet_map_mutex);
+        if (kal_copy_to_user((void *)(unsigned long)ioc.op.data.buf, map_cfg,
+                             ioc.op.data.len, sizeof(*map_cfg))) {
+            return -EFAULT;
+        }
         break;
     case NGKNET_RCPU_CONFIG:
         DBG_CMD(("NGKNET_RCPU_CONFIG\n"));
@@ -2555,6 +2896,10 @@ ngknet_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
     case NGKNET_STATS_RESET:
         DBG_CMD(("NGKNET_STATS_RESET\n"));
         bcmcnet_pdma_dev_stats_reset(pdev);
+        for (qi = 0; qi < NUM_Q_MAX; qi++) {
+            dev->rx_pool[qi].allocs = 0;
+            dev->rx_pool[qi].no_pages = 0;
+        }
         break;
     case NGKNET_NETIF_CREATE:
         DBG_CMD(("NGKNET_NETIF_CREATE\n"));
@@ -2710,13 +3055,45 @@ ngknet_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
     return 0;
 }
 
+/*!
+ * Map the VNET shared area of the device given by the page offset
+ */
 static int
 ngknet_mmap(struct file *filp, struct vm_area_struct *vma)
 {
-    return 0;
+    struct ngknet_dev *dev = NULL;
+    struct ngknet_vnet_map *map = NULL;
+    int rv = -ENODEV;
+
+    if (vma->vm_pgoff >= NUM_PDMA_DEV_MAX) {
+        return -EINVAL;
+    }
+    dev = &ngknet_devices[vma->vm_pgoff];
+
+    mutex_lock(&ngknet_vnet_map_mutex);
+    map = rcu_dereference_protected(dev->vnet_map,
+                                    lockdep_is_held(&ngknet_vnet_map_mutex));
+    if (map) {
+        if (vma->vm_end - vma->vm_start > map->size) {
+            rv = -EINVAL;
+        } else {
+            /* The page offset only selects the device */
+            vma->vm_pgoff = 0;
+            rv = dma_mmap_coherent(map->dev, vma, map->hdr, map->dma, map->size);
+        }
+        if (rv == 0) {
+            vma->vm_private_data = map;
+            vma->vm_ops = &ngknet_vnet_map_vm_ops;
+            kref_get(&map->ref);
+        }
+    }
+    mutex_unlock(&ngknet_vnet_map_mutex);
+
+    return rv;
 }
 
 static struct file_operations ngknet_fops = {
+    .owner = THIS_MODULE,
     .open = ngknet_open,
     .release = ngknet_release,
     .unlocked_ioctl = ngknet_ioctl,
@@ -2774,6 +3151,9 @@ ngknet_exit_module(void)
         ngknet_dev_remove(idx);
     }
 
+    /* Wait for the filters freed after RCU grace periods */
+    rcu_barrier();
+
     unregister_chrdev(NGKNET_MODULE_MAJOR, NGKNET_MODULE_NAME);
 }
 
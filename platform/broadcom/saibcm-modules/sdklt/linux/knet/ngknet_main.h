@@ -64,6 +64,43 @@
 #define DBG_RATE(_s)        do { if (debug & DBG_LVL_RATE) printk _s; } while (0)
 #define DBG_LINK(_s)        do { if (debug & DBG_LVL_LINK) printk _s; } while (0)
 
+/*!
+ * \brief Rx page pool.
+ */
+struct ngknet_rx_pool {
+    /*! Page pool, NULL if not used */
+    struct page_pool *pool;
+
+    /*! Number of pages taken from the pool */
+    uint64_t allocs;
+
+    /*! Number of failed page allocations */
+    uint64_t no_pages;
+};
+
+/*!
+ * \brief VNET area shared with user space.
+ */
+struct ngknet_vnet_map {
+    /*! Area header, start of the DMA memory */
+    struct ngknet_vnet_map_hdr *hdr;
+
+    /*! DMA address of the area */
+    dma_addr_t dma;
+
+    /*! Size of the area */
+    size_t size;
+
+    /*! Device the DMA memory belongs to */
+    struct device *dev;
+
+    /*! References from the device and user space mappings */
+    struct kref ref;
+
+    /*! Eventfd to signal VNET, NULL if not used */
+    struct eventfd_ctx *efd;
+};
+
 /*!
  * Device description
  */
@@ -92,10 +129,13 @@ struct ngknet_dev {
     /*! Device number (from BDE) */
     int dev_no;
 
-    /*! Virtual network devices, 0 is reserved for valid number of devices. */
+    /*!
+     * Virtual network devices, 0 is reserved for valid number of devices.
+     * Published with RCU, Rx looks them up without the device lock.
+     */
     struct net_device *vdev[NUM_VDEV_MAX + 1];
 
-    /*! Virtual network devices bound to queue */
+    /*! Virtual network devices bound to queue, published with RCU */
     struct net_device *bdev[NUM_Q_MAX];
 
     /*! Filter list */
@@ -104,6 +144,9 @@ struct ngknet_dev {
     /*! Filter control, 0 is reserved */
     void *fc[NUM_FILTER_MAX + 1];
 
+    /*! Compiled filters, NULL to match the filter list linearly */
+    struct ngknet_filter_cls __rcu *filt_cls;
+
     /*! Callback control */
     struct ngknet_callback_ctrl *cbc;
 
@@ -134,6 +177,12 @@ struct ngknet_dev {
     /*! HNET work */
     struct work_struct hnet_work;
 
+    /*! VNET area shared with user space */
+    struct ngknet_vnet_map __rcu *vnet_map;
+
+    /*! Rx page pools, indexed by channel */
+    struct ngknet_rx_pool rx_pool[NUM_Q_MAX];
+
     /*! PTP Tx queue */
     struct sk_buff_head ptp_tx_queue;
 
@@ -186,11 +235,8 @@ struct ngknet_private {
     /*! User data gotten back through callbacks */
     uint8_t user_data[NGKNET_NETIF_USER_DATA];
 
-    /*! Users of this network interface */
-    int users;
-
-    /*! Wait for this network interface free */
-    int wait;
+    /*! Users of this network interface, i.e. Rx packets being delivered */
+    atomic_t users;
 
     /*! HW timestamp Rx filter */
     int hwts_rx_filter;
@@ -283,5 +329,24 @@ ngknet_rx_rate_limit_get(void);
 extern void
 ngknet_rx_rate_limit_set(int rate_limit);
 
+/*!
+ * \brief Get Rx rate limit of high priority queues.
+ *
+ * \param [out] hi_queues Bitmap of high priority Rx queues.
+ *
+ * \retval Current Rx rate limit of high priority queues.
+ */
+extern int
+ngknet_rx_rate_limit_hi_get(uint64_t *hi_queues);
+
+/*!
+ * \brief Set Rx rate limit of high priority queues.
+ *
+ * \param [in] rate_limit Rx rate limit to be set.
+ * \param [in] hi_queues Bitmap of high priority Rx queues.
+ */
+extern void
+ngknet_rx_rate_limit_hi_set(int rate_limit, uint64_t hi_queues);
+
 #endif /* NGKNET_MAIN_H */
 
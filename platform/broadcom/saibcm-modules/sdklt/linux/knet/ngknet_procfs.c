@@ -243,7 +243,7 @@ proc_filter_info_show(struct seq_file *m, void *v)
             proc_data_show(m, filt.mask.b, filt.oob_data_size + filt.pkt_data_size);
             seq_printf(m, "user_data:      ");
             proc_data_show(m, filt.user_data, NGKNET_FILTER_USER_DATA);
-            seq_printf(m, "hits:           %llu\n", ((struct filt_ctrl *)dev->fc[filt.id])->hits);
+            seq_printf(m, "hits:           %llu\n", ngknet_filter_hits_get((struct filt_ctrl *)dev->fc[filt.id]));
         } while (filt.next);
     }
 
@@ -286,6 +286,132 @@ static struct proc_ops proc_filter_info_fops = {
 };
 #endif
 
+static int
+proc_filter_stats_show(struct seq_file *m, void *v)
+{
+    struct ngknet_dev *dev;
+    struct ngknet_filter_cls *cls;
+    struct ngknet_filter_table *tbl;
+    struct ngknet_filter_table_stats stats;
+    int di, ti, dn = 0;
+
+    for (di = 0; di < NUM_PDMA_DEV_MAX; di++) {
+        dev = &ngknet_devices[di];
+        if (!(dev->flags & NGKNET_DEV_ACTIVE)) {
+            continue;
+        }
+        dn++;
+
+        seq_printf(m, "\n");
+        seq_printf(m, "dev_no:         %d\n", di);
+        rcu_read_lock();
+        cls = rcu_dereference(dev->filt_cls);
+        if (!cls) {
+            seq_printf(m, "%s\n", "No compiled filters");
+            rcu_read_unlock();
+            continue;
+        }
+        for (ti = 0; ti < cls->num_tables; ti++) {
+            tbl = cls->tables[ti];
+            ngknet_filter_table_stats_get(cls, ti, &stats);
+            seq_printf(m, "table[%d]:       oob %d/%d, pkt %d/%d, filters %d, "
+                       "lookups %llu, hits %llu, matches %llu\n",
+                       ti, tbl->oob_data_offset, tbl->oob_data_size,
+                       tbl->pkt_data_offset, tbl->pkt_data_size, tbl->filters,
+                       (unsigned long long)stats.lookups,
+                       (unsigned long long)stats.hits,
+                       (unsigned long long)stats.matches);
+        }
+        ngknet_filter_table_stats_get(cls, cls->num_tables, &stats);
+        seq_printf(m, "linear:         filters %d, lookups %llu, matches %llu\n",
+                   cls->num_linear, (unsigned long long)stats.lookups,
+                   (unsigned long long)stats.matches);
+        rcu_read_unlock();
+    }
+
+    if (!dn) {
+        seq_printf(m, "%s\n", "No active device");
+    }
+
+    return 0;
+}
+
+static int
+proc_filter_stats_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, proc_filter_stats_show, NULL);
+}
+
+/*
+ * Syntax:
+ *   clear
+ *   selftest[=<packets>]
+ *
+ * The self-test matches generated packets with both the compiled filters
+ * and the filter list, and logs the mismatches and the time spent.
+ */
+static ssize_t
+proc_filter_stats_write(struct file *file, const char *buf,
+                        size_t count, loff_t *loff)
+{
+    struct ngknet_dev *dev;
+    char cmd_str[32] = {0};
+    char *ptr;
+    size_t len = min(count, sizeof(cmd_str) - 1);
+    int pkts = 4096;
+    int di, rv;
+
+    if (copy_from_user(cmd_str, buf, len)) {
+        return -EFAULT;
+    }
+
+    if ((ptr = strstr(cmd_str, "selftest=")) != NULL) {
+        pkts = simple_strtol(ptr + 9, NULL, 10);
+    }
+
+    for (di = 0; di < NUM_PDMA_DEV_MAX; di++) {
+        dev = &ngknet_devices[di];
+        if (!(dev->flags & NGKNET_DEV_ACTIVE)) {
+            continue;
+        }
+        if (strstr(cmd_str, "clear")) {
+            ngknet_filter_table_stats_clear(dev);
+        } else if (strstr(cmd_str, "selftest")) {
+            rv = ngknet_filter_selftest(dev, pkts);
+            if (rv < 0) {
+                printk("ngknet: device%d filter self-test failed\n", di);
+            }
+        }
+    }
+
+    return count;
+}
+
+static int
+proc_filter_stats_release(struct inode *inode, struct file *file)
+{
+    return single_release(inode, file);
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,6,0)
+static struct file_operations proc_filter_stats_fops = {
+    owner:      THIS_MODULE,
+    open:       proc_filter_stats_open,
+    read:       seq_read,
+    write:      proc_filter_stats_write,
+    llseek:     seq_lseek,
+    release:    proc_filter_stats_release,
+};
+#else
+static struct proc_ops proc_filter_stats_fops = {
+    proc_open:       proc_filter_stats_open,
+    proc_read:       seq_read,
+    proc_write:      proc_filter_stats_write,
+    proc_lseek:     seq_lseek,
+    proc_release:    proc_filter_stats_release,
+};
+#endif
+
 static int
 proc_netif_info_show(struct seq_file *m, void *v)
 {
@@ -387,6 +513,47 @@ static struct proc_ops proc_netif_info_fops = {
 };
 #endif
 
+static void
+proc_rx_pool_show(struct seq_file *m, struct ngknet_dev *dev, int queue)
+{
+    struct ngknet_rx_pool *rxp;
+    int chan;
+
+    if (SHR_FAILURE(bcmcnet_pdma_dev_queue_to_chan(&dev->pdma_dev, queue,
+                                                   PDMA_Q_RX, &chan))) {
+        return;
+    }
+    rxp = &dev->rx_pool[chan];
+    if (!rxp->pool) {
+        return;
+    }
+
+    seq_printf(m, "rx_pool_allocs[%d]:   %llu\n", queue, (unsigned long long)rxp->allocs);
+    seq_printf(m, "rx_pool_no_pages[%d]: %llu\n", queue, (unsigned long long)rxp->no_pages);
+#if defined(KAL_PAGE_POOL_SUPPORT) && defined(CONFIG_PAGE_POOL_STATS)
+    {
+        struct page_pool_stats pp_stats;
+
+        memset(&pp_stats, 0, sizeof(pp_stats));
+        page_pool_get_stats(rxp->pool, &pp_stats);
+        seq_printf(m, "rx_pool_fast[%d]:     %llu\n", queue,
+                   (unsigned long long)pp_stats.alloc_stats.fast);
+        seq_printf(m, "rx_pool_slow[%d]:     %llu\n", queue,
+                   (unsigned long long)(pp_stats.alloc_stats.slow +
+                                        pp_stats.alloc_stats.slow_high_order));
+        seq_printf(m, "rx_pool_refill[%d]:   %llu\n", queue,
+                   (unsigned long long)pp_stats.alloc_stats.refill);
+        seq_printf(m, "rx_pool_recycle[%d]:  %llu\n", queue,
+                   (unsigned long long)(pp_stats.recycle_stats.cached +
+                                        pp_stats.recycle_stats.ring));
+        seq_printf(m, "rx_pool_ring_full[%d]: %llu\n", queue,
+                   (unsigned long long)pp_stats.recycle_stats.ring_full);
+        seq_printf(m, "rx_pool_released[%d]: %llu\n", queue,
+                   (unsigned long long)pp_stats.recycle_stats.released_refcnt);
+    }
+#endif
+}
+
 static int
 proc_pkt_stats_show(struct seq_file *m, void *v)
 {
@@ -415,6 +582,9 @@ proc_pkt_stats_show(struct seq_file *m, void *v)
             seq_printf(m, "rx_packets[%d]:  %llu\n", qi, (unsigned long long)stats->rxq_packets[qi]);
             seq_printf(m, "rx_bytes[%d]:    %llu\n", qi, (unsigned long long)stats->rxq_bytes[qi]);
         }
+        for (qi = 0; qi < dev->pdma_dev.ctrl.nb_rxq; qi++) {
+            proc_rx_pool_show(m, dev, qi);
+        }
         seq_printf(m, "rx_dropped:     %llu\n", (unsigned long long)stats->rx_dropped);
         seq_printf(m, "rx_errors:      %llu\n", (unsigned long long)stats->rx_errors);
         seq_printf(m, "rx_head_errors: %llu\n", (unsigned long long)stats->rx_head_errors);
@@ -475,7 +645,33 @@ static struct proc_ops proc_pkt_stats_fops = {
 static int
 proc_rate_limit_show(struct seq_file *m, void *v)
 {
+    struct ngknet_dev *dev;
+    struct ngknet_rl_queue_stats stats;
+    uint64_t hi_queues;
+    int rate_limit_hi;
+    int di, qi;
+
+    rate_limit_hi = ngknet_rx_rate_limit_hi_get(&hi_queues);
     seq_printf(m, "Rx rate limit: %d pps\n", ngknet_rx_rate_limit_get());
+    seq_printf(m, "Rx rate limit high priority: %d pps\n", rate_limit_hi);
+    seq_printf(m, "High priority queues: 0x%llx\n", (unsigned long long)hi_queues);
+
+    for (di = 0; di < NUM_PDMA_DEV_MAX; di++) {
+        dev = &ngknet_devices[di];
+        if (!(dev->flags & NGKNET_DEV_ACTIVE)) {
+            continue;
+        }
+        seq_printf(m, "\n");
+        seq_printf(m, "dev_no:         %d\n", di);
+        for (qi = 0; qi < dev->pdma_dev.ctrl.nb_rxq && qi < NUM_Q_MAX; qi++) {
+            ngknet_rx_rate_limit_stats_get(dev, qi, &stats);
+            seq_printf(m, "rx_queue[%d]:    %s, limit %d pps%s, "
+                       "throttles %lu, overruns %lu\n",
+                       qi, hi_queues & (1ULL << qi) ? "high" : "low",
+                       stats.limit, stats.paused ? ", suspended" : "",
+                       stats.throttles, stats.overruns);
+        }
+    }
 
     return 0;
 }
@@ -486,20 +682,53 @@ proc_rate_limit_open(struct inode *inode, struct file *file)
     return single_open(file, proc_rate_limit_show, NULL);
 }
 
+/*
+ * Syntax:
+ *   <pps>
+ *   lo=<pps>,hi=<pps>,hi_queues=<bitmap>
+ *
+ * A plain number sets the limit of the low priority queues.
+ * A limit of -1 disables the rate limit.
+ *
+ * Examples:
+ *   1000
+ *   hi=5000,hi_queues=0xc0
+ */
 static ssize_t
 proc_rate_limit_write(struct file *file, const char *buf,
                       size_t count, loff_t *loff)
 {
-    char limit_str[9] = {0};
-    int rate_limit;
+    char limit_str[64] = {0};
+    char *ptr;
+    uint64_t hi_queues;
+    int rate_limit, rate_limit_hi;
+    size_t len = min(count, sizeof(limit_str) - 1);
 
-    if (copy_from_user(limit_str, buf, sizeof(limit_str) - 1)) {
+    if (copy_from_user(limit_str, buf, len)) {
         return -EFAULT;
     }
-    rate_limit = simple_strtol(limit_str, NULL, 10);
+
+    rate_limit = ngknet_rx_rate_limit_get();
+    rate_limit_hi = ngknet_rx_rate_limit_hi_get(&hi_queues);
+
+    if (!strchr(limit_str, '=')) {
+        rate_limit = simple_strtol(limit_str, NULL, 10);
+    }
+    if ((ptr = strstr(limit_str, "lo=")) != NULL) {
+        rate_limit = simple_strtol(ptr + 3, NULL, 10);
+    }
+    if ((ptr = strstr(limit_str, "hi=")) != NULL) {
+        rate_limit_hi = simple_strtol(ptr + 3, NULL, 10);
+    }
+    if ((ptr = strstr(limit_str, "hi_queues=")) != NULL) {
+        hi_queues = simple_strtoull(ptr + 10, NULL, 0);
+    }
 
     ngknet_rx_rate_limit_set(rate_limit);
-    printk("Rx rate limit set to: %d pps\n", rate_limit);
+    ngknet_rx_rate_limit_hi_set(rate_limit_hi, hi_queues);
+    printk("Rx rate limit set to: %d pps, high priority: %d pps, "
+           "queues 0x%llx\n", rate_limit, rate_limit_hi,
+           (unsigned long long)hi_queues);
 
     return count;
 }
@@ -680,6 +909,12 @@ ngknet_procfs_init(void)
         return -1;
     }
 
+    PROC_CREATE(entry, "filter_stats", 0666, proc_root, &proc_filter_stats_fops);
+    if (entry == NULL) {
+        printk(KERN_ERR "ngknet: proc_create failed\n");
+        return -1;
+    }
+
     PROC_CREATE(entry, "netif_info", 0444, proc_root, &proc_netif_info_fops);
     if (entry == NULL) {
         printk(KERN_ERR "ngknet: proc_create failed\n");
@@ -719,6 +954,7 @@ ngknet_procfs_cleanup(void)
     remove_proc_entry("debug_level", proc_root);
     remove_proc_entry("device_info", proc_root);
     remove_proc_entry("filter_info", proc_root);
+    remove_proc_entry("filter_stats", proc_root);
     remove_proc_entry("netif_info", proc_root);
     remove_proc_entry("pkt_stats", proc_root);
     remove_proc_entry("rate_limit", proc_root);
@@ -0,0 +1,203 @@
+/*! \file filter_replay.c
+ *
+ * Replay a recorded filter set through the NGKNET filter match.
+ *
+ * Filters are read in the format of /proc/linux_ngknet/filter, created
+ * with ngknet_filter_create() and checked with ngknet_filter_selftest(),
+ * which compares the compiled match with the filter list walk. Half of
+ * the filters are then destroyed and the check is repeated.
+ *
+ */
+/*
+ * $Copyright: Copyright 2018-2021 Broadcom. All rights reserved.
+ * The term 'Broadcom' refers to Broadcom Inc. and/or its subsidiaries.
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * version 2 as published by the Free Software Foundation.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * A copy of the GNU General Public License version 2 (GPLv2) can
+ * be found in the LICENSES folder.$
+ */
+
+#include <lkm/ngknet_dev.h>
+#include <bcmcnet/bcmcnet_core.h>
+#include "ngknet_main.h"
+#include "ngknet_extra.h"
+
+static struct ngknet_dev replay_dev;
+
+/* Module symbols referenced by ngknet_extra.c */
+
+int
+bcmcnet_pdma_dev_queue_to_chan(struct pdma_dev *dev, int queue, int dir, int *chan)
+{
+    *chan = queue;
+    return SHR_E_NONE;
+}
+
+int
+bcmcnet_pdma_rx_queue_suspend(struct pdma_dev *dev, int queue)
+{
+    return SHR_E_NONE;
+}
+
+int
+bcmcnet_pdma_rx_queue_resume(struct pdma_dev *dev, int queue)
+{
+    return SHR_E_NONE;
+}
+
+/*!
+ * Parse hex bytes of a data line, returns number of bytes.
+ */
+static int
+replay_data_parse(const char *str, uint8_t *buf, int pos)
+{
+    unsigned int byte;
+    int len;
+
+    while (pos < NGKNET_FILTER_BYTES_MAX && sscanf(str, " %2x%n", &byte, &len) == 1) {
+        buf[pos++] = byte;
+        str += len;
+    }
+
+    return pos;
+}
+
+/*!
+ * Read the next filter, returns 1 if one was read.
+ */
+static int
+replay_filter_read(FILE *fp, ngknet_filter_t *filt)
+{
+    char line[256], key[32];
+    uint8_t *data = NULL;
+    unsigned int val;
+    int data_len = 0, found = 0;
+    int pos;
+
+    memset(filt, 0, sizeof(*filt));
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[0] == ' ' && data) {
+            /* Continued filter data or mask */
+            data_len = replay_data_parse(line, data, data_len);
+            continue;
+        }
+        data = NULL;
+        pos = 0;
+        if (sscanf(line, "%31[^:\n]:%n", key, &pos) != 1 || !pos) {
+            /* Filters are separated by empty lines */
+            if (found) {
+                return 1;
+            }
+            continue;
+        }
+        found = 1;
+        if (strcmp(key, "filt_data") == 0 || strcmp(key, "filt_mask") == 0) {
+            data = key[5] == 'd' ? filt->data.b : filt->mask.b;
+            data_len = replay_data_parse(line + pos, data, 0);
+            continue;
+        }
+        if (strcmp(key, "desc") == 0) {
+            sscanf(line + pos, " %31[^\n]", filt->desc);
+            continue;
+        }
+        if (sscanf(line + pos, " %i", (int *)&val) != 1) {
+            continue;
+        }
+        if (strcmp(key, "type") == 0) {
+            filt->type = val;
+        } else if (strcmp(key, "flags") == 0) {
+            filt->flags = val;
+        } else if (strcmp(key, "prio") == 0) {
+            filt->priority = val;
+        } else if (strcmp(key, "chan") == 0) {
+            filt->chan = val;
+        } else if (strcmp(key, "dest_type") == 0) {
+            filt->dest_type = val;
+        } else if (strcmp(key, "dest_id") == 0) {
+            filt->dest_id = val;
+        } else if (strcmp(key, "dest_proto") == 0) {
+            filt->dest_proto = val;
+        } else if (strcmp(key, "mirror_type") == 0) {
+            filt->mirror_type = val;
+        } else if (strcmp(key, "mirror_id") == 0) {
+            filt->mirror_id = val;
+        } else if (strcmp(key, "mirror_proto") == 0) {
+            filt->mirror_proto = val;
+        } else if (strcmp(key, "oob_offset") == 0) {
+            filt->oob_data_offset = val;
+        } else if (strcmp(key, "oob_size") == 0) {
+            filt->oob_data_size = val;
+        } else if (strcmp(key, "pkt_offset") == 0) {
+            filt->pkt_data_offset = val;
+        } else if (strcmp(key, "pkt_size") == 0) {
+            filt->pkt_data_size = val;
+        }
+    }
+
+    return found;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct ngknet_dev *dev = &replay_dev;
+    ngknet_filter_t filt;
+    FILE *fp;
+    int pkts = argc > 2 ? atoi(argv[2]) : 100000;
+    int filters = 0, mismatches;
+    int id, rv;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <recorded filters> [packets]\n", argv[0]);
+        return 2;
+    }
+    fp = fopen(argv[1], "r");
+    if (!fp) {
+        perror(argv[1]);
+        return 2;
+    }
+
+    INIT_LIST_HEAD(&dev->filt_list);
+    spin_lock_init(&dev->lock);
+    srand(1);
+
+    while (replay_filter_read(fp, &filt)) {
+        if (filt.oob_data_size + filt.pkt_data_size > NGKNET_FILTER_BYTES_MAX) {
+            continue;
+        }
+        rv = ngknet_filter_create(dev, &filt);
+        if (SHR_FAILURE(rv)) {
+            fprintf(stderr, "Failed to create filter %s: %d\n", filt.desc, rv);
+            fclose(fp);
+            return 2;
+        }
+        filters++;
+    }
+    fclose(fp);
+
+    printf("Replaying %d packets through %d filters\n", pkts, filters);
+    mismatches = ngknet_filter_selftest(dev, pkts);
+
+    /* Recompile after destroying filters */
+    for (id = 1; id <= filters; id += 2) {
+        ngknet_filter_destroy(dev, id);
+    }
+    printf("Replaying %d packets through %d filters\n", pkts, filters / 2);
+    rv = ngknet_filter_selftest(dev, pkts);
+    if (mismatches >= 0) {
+        mismatches = rv < 0 ? rv : mismatches + rv;
+    }
+
+    ngknet_filter_destroy_all(dev);
+
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,312 @@
+/*! \file kshim.h
+ *
+ * Kernel stand-ins to build the NGKNET filter code in user space.
+ *
+ * Only what ngknet_extra.c needs is provided. Locks and RCU are no-ops
+ * and RCU callbacks run at once, as the replay is single threaded.
+ *
+ */
+/*
+ * $Copyright: Copyright 2018-2021 Broadcom. All rights reserved.
+ * The term 'Broadcom' refers to Broadcom Inc. and/or its subsidiaries.
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * version 2 as published by the Free Software Foundation.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * A copy of the GNU General Public License version 2 (GPLv2) can
+ * be found in the LICENSES folder.$
+ */
+
+#ifndef KSHIM_H
+#define KSHIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define KERNEL_VERSION(a, b, c)     (((a) << 16) + ((b) << 8) + (c))
+#define LINUX_VERSION_CODE          KERNEL_VERSION(5,10,0)
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef uint16_t __be16;
+typedef uint64_t dma_addr_t;
+typedef int bool;
+
+#define true                1
+#define false               0
+
+#define __rcu
+#define __percpu
+#define __user
+#define __iomem
+#define likely(x)           (x)
+#define unlikely(x)         (x)
+
+#define KERN_ERR            ""
+#define KERN_WARNING        ""
+#define KERN_INFO           ""
+#define KERN_DEBUG          ""
+#define printk              printf
+
+#define max(a, b)           ((a) > (b) ? (a) : (b))
+#define min(a, b)           ((a) < (b) ? (a) : (b))
+
+#define container_of(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define READ_ONCE(x)        (x)
+#define WRITE_ONCE(x, v)    ((x) = (v))
+#define smp_mb()            __sync_synchronize()
+
+/* Memory */
+
+#define GFP_KERNEL          0
+#define GFP_ATOMIC          0
+
+#define kmalloc(sz, gfp)        malloc(sz)
+#define kzalloc(sz, gfp)        calloc(1, sz)
+#define kcalloc(n, sz, gfp)     calloc(n, sz)
+#define kfree(p)                free(p)
+
+/* One CPU, per-CPU data is allocated once */
+#define for_each_possible_cpu(cpu)  for ((cpu) = 0; (cpu) < 1; (cpu)++)
+#define __alloc_percpu(sz, align)           calloc(1, sz)
+#define __alloc_percpu_gfp(sz, align, gfp)  calloc(1, sz)
+#define alloc_percpu(type)                  ((type *)calloc(1, sizeof(type)))
+#define free_percpu(p)                      free(p)
+#define per_cpu_ptr(p, cpu)                 (p)
+#define this_cpu_ptr(p)                     (p)
+#define this_cpu_inc(x)                     ((x)++)
+
+/* Lists */
+
+struct list_head {
+    struct list_head *next, *prev;
+};
+
+#define INIT_LIST_HEAD(head)    ((head)->next = (head)->prev = (head))
+#define list_empty(head)        ((head)->next == (head))
+#define list_for_each(pos, head) \
+    for (pos = (head)->next; pos != (head); pos = pos->next)
+
+static inline void
+list_add_tail(struct list_head *entry, struct list_head *head)
+{
+    entry->prev = head->prev;
+    entry->next = head;
+    head->prev->next = entry;
+    head->prev = entry;
+}
+
+static inline void
+list_del(struct list_head *entry)
+{
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+}
+
+/* Locking and RCU */
+
+typedef struct {
+    int locked;
+} spinlock_t;
+
+typedef struct {
+    int counter;
+} atomic_t;
+
+#define spin_lock_init(l)                   ((l)->locked = 0)
+#define spin_lock_irqsave(l, flags)         ((flags) = 0, (l)->locked++)
+#define spin_unlock_irqrestore(l, flags)    ((void)(flags), (l)->locked--)
+#define lockdep_is_held(l)                  ((l)->locked)
+
+#define atomic_set(v, i)            ((v)->counter = (i))
+#define atomic_read(v)              ((v)->counter)
+#define atomic_inc(v)               ((v)->counter++)
+#define atomic_dec_and_test(v)      (--(v)->counter == 0)
+
+struct rcu_head {
+    void *next;
+};
+
+#define rcu_read_lock()                     do { } while (0)
+#define rcu_read_unlock()                   do { } while (0)
+#define rcu_dereference(p)                  (p)
+#define rcu_dereference_protected(p, c)     (p)
+#define rcu_assign_pointer(p, v)            ((p) = (v))
+#define RCU_INIT_POINTER(p, v)              ((p) = (v))
+#define call_rcu(head, func)                (func)(head)
+#define cond_resched()                      do { } while (0)
+
+typedef struct {
+    int dummy;
+} wait_queue_head_t;
+
+struct work_struct {
+    int dummy;
+};
+
+struct kref {
+    atomic_t refcount;
+};
+
+/* Time */
+
+#define HZ                  100
+#define jiffies             0UL
+
+struct timer_list {
+    unsigned long expires;
+    void (*function)(struct timer_list *);
+};
+
+#define timer_setup(t, fn, fl)      ((t)->function = (fn))
+#define from_timer(var, t, field)   container_of(t, typeof(*var), field)
+#define add_timer(t)                do { } while (0)
+#define del_timer_sync(t)           do { } while (0)
+
+static inline uint64_t
+ktime_get_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void
+get_random_bytes(void *buf, int len)
+{
+    uint8_t *p = buf;
+
+    while (len--) {
+        *p++ = rand();
+    }
+}
+
+/* Hash, Bob Jenkins' lookup3 as in linux/jhash.h */
+
+#define JHASH_INITVAL       0xdeadbeef
+
+static inline uint32_t
+rol32(uint32_t w, unsigned int s)
+{
+    return (w << s) | (w >> ((-s) & 31));
+}
+
+#define __jhash_mix(a, b, c)                    \
+{                                               \
+    a -= c;  a ^= rol32(c, 4);  c += b;         \
+    b -= a;  b ^= rol32(a, 6);  a += c;         \
+    c -= b;  c ^= rol32(b, 8);  b += a;         \
+    a -= c;  a ^= rol32(c, 16); c += b;         \
+    b -= a;  b ^= rol32(a, 19); a += c;         \
+    c -= b;  c ^= rol32(b, 4);  b += a;         \
+}
+
+#define __jhash_final(a, b, c)                  \
+{                                               \
+    c ^= b; c -= rol32(b, 14);                  \
+    a ^= c; a -= rol32(c, 11);                  \
+    b ^= a; b -= rol32(a, 25);                  \
+    c ^= b; c -= rol32(b, 16);                  \
+    a ^= c; a -= rol32(c, 4);                   \
+    b ^= a; b -= rol32(a, 14);                  \
+    c ^= b; c -= rol32(b, 24);                  \
+}
+
+static inline uint32_t
+jhash2(const uint32_t *k, uint32_t length, uint32_t initval)
+{
+    uint32_t a, b, c;
+
+    a = b = c = JHASH_INITVAL + (length << 2) + initval;
+
+    while (length > 3) {
+        a += k[0];
+        b += k[1];
+        c += k[2];
+        __jhash_mix(a, b, c);
+        length -= 3;
+        k += 3;
+    }
+
+    switch (length) {
+    case 3: c += k[2];  /* fall through */
+    case 2: b += k[1];  /* fall through */
+    case 1: a += k[0];
+        __jhash_final(a, b, c);
+        break;
+    case 0:
+        break;
+    }
+
+    return c;
+}
+
+/* Network devices and packets */
+
+#define ETH_ALEN            6
+#define ETH_P_8021Q         0x8100
+#define ETH_P_8021AD        0x88A8
+#define VLAN_HLEN           4
+
+struct device;
+struct pci_dev;
+struct page;
+struct page_pool;
+struct task_struct;
+struct eventfd_ctx;
+
+struct net_device_stats {
+    unsigned long rx_dropped;
+};
+
+struct net_device {
+    char name[16];
+    void *priv;
+};
+
+struct sk_buff {
+    struct net_device *dev;
+    uint8_t *data;
+    unsigned int len;
+    __be16 protocol;
+    char cb[48];
+};
+
+struct sk_buff_head {
+    struct sk_buff *next, *prev;
+};
+
+struct timespec64 {
+    int64_t tv_sec;
+    long tv_nsec;
+};
+
+/* Used by unused helpers in ngknet_linux.h, never called */
+extern struct page *dev_alloc_page(void);
+extern struct sk_buff *build_skb(void *data, unsigned int frag_size);
+extern void eventfd_signal(struct eventfd_ctx *ctx, int n);
+extern void netif_trans_update(struct net_device *dev);
+extern void ktime_get_real_ts64(struct timespec64 *ts);
+extern unsigned long copy_from_user(void *to, const void *from, unsigned long n);
+extern unsigned long copy_to_user(void *to, const void *from, unsigned long n);
+
+#define netdev_priv(ndev)           ((ndev)->priv)
+#define pskb_copy(skb, gfp)         ((struct sk_buff *)NULL)
+#define skb_pull(skb, len)          ((skb)->data += (len))
+
+#endif /* KSHIM_H */
@@ -30,6 +30,15 @@
  * A message-based IOCTL interface is used for managing packet
  * filters and virtual Linux network interfaces.
  *
+ * Packet filters are compiled into hash tables of filters sharing
+ * the same data offsets, sizes and mask, so received packets are
+ * matched with one lookup per table rather than one compare per
+ * filter. Table statistics are shown in /proc/bcm/knet/stats.
+ *
+ * Packet, byte and drop counters are kept per CPU and summed when
+ * read, so the proc statistics and the "bcm_knet_stats" generic
+ * netlink family can be polled without taking the driver lock.
+ *
  * A virtual network interface can be configured to work in RCPU
  * mode, which means that packets from the switch device will
  * be encasulated with a RCPU header and a block of meta data
@@ -45,6 +54,35 @@
  * it can also be changed dynamically through the proc file
  * system (syntax is described in function header comment).
  *
+ * Rx packets can additionally be rate limited per filter and per
+ * destination network interface. A filter limit is applied when the
+ * filter matches, and the interface limit is applied to all packets
+ * sent to the interface by any filter. The limits are set through
+ * KCOM messages or /proc/bcm/knet/rate_limit.
+ *
+ * With the rx_page_pool module parameter, Rx DMA buffers are pages
+ * from a per-channel page pool which stay DMA mapped and are
+ * recycled when the network stack frees the packet.
+ *
+ * Netif Tx prepares packets and DCBs without holding the driver lock,
+ * which is only taken to reserve and fill a Tx DCB. In Continuous DMA
+ * mode the Tx DMA is restarted once per batch of packets sent by the
+ * network stack with xmit_more (see the tx_batch module parameter).
+ *
+ * With the rx_chan_napi module parameter, Rx packets are delivered to
+ * the network stack by one NAPI instance per Rx DMA channel, and the
+ * network interfaces get one Rx queue per channel. Channels can then
+ * be spread over CPUs with threaded NAPI or RPS, and
+ * /proc/bcm/knet/rx_bench measures the delivery path.
+ *
+ * Packets for the Rx API can instead be copied to a ring shared with
+ * user space, which is set up with the BKN_IOCTL_RX_RING ioctl and
+ * mmap() on the KNET device (see bkn_rx_ring_hdr_t). The consumer
+ * then reads packets without DMA event ioctls, and it is only woken
+ * through an eventfd when it asks for it. A reference consumer which
+ * also reports packet rate and CPU time per packet is provided in
+ * tools/bkn-rx-ring.c.
+ *
  * To support multiple instance, each instance has its event queue.
  *
  * To support pci hot-plug in this module, the resource update
@@ -67,6 +105,33 @@
 #include <linux/seq_file.h>
 #include <linux/if_vlan.h>
 #include <linux/nsproxy.h>
+#include <linux/jhash.h>
+#include <linux/percpu.h>
+#include <linux/rculist.h>
+#include <linux/u64_stats_sync.h>
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,10,0))
+#include <net/genetlink.h>
+#define BKN_STATS_GENL_SUPPORT
+#endif
+#if defined(LINUX_BDE_DMA_DEVICE_SUPPORT) && \
+    (LINUX_VERSION_CODE >= KERNEL_VERSION(6,1,0))
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6,6,0))
+#include <net/page_pool/helpers.h>
+#else
+#include <net/page_pool.h>
+#endif
+#define BKN_PAGE_POOL_SUPPORT
+#endif
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,31))
+#include <linux/eventfd.h>
+#include <linux/vmalloc.h>
+#define BKN_RX_RING_SUPPORT
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6,8,0))
+#define BKN_EVENTFD_SIGNAL(_ctx) eventfd_signal(_ctx)
+#else
+#define BKN_EVENTFD_SIGNAL(_ctx) eventfd_signal(_ctx, 1)
+#endif
+#endif
 
 
 MODULE_AUTHOR("Broadcom Corporation");
@@ -88,6 +153,11 @@ LKM_MOD_PARAM(rx_buffer_size, "i", int, 0);
 MODULE_PARM_DESC(rx_buffer_size,
 "Size of RX packet buffers (default 9216)");
 
+static int rx_page_pool = 0;
+LKM_MOD_PARAM(rx_page_pool, "i", int, 0);
+MODULE_PARM_DESC(rx_page_pool,
+"Use recycled page pool buffers for Rx DMA (default 0)");
+
 static int default_mtu = 1500;
 LKM_MOD_PARAM(default_mtu, "i", int, 0);
 MODULE_PARM_DESC(default_mtu,
@@ -202,6 +272,24 @@ LKM_MOD_PARAM(ft_vid, "i", int, 0);
 MODULE_PARM_DESC(ft_vid,
 "VLAN ID (VID) indicates the VLAN to which a frame belongs (default 0)");
 
+static int filter_cls = 1;
+LKM_MOD_PARAM(filter_cls, "i", int, 0);
+MODULE_PARM_DESC(filter_cls,
+"Match Rx packets with compiled filter hash tables instead of "
+"walking the filter list (default 1)");
+
+static int tx_batch = 32;
+LKM_MOD_PARAM(tx_batch, "i", int, 0);
+MODULE_PARM_DESC(tx_batch,
+"Maximum number of Tx packets queued by the network stack with xmit_more "
+"before the Tx DMA is started, 0 starts it per packet (default 32)");
+
+static int filter_selftest = 0;
+LKM_MOD_PARAM(filter_selftest, "i", int, 0);
+MODULE_PARM_DESC(filter_selftest,
+"Replay synthetic packets against a synthetic filter set on module load "
+"and compare compiled and linear filter matching (default 0)");
+
 /* Debug levels */
 #define DBG_LVL_VERB    0x1
 #define DBG_LVL_DCB     0x2
@@ -274,6 +362,18 @@ LKM_MOD_PARAM(napi_weight, "i", int, 0);
 MODULE_PARM_DESC(napi_weight,
 "Weight of NAPI interfaces (default 64)");
 
+static int rx_batch = 0;
+LKM_MOD_PARAM(rx_batch, "i", int, 0);
+MODULE_PARM_DESC(rx_batch,
+"Deliver Rx packets to the network stack once per NAPI poll instead of "
+"per packet: 0 per packet, 1 batched, 2 batched with GRO (default 0)");
+
+static int rx_chan_napi = 0;
+LKM_MOD_PARAM(rx_chan_napi, "i", int, 0);
+MODULE_PARM_DESC(rx_chan_napi,
+"Deliver Rx packets through one NAPI instance per Rx DMA channel, "
+"implies batched delivery (default 0)");
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,24)
 #define bkn_napi_enable(_dev, _napi) netif_poll_enable(_dev)
 #define bkn_napi_disable(_dev, _napi) netif_poll_disable(_dev)
@@ -294,6 +394,8 @@ MODULE_PARM_DESC(napi_weight,
 
 static int use_napi = 0;
 static int napi_weight = 0;
+static int rx_batch = 0;
+static int rx_chan_napi = 0;
 
 #define bkn_napi_enable(_dev, _napi)
 #define bkn_napi_disable(_dev, _napi)
@@ -312,6 +414,36 @@ static int napi_weight = 0;
 #define NETDEV_UPDATE_TRANS_START_TIME(dev) netif_trans_update(dev)
 #endif
 
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(3,13,0))
+#define u64_stats_init(_syncp)
+#endif
+
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(5,0,0))
+static inline unsigned long
+bkn_u64_stats_update_begin_irqsave(struct u64_stats_sync *syncp)
+{
+    unsigned long flags = 0;
+
+#if BITS_PER_LONG == 32
+    local_irq_save(flags);
+    u64_stats_update_begin(syncp);
+#endif
+    return flags;
+}
+
+static inline void
+bkn_u64_stats_update_end_irqrestore(struct u64_stats_sync *syncp,
+                                    unsigned long flags)
+{
+#if BITS_PER_LONG == 32
+    u64_stats_update_end(syncp);
+    local_irq_restore(flags);
+#endif
+}
+#define u64_stats_update_begin_irqsave bkn_u64_stats_update_begin_irqsave
+#define u64_stats_update_end_irqrestore bkn_u64_stats_update_end_irqrestore
+#endif
+
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(2,6,24))
 #define skb_copy_to_linear_data(_skb, _pkt, _len) \
     eth_copy_and_sum(_skb, _pkt, _len, 0)
@@ -509,6 +641,15 @@ static inline void bkn_skb_tx_timestamp(struct sk_buff *skb)
 #define BKN_NETDEV_TX_BUSY      1
 #endif
 
+/* More Tx packets will follow from the network stack */
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5,2,0))
+#define BKN_XMIT_MORE(_skb)     netdev_xmit_more()
+#elif (LINUX_VERSION_CODE >= KERNEL_VERSION(3,18,0))
+#define BKN_XMIT_MORE(_skb)     ((_skb)->xmit_more)
+#else
+#define BKN_XMIT_MORE(_skb)     0
+#endif
+
 /*
  * Get a 16-bit value from packet offset
  * _data Pointer to packet
@@ -535,6 +676,9 @@ static inline void bkn_skb_tx_timestamp(struct sk_buff *skb)
 
 #define PKT_TX_HDR_SIZE         16
 
+/* Largest DCB size supported by KCOM_M_HW_INIT (8-bit size in bytes) */
+#define BKN_DCB_WSIZE_MAX       64
+
 static volatile int module_initialized;
 
 static ibde_t *kernel_bde = NULL;
@@ -546,6 +690,7 @@ typedef struct bkn_desc_info_s {
     struct sk_buff *skb;
     uint64_t skb_dma;
     uint32_t dma_size;
+    struct page *page;          /* Rx buffer from page pool */
 } bkn_desc_info_t;
 
 /* DCB chain info */
@@ -568,6 +713,41 @@ typedef struct bkn_dcb_chain_s {
 #define FCS_SZ 4
 #define TAG_SZ 4
 
+/* Index of device counters, packet counters are followed by byte counters */
+#define BKN_STATS_TX(_idx)          (_idx)
+#define BKN_STATS_RX(_chan, _idx)   \
+    (BKN_TX_STATS_MAX + (_chan) * BKN_RX_STATS_MAX + (_idx))
+#define BKN_STATS_MAX               BKN_STATS_RX(NUM_RX_CHAN, 0)
+
+/* Device counters of one CPU */
+typedef struct bkn_pcpu_stats_s {
+    struct u64_stats_sync syncp;
+    u64 cnt[BKN_STATS_MAX];
+} bkn_pcpu_stats_t;
+
+/* Rx packets waiting for delivery above one Rx DMA channel */
+#define BKN_RX_NAPI_BACKLOG     (MAX_RX_DCBS * 16)
+
+/* Per-channel Rx delivery, used when rx_chan_napi is set */
+typedef struct bkn_rx_napi_s {
+    struct napi_struct napi;
+    struct sk_buff_head queue;  /* Rx skbs waiting for delivery */
+    struct bkn_switch_info_s *sinfo;
+    int chan;
+} bkn_rx_napi_t;
+
+/* Rx ring shared with user space (see bkn_rx_ring_hdr_t) */
+typedef struct bkn_rx_ring_s {
+    bkn_rx_ring_hdr_t *hdr;     /* Start of vmalloc_user memory */
+    bkn_rx_ring_desc_t *desc;   /* Slot descriptors */
+    uint8_t *buf;               /* Slot packet buffers */
+    uint32_t size;              /* Size of shared memory */
+    uint32_t slots;             /* Number of slots (power of 2) */
+    uint32_t slot_size;         /* Size of slot packet buffer */
+    uint32_t head;              /* Producer index (kernel copy) */
+    struct eventfd_ctx *efd;    /* Consumer notification */
+} bkn_rx_ring_t;
+
 /* Device control info */
 typedef struct bkn_switch_info_s {
     struct list_head list;
@@ -575,6 +755,8 @@ typedef struct bkn_switch_info_s {
     struct net_device **ndevs;  /* Indexed array of ndev_list */
     int ndev_max;               /* Size of indexed array */
     struct list_head rxpf_list; /* Associated Rx packet filters */
+    struct bkn_filter_cls_s *rxpf_cls; /* Compiled Rx packet filters */
+    bkn_rx_ring_t *rx_ring;     /* Rx API packets shared with user space */
     volatile void *base_addr;   /* Base address for PCI register access */
     struct BKN_DMA_DEV *dma_dev;    /* Required for DMA memory control */
     struct pci_dev *pdev;       /* Required for DMA memory control */
@@ -615,6 +797,7 @@ typedef struct bkn_switch_info_s {
     uint32_t napi_poll_mode;    /* NAPI is in polling mode */
     uint32_t napi_not_done;     /* NAPI poll did not process all packets */
     uint32_t napi_poll_again;   /* Used if DCB chain is restarted */
+    int rx_batching;            /* Rx skbs are queued for batched delivery */
     uint32_t tx_yield;          /* Tx schedule for Continuous DMA and Non-NAPI
                                    mode. */
     void *dcb_mem;              /* Logical pointer to DCB memory */
@@ -638,19 +821,11 @@ typedef struct bkn_switch_info_s {
         int dirty;              /* Index of next Tx DCB to complete */
         int api_active;         /* BCM Tx API is in progress */
         int suspends;           /* Calls to netif_stop_queue (debug only) */
+        int reserved;           /* Free Tx DCBs reserved by netif Tx */
+        int db_pending;         /* Tx DCBs added since last DMA doorbell */
         struct list_head api_dcb_list; /* Tx DCB chains from BCM Tx API */
         bkn_dcb_chain_t *api_dcb_chain; /* Current Tx DCB chain */
         bkn_dcb_chain_t *api_dcb_chain_end; /* Tx DCB chain end */
-        uint32_t pkts;              /* Tx packet counter */
-        uint32_t pkts_d_no_skb;     /* Tx drop - skb allocation failed */
-        uint32_t pkts_d_rcpu_encap; /* Tx drop - bad RCPU encapsulation */
-        uint32_t pkts_d_rcpu_sig;   /* Tx drop - bad RCPU signature */
-        uint32_t pkts_d_rcpu_meta;  /* Tx drop - bad RCPU meta data */
-        uint32_t pkts_d_pad_fail;   /* Tx drop - pad to minimum size failed */
-        uint32_t pkts_d_dma_resrc;  /* Tx drop - no DMA resources */
-        uint32_t pkts_d_callback;   /* Tx drop - consumed by call-back */
-        uint32_t pkts_d_no_link;    /* Tx drop - software link down */
-        uint32_t pkts_d_over_limit; /* Tx drop - length is out of range */
     } tx;
     struct {
         bkn_desc_info_t desc[MAX_RX_DCBS+1];
@@ -673,20 +848,23 @@ typedef struct bkn_switch_info_s {
         struct list_head api_dcb_list; /* Rx DCB chains from BCM Rx API */
         bkn_dcb_chain_t *api_dcb_chain; /* Current Rx DCB chain */
         bkn_dcb_chain_t *api_dcb_chain_end; /* Rx DCB chain end */
-        uint32_t pkts;              /* Rx packet counter */
-        uint32_t pkts_ref;          /* Rx packet count for rate calculation */
-        uint32_t pkts_f_api;        /* Rx packets filtered to API */
-        uint32_t pkts_f_netif;      /* Rx packets filtered to net interface */
-        uint32_t pkts_m_api;        /* Rx packets mirrored to API */
-        uint32_t pkts_m_netif;      /* Rx packets mirrored to net interface */
-        uint32_t pkts_d_no_skb;     /* Rx drop - skb allocation failed */
-        uint32_t pkts_d_no_match;   /* Rx drop - no matching filters */
-        uint32_t pkts_d_unkn_netif; /* Rx drop - unknown net interface ID */
-        uint32_t pkts_d_unkn_dest;  /* Rx drop - unknown destination type */
-        uint32_t pkts_d_callback;   /* Rx drop - consumed by call-back */
-        uint32_t pkts_d_no_link;    /* Rx drop - software link down */
-        uint32_t pkts_d_no_api_buf; /* Rx drop - no API buffers */
+        u64 pkts_ref;           /* Rx packet count for rate calculation */
+        struct sk_buff_head batch; /* Rx skbs pending batched delivery */
+        bkn_rx_napi_t rxn;      /* Channel NAPI for Rx delivery */
+#ifdef BKN_PAGE_POOL_SUPPORT
+        struct page_pool *page_pool; /* Rx buffers when rx_page_pool is set */
+#endif
     } rx[NUM_RX_CHAN];
+    bkn_pcpu_stats_t __percpu *stats; /* Tx/Rx counters */
+    u64 stats_base[BKN_STATS_MAX]; /* Counter values at last clear */
+    spinlock_t stats_lock;      /* Protects counter values at last clear */
+    struct {
+        int netif;              /* Net interface receiving injected packets */
+        int chan;               /* Rx queue of injected packets */
+        int size;               /* Injected packet size */
+        u64 pkts;               /* Packets injected */
+        u64 ns;                 /* Time until packets were delivered */
+    } rx_bench;                 /* Last Rx delivery benchmark */
 } bkn_switch_info_t;
 
 #define INVALID_INSTANCE_ID         BDE_DEV_INST_ID_INVALID
@@ -945,6 +1123,24 @@ static u8 bkn_rcpu_smac[6];
 /* Driver Proc Entry root */
 static struct proc_dir_entry *bkn_proc_root = NULL;
 
+/*
+ * Rx rate limit token bucket
+ *
+ * Tokens are added when a packet is checked based on the jiffies
+ * elapsed since the last check, so no timer is needed. One packet
+ * costs HZ tokens, which keeps low rates accurate. Buckets are
+ * updated under the driver lock.
+ */
+#define BKN_RATE_TICKS_MAX          (64 * HZ)
+
+typedef struct bkn_rate_s {
+    uint32_t rate_max;              /* Packets per second (0 = no limit) */
+    uint32_t burst_max;             /* Bucket size in packets */
+    u64 tokens;                     /* Packets allowed, times HZ */
+    unsigned long tok_jif;          /* Jiffies at last token update */
+    u64 drops;                      /* Packets dropped by this limit */
+} bkn_rate_t;
+
 typedef struct bkn_priv_s {
     struct list_head list;
     struct net_device_stats stats;
@@ -965,15 +1161,248 @@ typedef struct bkn_priv_s {
     u32 ptp_stats_tx;
     u32 ptp_stats_rx;
     struct ethtool_link_settings link_settings;
+    struct {
+        u64 pkts;
+        u64 bytes;
+    } rxq_stats[NUM_RX_CHAN];   /* Rx counters per Rx DMA channel */
+    bkn_rate_t rate;            /* Rx rate limit */
 } bkn_priv_t;
 
+/* Filter counters of one CPU */
+typedef struct bkn_filter_stats_s {
+    struct u64_stats_sync syncp;
+    u64 pkts;
+    u64 bytes;
+} bkn_filter_stats_t;
+
 typedef struct bkn_filter_s {
     struct list_head list;
     int dev_no;
-    unsigned long hits;
+    bkn_filter_stats_t __percpu *stats; /* Hits and matched bytes */
+    u64 pkts_base;                  /* Hits at last clear */
+    u64 bytes_base;                 /* Matched bytes at last clear */
+    struct rcu_head rcu;            /* Deferred free for lockless readers */
     kcom_filter_t kf;
+    bkn_rate_t rate;                /* Rx rate limit */
+    /* Filter classifier, valid while filter is part of compiled filters */
+    int order;                      /* Position in rxpf_list */
+    uint32_t key_hash;              /* Hash of masked filter data */
+    struct bkn_filter_s *tuple_next;/* Next key in hash bucket */
+    struct bkn_filter_s *key_next;  /* Next filter with same key */
 } bkn_filter_t;
 
+/*
+ * Rx filter classifier
+ *
+ * Filters using the same data offsets, sizes and mask form a tuple.
+ * Each tuple is a hash table keyed by the masked filter data, so a
+ * packet is matched against a tuple with one key extraction and one
+ * hash lookup. Tuples are searched in priority order of their first
+ * filter, and search stops when no remaining filter can precede the
+ * best match found so far. Filters which don't fit a tuple are
+ * matched linearly as before.
+ */
+#define BKN_FILTER_TUPLE_MAX        32
+#define BKN_FILTER_HASH_SIZE        64
+
+typedef struct bkn_filter_tuple_s {
+    uint16_t oob_data_offset;
+    uint16_t oob_data_size;
+    uint16_t pkt_data_offset;
+    uint16_t pkt_data_size;
+    int wsize;                      /* Key size (in 32-bit words) */
+    int min_order;                  /* Order of first filter in tuple */
+    int filters;                    /* Number of filters in tuple */
+    uint32_t mask[KCOM_FILTER_WORDS_MAX];
+    bkn_filter_t *bucket[BKN_FILTER_HASH_SIZE];
+    unsigned long lookups;          /* Packets looked up in tuple */
+    unsigned long hits;             /* Lookups finding a key */
+    unsigned long matches;          /* Packets matched by tuple */
+} bkn_filter_tuple_t;
+
+typedef struct bkn_filter_cls_s {
+    int num_tuples;
+    bkn_filter_tuple_t *tuples[BKN_FILTER_TUPLE_MAX]; /* Sorted by min_order */
+    int num_linear;
+    bkn_filter_t **linear;          /* Unusual filters, sorted by order */
+    unsigned long linear_checks;    /* Linear filters compared */
+    unsigned long linear_matches;   /* Packets matched by linear filters */
+} bkn_filter_cls_t;
+
+/*
+ * Per-CPU counters
+ *
+ * Counters are updated by the local CPU only, so the datapath needs
+ * no atomic operations, and they are read without the driver lock by
+ * summing the values of all CPUs. Clearing a counter records its
+ * current value, which is subtracted from later reads.
+ *
+ * The same counters are updated from interrupt, softirq and process
+ * context, so an update must not be interrupted by another one on the
+ * same CPU, or the u64_stats sequence of 32-bit hosts breaks.
+ */
+static inline void
+bkn_stats_add(bkn_switch_info_t *sinfo, int cnt, u64 val)
+{
+    bkn_pcpu_stats_t *pcpu = get_cpu_ptr(sinfo->stats);
+    unsigned long flags;
+
+    flags = u64_stats_update_begin_irqsave(&pcpu->syncp);
+    pcpu->cnt[cnt] += val;
+    u64_stats_update_end_irqrestore(&pcpu->syncp, flags);
+    put_cpu_ptr(sinfo->stats);
+}
+
+/* Count packet and bytes, cnt is the index of a packet counter */
+static inline void
+bkn_stats_pkt(bkn_switch_info_t *sinfo, int cnt, int pktlen)
+{
+    bkn_pcpu_stats_t *pcpu = get_cpu_ptr(sinfo->stats);
+    unsigned long flags;
+
+    flags = u64_stats_update_begin_irqsave(&pcpu->syncp);
+    pcpu->cnt[cnt]++;
+    pcpu->cnt[cnt + 1] += pktlen;
+    u64_stats_update_end_irqrestore(&pcpu->syncp, flags);
+    put_cpu_ptr(sinfo->stats);
+}
+
+static u64
+bkn_stats_sum(bkn_switch_info_t *sinfo, int cnt)
+{
+    bkn_pcpu_stats_t *pcpu;
+    unsigned int start;
+    u64 sum = 0, val;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        pcpu = per_cpu_ptr(sinfo->stats, cpu);
+        do {
+            start = u64_stats_fetch_begin(&pcpu->syncp);
+            val = pcpu->cnt[cnt];
+        } while (u64_stats_fetch_retry(&pcpu->syncp, start));
+        sum += val;
+    }
+    return sum;
+}
+
+/* Counter value since last clear */
+static u64
+bkn_stats_get(bkn_switch_info_t *sinfo, int cnt)
+{
+    u64 val = bkn_stats_sum(sinfo, cnt);
+
+    spin_lock(&sinfo->stats_lock);
+    val -= sinfo->stats_base[cnt];
+    spin_unlock(&sinfo->stats_lock);
+    return val;
+}
+
+static void
+bkn_stats_clear(bkn_switch_info_t *sinfo, int cnt)
+{
+    u64 val = bkn_stats_sum(sinfo, cnt);
+
+    spin_lock(&sinfo->stats_lock);
+    sinfo->stats_base[cnt] = val;
+    spin_unlock(&sinfo->stats_lock);
+}
+
+static inline void
+bkn_filter_stats_add(bkn_filter_t *filter, int pktlen)
+{
+    bkn_filter_stats_t *pcpu = get_cpu_ptr(filter->stats);
+    unsigned long flags;
+
+    flags = u64_stats_update_begin_irqsave(&pcpu->syncp);
+    pcpu->pkts++;
+    pcpu->bytes += pktlen;
+    u64_stats_update_end_irqrestore(&pcpu->syncp, flags);
+    put_cpu_ptr(filter->stats);
+}
+
+static void
+bkn_filter_stats_sum(bkn_filter_t *filter, u64 *pkts, u64 *bytes)
+{
+    bkn_filter_stats_t *pcpu;
+    unsigned int start;
+    u64 p, b;
+    int cpu;
+
+    *pkts = 0;
+    *bytes = 0;
+    for_each_possible_cpu(cpu) {
+        pcpu = per_cpu_ptr(filter->stats, cpu);
+        do {
+            start = u64_stats_fetch_begin(&pcpu->syncp);
+            p = pcpu->pkts;
+            b = pcpu->bytes;
+        } while (u64_stats_fetch_retry(&pcpu->syncp, start));
+        *pkts += p;
+        *bytes += b;
+    }
+}
+
+/* Filter hits and matched bytes since last clear */
+static void
+bkn_filter_stats_get(bkn_switch_info_t *sinfo, bkn_filter_t *filter,
+                     u64 *pkts, u64 *bytes)
+{
+    bkn_filter_stats_sum(filter, pkts, bytes);
+
+    spin_lock(&sinfo->stats_lock);
+    *pkts -= filter->pkts_base;
+    *bytes -= filter->bytes_base;
+    spin_unlock(&sinfo->stats_lock);
+}
+
+static void
+bkn_filter_stats_clear(bkn_switch_info_t *sinfo, bkn_filter_t *filter)
+{
+    u64 pkts, bytes;
+
+    bkn_filter_stats_sum(filter, &pkts, &bytes);
+
+    spin_lock(&sinfo->stats_lock);
+    filter->pkts_base = pkts;
+    filter->bytes_base = bytes;
+    spin_unlock(&sinfo->stats_lock);
+}
+
+static bkn_filter_t *
+bkn_filter_alloc(void)
+{
+    bkn_filter_t *filter;
+    int cpu;
+
+    filter = kzalloc(sizeof(*filter), GFP_KERNEL);
+    if (filter == NULL) {
+        return NULL;
+    }
+    filter->stats = alloc_percpu(bkn_filter_stats_t);
+    if (filter->stats == NULL) {
+        kfree(filter);
+        return NULL;
+    }
+    for_each_possible_cpu(cpu) {
+        u64_stats_init(&per_cpu_ptr(filter->stats, cpu)->syncp);
+    }
+    return filter;
+}
+
+static void
+bkn_filter_free(bkn_filter_t *filter)
+{
+    free_percpu(filter->stats);
+    kfree(filter);
+}
+
+static void
+bkn_filter_free_rcu(struct rcu_head *rcu)
+{
+    bkn_filter_free(container_of(rcu, bkn_filter_t, rcu));
+}
+
 
 /*
  * Multiple instance support in KNET
@@ -1895,6 +2324,164 @@ bkn_free_dcbs(bkn_switch_info_t *sinfo)
     }
 }
 
+#ifdef BKN_PAGE_POOL_SUPPORT
+/*
+ * Page pool Rx buffers.
+ *
+ * The pool keeps its pages DMA mapped, so Rx DCBs are refilled without
+ * mapping and completed without unmapping. The skb is built around the
+ * page once the packet has arrived, and pages released by the network
+ * stack go back to the pool instead of the page allocator.
+ */
+#define BKN_RX_POOL_HEADROOM \
+    (NET_SKB_PAD + SKB_DATA_ALIGN(RCPU_RX_ENCAP_SIZE))
+#define BKN_RX_POOL_BUF_SIZE \
+    (BKN_RX_POOL_HEADROOM + \
+     SKB_DATA_ALIGN(rx_buffer_size + RCPU_RX_META_SIZE) + \
+     SKB_DATA_ALIGN(sizeof(struct skb_shared_info)))
+
+static void
+bkn_rx_pool_create(bkn_switch_info_t *sinfo)
+{
+    struct page_pool_params pp;
+    struct page_pool *pool;
+    int chan;
+
+    if (!rx_page_pool || sinfo->dma_dev == NULL) {
+        return;
+    }
+#ifdef KNET_NO_AXI_DMA_INVAL
+    if (sinfo->pdev == NULL) {
+        /* Rx buffers are not invalidated, see bkn_rx_skb_fill */
+        return;
+    }
+#endif
+
+    memset(&pp, 0, sizeof(pp));
+    pp.flags = PP_FLAG_DMA_MAP | PP_FLAG_DMA_SYNC_DEV;
+    pp.order = get_order(BKN_RX_POOL_BUF_SIZE);
+    pp.pool_size = MAX_RX_DCBS * 2;
+    pp.nid = NUMA_NO_NODE;
+    pp.dev = sinfo->dma_dev;
+    pp.dma_dir = DMA_FROM_DEVICE;
+    pp.offset = BKN_RX_POOL_HEADROOM;
+    pp.max_len = rx_buffer_size + RCPU_RX_META_SIZE;
+
+    for (chan = 0; chan < NUM_RX_CHAN; chan++) {
+        if (sinfo->rx[chan].page_pool) {
+            continue;
+        }
+        /*
+         * DCBs are filled per descriptor type, so a pool may appear
+         * while the channel still holds SKB buffers.
+         */
+        pool = page_pool_create(&pp);
+        if (IS_ERR(pool)) {
+            /* Channel keeps using SKB Rx buffers */
+            gprintk("Unable to create Rx%d page pool (%ld)\n",
+                    chan, PTR_ERR(pool));
+            continue;
+        }
+        sinfo->rx[chan].page_pool = pool;
+    }
+}
+
+static void
+bkn_rx_pool_release(bkn_switch_info_t *sinfo, int chan, bkn_desc_info_t *desc)
+{
+    if (desc->page != NULL) {
+        page_pool_put_full_page(sinfo->rx[chan].page_pool, desc->page, false);
+        desc->page = NULL;
+        desc->skb_dma = 0;
+    }
+}
+
+static void
+bkn_rx_pool_destroy(bkn_switch_info_t *sinfo)
+{
+    bkn_desc_info_t *desc;
+    int chan, idx;
+
+    for (chan = 0; chan < NUM_RX_CHAN; chan++) {
+        if (sinfo->rx[chan].page_pool == NULL) {
+            continue;
+        }
+        /* Release buffers of completed DCBs which were not refilled */
+        for (idx = 0; idx < MAX_RX_DCBS; idx++) {
+            desc = &sinfo->rx[chan].desc[idx];
+            if (desc->skb != NULL) {
+                dev_kfree_skb_any(desc->skb);
+                desc->skb = NULL;
+            }
+            bkn_rx_pool_release(sinfo, chan, desc);
+        }
+        page_pool_destroy(sinfo->rx[chan].page_pool);
+        sinfo->rx[chan].page_pool = NULL;
+    }
+}
+
+static int
+bkn_rx_pool_fill(bkn_switch_info_t *sinfo, int chan, bkn_desc_info_t *desc,
+                 uint32_t dma_size)
+{
+    struct page *page;
+
+    if (desc->skb != NULL) {
+        /* Packet was not passed on, so the skb returns its page to the pool */
+        dev_kfree_skb_any(desc->skb);
+        desc->skb = NULL;
+    }
+    if (desc->page == NULL) {
+        page = page_pool_dev_alloc_pages(sinfo->rx[chan].page_pool);
+        if (page == NULL) {
+            bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_POOL_NO_PAGE), 1);
+            return -1;
+        }
+        bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_POOL_ALLOC), 1);
+        desc->page = page;
+        desc->skb_dma = page_pool_get_dma_addr(page) + BKN_RX_POOL_HEADROOM;
+    } else {
+        /* Page kept by a failed skb build is handed back to the device */
+        dma_sync_single_for_device(sinfo->dma_dev, desc->skb_dma,
+                                   desc->dma_size, DMA_FROM_DEVICE);
+    }
+    desc->dma_size = dma_size;
+    return 0;
+}
+
+static struct sk_buff *
+bkn_rx_pool_build_skb(bkn_switch_info_t *sinfo, int chan, bkn_desc_info_t *desc)
+{
+    struct page_pool *pool = sinfo->rx[chan].page_pool;
+    void *data = page_address(desc->page);
+    unsigned int truesize = PAGE_SIZE << pool->p.order;
+    struct sk_buff *skb;
+
+    dma_sync_single_for_cpu(sinfo->dma_dev, desc->skb_dma, desc->dma_size,
+                            page_pool_get_dma_dir(pool));
+    if (in_serving_softirq() && !in_hardirq()) {
+        /* NAPI poll or Rx tick, use the per-CPU skb cache */
+        skb = napi_build_skb(data, truesize);
+    } else {
+        skb = build_skb(data, truesize);
+    }
+    if (skb == NULL) {
+        /* The page stays with the DCB */
+        bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_NO_SKB), 1);
+        return NULL;
+    }
+    skb_reserve(skb, BKN_RX_POOL_HEADROOM);
+    skb_mark_for_recycle(skb);
+    desc->page = NULL;
+    desc->skb = skb;
+    return skb;
+}
+#else
+#define bkn_rx_pool_create(_sinfo)
+#define bkn_rx_pool_release(_sinfo, _chan, _desc)
+#define bkn_rx_pool_destroy(_sinfo)
+#endif
+
 static void
 bkn_clean_tx_dcbs(bkn_switch_info_t *sinfo)
 {
@@ -1943,6 +2530,7 @@ bkn_clean_rx_dcbs(bkn_switch_info_t *sinfo, int chan)
             dev_kfree_skb_any(desc->skb);
             desc->skb = NULL;
         }
+        bkn_rx_pool_release(sinfo, chan, desc);
         if (++sinfo->rx[chan].dirty >= MAX_RX_DCBS) {
             sinfo->rx[chan].dirty = 0;
         }
@@ -2009,6 +2597,7 @@ bkn_init_dcbs(bkn_switch_info_t *sinfo)
     sinfo->halt_addr[XGS_DMA_TX_CHAN] = sinfo->tx.desc[0].dcb_dma;
     sinfo->tx.free = MAX_TX_DCBS;
     sinfo->tx.cur = 0;
+    sinfo->tx.db_pending = 0;
     sinfo->tx.dirty = 0;
 
     DBG_DCB_TX(("Tx DCBs @ 0x%08x.\n",
@@ -2189,57 +2778,234 @@ bkn_api_rx_chain_done(bkn_switch_info_t *sinfo, int chan)
     bkn_api_rx_restart(sinfo, chan);
 }
 
-static int
-bkn_api_rx_copy_from_skb(bkn_switch_info_t *sinfo,
-                         int chan, bkn_desc_info_t *desc, int rx_hwts)
+#ifdef BKN_RX_RING_SUPPORT
+
+#define BKN_RX_RING_SLOTS_MAX       32768
+#define BKN_RX_RING_SLOT_SIZE_MAX   16384
+
+/* Serializes shared Rx ring create/destroy against mmap */
+static DEFINE_MUTEX(bkn_rx_ring_mutex);
+
+static void
+bkn_rx_ring_free(bkn_rx_ring_t *ring)
 {
-    bkn_dcb_chain_t *dcb_chain;
-    uint32_t *dcb;
-    uint32_t dcb_stat;
-    uint8_t *pkt;
-    uint8_t *skb_pkt;
-    uint64_t pkt_dma;
-    int pktlen;
-    int i;
-    bkn_evt_resource_t *evt;
+    if (ring->efd) {
+        eventfd_ctx_put(ring->efd);
+    }
+    /* Pages stay allocated until user space unmaps them */
+    vfree(ring->hdr);
+    kfree(ring);
+}
 
-    dcb_stat = desc->dcb_mem[sinfo->dcb_wsize-1];
-    pktlen = dcb_stat & SOC_DCB_KNET_COUNT_MASK;
+static int
+bkn_rx_ring_create(bkn_switch_info_t *sinfo, bkn_rx_ring_cfg_t *cfg)
+{
+    bkn_rx_ring_t *ring;
+    uint32_t desc_offset;
+    uint32_t buf_offset;
+    uint32_t slot_size;
+    unsigned long flags;
 
-    dcb_chain = sinfo->rx[chan].api_dcb_chain;
-    if (CDMA_CH(sinfo, XGS_DMA_RX_CHAN + chan) && dcb_chain == NULL) {
-        /* Last chain done, try to get a new one */
-        bkn_api_rx_chain_done(sinfo, chan);
-        dcb_chain = sinfo->rx[chan].api_dcb_chain;
+    if ((cfg->slots & (cfg->slots - 1)) != 0 ||
+        cfg->slots > BKN_RX_RING_SLOTS_MAX ||
+        cfg->slot_size < ETH_ZLEN ||
+        cfg->slot_size > BKN_RX_RING_SLOT_SIZE_MAX) {
+        return -EINVAL;
     }
-    if (dcb_chain == NULL) {
-        DBG_WARN(("No Rx API buffers\n"));
-        sinfo->rx[chan].pkts_d_no_api_buf++;
-        return -1;
+    slot_size = ALIGN(cfg->slot_size, SMP_CACHE_BYTES);
+    desc_offset = ALIGN(sizeof(bkn_rx_ring_hdr_t), SMP_CACHE_BYTES);
+    buf_offset = PAGE_ALIGN(desc_offset +
+                            cfg->slots * sizeof(bkn_rx_ring_desc_t));
+
+    ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+    if (ring == NULL) {
+        return -ENOMEM;
     }
-    dcb = &dcb_chain->dcb_mem[dcb_chain->dcb_cur * sinfo->dcb_wsize];
-    if ((sinfo->cmic_type == 'x' && (dcb[2] & 0xffff) < pktlen) ||
-        (sinfo->cmic_type != 'x' && (dcb[1] & 0xffff) < pktlen)) {
-        DBG_WARN(("Rx API buffer too small\n"));
-        return -1;
+    ring->slots = cfg->slots;
+    ring->slot_size = slot_size;
+    ring->size = PAGE_ALIGN(buf_offset + cfg->slots * slot_size);
+    ring->hdr = vmalloc_user(ring->size);
+    if (ring->hdr == NULL) {
+        kfree(ring);
+        return -ENOMEM;
     }
-    if (sinfo->cmic_type == 'x') {
-        pkt_dma = BUS_TO_DMA_HI(dcb[1]);
-        pkt_dma = pkt_dma << 32 | dcb[0];
-    } else {
-        pkt_dma = dcb[0];
+    ring->desc = (bkn_rx_ring_desc_t *)((uint8_t *)ring->hdr + desc_offset);
+    ring->buf = (uint8_t *)ring->hdr + buf_offset;
+    if (cfg->eventfd >= 0) {
+        ring->efd = eventfd_ctx_fdget(cfg->eventfd);
+        if (IS_ERR(ring->efd)) {
+            ring->efd = NULL;
+            bkn_rx_ring_free(ring);
+            return -EBADF;
+        }
     }
-    pkt = (uint8_t *)kernel_bde->p2l(sinfo->dev_no, (sal_paddr_t)pkt_dma);
-    if (pkt == NULL) {
-        DBG_WARN(("Invalid Rx API buffer\n"));
-        return -1;
+
+    ring->hdr->magic = BKN_RX_RING_MAGIC;
+    ring->hdr->version = BKN_RX_RING_VERSION;
+    ring->hdr->slots = ring->slots;
+    ring->hdr->slot_size = ring->slot_size;
+    ring->hdr->desc_offset = desc_offset;
+    ring->hdr->buf_offset = buf_offset;
+
+    spin_lock_irqsave(&sinfo->lock, flags);
+    if (sinfo->rx_ring) {
+        spin_unlock_irqrestore(&sinfo->lock, flags);
+        bkn_rx_ring_free(ring);
+        return -EBUSY;
     }
+    sinfo->rx_ring = ring;
+    spin_unlock_irqrestore(&sinfo->lock, flags);
 
-    skb_pkt = desc->skb->data;
+    cfg->slot_size = ring->slot_size;
+    cfg->mmap_size = ring->size;
 
-    /* Strip custom header from KNETSync packets.  */
-    if ((rx_hwts) &&
-        ((skb_pkt[0] == 'B') && (skb_pkt[1] == 'C') &&
+    return 0;
+}
+
+static int
+bkn_rx_ring_destroy(bkn_switch_info_t *sinfo)
+{
+    bkn_rx_ring_t *ring;
+    unsigned long flags;
+
+    spin_lock_irqsave(&sinfo->lock, flags);
+    ring = sinfo->rx_ring;
+    sinfo->rx_ring = NULL;
+    spin_unlock_irqrestore(&sinfo->lock, flags);
+
+    if (ring == NULL) {
+        return -ENOENT;
+    }
+    bkn_rx_ring_free(ring);
+
+    return 0;
+}
+
+/*
+ * Copy an Rx API packet into the next slot of the shared Rx ring.
+ * This replaces the Rx API DCB chain and DMA event handoff, so the
+ * consumer only needs to poll the ring (or wait on its eventfd).
+ * Called with sinfo->lock held.
+ */
+static int
+bkn_rx_ring_put(bkn_switch_info_t *sinfo, bkn_rx_ring_t *ring,
+                int chan, bkn_desc_info_t *desc, int rx_hwts)
+{
+    bkn_rx_ring_hdr_t *hdr = ring->hdr;
+    bkn_rx_ring_desc_t *rdesc;
+    uint8_t *skb_pkt;
+    uint32_t slot;
+    int pktlen;
+    int i;
+
+    pktlen = desc->dcb_mem[sinfo->dcb_wsize-1] & SOC_DCB_KNET_COUNT_MASK;
+    if ((uint32_t)pktlen > ring->slot_size) {
+        DBG_WARN(("Rx ring slot too small\n"));
+        return -1;
+    }
+
+    /* Tail is written by user space, only its distance to head matters */
+    if ((uint32_t)(ring->head - hdr->tail) >= ring->slots) {
+        hdr->drops++;
+        bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_RING_FULL), 1);
+        return -1;
+    }
+    smp_rmb();
+
+    skb_pkt = desc->skb->data;
+
+    /* Strip custom header from KNETSync packets.  */
+    if ((rx_hwts) &&
+        ((skb_pkt[0] == 'B') && (skb_pkt[1] == 'C') &&
+         (skb_pkt[2] == 'M') && (skb_pkt[3] == 'C'))) {
+
+        skb_pkt = skb_pkt + skb_pkt[4];
+    }
+
+    slot = ring->head & (ring->slots - 1);
+    memcpy(ring->buf + slot * ring->slot_size, skb_pkt, pktlen);
+    rdesc = &ring->desc[slot];
+    rdesc->len = pktlen;
+    rdesc->chan = chan;
+    rdesc->dcb_words = min(sinfo->dcb_wsize, BKN_RX_RING_DCB_WORDS);
+    for (i = 0; i < rdesc->dcb_words; i++) {
+        rdesc->dcb[i] = desc->dcb_mem[i];
+    }
+
+    /* Publish the slot before the new head */
+    smp_wmb();
+    hdr->head = ++ring->head;
+    bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_RING), 1);
+
+    /* Pairs with the consumer setting wakeup before checking head */
+    smp_mb();
+    if (ring->efd && hdr->wakeup) {
+        hdr->wakeup = 0;
+        BKN_EVENTFD_SIGNAL(ring->efd);
+    }
+
+    return 0;
+}
+
+#endif /* BKN_RX_RING_SUPPORT */
+
+static int
+bkn_api_rx_copy_from_skb(bkn_switch_info_t *sinfo,
+                         int chan, bkn_desc_info_t *desc, int rx_hwts)
+{
+    bkn_dcb_chain_t *dcb_chain;
+    uint32_t *dcb;
+    uint32_t dcb_stat;
+    uint8_t *pkt;
+    uint8_t *skb_pkt;
+    uint64_t pkt_dma;
+    int pktlen;
+    int i;
+    bkn_evt_resource_t *evt;
+
+#ifdef BKN_RX_RING_SUPPORT
+    if (sinfo->rx_ring) {
+        return bkn_rx_ring_put(sinfo, sinfo->rx_ring, chan, desc, rx_hwts);
+    }
+#endif
+
+    dcb_stat = desc->dcb_mem[sinfo->dcb_wsize-1];
+    pktlen = dcb_stat & SOC_DCB_KNET_COUNT_MASK;
+
+    dcb_chain = sinfo->rx[chan].api_dcb_chain;
+    if (CDMA_CH(sinfo, XGS_DMA_RX_CHAN + chan) && dcb_chain == NULL) {
+        /* Last chain done, try to get a new one */
+        bkn_api_rx_chain_done(sinfo, chan);
+        dcb_chain = sinfo->rx[chan].api_dcb_chain;
+    }
+    if (dcb_chain == NULL) {
+        DBG_WARN(("No Rx API buffers\n"));
+        bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_NO_API_BUF), 1);
+        return -1;
+    }
+    dcb = &dcb_chain->dcb_mem[dcb_chain->dcb_cur * sinfo->dcb_wsize];
+    if ((sinfo->cmic_type == 'x' && (dcb[2] & 0xffff) < pktlen) ||
+        (sinfo->cmic_type != 'x' && (dcb[1] & 0xffff) < pktlen)) {
+        DBG_WARN(("Rx API buffer too small\n"));
+        return -1;
+    }
+    if (sinfo->cmic_type == 'x') {
+        pkt_dma = BUS_TO_DMA_HI(dcb[1]);
+        pkt_dma = pkt_dma << 32 | dcb[0];
+    } else {
+        pkt_dma = dcb[0];
+    }
+    pkt = (uint8_t *)kernel_bde->p2l(sinfo->dev_no, (sal_paddr_t)pkt_dma);
+    if (pkt == NULL) {
+        DBG_WARN(("Invalid Rx API buffer\n"));
+        return -1;
+    }
+
+    skb_pkt = desc->skb->data;
+
+    /* Strip custom header from KNETSync packets.  */
+    if ((rx_hwts) &&
+        ((skb_pkt[0] == 'B') && (skb_pkt[1] == 'C') &&
          (skb_pkt[2] == 'M') && (skb_pkt[3] == 'C'))) {
 
         skb_pkt = skb_pkt + skb_pkt[4];
@@ -2288,10 +3054,53 @@ bkn_api_rx_copy_from_skb(bkn_switch_info_t *sinfo,
     return 0;
 }
 
+static int
+bkn_rx_skb_fill(bkn_switch_info_t *sinfo, int chan, bkn_desc_info_t *desc,
+                uint32_t resv_size, uint32_t dma_size)
+{
+    struct sk_buff *skb;
+
+    if (desc->skb == NULL) {
+        skb = dev_alloc_skb(rx_buffer_size + SKB_DATA_ALIGN(resv_size));
+        if (skb == NULL) {
+            return -1;
+        }
+        skb_reserve(skb, SKB_DATA_ALIGN(resv_size));
+        desc->skb = skb;
+    } else {
+        DBG_DCB_RX(("Refill Rx%d SKB in DCB %d recycled.\n",
+                    chan, sinfo->rx[chan].cur));
+    }
+    skb = desc->skb;
+    desc->dma_size = dma_size;
+#ifdef KNET_NO_AXI_DMA_INVAL
+    /*
+     * FIXME: Need to retain this code until iProc customers have been
+     * migrated to updated u-boot. Old u-boot versions are unable to load
+     * the kernel into non-ACP memory.
+     */
+    /*
+     * Cache invalidate may corrupt DMA memory on some iProc-based devices
+     * if the kernel is mapped to ACP memory.
+     */
+    if (sinfo->pdev == NULL) {
+        desc->dma_size = 0;
+    }
+#endif
+    desc->skb_dma = BKN_DMA_MAP_SINGLE(sinfo->dma_dev,
+                                   skb->data, desc->dma_size,
+                                   BKN_DMA_FROMDEV);
+    if (BKN_DMA_MAPPING_ERROR(sinfo->dma_dev, desc->skb_dma)) {
+        dev_kfree_skb_any(skb);
+        desc->skb = NULL;
+        return -1;
+    }
+    return 0;
+}
+
 static void
 bkn_rx_refill(bkn_switch_info_t *sinfo, int chan)
 {
-    struct sk_buff *skb;
     bkn_desc_info_t *desc;
     uint32_t *dcb;
     uint32_t resv_size = sinfo->cmic_type == 'x' ? RCPU_HDR_SIZE : RCPU_RX_ENCAP_SIZE;
@@ -2311,39 +3120,16 @@ bkn_rx_refill(bkn_switch_info_t *sinfo, int chan)
 
     while (sinfo->rx[chan].free < MAX_RX_DCBS) {
         desc = &sinfo->rx[chan].desc[sinfo->rx[chan].cur];
-        if (desc->skb == NULL) {
-            skb = dev_alloc_skb(rx_buffer_size + SKB_DATA_ALIGN(resv_size));
-            if (skb == NULL) {
+#ifdef BKN_PAGE_POOL_SUPPORT
+        if (sinfo->rx[chan].page_pool) {
+            if (bkn_rx_pool_fill(sinfo, chan, desc,
+                                 rx_buffer_size + meta_size) < 0) {
                 break;
             }
-            skb_reserve(skb, SKB_DATA_ALIGN(resv_size));
-            desc->skb = skb;
-        } else {
-            DBG_DCB_RX(("Refill Rx%d SKB in DCB %d recycled.\n",
-                        chan, sinfo->rx[chan].cur));
-        }
-        skb = desc->skb;
-        desc->dma_size = rx_buffer_size + meta_size;
-#ifdef KNET_NO_AXI_DMA_INVAL
-        /*
-         * FIXME: Need to retain this code until iProc customers have been
-         * migrated to updated u-boot. Old u-boot versions are unable to load
-         * the kernel into non-ACP memory.
-         */
-        /*
-         * Cache invalidate may corrupt DMA memory on some iProc-based devices
-         * if the kernel is mapped to ACP memory.
-         */
-        if (sinfo->pdev == NULL) {
-            desc->dma_size = 0;
-        }
+        } else
 #endif
-        desc->skb_dma = BKN_DMA_MAP_SINGLE(sinfo->dma_dev,
-                                       skb->data, desc->dma_size,
-                                       BKN_DMA_FROMDEV);
-        if (BKN_DMA_MAPPING_ERROR(sinfo->dma_dev, desc->skb_dma)) {
-            dev_kfree_skb_any(skb);
-            desc->skb = NULL;
+        if (bkn_rx_skb_fill(sinfo, chan, desc, resv_size,
+                            rx_buffer_size + meta_size) < 0) {
             break;
         }
         DBG_DCB_RX(("Refill Rx%d DCB %d (0x%08x).\n",
@@ -2547,119 +3333,484 @@ device_is_dpp(bkn_switch_info_t *sinfo)
 static inline int
 device_is_dnx(bkn_switch_info_t *sinfo)
 {
-    int is_dnx = 0;
+    int is_dnx = 0;
+
+    is_dnx = (sinfo->dcb_type == 39) ? 1 : 0;
+    return is_dnx;
+}
+
+/* is DPP or is DNX*/
+static inline int
+device_is_sand(bkn_switch_info_t *sinfo)
+{
+    int is_dpp = 0;
+    int is_dnx = 0;
+
+    is_dpp = (sinfo->dcb_type == 28) ? 1 : 0;
+    is_dnx = (sinfo->dcb_type == 39) ? 1 : 0;
+
+    return (is_dpp | is_dnx);
+}
+
+/*
+ * Check that filter priority allows matching packets received on channel.
+ */
+static inline int
+bkn_filter_chan_match(bkn_switch_info_t *sinfo, kcom_filter_t *kf, int chan)
+{
+    if (device_is_dnx(sinfo))
+    {
+        /*
+         * Mutliple RX channels are enabled on JR2 and above devices
+         * Bind between priority 0 and RX channel 0 is not checked, then all enabled RX channels can receive packets.
+         */
+        if (kf->priority && (kf->priority < (num_rx_prio * sinfo->rx_chans))) {
+            if (kf->priority < (num_rx_prio * chan) ||
+                kf->priority >= (num_rx_prio * (chan + 1))) {
+                return 0;
+            }
+        }
+    }
+    else {
+        if (kf->priority < (num_rx_prio * sinfo->rx_chans)) {
+            if (kf->priority < (num_rx_prio * chan) ||
+                kf->priority >= (num_rx_prio * (chan + 1))) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/*
+ * Compare masked OOB metadata and packet data with filter data.
+ */
+static int
+bkn_filter_data_match(bkn_switch_info_t *sinfo, kcom_filter_t *kf,
+                      uint8_t *pkt, int pktlen, uint8_t *oob)
+{
+    kcom_filter_t scratch;
+    int size, wsize;
+    int idx;
+
+    if (kf->pkt_data_offset + kf->pkt_data_size > pktlen) {
+        return 0;
+    }
+    memcpy(&scratch.data.b[0],
+           &oob[kf->oob_data_offset], kf->oob_data_size);
+    memcpy(&scratch.data.b[kf->oob_data_size],
+           &pkt[kf->pkt_data_offset], kf->pkt_data_size);
+    size = kf->oob_data_size + kf->pkt_data_size;
+    wsize = BYTES2WORDS(size);
+    DBG_VERB(("Filter: size = %d (%d), data = 0x%08x, mask = 0x%08x\n",
+              size, wsize, kf->data.w[0], kf->mask.w[0]));
+
+    if (device_is_sand(sinfo)) {
+        DBG_DUNE(("Filter: size = %d (wsize %d)\n", size, wsize));
+        for (idx = 0; idx < wsize; idx++)
+        {
+            DBG_DUNE(("OOB[%d]: 0x%08x [0x%08x]\n", idx, kf->data.w[idx], kf->mask.w[idx]));
+        }
+        DBG_DUNE(("Meta Data [+ Selected Raw packet data]\n"));
+        for (idx = 0; idx < wsize; idx++)
+        {
+            DBG_DUNE(("Scratch[%d]: 0x%08x\n", idx, scratch.data.w[idx]));
+        }
+    }
+
+    for (idx = 0; idx < wsize; idx++) {
+        scratch.data.w[idx] &= kf->mask.w[idx];
+        if (scratch.data.w[idx] != kf->data.w[idx]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Deliver packet matching filter, custom filters may decline the packet.
+ */
+static bkn_filter_t *
+bkn_filter_accept(bkn_switch_info_t *sinfo, bkn_filter_t *filter,
+                  uint8_t *pkt, int pktlen, void *meta, int chan,
+                  bkn_filter_t *cbf)
+{
+    kcom_filter_t *kf = &filter->kf;
+
+    if (kf->dest_type == KCOM_DEST_T_CB) {
+        /* Check for custom filters */
+        if (knet_filter_cb != NULL && cbf != NULL) {
+            memset(cbf, 0, sizeof(*cbf));
+            memcpy(&cbf->kf, kf, sizeof(cbf->kf));
+            if (knet_filter_cb(pkt, pktlen, sinfo->dev_no,
+                               meta, chan, &cbf->kf)) {
+                bkn_filter_stats_add(filter, pktlen);
+                return cbf;
+            }
+        } else {
+            DBG_FLTR(("Match, but not filter callback\n"));
+        }
+        return NULL;
+    }
+    bkn_filter_stats_add(filter, pktlen);
+    return filter;
+}
+
+static bkn_filter_t *
+bkn_match_rx_pkt_linear(bkn_switch_info_t *sinfo, uint8_t *pkt, int pktlen,
+                        void *meta, int chan, bkn_filter_t *cbf)
+{
+    struct list_head *list;
+    bkn_filter_t *filter, *match;
+
+    list_for_each(list, &sinfo->rxpf_list) {
+        filter = (bkn_filter_t *)list;
+        if (!bkn_filter_chan_match(sinfo, &filter->kf, chan)) {
+            continue;
+        }
+        if (!bkn_filter_data_match(sinfo, &filter->kf, pkt, pktlen, meta)) {
+            continue;
+        }
+        match = bkn_filter_accept(sinfo, filter, pkt, pktlen, meta, chan, cbf);
+        if (match) {
+            return match;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Check if filter fits a tuple: mask and data must be confined to the
+ * matched bytes, and data must not have bits outside the mask (such a
+ * filter never matches, and is left to the linear filters).
+ */
+static int
+bkn_filter_tuple_usable(kcom_filter_t *kf)
+{
+    int size, idx;
+
+    size = kf->oob_data_size + kf->pkt_data_size;
+    for (idx = size; idx < BYTES2WORDS(size) * 4; idx++) {
+        if (kf->mask.b[idx] != 0) {
+            return 0;
+        }
+    }
+    for (idx = 0; idx < BYTES2WORDS(size); idx++) {
+        if (kf->data.w[idx] & ~kf->mask.w[idx]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int
+bkn_filter_tuple_same(bkn_filter_tuple_t *tuple, kcom_filter_t *kf)
+{
+    return tuple->oob_data_offset == kf->oob_data_offset &&
+           tuple->oob_data_size == kf->oob_data_size &&
+           tuple->pkt_data_offset == kf->pkt_data_offset &&
+           tuple->pkt_data_size == kf->pkt_data_size &&
+           memcmp(tuple->mask, kf->mask.w, tuple->wsize * 4) == 0;
+}
+
+static inline uint32_t
+bkn_filter_key_hash(uint32_t *key, int wsize)
+{
+    return jhash2(key, wsize, 0);
+}
+
+/*
+ * Add filter to tuple, filters with equal key are kept in list order.
+ */
+static void
+bkn_filter_tuple_add(bkn_filter_tuple_t *tuple, bkn_filter_t *filter)
+{
+    bkn_filter_t **head, *last;
+
+    filter->key_hash = bkn_filter_key_hash(filter->kf.data.w, tuple->wsize);
+    filter->tuple_next = NULL;
+    filter->key_next = NULL;
+
+    head = &tuple->bucket[filter->key_hash & (BKN_FILTER_HASH_SIZE - 1)];
+    for (; *head != NULL; head = &(*head)->tuple_next) {
+        if ((*head)->key_hash == filter->key_hash &&
+            memcmp((*head)->kf.data.w, filter->kf.data.w,
+                   tuple->wsize * 4) == 0) {
+            /* Filters are added in list order, append */
+            for (last = *head; last->key_next; last = last->key_next);
+            last->key_next = filter;
+            tuple->filters++;
+            return;
+        }
+    }
+    *head = filter;
+    tuple->filters++;
+}
+
+static void
+bkn_filter_cls_free(bkn_filter_cls_t *cls)
+{
+    int idx;
+
+    if (cls == NULL) {
+        return;
+    }
+    for (idx = 0; idx < cls->num_tuples; idx++) {
+        kfree(cls->tuples[idx]);
+    }
+    kfree(cls->linear);
+    kfree(cls);
+}
+
+/*
+ * Compile filter list into tuples. Statistics of tuples found in the
+ * old compiled filters are carried over. Returns NULL on failure, in
+ * which case filters are matched linearly.
+ */
+static bkn_filter_cls_t *
+bkn_filter_cls_compile(bkn_switch_info_t *sinfo, bkn_filter_cls_t *old,
+                       gfp_t gfp)
+{
+    struct list_head *list;
+    bkn_filter_cls_t *cls;
+    bkn_filter_tuple_t *tuple;
+    bkn_filter_t *filter;
+    kcom_filter_t *kf;
+    int num_filters = 0;
+    int idx;
+
+    list_for_each(list, &sinfo->rxpf_list) {
+        num_filters++;
+    }
+
+    cls = kzalloc(sizeof(*cls), gfp);
+    if (cls == NULL) {
+        return NULL;
+    }
+    if (num_filters) {
+        cls->linear = kcalloc(num_filters, sizeof(bkn_filter_t *), gfp);
+        if (cls->linear == NULL) {
+            kfree(cls);
+            return NULL;
+        }
+    }
+
+    num_filters = 0;
+    list_for_each(list, &sinfo->rxpf_list) {
+        filter = (bkn_filter_t *)list;
+        kf = &filter->kf;
+        filter->order = num_filters++;
+
+        tuple = NULL;
+        if (bkn_filter_tuple_usable(kf)) {
+            for (idx = 0; idx < cls->num_tuples; idx++) {
+                if (bkn_filter_tuple_same(cls->tuples[idx], kf)) {
+                    tuple = cls->tuples[idx];
+                    break;
+                }
+            }
+            if (tuple == NULL && cls->num_tuples < BKN_FILTER_TUPLE_MAX) {
+                tuple = kzalloc(sizeof(*tuple), gfp);
+                if (tuple == NULL) {
+                    bkn_filter_cls_free(cls);
+                    return NULL;
+                }
+                tuple->oob_data_offset = kf->oob_data_offset;
+                tuple->oob_data_size = kf->oob_data_size;
+                tuple->pkt_data_offset = kf->pkt_data_offset;
+                tuple->pkt_data_size = kf->pkt_data_size;
+                tuple->wsize = BYTES2WORDS(kf->oob_data_size +
+                                           kf->pkt_data_size);
+                memcpy(tuple->mask, kf->mask.w, tuple->wsize * 4);
+                /* Tuples are created in list order */
+                tuple->min_order = filter->order;
+                cls->tuples[cls->num_tuples++] = tuple;
+            }
+        }
+
+        if (tuple) {
+            bkn_filter_tuple_add(tuple, filter);
+        } else {
+            cls->linear[cls->num_linear++] = filter;
+        }
+    }
+
+    if (old) {
+        for (idx = 0; idx < cls->num_tuples; idx++) {
+            int oidx;
+
+            tuple = cls->tuples[idx];
+            for (oidx = 0; oidx < old->num_tuples; oidx++) {
+                bkn_filter_tuple_t *otuple = old->tuples[oidx];
+
+                if (otuple->wsize == tuple->wsize &&
+                    otuple->oob_data_offset == tuple->oob_data_offset &&
+                    otuple->oob_data_size == tuple->oob_data_size &&
+                    otuple->pkt_data_offset == tuple->pkt_data_offset &&
+                    otuple->pkt_data_size == tuple->pkt_data_size &&
+                    memcmp(otuple->mask, tuple->mask, tuple->wsize * 4) == 0) {
+                    tuple->lookups = otuple->lookups;
+                    tuple->hits = otuple->hits;
+                    tuple->matches = otuple->matches;
+                    break;
+                }
+            }
+        }
+        cls->linear_checks = old->linear_checks;
+        cls->linear_matches = old->linear_matches;
+    }
+
+    return cls;
+}
+
+/*
+ * Recompile Rx filters after the filter list changed. Must be called
+ * with the device lock held. Returns the old compiled filters, which
+ * are freed by the caller after releasing the lock.
+ */
+static bkn_filter_cls_t *
+bkn_filter_cls_update(bkn_switch_info_t *sinfo)
+{
+    bkn_filter_cls_t *old = sinfo->rxpf_cls;
 
-    is_dnx = (sinfo->dcb_type == 39) ? 1 : 0;
-    return is_dnx;
+    sinfo->rxpf_cls = bkn_filter_cls_compile(sinfo, old, GFP_ATOMIC);
+    if (sinfo->rxpf_cls == NULL && !list_empty(&sinfo->rxpf_list)) {
+        DBG_WARN(("Failed to compile Rx filters, using linear match\n"));
+    }
+    return old;
 }
 
-/* is DPP or is DNX*/
-static inline int
-device_is_sand(bkn_switch_info_t *sinfo)
+/*
+ * Look up packet in tuple, returns first filter with matching key.
+ */
+static bkn_filter_t *
+bkn_filter_tuple_lookup(bkn_filter_tuple_t *tuple, uint8_t *pkt, int pktlen,
+                        uint8_t *oob)
 {
-    int is_dpp = 0;
-    int is_dnx = 0;
+    union {
+        uint8_t b[KCOM_FILTER_BYTES_MAX];
+        uint32_t w[KCOM_FILTER_WORDS_MAX];
+    } key;
+    bkn_filter_t *filter;
+    uint32_t hash;
+    int idx;
 
-    is_dpp = (sinfo->dcb_type == 28) ? 1 : 0;
-    is_dnx = (sinfo->dcb_type == 39) ? 1 : 0;
+    if (tuple->pkt_data_offset + tuple->pkt_data_size > pktlen) {
+        return NULL;
+    }
+    tuple->lookups++;
 
-    return (is_dpp | is_dnx);
+    if (tuple->wsize) {
+        key.w[tuple->wsize - 1] = 0;
+    }
+    memcpy(&key.b[0], &oob[tuple->oob_data_offset], tuple->oob_data_size);
+    memcpy(&key.b[tuple->oob_data_size],
+           &pkt[tuple->pkt_data_offset], tuple->pkt_data_size);
+    for (idx = 0; idx < tuple->wsize; idx++) {
+        key.w[idx] &= tuple->mask[idx];
+    }
+
+    hash = bkn_filter_key_hash(key.w, tuple->wsize);
+    filter = tuple->bucket[hash & (BKN_FILTER_HASH_SIZE - 1)];
+    for (; filter != NULL; filter = filter->tuple_next) {
+        if (filter->key_hash == hash &&
+            memcmp(filter->kf.data.w, key.w, tuple->wsize * 4) == 0) {
+            tuple->hits++;
+            return filter;
+        }
+    }
+    return NULL;
 }
 
 static bkn_filter_t *
-bkn_match_rx_pkt(bkn_switch_info_t *sinfo, uint8_t *pkt, int pktlen,
-                 void *meta, int chan, bkn_filter_t *cbf)
+bkn_match_rx_pkt_cls(bkn_switch_info_t *sinfo, bkn_filter_cls_t *cls,
+                     uint8_t *pkt, int pktlen, void *meta, int chan,
+                     bkn_filter_t *cbf)
 {
-    struct list_head *list;
-    bkn_filter_t *filter;
-    kcom_filter_t scratch, *kf;
+    bkn_filter_t *cand[BKN_FILTER_TUPLE_MAX];
+    bkn_filter_t *best, *filter, *match;
     uint8_t *oob = (uint8_t *)meta;
-    int size, wsize;
-    int idx, match;
+    int num_looked_up = 0;
+    int linear_idx = 0;
+    int best_idx;
+    int idx;
 
-    list_for_each(list, &sinfo->rxpf_list) {
-        filter = (bkn_filter_t *)list;
-        kf = &filter->kf;
-        if (kf->pkt_data_offset + kf->pkt_data_size > pktlen) {
-            continue;
+    while (1) {
+        /* Best candidate of tuples looked up so far */
+        best = NULL;
+        best_idx = -1;
+        for (idx = 0; idx < num_looked_up; idx++) {
+            if (cand[idx] && (best == NULL || cand[idx]->order < best->order)) {
+                best = cand[idx];
+                best_idx = idx;
+            }
         }
-        memcpy(&scratch.data.b[0],
-               &oob[kf->oob_data_offset], kf->oob_data_size);
-        memcpy(&scratch.data.b[kf->oob_data_size],
-               &pkt[kf->pkt_data_offset], kf->pkt_data_size);
-        size = kf->oob_data_size + kf->pkt_data_size;
-        wsize = BYTES2WORDS(size);
-        DBG_VERB(("Filter: size = %d (%d), data = 0x%08x, mask = 0x%08x\n",
-                  size, wsize, kf->data.w[0], kf->mask.w[0]));
 
-        if (device_is_sand(sinfo)) {
-            DBG_DUNE(("Filter: size = %d (wsize %d)\n", size, wsize));
-            for (idx = 0; idx < wsize; idx++)
-            {
-                DBG_DUNE(("OOB[%d]: 0x%08x [0x%08x]\n", idx, kf->data.w[idx], kf->mask.w[idx]));
-            }
-            DBG_DUNE(("Meta Data [+ Selected Raw packet data]\n"));
-            for (idx = 0; idx < wsize; idx++)
-            {
-                DBG_DUNE(("Scratch[%d]: 0x%08x\n", idx, scratch.data.w[idx]));
+        /* Look up tuples which may contain a filter preceding best */
+        while (num_looked_up < cls->num_tuples &&
+               (best == NULL ||
+                cls->tuples[num_looked_up]->min_order < best->order)) {
+            idx = num_looked_up++;
+            cand[idx] = bkn_filter_tuple_lookup(cls->tuples[idx],
+                                                pkt, pktlen, oob);
+            if (cand[idx] && (best == NULL || cand[idx]->order < best->order)) {
+                best = cand[idx];
+                best_idx = idx;
             }
         }
 
-        match = 1;
-        if (match) {
-            if (device_is_dnx(sinfo))
-            {
-                /*
-                 * Mutliple RX channels are enabled on JR2 and above devices
-                 * Bind between priority 0 and RX channel 0 is not checked, then all enabled RX channels can receive packets.
-                 */
-                if (kf->priority && (kf->priority < (num_rx_prio * sinfo->rx_chans))) {
-                    if (kf->priority < (num_rx_prio * chan) ||
-                        kf->priority >= (num_rx_prio * (chan + 1))) {
-                        match = 0;
-                    }
-                }
-            }
-            else {
-                if (kf->priority < (num_rx_prio * sinfo->rx_chans)) {
-                    if (kf->priority < (num_rx_prio * chan) ||
-                        kf->priority >= (num_rx_prio * (chan + 1))) {
-                        match = 0;
-                    }
-                }
+        /* Linear filters preceding best */
+        while (linear_idx < cls->num_linear &&
+               (best == NULL ||
+                cls->linear[linear_idx]->order < best->order)) {
+            filter = cls->linear[linear_idx];
+            cls->linear_checks++;
+            if (bkn_filter_data_match(sinfo, &filter->kf, pkt, pktlen, oob)) {
+                best = filter;
+                best_idx = -1;
+                break;
             }
+            linear_idx++;
         }
-        if (match) {
-            for (idx = 0; idx < wsize; idx++) {
-                scratch.data.w[idx] &= kf->mask.w[idx];
-                if (scratch.data.w[idx] != kf->data.w[idx]) {
-                    match = 0;
-                    break;
-                }
-            }
+
+        if (best == NULL) {
+            return NULL;
+        }
+
+        /* Advance past best for the next round */
+        if (best_idx < 0) {
+            linear_idx++;
+        } else {
+            cand[best_idx] = best->key_next;
+        }
+
+        if (!bkn_filter_chan_match(sinfo, &best->kf, chan)) {
+            continue;
         }
+        match = bkn_filter_accept(sinfo, best, pkt, pktlen, meta, chan, cbf);
         if (match) {
-            if (kf->dest_type == KCOM_DEST_T_CB) {
-                /* Check for custom filters */
-                if (knet_filter_cb != NULL && cbf != NULL) {
-                    memset(cbf, 0, sizeof(*cbf));
-                    memcpy(&cbf->kf, kf, sizeof(cbf->kf));
-                    if (knet_filter_cb(pkt, pktlen, sinfo->dev_no,
-                                       meta, chan, &cbf->kf)) {
-                        filter->hits++;
-                        return cbf;
-                    }
-                } else {
-                    DBG_FLTR(("Match, but not filter callback\n"));
-                }
+            if (best_idx < 0) {
+                cls->linear_matches++;
             } else {
-                filter->hits++;
-                return filter;
+                cls->tuples[best_idx]->matches++;
             }
+            DBG_FLTR(("Filter ID %d matched by %s\n", best->kf.id,
+                      best_idx < 0 ? "linear match" : "filter tuple"));
+            return match;
         }
     }
+}
 
-    return NULL;
+static bkn_filter_t *
+bkn_match_rx_pkt(bkn_switch_info_t *sinfo, uint8_t *pkt, int pktlen,
+                 void *meta, int chan, bkn_filter_t *cbf)
+{
+    if (filter_cls && sinfo->rxpf_cls) {
+        return bkn_match_rx_pkt_cls(sinfo, sinfo->rxpf_cls,
+                                    pkt, pktlen, meta, chan, cbf);
+    }
+    return bkn_match_rx_pkt_linear(sinfo, pkt, pktlen, meta, chan, cbf);
 }
 
 static bkn_priv_t *
@@ -2693,6 +3844,102 @@ bkn_netif_lookup(bkn_switch_info_t *sinfo, int id)
     return NULL;
 }
 
+static bkn_filter_t *
+bkn_filter_lookup(bkn_switch_info_t *sinfo, int id)
+{
+    struct list_head *list;
+    bkn_filter_t *filter;
+
+    list_for_each(list, &sinfo->rxpf_list) {
+        filter = (bkn_filter_t *)list;
+        if (filter->kf.id == id) {
+            return filter;
+        }
+    }
+    return NULL;
+}
+
+static void
+bkn_rate_set(bkn_rate_t *rl, uint32_t rate_max, uint32_t burst_max)
+{
+    /* Same default burst size as the Rx DMA rate control */
+    if (burst_max == 0) {
+        burst_max = rate_max / 10;
+    }
+    if (burst_max == 0) {
+        burst_max = 1;
+    }
+    rl->rate_max = rate_max;
+    rl->burst_max = burst_max;
+    rl->tokens = (u64)burst_max * HZ;
+    rl->tok_jif = jiffies;
+}
+
+/*
+ * Take a token for one packet.
+ * Returns non-zero if the packet exceeds the rate limit.
+ */
+static int
+bkn_rate_exceeded(bkn_rate_t *rl)
+{
+    unsigned long cur_jif, ticks;
+    u64 tokens_max;
+
+    if (rl->rate_max == 0) {
+        return 0;
+    }
+
+    tokens_max = (u64)rl->burst_max * HZ;
+    cur_jif = jiffies;
+    ticks = cur_jif - rl->tok_jif;
+    rl->tok_jif = cur_jif;
+    if (ticks > BKN_RATE_TICKS_MAX) {
+        ticks = BKN_RATE_TICKS_MAX;
+    }
+    rl->tokens += (u64)ticks * rl->rate_max;
+    if (rl->tokens > tokens_max) {
+        rl->tokens = tokens_max;
+    }
+
+    if (rl->tokens < HZ) {
+        rl->drops++;
+        return 1;
+    }
+    rl->tokens -= HZ;
+    return 0;
+}
+
+/*
+ * Apply filter rate limit to a matched Rx packet.
+ * Returns non-zero if the packet must be dropped.
+ */
+static int
+bkn_filter_rate_drop(bkn_switch_info_t *sinfo, bkn_filter_t *filter, int chan)
+{
+    if (bkn_rate_exceeded(&filter->rate)) {
+        DBG_FLTR(("Filter ID %d rate exceeded\n", filter->kf.id));
+        bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_RATE_LIMIT), 1);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Apply net interface rate limit to an Rx packet.
+ * Returns non-zero if the packet must be dropped.
+ */
+static int
+bkn_netif_rate_drop(bkn_switch_info_t *sinfo, bkn_priv_t *priv, int chan)
+{
+    if (bkn_rate_exceeded(&priv->rate)) {
+        DBG_FLTR(("Netif %d rate exceeded\n", priv->id));
+        bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_RATE_LIMIT), 1);
+        priv->stats.rx_dropped++;
+        return 1;
+    }
+    return 0;
+}
+
 static int
 bkn_hw_tstamp_rx_set(bkn_switch_info_t *sinfo, int phys_port, struct sk_buff *skb, uint32 *meta)
 {
@@ -3626,6 +4873,242 @@ bkn_packet_header_parse(bkn_switch_info_t *sinfo, uint8_t *buf, uint32_t buf_len
     return 0;
 }
 
+/*
+ * Account Rx skb to the Rx queue of its net interface. Called with the
+ * driver lock held.
+ */
+static inline void
+bkn_rx_queue_count(bkn_switch_info_t *sinfo, int chan, struct sk_buff *skb)
+{
+    bkn_priv_t *priv = netdev_priv(skb->dev);
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,38))
+    if (rx_chan_napi) {
+        /* Lets RPS steer each Rx DMA channel separately */
+        skb_record_rx_queue(skb, chan);
+    }
+#endif
+    priv->rxq_stats[chan].pkts++;
+    priv->rxq_stats[chan].bytes += skb->len;
+}
+
+/*
+ * Pass Rx skb up the network stack. During a batched NAPI poll the skb
+ * is queued and delivered by bkn_rx_batch_deliver once the poll has
+ * released the driver lock, otherwise the lock is released for each
+ * packet.
+ */
+static void
+bkn_rx_deliver(bkn_switch_info_t *sinfo, int chan, struct sk_buff *skb)
+{
+    bkn_rx_queue_count(sinfo, chan, skb);
+
+    if (sinfo->rx_batching) {
+        __skb_queue_tail(&sinfo->rx[chan].batch, skb);
+        return;
+    }
+
+    /* Disable configuration API while the spinlock is released. */
+    sinfo->cfg_api_locked = 1;
+    /* Unlock while calling up network stack */
+    spin_unlock(&sinfo->lock);
+    if (use_napi) {
+        netif_receive_skb(skb);
+    } else {
+        netif_rx(skb);
+    }
+    spin_lock(&sinfo->lock);
+    /* Re-enable configuration API once spinlock is regained. */
+    sinfo->cfg_api_locked = 0;
+}
+
+/*
+ * Deliver a queue of Rx skbs received on one channel from NAPI
+ * context. Called without the driver lock.
+ */
+static void
+bkn_rx_queue_deliver(bkn_switch_info_t *sinfo, int chan,
+                     struct napi_struct *napi, struct sk_buff_head *queue)
+{
+    struct sk_buff *skb;
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,19,0))
+    struct list_head list;
+#endif
+    int pkts, merged;
+
+    pkts = skb_queue_len(queue);
+    if (pkts == 0) {
+        return;
+    }
+    merged = 0;
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,29))
+    if (rx_batch == 2) {
+        while ((skb = __skb_dequeue(queue)) != NULL) {
+            switch (napi_gro_receive(napi, skb)) {
+            case GRO_MERGED:
+            case GRO_MERGED_FREE:
+                merged++;
+                break;
+            default:
+                break;
+            }
+        }
+    }
+#endif
+    /* Remaining skbs, all of them unless GRO is used */
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,19,0))
+    INIT_LIST_HEAD(&list);
+    while ((skb = __skb_dequeue(queue)) != NULL) {
+        list_add_tail(&skb->list, &list);
+    }
+    netif_receive_skb_list(&list);
+#else
+    while ((skb = __skb_dequeue(queue)) != NULL) {
+        netif_receive_skb(skb);
+    }
+#endif
+    bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_BATCHES), 1);
+    bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_BATCH_PKTS), pkts);
+    if (merged) {
+        bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_GRO_MERGED),
+                      merged);
+    }
+}
+
+/*
+ * Hand Rx skbs over to the NAPI instance of their channel. Called from
+ * softirq context or with bottom halves disabled.
+ */
+static void
+bkn_rx_chan_napi_queue(bkn_switch_info_t *sinfo, int chan,
+                       struct sk_buff_head *skbs)
+{
+    bkn_rx_napi_t *rxn = &sinfo->rx[chan].rxn;
+    struct sk_buff *skb;
+    int drops = 0;
+
+    spin_lock(&rxn->queue.lock);
+    while ((skb = __skb_dequeue(skbs)) != NULL) {
+        if (skb_queue_len(&rxn->queue) >= BKN_RX_NAPI_BACKLOG) {
+            dev_kfree_skb_any(skb);
+            drops++;
+            continue;
+        }
+        __skb_queue_tail(&rxn->queue, skb);
+    }
+    spin_unlock(&rxn->queue.lock);
+
+    if (drops) {
+        bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_BACKLOG), drops);
+    }
+    bkn_napi_schedule(sinfo->dev, &rxn->napi);
+}
+
+#if NAPI_SUPPORT && (LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,24))
+/*
+ * NAPI poll of one Rx channel. Only delivers skbs queued by the device
+ * poll, so channels can be spread over CPUs, e.g. with threaded NAPI.
+ */
+static int
+bkn_rx_chan_poll(struct napi_struct *napi, int budget)
+{
+    bkn_rx_napi_t *rxn = container_of(napi, bkn_rx_napi_t, napi);
+    struct sk_buff_head queue;
+    struct sk_buff *skb;
+    int done;
+
+    __skb_queue_head_init(&queue);
+    spin_lock(&rxn->queue.lock);
+    while (skb_queue_len(&queue) < budget &&
+           (skb = __skb_dequeue(&rxn->queue)) != NULL) {
+        __skb_queue_tail(&queue, skb);
+    }
+    spin_unlock(&rxn->queue.lock);
+
+    done = skb_queue_len(&queue);
+    bkn_rx_queue_deliver(rxn->sinfo, rxn->chan, napi, &queue);
+
+    if (done < budget) {
+        bkn_napi_complete(rxn->sinfo->dev, napi);
+        /* Catch skbs queued while the poll was still scheduled */
+        if (skb_queue_len(&rxn->queue)) {
+            bkn_napi_schedule(rxn->sinfo->dev, napi);
+        }
+    }
+    return done;
+}
+
+/*
+ * Drop the Rx skbs of a network device which is going away from the
+ * channel NAPI queues. These skbs hold no reference on their device,
+ * so the channel NAPIs are stopped meanwhile to make sure that no poll
+ * still delivers any of them.
+ */
+static void
+bkn_rx_chan_napi_flush(bkn_switch_info_t *sinfo, struct net_device *dev)
+{
+    bkn_rx_napi_t *rxn;
+    struct sk_buff *skb, *tmp;
+    int chan;
+
+    if (!use_napi || !rx_chan_napi) {
+        return;
+    }
+
+    /* Channel NAPIs are only enabled while the base device is up */
+    rtnl_lock();
+    if (netif_running(sinfo->dev)) {
+        for (chan = 0; chan < NUM_RX_CHAN; chan++) {
+            rxn = &sinfo->rx[chan].rxn;
+            bkn_napi_disable(sinfo->dev, &rxn->napi);
+            spin_lock_bh(&rxn->queue.lock);
+            skb_queue_walk_safe(&rxn->queue, skb, tmp) {
+                if (skb->dev == dev) {
+                    __skb_unlink(skb, &rxn->queue);
+                    dev_kfree_skb_any(skb);
+                }
+            }
+            spin_unlock_bh(&rxn->queue.lock);
+            bkn_napi_enable(sinfo->dev, &rxn->napi);
+            if (skb_queue_len(&rxn->queue)) {
+                local_bh_disable();
+                bkn_napi_schedule(sinfo->dev, &rxn->napi);
+                local_bh_enable();
+            }
+        }
+    }
+    rtnl_unlock();
+}
+#else
+static void
+bkn_rx_chan_napi_flush(bkn_switch_info_t *sinfo, struct net_device *dev)
+{
+}
+#endif
+
+/*
+ * Deliver Rx skbs queued during NAPI poll. Called without the driver
+ * lock and with the configuration API disabled.
+ */
+static void
+bkn_rx_batch_deliver(bkn_switch_info_t *sinfo)
+{
+    struct sk_buff_head *batch;
+    int chan;
+
+    for (chan = 0; chan < sinfo->rx_chans; chan++) {
+        batch = &sinfo->rx[chan].batch;
+        if (skb_queue_len(batch) == 0) {
+            continue;
+        }
+        if (rx_chan_napi) {
+            bkn_rx_chan_napi_queue(sinfo, chan, batch);
+        } else {
+            bkn_rx_queue_deliver(sinfo, chan, &sinfo->napi, batch);
+        }
+    }
+}
+
 static int
 bkn_do_api_rx(bkn_switch_info_t *sinfo, int chan, int budget)
 {
@@ -3679,7 +5162,6 @@ bkn_do_api_rx(bkn_switch_info_t *sinfo, int chan, int budget)
             (sinfo->cmic_type != 'x' && (dcb[1] & (1 << 16)) == 0)) {
             sinfo->rx[chan].chain_complete = 1;
         }
-        sinfo->rx[chan].pkts++;
         if (sinfo->cmic_type == 'x') {
             pkt_dma = BUS_TO_DMA_HI(dcb[1]);
             pkt_dma = pkt_dma << 32 | dcb[0];
@@ -3688,6 +5170,7 @@ bkn_do_api_rx(bkn_switch_info_t *sinfo, int chan, int budget)
         }
         pkt = (uint8_t *)kernel_bde->p2l(sinfo->dev_no, (sal_paddr_t)pkt_dma);
         pktlen = dcb[sinfo->dcb_wsize-1] & SOC_DCB_KNET_COUNT_MASK;
+        bkn_stats_pkt(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_PKTS), pktlen);
         bkn_dump_pkt(pkt, pktlen, XGS_DMA_RX_CHAN);
 
         if (device_is_sand(sinfo)) {
@@ -3785,12 +5268,14 @@ bkn_do_api_rx(bkn_switch_info_t *sinfo, int chan, int budget)
             }
         }
         drop_api = 1;
-        if (filter) {
+        if (filter && bkn_filter_rate_drop(sinfo, filter, chan)) {
+            DBG_PKT(("Rx packet dropped by rate limit.\n"));
+        } else if (filter) {
             DBG_FLTR(("Match filter ID %d\n", filter->kf.id));
             switch (filter->kf.dest_type) {
             case KCOM_DEST_T_API:
                 DBG_FLTR(("Send to Rx API\n"));
-                sinfo->rx[chan].pkts_f_api++;
+                bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_F_API), 1);
                 drop_api = 0;
                 break;
             case KCOM_DEST_T_NETIF:
@@ -3798,7 +5283,10 @@ bkn_do_api_rx(bkn_switch_info_t *sinfo, int chan, int budget)
                 if (priv) {
                     /* Check that software link is up */
                     if (!netif_carrier_ok(priv->dev)) {
-                        sinfo->rx[chan].pkts_d_no_link++;
+                        bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_NO_LINK), 1);
+                        break;
+                    }
+                    if (bkn_netif_rate_drop(sinfo, priv, chan)) {
                         break;
                     }
 
@@ -3809,14 +5297,14 @@ bkn_do_api_rx(bkn_switch_info_t *sinfo, int chan, int budget)
                     if (device_is_sand(sinfo)) {
                         skb = dev_alloc_skb(pktlen + RCPU_HDR_SIZE + pkt_hdr_size + 2);
                         if (skb == NULL) {
-                            sinfo->rx[chan].pkts_d_no_skb++;
+                            bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_NO_SKB), 1);
                             break;
                         }
                         skb_reserve(skb, RCPU_HDR_SIZE + pkt_hdr_size);
                     } else {
                         skb = dev_alloc_skb(pktlen + RCPU_RX_ENCAP_SIZE + 2);
                         if (skb == NULL) {
-                            sinfo->rx[chan].pkts_d_no_skb++;
+                            bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_NO_SKB), 1);
                             break;
                         }
                         skb_reserve(skb, RCPU_RX_ENCAP_SIZE);
@@ -3824,7 +5312,7 @@ bkn_do_api_rx(bkn_switch_info_t *sinfo, int chan, int budget)
 
                     DBG_FLTR(("Send to netif %d (%s)\n",
                               priv->id, priv->dev->name));
-                    sinfo->rx[chan].pkts_f_netif++;
+                    bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_F_NETIF), 1);
                     skb->dev = priv->dev;
                     skb_reserve(skb, 2);    /* 16 byte align the IP fields. */
 
@@ -3889,7 +5377,7 @@ bkn_do_api_rx(bkn_switch_info_t *sinfo, int chan, int budget)
                         }
                         if (skb == NULL) {
                             /* Consumed by call-back */
-                            sinfo->rx[chan].pkts_d_callback++;
+                            bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_CALLBACK), 1);
                             break;
                         }
                     }
@@ -3914,43 +5402,30 @@ bkn_do_api_rx(bkn_switch_info_t *sinfo, int chan, int budget)
                     }
                     DBG_DUNE(("skb protocol 0x%04x\n", skb->protocol));
 
-                    /*
-                     * Disable configuration API while the spinlock is released.
-                     */
-                    sinfo->cfg_api_locked = 1;
-                    /* Unlock while calling up network stack */
-                    spin_unlock(&sinfo->lock);
-                    if (use_napi) {
-                        netif_receive_skb(skb);
-                    } else {
-                        netif_rx(skb);
-                    }
-                    spin_lock(&sinfo->lock);
-                    /* Re-enable configuration API once spinlock is regained. */
-                    sinfo->cfg_api_locked = 0;
+                    bkn_rx_deliver(sinfo, chan, skb);
 
                     if (filter->kf.mirror_type == KCOM_DEST_T_API ||
                         dbg_pkt_enable) {
                         DBG_FLTR(("Mirror to Rx API\n"));
-                        sinfo->rx[chan].pkts_m_api++;
+                        bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_M_API), 1);
                         drop_api = 0;
                     }
                 } else {
                     DBG_FLTR(("Unknown netif %d\n",
                               filter->kf.dest_id));
-                    sinfo->rx[chan].pkts_d_unkn_netif++;
+                    bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_UNKN_NETIF), 1);
                 }
                 break;
             default:
                 /* Drop packet */
                 DBG_FLTR(("Unknown dest type %d\n",
                           filter->kf.dest_type));
-                sinfo->rx[chan].pkts_d_unkn_dest++;
+                bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_UNKN_DEST), 1);
                 break;
             }
         } else {
             DBG_PKT(("Rx packet dropped.\n"));
-            sinfo->rx[chan].pkts_d_no_match++;
+            bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_NO_MATCH), 1);
         }
         if (drop_api) {
             /* If count is zero, the DCB will just be recycled */
@@ -4014,7 +5489,7 @@ bkn_skb_rx_netif_process(bkn_switch_info_t *sinfo, int dest_id, int chan,
         skb = knet_rx_cb(skb, sinfo->dev_no, rx_cb_meta);
         if (skb == NULL) {
             /* Consumed by call-back */
-            sinfo->rx[chan].pkts_d_callback++;
+            bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_CALLBACK), 1);
             priv->stats.rx_dropped++;
             return -1;
         }
@@ -4092,16 +5567,26 @@ bkn_do_skb_rx(bkn_switch_info_t *sinfo, int chan, int budget)
                 sinfo->napi_poll_again = 1;
             }
         }
-        sinfo->rx[chan].pkts++;
         skb = desc->skb;
 
         DBG_DCB_RX(("Rx%d SKB DMA done (%d).\n", chan, sinfo->rx[chan].dirty));
-        BKN_DMA_UNMAP_SINGLE(sinfo->dma_dev,
-                             desc->skb_dma, desc->dma_size,
-                             BKN_DMA_FROMDEV);
-        desc->skb_dma = 0;
+#ifdef BKN_PAGE_POOL_SUPPORT
+        if (desc->page != NULL) {
+            skb = bkn_rx_pool_build_skb(sinfo, chan, desc);
+            if (skb == NULL) {
+                goto rx_dcb_done;
+            }
+        } else
+#endif
+        {
+            BKN_DMA_UNMAP_SINGLE(sinfo->dma_dev,
+                                 desc->skb_dma, desc->dma_size,
+                                 BKN_DMA_FROMDEV);
+            desc->skb_dma = 0;
+        }
 
         pktlen = dcb[sinfo->dcb_wsize-1] & 0xffff;
+        bkn_stats_pkt(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_PKTS), pktlen);
         priv = netdev_priv(sinfo->dev);
         bkn_dump_pkt(skb->data, pktlen, XGS_DMA_RX_CHAN);
 
@@ -4226,12 +5711,14 @@ bkn_do_skb_rx(bkn_switch_info_t *sinfo, int chan, int budget)
             }
         }
         DBG_PKT(("Rx packet (%d bytes).\n", pktlen));
-        if (filter) {
+        if (filter && bkn_filter_rate_drop(sinfo, filter, chan)) {
+            priv->stats.rx_dropped++;
+        } else if (filter) {
             DBG_FLTR(("Match filter ID %d\n", filter->kf.id));
             switch (filter->kf.dest_type) {
             case KCOM_DEST_T_API:
                 DBG_FLTR(("Send to Rx API\n"));
-                sinfo->rx[chan].pkts_f_api++;
+                bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_F_API), 1);
                 bkn_api_rx_copy_from_skb(sinfo, chan, desc, 0);
                 break;
             case KCOM_DEST_T_NETIF:
@@ -4241,16 +5728,19 @@ bkn_do_skb_rx(bkn_switch_info_t *sinfo, int chan, int budget)
 
                     /* Check that software link is up */
                     if (!netif_carrier_ok(priv->dev)) {
-                        sinfo->rx[chan].pkts_d_no_link++;
+                        bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_NO_LINK), 1);
+                        break;
+                    }
+                    if (bkn_netif_rate_drop(sinfo, priv, chan)) {
                         break;
                     }
                     DBG_FLTR(("Send to netif %d (%s)\n",
                               priv->id, priv->dev->name));
-                    sinfo->rx[chan].pkts_f_netif++;
+                    bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_F_NETIF), 1);
 
                     if ((filter->kf.mirror_type == KCOM_DEST_T_API) ||
                         dbg_pkt_enable) {
-                        sinfo->rx[chan].pkts_m_api++;
+                        bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_M_API), 1);
                         bkn_api_rx_copy_from_skb(sinfo, chan, desc,
                                                  priv->rx_hwts);
                     }
@@ -4316,10 +5806,11 @@ bkn_do_skb_rx(bkn_switch_info_t *sinfo, int chan, int budget)
                         if (filter->kf.mirror_type == KCOM_DEST_T_NETIF) {
                             mpriv = bkn_netif_lookup(sinfo, filter->kf.mirror_id);
                             /* Clone skb for mirror_to netinf */
-                            if (mpriv && netif_carrier_ok(mpriv->dev)) {
+                            if (mpriv && netif_carrier_ok(mpriv->dev) &&
+                                !bkn_netif_rate_drop(sinfo, mpriv, chan)) {
                                 mskb = skb_clone(skb, GFP_ATOMIC);
                                 if (mskb == NULL) {
-                                    sinfo->rx[chan].pkts_d_no_skb++;
+                                    bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_NO_SKB), 1);
                                 }
                             }
                         }
@@ -4355,10 +5846,11 @@ bkn_do_skb_rx(bkn_switch_info_t *sinfo, int chan, int budget)
                         /* Clone skb for mirror_to netinf */
                         if (filter->kf.mirror_type == KCOM_DEST_T_NETIF) {
                             mpriv = bkn_netif_lookup(sinfo, filter->kf.mirror_id);
-                            if (mpriv && netif_carrier_ok(mpriv->dev)) {
+                            if (mpriv && netif_carrier_ok(mpriv->dev) &&
+                                !bkn_netif_rate_drop(sinfo, mpriv, chan)) {
                                 mskb = skb_clone(skb, GFP_ATOMIC);
                                 if (mskb == NULL) {
-                                    sinfo->rx[chan].pkts_d_no_skb++;
+                                    bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_NO_SKB), 1);
                                 } else {
                                     mpriv->stats.rx_packets++;
                                     mpriv->stats.rx_bytes += mskb->len;
@@ -4372,67 +5864,34 @@ bkn_do_skb_rx(bkn_switch_info_t *sinfo, int chan, int budget)
                     }
                     if (mskb) {
                         /* Send up to mirror_to netif */
-                        sinfo->rx[chan].pkts_m_netif++;
-                        /*
-                        * Disable configuration API while the spinlock
-                        * is released.
-                        */
-                        sinfo->cfg_api_locked = 1;
-
-                        /* Unlock while calling up network stack */
-                        spin_unlock(&sinfo->lock);
-                        if (use_napi) {
-                            netif_receive_skb(mskb);
-                        } else {
-                            netif_rx(mskb);
-                        }
-                        spin_lock(&sinfo->lock);
-                        /*
-                        * Re-enable configuration API once the spinlock
-                        * is regained.
-                        */
-                        sinfo->cfg_api_locked = 0;
+                        bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_M_NETIF), 1);
+                        bkn_rx_deliver(sinfo, chan, mskb);
                     }
 
                     /* Ensure that we reallocate SKB for this DCB */
                     desc->skb = NULL;
-                    /*
-                     * Disable configuration API while the spinlock
-                     * is released.
-                     */
-                    sinfo->cfg_api_locked = 1;
-
-                    /* Unlock while calling up network stack */
-                    spin_unlock(&sinfo->lock);
-                    if (use_napi) {
-                        netif_receive_skb(skb);
-                    } else {
-                        netif_rx(skb);
-                    }
-                    spin_lock(&sinfo->lock);
-                    /*
-                     * Re-enable configuration API once the spinlock
-                     * is regained.
-                     */
-                    sinfo->cfg_api_locked = 0;
+                    bkn_rx_deliver(sinfo, chan, skb);
                 } else {
                     DBG_FLTR(("Unknown netif %d\n",
                               filter->kf.dest_id));
-                    sinfo->rx[chan].pkts_d_unkn_netif++;
+                    bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_UNKN_NETIF), 1);
                 }
                 break;
             default:
                 /* Drop packet */
                 DBG_FLTR(("Unknown dest type %d\n",
                           filter->kf.dest_type));
-                sinfo->rx[chan].pkts_d_unkn_dest++;
+                bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_UNKN_DEST), 1);
                 break;
             }
         } else {
             DBG_PKT(("Rx packet dropped.\n"));
-            sinfo->rx[chan].pkts_d_no_match++;
+            bkn_stats_add(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_NO_MATCH), 1);
             priv->stats.rx_dropped++;
         }
+#ifdef BKN_PAGE_POOL_SUPPORT
+rx_dcb_done:
+#endif
         dcb[sinfo->dcb_wsize-1] &= ~(1 << 31);
         if (++sinfo->rx[chan].dirty >= MAX_RX_DCBS) {
             sinfo->rx[chan].dirty = 0;
@@ -4765,7 +6224,7 @@ bkn_api_tx(bkn_switch_info_t *sinfo)
     if (list_empty(&sinfo->tx.api_dcb_list)) {
         sinfo->tx.api_active = 0;
     } else {
-        sinfo->tx.pkts++;
+        bkn_stats_add(sinfo, BKN_STATS_TX(BKN_TX_STATS_PKTS), 1);
         dcb_chain = list_entry(sinfo->tx.api_dcb_list.next,
                                bkn_dcb_chain_t, list);
         DBG_DCB_TX(("Start API Tx DMA, first DCB @ 0x%08x (%d DCBs).\n",
@@ -5424,12 +6883,18 @@ bkn_open(struct net_device *dev)
     bkn_priv_t *priv = netdev_priv(dev);
     bkn_switch_info_t *sinfo = priv->sinfo;
     unsigned long flags;
+    int chan;
 
     /* Check if base device */
     if (priv->id <= 0) {
         /* NAPI used only on base device */
         if (use_napi) {
             bkn_napi_enable(dev, &sinfo->napi);
+            if (rx_chan_napi) {
+                for (chan = 0; chan < NUM_RX_CHAN; chan++) {
+                    bkn_napi_enable(dev, &sinfo->rx[chan].rxn.napi);
+                }
+            }
         }
 
         /* Start DMA when base device is started */
@@ -5615,9 +7080,20 @@ bkn_poll(struct napi_struct *napi, int budget)
     DBG_NAPI(("NAPI poll on %s.\n", sinfo->dev->name));
 
     sinfo->napi_poll_again = 0;
+    sinfo->rx_batching = rx_batch || rx_chan_napi;
 
     rx_dcbs_done = dev_do_dma(sinfo, budget);
 
+    if (sinfo->rx_batching) {
+        /* Deliver queued skbs with a single unlock */
+        sinfo->rx_batching = 0;
+        sinfo->cfg_api_locked = 1;
+        spin_unlock_irqrestore(&sinfo->lock, flags);
+        bkn_rx_batch_deliver(sinfo);
+        spin_lock_irqsave(&sinfo->lock, flags);
+        sinfo->cfg_api_locked = 0;
+    }
+
     if (sinfo->napi_poll_again || rx_dcbs_done >= budget) {
         /* Force poll again */
         rx_dcbs_done = budget;
@@ -5638,6 +7114,7 @@ bkn_stop(struct net_device *dev)
     bkn_priv_t *priv = netdev_priv(dev);
     bkn_switch_info_t *sinfo = priv->sinfo;
     unsigned long flags;
+    int chan;
 
     netif_stop_queue(dev);
 
@@ -5646,6 +7123,12 @@ bkn_stop(struct net_device *dev)
         /* NAPI used only on base device */
         if (use_napi) {
             bkn_napi_disable(dev, &sinfo->napi);
+            if (rx_chan_napi) {
+                for (chan = 0; chan < NUM_RX_CHAN; chan++) {
+                    bkn_napi_disable(dev, &sinfo->rx[chan].rxn.napi);
+                    skb_queue_purge(&sinfo->rx[chan].rxn.queue);
+                }
+            }
         }
         /* Suspend all devices if base device is stopped */
         if (basedev_suspend) {
@@ -5726,6 +7209,80 @@ bkn_hw_tstamp_tx_config(bkn_switch_info_t *sinfo,
     return 0;
 }
 
+/*
+ * Tx DMA doorbell
+ *
+ * In Continuous DMA mode new Tx DCBs are handed to the DMA engine by
+ * moving the halt location. While the network stack signals that more
+ * packets follow (xmit_more), this is deferred for up to tx_batch
+ * packets. Caller must hold the driver lock.
+ */
+static void
+bkn_tx_doorbell(bkn_switch_info_t *sinfo)
+{
+    if (sinfo->tx.db_pending == 0) {
+        return;
+    }
+    sinfo->tx.db_pending = 0;
+    if (sinfo->tx.api_active) {
+        /* Halt location is restored when switching back from API Tx */
+        return;
+    }
+    /* DMA run to the new halt location */
+    bkn_cdma_goto(sinfo, XGS_DMA_TX_CHAN,
+                  sinfo->tx.desc[sinfo->tx.cur].dcb_dma);
+    bkn_stats_add(sinfo, BKN_STATS_TX(BKN_TX_STATS_DOORBELLS), 1);
+}
+
+/*
+ * Advertise the space bkn_tx needs in front of and after the packet,
+ * so the network stack allocates it up front and Tx skbs normally
+ * need no reallocation.
+ */
+static void
+bkn_tx_headroom_set(bkn_switch_info_t *sinfo, bkn_priv_t *priv)
+{
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,27))
+    int headroom = 0;
+
+    /* RCPU packets carry their own headers in the RCPU encapsulation */
+    if ((priv->flags & KCOM_NETIF_F_RCPU_ENCAP) == 0) {
+        if (device_is_sand(sinfo)) {
+            headroom = priv->system_headers_size +
+                       BKN_DPP_OTSH_SIZE_BYTE + 4;
+        } else if (sinfo->cmic_type == 'x' && priv->port >= 0) {
+            headroom = PKT_TX_HDR_SIZE + 4;
+        }
+        if (priv->port < 0 || (priv->flags & KCOM_NETIF_F_ADD_TAG)) {
+            headroom += TAG_SZ;
+        }
+    }
+    priv->dev->needed_headroom = headroom;
+    priv->dev->needed_tailroom = FCS_SZ;
+#endif
+}
+
+/*
+ * Netif Tx
+ *
+ * A Tx DCB is reserved under the driver lock before the packet is
+ * modified, so the packet can still be returned to the network stack
+ * when the Tx ring is full. Encapsulation, skb reallocation, Tx
+ * call-back, DCB setup and DMA mapping are then done without the
+ * lock, and the lock is taken again only to copy the prepared DCB
+ * into the ring.
+ *
+ * Tx throughput can be measured with pktgen against a KNET netif:
+ *   modprobe pktgen
+ *   echo "add_device <netif>" > /proc/net/pktgen/kpktgend_0
+ *   echo "count 10000000" > /proc/net/pktgen/<netif>
+ *   echo "pkt_size 64" > /proc/net/pktgen/<netif>
+ *   echo "burst 32" > /proc/net/pktgen/<netif>
+ *   echo "start" > /proc/net/pktgen/pgctrl
+ *   cat /proc/net/pktgen/<netif>
+ * The pktgen burst setting marks packets with xmit_more, and the Tx
+ * doorbells counter in /proc/bcm/knet/dstats shows the batching.
+ */
 static int
 bkn_tx(struct sk_buff *skb, struct net_device *dev)
 {
@@ -5740,6 +7297,10 @@ bkn_tx(struct sk_buff *skb, struct net_device *dev)
     unsigned long flags;
     uint8_t cpu_channel = 0;
     int headroom, tailroom;
+    bkn_desc_info_t *desc;
+    uint32_t dcb[BKN_DCB_WSIZE_MAX], *meta;
+    uint64_t skb_dma;
+    int more = BKN_XMIT_MORE(skb);
 
     DBG_VERB(("Netif Tx: Len=%d priv->id=%d\n", skb->len, priv->id));
 
@@ -5759,203 +7320,117 @@ bkn_tx(struct sk_buff *skb, struct net_device *dev)
     if (!netif_carrier_ok(dev)) {
         DBG_WARN(("Tx drop: Netif link is down.\n"));
         priv->stats.tx_dropped++;
-        sinfo->tx.pkts_d_no_link++;
+        bkn_stats_add(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_NO_LINK), 1);
         dev_kfree_skb_any(skb);
         return 0;
     }
 
+    /*
+     * Reserve a Tx DCB before the packet is modified. One DCB is
+     * always kept free for switching to BCM API Tx.
+     */
     spin_lock_irqsave(&sinfo->lock, flags);
+    if (sinfo->tx.free - sinfo->tx.reserved <= 1) {
+        DBG_VERB(("Tx busy: No DMA resources\n"));
+        bkn_stats_add(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_DMA_RESRC), 1);
+        bkn_suspend_tx(sinfo);
+        bkn_tx_doorbell(sinfo);
+        spin_unlock_irqrestore(&sinfo->lock, flags);
+        return BKN_NETDEV_TX_BUSY;
+    }
+    sinfo->tx.reserved++;
+    spin_unlock_irqrestore(&sinfo->lock, flags);
 
-    if (sinfo->tx.free > 1) {
-        bkn_desc_info_t *desc = &sinfo->tx.desc[sinfo->tx.cur];
-        uint32_t *dcb, *meta;
+    pktdata = skb->data;
+    pktlen = skb->len;
 
-        pktdata = skb->data;
-        pktlen = skb->len;
+    if (device_is_sand(sinfo)) {
+        hdrlen = priv->system_headers_size;
 
-        if (device_is_sand(sinfo)) {
-            hdrlen = priv->system_headers_size;
+        /* Account for extra OAM-TS header. */
+        if ((bkn_skb_tx_flags(skb) & SKBTX_HW_TSTAMP) &&
+            (hdrlen > (BKN_DNX_PTCH_2_SIZE))) {
+            /* T_LOCAL_PORT intf will use PTCH_2 + ITMH */
+            hdrlen += BKN_DPP_OTSH_SIZE_BYTE;
+        }
 
-            /* Account for extra OAM-TS header. */
-            if ((bkn_skb_tx_flags(skb) & SKBTX_HW_TSTAMP) &&
-                (hdrlen > (BKN_DNX_PTCH_2_SIZE))) {
-                /* T_LOCAL_PORT intf will use PTCH_2 + ITMH */
-                hdrlen += BKN_DPP_OTSH_SIZE_BYTE;
-            }
+    }
+    else {
+        hdrlen = (sinfo->cmic_type == 'x' ) ? PKT_TX_HDR_SIZE : 0;
+    }
+    rcpulen = 0;
+    sop = 0;
 
+    if (priv->flags & KCOM_NETIF_F_RCPU_ENCAP) {
+        rcpulen = RCPU_HDR_SIZE;
+        if (skb->len < (rcpulen + 14)) {
+            DBG_WARN(("Tx drop: Invalid RCPU encapsulation\n"));
+            priv->stats.tx_dropped++;
+            bkn_stats_add(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_RCPU_ENCAP), 1);
+            goto tx_drop;
         }
-        else {
-            hdrlen = (sinfo->cmic_type == 'x' ) ? PKT_TX_HDR_SIZE : 0;
+        if (check_rcpu_signature &&
+            PKT_U16_GET(skb->data, 18) != sinfo->rcpu_sig) {
+            DBG_WARN(("Tx drop: Invalid RCPU signature\n"));
+            priv->stats.tx_dropped++;
+            bkn_stats_add(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_RCPU_SIG), 1);
+            goto tx_drop;
         }
-        rcpulen = 0;
-        sop = 0;
 
-        if (priv->flags & KCOM_NETIF_F_RCPU_ENCAP) {
-            rcpulen = RCPU_HDR_SIZE;
-            if (skb->len < (rcpulen + 14)) {
-                DBG_WARN(("Tx drop: Invalid RCPU encapsulation\n"));
-                priv->stats.tx_dropped++;
-                sinfo->tx.pkts_d_rcpu_encap++;
-                dev_kfree_skb_any(skb);
-                spin_unlock_irqrestore(&sinfo->lock, flags);
-                return 0;
-            }
-            if (check_rcpu_signature &&
-                PKT_U16_GET(skb->data, 18) != sinfo->rcpu_sig) {
-                DBG_WARN(("Tx drop: Invalid RCPU signature\n"));
+        if (device_is_sand(sinfo)) {
+            /* Dune devices don't use meta data */
+            sop = 0;
+            /* Get CPU channel from RCPU.cpu_channel */
+            cpu_channel =  skb->data[29];
+            /* System headers are supposed to be set by users in RCPU mode. */
+            hdrlen = 0;
+        } else if (skb->data[21] & RCPU_F_MODHDR) {
+            sop = skb->data[RCPU_HDR_SIZE];
+            switch (sop) {
+            case 0xff:
+            case 0x81:
+            case 0xfb:
+            case 0xfc:
+                break;
+            default:
+                DBG_WARN(("Tx drop: Invalid RCPU meta data\n"));
                 priv->stats.tx_dropped++;
-                sinfo->tx.pkts_d_rcpu_sig++;
-                dev_kfree_skb_any(skb);
-                spin_unlock_irqrestore(&sinfo->lock, flags);
-                return 0;
+                bkn_stats_add(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_RCPU_META), 1);
+                goto tx_drop;
             }
-
-            if (device_is_sand(sinfo)) {
-                /* Dune devices don't use meta data */
-                sop = 0;
-                /* Get CPU channel from RCPU.cpu_channel */
-                cpu_channel =  skb->data[29];
-                /* System headers are supposed to be set by users in RCPU mode. */
-                hdrlen = 0;
-            } else if (skb->data[21] & RCPU_F_MODHDR) {
-                sop = skb->data[RCPU_HDR_SIZE];
-                switch (sop) {
-                case 0xff:
-                case 0x81:
-                case 0xfb:
-                case 0xfc:
-                    break;
-                default:
-                    DBG_WARN(("Tx drop: Invalid RCPU meta data\n"));
+            if (sinfo->cmic_type != 'x') {
+                if (skb->len < (rcpulen + RCPU_TX_META_SIZE + 14)) {
+                    DBG_WARN(("Tx drop: Invalid RCPU encapsulation\n"));
                     priv->stats.tx_dropped++;
-                    sinfo->tx.pkts_d_rcpu_meta++;
-                    dev_kfree_skb_any(skb);
-                    spin_unlock_irqrestore(&sinfo->lock, flags);
-                    return 0;
-                }
-                if (sinfo->cmic_type != 'x') {
-                    if (skb->len < (rcpulen + RCPU_TX_META_SIZE + 14)) {
-                        DBG_WARN(("Tx drop: Invalid RCPU encapsulation\n"));
-                        priv->stats.tx_dropped++;
-                        sinfo->tx.pkts_d_rcpu_encap++;
-                        dev_kfree_skb_any(skb);
-                        spin_unlock_irqrestore(&sinfo->lock, flags);
-                        return 0;
-                    }
-                    rcpulen += RCPU_TX_META_SIZE;
+                    bkn_stats_add(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_RCPU_ENCAP), 1);
+                    goto tx_drop;
                 }
+                rcpulen += RCPU_TX_META_SIZE;
             }
-            /* Skip over RCPU encapsulation */
-            pktdata = &skb->data[rcpulen];
-            pktlen -= rcpulen;
+        }
+        /* Skip over RCPU encapsulation */
+        pktdata = &skb->data[rcpulen];
+        pktlen -= rcpulen;
 
-            /* CPU packets require tag */
-            if (sop == 0) {
-                if (device_is_sand(sinfo)) {
-                    /*
-                     * There should be Module Header + PTCH_2 + [ITMH] on JR2,
-                     * PTCH_2 +[ITMH] on JR1
-                     */
-                } else {
-                    hdrlen = 0;
-                    tpid = PKT_U16_GET(pktdata, 12);
-                    if (tpid != 0x8100) {
-                        if (skb_header_cloned(skb)) {
-                            /* Current SKB cannot be modified */
-                            DBG_SKB(("Realloc Tx SKB\n"));
-                            /*
-                             * New SKB needs extra TAG_SZ for VLAN tag
-                             * and extra FCS_SZ for Ethernet FCS.
-                             */
-                            headroom = TAG_SZ;
-                            tailroom = FCS_SZ;
-                            new_skb = skb_copy_expand(skb,
-                                                      headroom + skb_headroom(skb),
-                                                      tailroom + skb_tailroom(skb),
-                                                      GFP_ATOMIC);
-                            if (new_skb == NULL) {
-                                DBG_WARN(("Tx drop: No SKB memory\n"));
-                                priv->stats.tx_dropped++;
-                                sinfo->tx.pkts_d_no_skb++;
-                                dev_kfree_skb_any(skb);
-                                spin_unlock_irqrestore(&sinfo->lock, flags);
-                                return 0;
-                            }
-                            /* Remove rcpulen from buffer. */
-                            skb_pull(new_skb, rcpulen);
-                            /* Extended by TAG_SZ at the start of buffer. */
-                            skb_push(new_skb, TAG_SZ);
-                            /* Restore the data before the tag. */
-                            memcpy(new_skb->data, pktdata, 12);
-                            bkn_skb_tstamp_copy(new_skb, skb);
-                            dev_kfree_skb_any(skb);
-                            skb = new_skb;
-                            pktdata = skb->data;
-                            rcpulen = 0;
-                        } else {
-                            /* Add tag to RCPU header space */
-                            DBG_SKB(("Expand into unused RCPU header\n"));
-                            rcpulen -= TAG_SZ;
-                            pktdata = &skb->data[rcpulen];
-                            for (idx = 0; idx < 12; idx++) {
-                                pktdata[idx] = pktdata[idx + TAG_SZ];
-                            }
-                        }
-                        pktdata[12] = 0x81;
-                        pktdata[13] = 0x00;
-                        pktdata[14] = (priv->vlan >> 8) & 0xf;
-                        pktdata[15] = priv->vlan & 0xff;
-                        pktlen += TAG_SZ;
-                    }
-                }
-            }
-        } else {
-            if (((sinfo->cmic_type == 'x') && (priv->port >= 0))
-                    || device_is_sand(sinfo)) {
-                if (skb_header_cloned(skb) || skb_headroom(skb) < hdrlen + 4) {
-                    /* Current SKB cannot be modified */
-                    DBG_SKB(("Realloc Tx SKB\n"));
-                    if (device_is_sand(sinfo)) {
-                        headroom = hdrlen;
-                    } else {
-                        headroom = hdrlen + 4;
-                    }
-                    tailroom = FCS_SZ;
-                    new_skb = skb_copy_expand(skb,
-                                              headroom + skb_headroom(skb),
-                                              tailroom + skb_tailroom(skb),
-                                              GFP_ATOMIC);
-                    if (new_skb == NULL) {
-                        DBG_WARN(("Tx drop: No SKB memory\n"));
-                        priv->stats.tx_dropped++;
-                        sinfo->tx.pkts_d_no_skb++;
-                        dev_kfree_skb_any(skb);
-                        spin_unlock_irqrestore(&sinfo->lock, flags);
-                        return 0;
-                    }
-                    skb_push(new_skb, hdrlen);
-                    bkn_skb_tstamp_copy(new_skb, skb);
-                    dev_kfree_skb_any(skb);
-                    skb = new_skb;
-                } else {
-                    DBG_SKB(("Expand Tx SKB\n"));
-                    skb_push(skb, hdrlen);
-                }
-                memset(skb->data, 0, hdrlen);
-                pktdata = skb->data;
-                pktlen += hdrlen;
+        /* CPU packets require tag */
+        if (sop == 0) {
+            if (device_is_sand(sinfo)) {
+                /*
+                 * There should be Module Header + PTCH_2 + [ITMH] on JR2,
+                 * PTCH_2 +[ITMH] on JR1
+                 */
             } else {
                 hdrlen = 0;
-            }
-
-            if (priv->port < 0 || (priv->flags & KCOM_NETIF_F_ADD_TAG)) {
-                DBG_DUNE(("ADD VLAN TAG\n"));
-                /* Need to add VLAN tag if packet is untagged */
-                tpid = PKT_U16_GET(skb->data, hdrlen + 12);
+                tpid = PKT_U16_GET(pktdata, 12);
                 if (tpid != 0x8100) {
-                    if (skb_header_cloned(skb) || skb_headroom(skb) < 4) {
+                    if (skb_header_cloned(skb)) {
                         /* Current SKB cannot be modified */
                         DBG_SKB(("Realloc Tx SKB\n"));
+                        bkn_stats_add(sinfo, BKN_STATS_TX(BKN_TX_STATS_REALLOC), 1);
+                        /*
+                         * New SKB needs extra TAG_SZ for VLAN tag
+                         * and extra FCS_SZ for Ethernet FCS.
+                         */
                         headroom = TAG_SZ;
                         tailroom = FCS_SZ;
                         new_skb = skb_copy_expand(skb,
@@ -5965,356 +7440,445 @@ bkn_tx(struct sk_buff *skb, struct net_device *dev)
                         if (new_skb == NULL) {
                             DBG_WARN(("Tx drop: No SKB memory\n"));
                             priv->stats.tx_dropped++;
-                            sinfo->tx.pkts_d_no_skb++;
-                            dev_kfree_skb_any(skb);
-                            spin_unlock_irqrestore(&sinfo->lock, flags);
-                            return 0;
+                            bkn_stats_add(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_NO_SKB), 1);
+                            goto tx_drop;
                         }
+                        /* Remove rcpulen from buffer. */
+                        skb_pull(new_skb, rcpulen);
+                        /* Extended by TAG_SZ at the start of buffer. */
                         skb_push(new_skb, TAG_SZ);
-                        memcpy(new_skb->data, pktdata, hdrlen + 12);
+                        /* Restore the data before the tag. */
+                        memcpy(new_skb->data, pktdata, 12);
                         bkn_skb_tstamp_copy(new_skb, skb);
                         dev_kfree_skb_any(skb);
                         skb = new_skb;
+                        pktdata = skb->data;
+                        rcpulen = 0;
                     } else {
-                        /* Add tag to existing buffer */
-                        DBG_SKB(("Expand Tx SKB\n"));
-                        skb_push(skb, TAG_SZ);
-                        for (idx = 0; idx < hdrlen + 12; idx++) {
-                            skb->data[idx] = skb->data[idx + TAG_SZ];
+                        /* Add tag to RCPU header space */
+                        DBG_SKB(("Expand into unused RCPU header\n"));
+                        rcpulen -= TAG_SZ;
+                        pktdata = &skb->data[rcpulen];
+                        for (idx = 0; idx < 12; idx++) {
+                            pktdata[idx] = pktdata[idx + TAG_SZ];
                         }
                     }
-                    pktdata = skb->data;
-                    pktdata[hdrlen + 12] = 0x81;
-                    pktdata[hdrlen + 13] = 0x00;
-                    pktdata[hdrlen + 14] = (priv->vlan >> 8) & 0xf;
-                    pktdata[hdrlen + 15] = priv->vlan & 0xff;
+                    pktdata[12] = 0x81;
+                    pktdata[13] = 0x00;
+                    pktdata[14] = (priv->vlan >> 8) & 0xf;
+                    pktdata[15] = priv->vlan & 0xff;
                     pktlen += TAG_SZ;
                 }
             }
         }
-
-        /* Pad packet if needed */
-        taglen = 0;
-        tpid = PKT_U16_GET(pktdata, hdrlen + 12);
-        if (tpid == 0x8100) {
-            taglen = 4;
-        }
-        if (pktlen < (60 + taglen + hdrlen)) {
-            pktlen = (60 + taglen + hdrlen);
-            if (SKB_PADTO(skb, pktlen) != 0) {
-                DBG_WARN(("Tx drop: skb_padto failed\n"));
-                priv->stats.tx_dropped++;
-                sinfo->tx.pkts_d_pad_fail++;
+    } else {
+        if (((sinfo->cmic_type == 'x') && (priv->port >= 0))
+                || device_is_sand(sinfo)) {
+            if (skb_header_cloned(skb) || skb_headroom(skb) < hdrlen + 4) {
+                /* Current SKB cannot be modified */
+                DBG_SKB(("Realloc Tx SKB\n"));
+                bkn_stats_add(sinfo, BKN_STATS_TX(BKN_TX_STATS_REALLOC), 1);
+                if (device_is_sand(sinfo)) {
+                    headroom = hdrlen;
+                } else {
+                    headroom = hdrlen + 4;
+                }
+                tailroom = FCS_SZ;
+                new_skb = skb_copy_expand(skb,
+                                          headroom + skb_headroom(skb),
+                                          tailroom + skb_tailroom(skb),
+                                          GFP_ATOMIC);
+                if (new_skb == NULL) {
+                    DBG_WARN(("Tx drop: No SKB memory\n"));
+                    priv->stats.tx_dropped++;
+                    bkn_stats_add(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_NO_SKB), 1);
+                    goto tx_drop;
+                }
+                skb_push(new_skb, hdrlen);
+                bkn_skb_tstamp_copy(new_skb, skb);
                 dev_kfree_skb_any(skb);
-                spin_unlock_irqrestore(&sinfo->lock, flags);
-                return 0;
+                skb = new_skb;
+            } else {
+                DBG_SKB(("Expand Tx SKB\n"));
+                skb_push(skb, hdrlen);
             }
-            /* skb_padto may update the skb->data pointer */
-            pktdata = &skb->data[rcpulen];
-        }
-
-        if ((pktlen + FCS_SZ) > SOC_DCB_KNET_COUNT_MASK) {
-            DBG_WARN(("Tx drop: size of pkt (%d) is out of range(%d)\n",
-                     (pktlen + FCS_SZ), SOC_DCB_KNET_COUNT_MASK));
-            sinfo->tx.pkts_d_over_limit++;
-            priv->stats.tx_dropped++;
-            dev_kfree_skb_any(skb);
-            spin_unlock_irqrestore(&sinfo->lock, flags);
-            return 0;
+            memset(skb->data, 0, hdrlen);
+            pktdata = skb->data;
+            pktlen += hdrlen;
+        } else {
+            hdrlen = 0;
         }
 
-        dcb = desc->dcb_mem;
-        meta = (sinfo->cmic_type == 'x') ? (uint32_t *)pktdata : dcb;
-        memset(dcb, 0, sinfo->dcb_wsize * sizeof(uint32_t));
-        if (priv->flags & KCOM_NETIF_F_RCPU_ENCAP) {
-            if (device_is_sand(sinfo)) {
-                if (sinfo->cmic_type == 'x') {
-                    dcb[2] |= 1 << 19;
-                    /* Given Module Header exists and set first byte to be CPU channel  */
-                    pktdata[0] = cpu_channel;
-                } else {
-                    dcb[1] |= 1 << 19;
-                    /* Set CPU channel */
-                    dcb[2] = (cpu_channel & 0xff) << 24;
-                }
-
-            } else if (sop != 0) {
-                /* If module header SOP is non-zero, use RCPU meta data */
-                if (sinfo->cmic_type == 'x') {
-                    dcb[2] |= 1 << 19;
-                } else {
-                    metalen = (sinfo->dcb_wsize - 3) * sizeof(uint32_t);
-                    if (metalen > RCPU_TX_META_SIZE) {
-                        metalen = RCPU_TX_META_SIZE;
+        if (priv->port < 0 || (priv->flags & KCOM_NETIF_F_ADD_TAG)) {
+            DBG_DUNE(("ADD VLAN TAG\n"));
+            /* Need to add VLAN tag if packet is untagged */
+            tpid = PKT_U16_GET(skb->data, hdrlen + 12);
+            if (tpid != 0x8100) {
+                if (skb_header_cloned(skb) || skb_headroom(skb) < 4) {
+                    /* Current SKB cannot be modified */
+                    DBG_SKB(("Realloc Tx SKB\n"));
+                    bkn_stats_add(sinfo, BKN_STATS_TX(BKN_TX_STATS_REALLOC), 1);
+                    headroom = TAG_SZ;
+                    tailroom = FCS_SZ;
+                    new_skb = skb_copy_expand(skb,
+                                              headroom + skb_headroom(skb),
+                                              tailroom + skb_tailroom(skb),
+                                              GFP_ATOMIC);
+                    if (new_skb == NULL) {
+                        DBG_WARN(("Tx drop: No SKB memory\n"));
+                        priv->stats.tx_dropped++;
+                        bkn_stats_add(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_NO_SKB), 1);
+                        goto tx_drop;
                     }
-                    metadata = (uint32_t *)&skb->data[RCPU_HDR_SIZE];
-                    for (idx = 0; idx < BYTES2WORDS(metalen); idx++) {
-                        dcb[idx + 2] = ntohl(metadata[idx]);
+                    skb_push(new_skb, TAG_SZ);
+                    memcpy(new_skb->data, pktdata, hdrlen + 12);
+                    bkn_skb_tstamp_copy(new_skb, skb);
+                    dev_kfree_skb_any(skb);
+                    skb = new_skb;
+                } else {
+                    /* Add tag to existing buffer */
+                    DBG_SKB(("Expand Tx SKB\n"));
+                    skb_push(skb, TAG_SZ);
+                    for (idx = 0; idx < hdrlen + 12; idx++) {
+                        skb->data[idx] = skb->data[idx + TAG_SZ];
                     }
-                    dcb[1] |= 1 << 19;
                 }
+                pktdata = skb->data;
+                pktdata[hdrlen + 12] = 0x81;
+                pktdata[hdrlen + 13] = 0x00;
+                pktdata[hdrlen + 14] = (priv->vlan >> 8) & 0xf;
+                pktdata[hdrlen + 15] = priv->vlan & 0xff;
+                pktlen += TAG_SZ;
             }
-        } else if (priv->port >= 0) {
-            /* Send to physical port */
+        }
+    }
+
+    /* Pad packet if needed */
+    taglen = 0;
+    tpid = PKT_U16_GET(pktdata, hdrlen + 12);
+    if (tpid == 0x8100) {
+        taglen = 4;
+    }
+    if (pktlen < (60 + taglen + hdrlen)) {
+        pktlen = (60 + taglen + hdrlen);
+        if (SKB_PADTO(skb, pktlen) != 0) {
+            DBG_WARN(("Tx drop: skb_padto failed\n"));
+            priv->stats.tx_dropped++;
+            bkn_stats_add(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_PAD_FAIL), 1);
+            goto tx_drop;
+        }
+        /* skb_padto may update the skb->data pointer */
+        pktdata = &skb->data[rcpulen];
+    }
+
+    if ((pktlen + FCS_SZ) > SOC_DCB_KNET_COUNT_MASK) {
+        DBG_WARN(("Tx drop: size of pkt (%d) is out of range(%d)\n",
+                 (pktlen + FCS_SZ), SOC_DCB_KNET_COUNT_MASK));
+        bkn_stats_add(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_OVER_LIMIT), 1);
+        priv->stats.tx_dropped++;
+        goto tx_drop;
+    }
+
+    meta = (sinfo->cmic_type == 'x') ? (uint32_t *)pktdata : dcb;
+    memset(dcb, 0, sinfo->dcb_wsize * sizeof(uint32_t));
+    if (priv->flags & KCOM_NETIF_F_RCPU_ENCAP) {
+        if (device_is_sand(sinfo)) {
             if (sinfo->cmic_type == 'x') {
                 dcb[2] |= 1 << 19;
+                /* Given Module Header exists and set first byte to be CPU channel  */
+                pktdata[0] = cpu_channel;
             } else {
                 dcb[1] |= 1 << 19;
-            }
-            switch (sinfo->dcb_type) {
-            case 23:
-            case 26:
-            case 30:
-            case 31:
-            case 34:
-            case 37:
-                dcb[2] = 0x81000000;
-                dcb[3] = priv->port;
-                dcb[3] |= (priv->qnum & 0xc00) << 20;
-                dcb[4] = 0x00040000;
-                dcb[4] |= (priv->qnum & 0x3ff) << 8;
-                break;
-            case 24:
-                dcb[2] = 0xff000000;
-                dcb[3] = 0x00000100;
-                dcb[4] = priv->port;
-                dcb[4] |= (priv->qnum & 0xfff) << 14;
-                break;
-            case 28:
-                /*
-                 * If KCOM_NETIF_T_PORT, add PTCH+ITMH header
-                 * If KCOM_NETIF_T_VLAN, add PTCH+header
-                 */
-                pktdata = skb->data;
-                memcpy(&pktdata[0], priv->system_headers, priv->system_headers_size);
                 /* Set CPU channel */
-                dcb[2] = ((priv->qnum & 0xff) << 24);
-                break;
-            case 29:
-                dcb[2] = 0x81000000;
-                dcb[3] = priv->port;
-                dcb[4] = 0x00100000;
-                dcb[4] |= (priv->qnum & 0xfff) << 8;
-                break;
-            case 32:
-                dcb[2] = 0x81000000;
-                dcb[3] = priv->port;
-                dcb[4] = 0x00004000;
-                dcb[4] |= (priv->qnum & 0x3f) << 8;
-                break;
-            case 33:
-                dcb[2] = 0x81000000;
-                dcb[3] = (priv->port) << 2;
-                dcb[4] = 0x00100000;
-                dcb[4] |= (priv->qnum & 0xfff) << 8;
-                break;
-            case 35:
-                dcb[2] = 0x81000000;
-                dcb[3] = (priv->port) << 4;
-                dcb[4] = 0x00400000;
-                dcb[4] |= (priv->qnum & 0x3fff) << 8;
-                break;
-            case 36:
-                if (sinfo->cmic_type == 'x') {
-                    meta[0] = htonl(0x81000000);
-                    meta[1] = htonl(priv->port);
-                    meta[2] = htonl(0x00008000 | (priv->qnum & 0x3f) << 9);
-                } else {
-                    dcb[2] = 0x81000000;
-                    dcb[3] = priv->port;
-                    dcb[4] = 0x00008000;
-                    dcb[4] |= (priv->qnum & 0x3f) << 9;
-                }
-                break;
-            case 38:
-                if (sinfo->cmic_type == 'x') {
-                    meta[0] = htonl(0x81000000);
-                    meta[1] = htonl(priv->port);
-                    meta[2] = htonl(0x00004000 | (priv->qnum & 0x3f) << 8);
-                } else {
-                    dcb[2] = 0x81000000;
-                    dcb[3] = priv->port;
-                    dcb[4] = 0x00004000;
-                    dcb[4] |= (priv->qnum & 0x3f) << 8;
-                }
-                break;
-            case 39:
-                if (device_is_dnx(sinfo)) {
-                    /*
-                     * if KCOM_NETIF_T_PORT, add MH+PTCH+ITMH header
-                     * if KCOM_NETIF_T_VLAN, add MH+PTCH+header
-                     */
-                    pktdata = skb->data;
-                    memcpy(&pktdata[0], priv->system_headers, priv->system_headers_size);
+                dcb[2] = (cpu_channel & 0xff) << 24;
+            }
+
+        } else if (sop != 0) {
+            /* If module header SOP is non-zero, use RCPU meta data */
+            if (sinfo->cmic_type == 'x') {
+                dcb[2] |= 1 << 19;
+            } else {
+                metalen = (sinfo->dcb_wsize - 3) * sizeof(uint32_t);
+                if (metalen > RCPU_TX_META_SIZE) {
+                    metalen = RCPU_TX_META_SIZE;
                 }
-                break;
-            case 40:
-                if (sinfo->cmic_type == 'x') {
-                    meta[0] = htonl(0x81000000);
-                    meta[1] = htonl(priv->port | (priv->qnum & 0xc00) << 20);
-                    meta[2] = htonl(0x00040000 | (priv->qnum & 0x3ff) << 8);
-                } else {
-                    dcb[2] = 0x81000000;
-                    dcb[3] = priv->port;
-                    dcb[3] |= (priv->qnum & 0xc00) << 20;
-                    dcb[4] = 0x00040000;
-                    dcb[4] |= (priv->qnum & 0x3ff) << 8;
+                metadata = (uint32_t *)&skb->data[RCPU_HDR_SIZE];
+                for (idx = 0; idx < BYTES2WORDS(metalen); idx++) {
+                    dcb[idx + 2] = ntohl(metadata[idx]);
                 }
-                break;
-            default:
-                dcb[2] = 0xff000000;
-                dcb[3] = 0x00000100;
-                dcb[4] = priv->port;
-                break;
+                dcb[1] |= 1 << 19;
             }
         }
-
-        /* Optional SKB updates */
-        if (knet_tx_cb != NULL) {
-            KNET_SKB_CB(skb)->netif_user_data = priv->cb_user_data;
-            KNET_SKB_CB(skb)->dcb_type = sinfo->dcb_type & 0xFFFF;
-            skb = knet_tx_cb(skb, sinfo->dev_no, meta);
-            if (skb == NULL) {
-                /* Consumed by call-back */
-                DBG_WARN(("Tx drop: Consumed by call-back\n"));
-                priv->stats.tx_dropped++;
-                sinfo->tx.pkts_d_callback++;
-                spin_unlock_irqrestore(&sinfo->lock, flags);
-                return 0;
+    } else if (priv->port >= 0) {
+        /* Send to physical port */
+        if (sinfo->cmic_type == 'x') {
+            dcb[2] |= 1 << 19;
+        } else {
+            dcb[1] |= 1 << 19;
+        }
+        switch (sinfo->dcb_type) {
+        case 23:
+        case 26:
+        case 30:
+        case 31:
+        case 34:
+        case 37:
+            dcb[2] = 0x81000000;
+            dcb[3] = priv->port;
+            dcb[3] |= (priv->qnum & 0xc00) << 20;
+            dcb[4] = 0x00040000;
+            dcb[4] |= (priv->qnum & 0x3ff) << 8;
+            break;
+        case 24:
+            dcb[2] = 0xff000000;
+            dcb[3] = 0x00000100;
+            dcb[4] = priv->port;
+            dcb[4] |= (priv->qnum & 0xfff) << 14;
+            break;
+        case 28:
+            /*
+             * If KCOM_NETIF_T_PORT, add PTCH+ITMH header
+             * If KCOM_NETIF_T_VLAN, add PTCH+header
+             */
+            pktdata = skb->data;
+            memcpy(&pktdata[0], priv->system_headers, priv->system_headers_size);
+            /* Set CPU channel */
+            dcb[2] = ((priv->qnum & 0xff) << 24);
+            break;
+        case 29:
+            dcb[2] = 0x81000000;
+            dcb[3] = priv->port;
+            dcb[4] = 0x00100000;
+            dcb[4] |= (priv->qnum & 0xfff) << 8;
+            break;
+        case 32:
+            dcb[2] = 0x81000000;
+            dcb[3] = priv->port;
+            dcb[4] = 0x00004000;
+            dcb[4] |= (priv->qnum & 0x3f) << 8;
+            break;
+        case 33:
+            dcb[2] = 0x81000000;
+            dcb[3] = (priv->port) << 2;
+            dcb[4] = 0x00100000;
+            dcb[4] |= (priv->qnum & 0xfff) << 8;
+            break;
+        case 35:
+            dcb[2] = 0x81000000;
+            dcb[3] = (priv->port) << 4;
+            dcb[4] = 0x00400000;
+            dcb[4] |= (priv->qnum & 0x3fff) << 8;
+            break;
+        case 36:
+            if (sinfo->cmic_type == 'x') {
+                meta[0] = htonl(0x81000000);
+                meta[1] = htonl(priv->port);
+                meta[2] = htonl(0x00008000 | (priv->qnum & 0x3f) << 9);
+            } else {
+                dcb[2] = 0x81000000;
+                dcb[3] = priv->port;
+                dcb[4] = 0x00008000;
+                dcb[4] |= (priv->qnum & 0x3f) << 9;
             }
-            /* Restore (possibly) altered packet variables
-             * bit0 -bit15 of dcb[1] is used to save requested byte count
-             */
-            if ((skb->len + FCS_SZ) <= SOC_DCB_KNET_COUNT_MASK) {
-                pktlen = skb->len;
-                if (pktlen < (60 + taglen + hdrlen)) {
-                    pktlen = (60 + taglen + hdrlen);
-                    if (SKB_PADTO(skb, pktlen) != 0) {
-                        DBG_WARN(("Tx drop: skb_padto failed\n"));
-                        priv->stats.tx_dropped++;
-                        sinfo->tx.pkts_d_pad_fail++;
-                        dev_kfree_skb_any(skb);
-                        spin_unlock_irqrestore(&sinfo->lock, flags);
-                        return 0;
-                    }
-                    DBG_SKB(("Packet padded to %d bytes after tx callback\n", pktlen));
-                }
+            break;
+        case 38:
+            if (sinfo->cmic_type == 'x') {
+                meta[0] = htonl(0x81000000);
+                meta[1] = htonl(priv->port);
+                meta[2] = htonl(0x00004000 | (priv->qnum & 0x3f) << 8);
+            } else {
+                dcb[2] = 0x81000000;
+                dcb[3] = priv->port;
+                dcb[4] = 0x00004000;
+                dcb[4] |= (priv->qnum & 0x3f) << 8;
+            }
+            break;
+        case 39:
+            if (device_is_dnx(sinfo)) {
+                /*
+                 * if KCOM_NETIF_T_PORT, add MH+PTCH+ITMH header
+                 * if KCOM_NETIF_T_VLAN, add MH+PTCH+header
+                 */
                 pktdata = skb->data;
-                if (sinfo->cmic_type == 'x') {
-                    meta = (uint32_t *)pktdata;
-                }
+                memcpy(&pktdata[0], priv->system_headers, priv->system_headers_size);
+            }
+            break;
+        case 40:
+            if (sinfo->cmic_type == 'x') {
+                meta[0] = htonl(0x81000000);
+                meta[1] = htonl(priv->port | (priv->qnum & 0xc00) << 20);
+                meta[2] = htonl(0x00040000 | (priv->qnum & 0x3ff) << 8);
             } else {
-                DBG_WARN(("Tx drop: size of pkt (%d) is out of range(%d)\n",
-                         (pktlen + FCS_SZ), SOC_DCB_KNET_COUNT_MASK));
-                sinfo->tx.pkts_d_over_limit++;
-                priv->stats.tx_dropped++;
-                sinfo->tx.pkts_d_callback++;
-                dev_kfree_skb_any(skb);
-                spin_unlock_irqrestore(&sinfo->lock, flags);
-                return 0;
+                dcb[2] = 0x81000000;
+                dcb[3] = priv->port;
+                dcb[3] |= (priv->qnum & 0xc00) << 20;
+                dcb[4] = 0x00040000;
+                dcb[4] |= (priv->qnum & 0x3ff) << 8;
             }
+            break;
+        default:
+            dcb[2] = 0xff000000;
+            dcb[3] = 0x00000100;
+            dcb[4] = priv->port;
+            break;
         }
+    }
 
-        /* Do Tx timestamping */
-        if (bkn_skb_tx_flags(skb) & SKBTX_HW_TSTAMP) {
-            KNET_SKB_CB(skb)->hwts = priv->tx_hwts;
-            if ((priv->port >= 0) && (priv->tx_hwts & HWTSTAMP_TX_ON)) {
-                /* TwoStep Processing of ptp-packets */
-                KNET_SKB_CB(skb)->port = priv->phys_port;
-                bkn_hw_tstamp_tx_config(sinfo, priv->tx_hwts, hdrlen, skb, meta);
+    /* Optional SKB updates */
+    if (knet_tx_cb != NULL) {
+        KNET_SKB_CB(skb)->netif_user_data = priv->cb_user_data;
+        KNET_SKB_CB(skb)->dcb_type = sinfo->dcb_type & 0xFFFF;
+        skb = knet_tx_cb(skb, sinfo->dev_no, meta);
+        if (skb == NULL) {
+            /* Consumed by call-back */
+            DBG_WARN(("Tx drop: Consumed by call-back\n"));
+            priv->stats.tx_dropped++;
+            bkn_stats_add(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_CALLBACK), 1);
+            goto tx_release;
+        }
+        /* Restore (possibly) altered packet variables
+         * bit0 -bit15 of dcb[1] is used to save requested byte count
+         */
+        if ((skb->len + FCS_SZ) <= SOC_DCB_KNET_COUNT_MASK) {
+            pktlen = skb->len;
+            if (pktlen < (60 + taglen + hdrlen)) {
+                pktlen = (60 + taglen + hdrlen);
+                if (SKB_PADTO(skb, pktlen) != 0) {
+                    DBG_WARN(("Tx drop: skb_padto failed\n"));
+                    priv->stats.tx_dropped++;
+                    bkn_stats_add(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_PAD_FAIL), 1);
+                    goto tx_drop;
+                }
+                DBG_SKB(("Packet padded to %d bytes after tx callback\n", pktlen));
+            }
+            pktdata = skb->data;
+            if (sinfo->cmic_type == 'x') {
+                meta = (uint32_t *)pktdata;
+            }
+        } else {
+            DBG_WARN(("Tx drop: size of pkt (%d) is out of range(%d)\n",
+                     (pktlen + FCS_SZ), SOC_DCB_KNET_COUNT_MASK));
+            bkn_stats_add(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_OVER_LIMIT), 1);
+            priv->stats.tx_dropped++;
+            bkn_stats_add(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_CALLBACK), 1);
+            goto tx_drop;
+        }
+    }
 
-                bkn_skb_tx_flags(skb) |= SKBTX_IN_PROGRESS;
-                bkn_skb_tx_timestamp(skb);
+    /* Do Tx timestamping */
+    if (bkn_skb_tx_flags(skb) & SKBTX_HW_TSTAMP) {
+        KNET_SKB_CB(skb)->hwts = priv->tx_hwts;
+        if ((priv->port >= 0) && (priv->tx_hwts & HWTSTAMP_TX_ON)) {
+            /* TwoStep Processing of ptp-packets */
+            KNET_SKB_CB(skb)->port = priv->phys_port;
+            bkn_hw_tstamp_tx_config(sinfo, priv->tx_hwts, hdrlen, skb, meta);
 
-            } else if (priv->tx_hwts & HWTSTAMP_TX_ONESTEP_SYNC) {
+            bkn_skb_tx_flags(skb) |= SKBTX_IN_PROGRESS;
+            bkn_skb_tx_timestamp(skb);
 
-                /* OneStep Processing of ptp-packets */
-                KNET_SKB_CB(skb)->port = priv->phys_port;
-                KNET_SKB_CB(skb)->ts = 0;
-                bkn_hw_tstamp_tx_config(sinfo, priv->tx_hwts, hdrlen, skb,
-                                        ((priv->port >= 0) ? meta : NULL));
+        } else if (priv->tx_hwts & HWTSTAMP_TX_ONESTEP_SYNC) {
 
-                if (KNET_SKB_CB(skb)->ts != 0) {
-                    bkn_skb_tx_flags(skb) |= SKBTX_IN_PROGRESS;
-                    bkn_skb_tx_timestamp(skb);
-                }
+            /* OneStep Processing of ptp-packets */
+            KNET_SKB_CB(skb)->port = priv->phys_port;
+            KNET_SKB_CB(skb)->ts = 0;
+            bkn_hw_tstamp_tx_config(sinfo, priv->tx_hwts, hdrlen, skb,
+                                    ((priv->port >= 0) ? meta : NULL));
 
+            if (KNET_SKB_CB(skb)->ts != 0) {
+                bkn_skb_tx_flags(skb) |= SKBTX_IN_PROGRESS;
+                bkn_skb_tx_timestamp(skb);
             }
 
-            /* Increment ptp tx counters. */
-            priv->ptp_stats_tx++;
         }
 
-        /* Prepare for DMA */
-        desc->skb = skb;
-        /*
-         * Add FCS bytes
-         * FCS bytes are always appended to packet by MAC on Dune devices
-         */
-        if (!device_is_sand(sinfo)) {
-            pktlen = pktlen + FCS_SZ;
-        }
-        desc->dma_size = pktlen;
-        desc->skb_dma = BKN_DMA_MAP_SINGLE(sinfo->dma_dev,
-                                       pktdata, desc->dma_size,
-                                       BKN_DMA_TODEV);
-        if (BKN_DMA_MAPPING_ERROR(sinfo->dma_dev, desc->skb_dma)) {
-            priv->stats.tx_dropped++;
-            dev_kfree_skb_any(skb);
-            spin_unlock_irqrestore(&sinfo->lock, flags);
-            return 0;
-        }
-        dcb[0] = desc->skb_dma;
+        /* Increment ptp tx counters. */
+        priv->ptp_stats_tx++;
+    }
+
+    /*
+     * Add FCS bytes
+     * FCS bytes are always appended to packet by MAC on Dune devices
+     */
+    if (!device_is_sand(sinfo)) {
+        pktlen = pktlen + FCS_SZ;
+    }
+    skb_dma = BKN_DMA_MAP_SINGLE(sinfo->dma_dev, pktdata, pktlen,
+                                 BKN_DMA_TODEV);
+    if (BKN_DMA_MAPPING_ERROR(sinfo->dma_dev, skb_dma)) {
+        priv->stats.tx_dropped++;
+        goto tx_drop;
+    }
+    dcb[0] = skb_dma;
+    if (sinfo->cmic_type == 'x') {
+        dcb[1] = DMA_TO_BUS_HI(skb_dma >> 32);
+        dcb[2] &= ~SOC_DCB_KNET_COUNT_MASK;
+        dcb[2] |= pktlen;
+    } else {
+        dcb[1] &= ~SOC_DCB_KNET_COUNT_MASK;
+        dcb[1] |= pktlen;
+    }
+    if (CDMA_CH(sinfo, XGS_DMA_TX_CHAN)) {
         if (sinfo->cmic_type == 'x') {
-            dcb[1] = DMA_TO_BUS_HI(desc->skb_dma >> 32);
-            dcb[2] &= ~SOC_DCB_KNET_COUNT_MASK;
-            dcb[2] |= pktlen;
+            dcb[2] |= 1 << 24 | 1 << 16;
         } else {
-            dcb[1] &= ~SOC_DCB_KNET_COUNT_MASK;
-            dcb[1] |= pktlen;
+            dcb[1] |= 1 << 24 | 1 << 16;
         }
+    }
 
-        bkn_dump_dcb("Tx RCPU", dcb, sinfo->dcb_wsize, XGS_DMA_TX_CHAN);
-        DBG_DCB_TX(("Add Tx DCB @ 0x%08x (%d) [%d free] (%d bytes).\n",
-                    (uint32_t)desc->dcb_dma, sinfo->tx.cur,
-                    sinfo->tx.free, pktlen));
-        bkn_dump_pkt(pktdata, pktlen, XGS_DMA_TX_CHAN);
+    spin_lock_irqsave(&sinfo->lock, flags);
 
-        if (CDMA_CH(sinfo, XGS_DMA_TX_CHAN)) {
-            if (sinfo->cmic_type == 'x') {
-                dcb[2] |= 1 << 24 | 1 << 16;
-            } else {
-                dcb[1] |= 1 << 24 | 1 << 16;
-            }
-        } else {
-            bkn_tx_dma_start(sinfo);
-        }
-        if (++sinfo->tx.cur >= MAX_TX_DCBS) {
-            sinfo->tx.cur = 0;
-        }
-        sinfo->tx.free--;
+    sinfo->tx.reserved--;
 
-        if (CDMA_CH(sinfo, XGS_DMA_TX_CHAN) && !sinfo->tx.api_active) {
-            /* DMA run to the new halt location */
-            bkn_cdma_goto(sinfo, XGS_DMA_TX_CHAN,
-                          sinfo->tx.desc[sinfo->tx.cur].dcb_dma);
-        }
+    /* Prepare for DMA */
+    desc = &sinfo->tx.desc[sinfo->tx.cur];
+    memcpy(desc->dcb_mem, dcb, sinfo->dcb_wsize * sizeof(uint32_t));
+    desc->skb = skb;
+    desc->skb_dma = skb_dma;
+    desc->dma_size = pktlen;
+
+    bkn_dump_dcb("Tx RCPU", desc->dcb_mem, sinfo->dcb_wsize, XGS_DMA_TX_CHAN);
+    DBG_DCB_TX(("Add Tx DCB @ 0x%08x (%d) [%d free] (%d bytes).\n",
+                (uint32_t)desc->dcb_dma, sinfo->tx.cur,
+                sinfo->tx.free, pktlen));
+    bkn_dump_pkt(pktdata, pktlen, XGS_DMA_TX_CHAN);
+
+    if (!CDMA_CH(sinfo, XGS_DMA_TX_CHAN)) {
+        bkn_tx_dma_start(sinfo);
+    }
+    if (++sinfo->tx.cur >= MAX_TX_DCBS) {
+        sinfo->tx.cur = 0;
+    }
+    sinfo->tx.free--;
 
-        priv->stats.tx_packets++;
-        priv->stats.tx_bytes += pktlen;
-        sinfo->tx.pkts++;
-    } else {
-        DBG_VERB(("Tx busy: No DMA resources\n"));
-        sinfo->tx.pkts_d_dma_resrc++;
-        bkn_suspend_tx(sinfo);
-        spin_unlock_irqrestore(&sinfo->lock, flags);
-        return BKN_NETDEV_TX_BUSY;
+    if (CDMA_CH(sinfo, XGS_DMA_TX_CHAN)) {
+        sinfo->tx.db_pending++;
+        if (!more || sinfo->tx.db_pending >= tx_batch ||
+            sinfo->tx.free - sinfo->tx.reserved <= 1) {
+            bkn_tx_doorbell(sinfo);
+        }
     }
 
+    priv->stats.tx_packets++;
+    priv->stats.tx_bytes += pktlen;
+    bkn_stats_pkt(sinfo, BKN_STATS_TX(BKN_TX_STATS_PKTS), pktlen);
+
     NETDEV_UPDATE_TRANS_START_TIME(dev);
 
     spin_unlock_irqrestore(&sinfo->lock, flags);
 
+    return 0;
+
+tx_drop:
+    dev_kfree_skb_any(skb);
+tx_release:
+    /* Return the reserved Tx DCB */
+    spin_lock_irqsave(&sinfo->lock, flags);
+    sinfo->tx.reserved--;
+    if (!more) {
+        bkn_tx_doorbell(sinfo);
+    }
+    spin_unlock_irqrestore(&sinfo->lock, flags);
+
     return 0;
 }
 
@@ -6408,6 +7972,7 @@ bkn_rxtick_func(bkn_switch_info_t *sinfo)
     unsigned long flags;
     unsigned long cur_jif, ticks;
     uint32_t pkt_diff;
+    u64 pkts;
     int chan;
 
     spin_lock_irqsave(&sinfo->lock, flags);
@@ -6420,12 +7985,13 @@ bkn_rxtick_func(bkn_switch_info_t *sinfo)
             if (UNET_CH(sinfo, XGS_DMA_RX_CHAN + chan)) {
                 continue;
             }
-            pkt_diff = sinfo->rx[chan].pkts - sinfo->rx[chan].pkts_ref;
+            pkts = bkn_stats_sum(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_PKTS));
+            pkt_diff = pkts - sinfo->rx[chan].pkts_ref;
             cur_jif = jiffies;
             ticks = cur_jif - sinfo->rx[chan].rate_jif;
             sinfo->rx[chan].rate = (pkt_diff * HZ) / ticks;
             sinfo->rx[chan].rate_jif = cur_jif;
-            sinfo->rx[chan].pkts_ref = sinfo->rx[chan].pkts;
+            sinfo->rx[chan].pkts_ref = pkts;
         }
         sinfo->rxticks = 0;
     }
@@ -6517,7 +8083,12 @@ static void
 bkn_destroy_sinfo(bkn_switch_info_t *sinfo)
 {
     list_del(&sinfo->list);
+    bkn_rx_pool_destroy(sinfo);
+#ifdef BKN_RX_RING_SUPPORT
+    bkn_rx_ring_destroy(sinfo);
+#endif
     bkn_free_dcbs(sinfo);
+    free_percpu(sinfo->stats);
     kfree(sinfo);
 }
 
@@ -6525,12 +8096,21 @@ static bkn_switch_info_t *
 bkn_create_sinfo(int dev_no)
 {
     bkn_switch_info_t *sinfo;
-    int chan;
+    int chan, cpu;
 
     if ((sinfo = kmalloc(sizeof(*sinfo), GFP_KERNEL)) == NULL) {
         return NULL;
     }
     memset(sinfo, 0, sizeof(*sinfo));
+    sinfo->stats = alloc_percpu(bkn_pcpu_stats_t);
+    if (sinfo->stats == NULL) {
+        kfree(sinfo);
+        return NULL;
+    }
+    for_each_possible_cpu(cpu) {
+        u64_stats_init(&per_cpu_ptr(sinfo->stats, cpu)->syncp);
+    }
+    spin_lock_init(&sinfo->stats_lock);
     INIT_LIST_HEAD(&sinfo->ndev_list);
     INIT_LIST_HEAD(&sinfo->rxpf_list);
     sinfo->base_addr = lkbde_get_dev_virt(dev_no);
@@ -6560,6 +8140,10 @@ bkn_create_sinfo(int dev_no)
     for (chan = 0; chan < NUM_RX_CHAN; chan++) {
         INIT_LIST_HEAD(&sinfo->rx[chan].api_dcb_list);
         sinfo->rx[chan].use_rx_skb = use_rx_skb;
+        skb_queue_head_init(&sinfo->rx[chan].batch);
+        skb_queue_head_init(&sinfo->rx[chan].rxn.queue);
+        sinfo->rx[chan].rxn.sinfo = sinfo;
+        sinfo->rx[chan].rxn.chan = chan;
     }
 
     /*
@@ -6626,6 +8210,51 @@ bkn_get_drvinfo(struct net_device *dev, struct ethtool_drvinfo *drvinfo)
     strlcpy(drvinfo->bus_info, "N/A", sizeof(drvinfo->bus_info));
 }
 
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,33))
+/* Per Rx queue counters, one queue per Rx DMA channel */
+static int
+bkn_get_sset_count(struct net_device *dev, int sset)
+{
+    if (sset != ETH_SS_STATS) {
+        return -EOPNOTSUPP;
+    }
+    return NUM_RX_CHAN * 2;
+}
+
+static void
+bkn_get_strings(struct net_device *dev, u32 sset, u8 *data)
+{
+    int chan;
+
+    if (sset != ETH_SS_STATS) {
+        return;
+    }
+    for (chan = 0; chan < NUM_RX_CHAN; chan++) {
+        snprintf(data, ETH_GSTRING_LEN, "rx%d_packets", chan);
+        data += ETH_GSTRING_LEN;
+        snprintf(data, ETH_GSTRING_LEN, "rx%d_bytes", chan);
+        data += ETH_GSTRING_LEN;
+    }
+}
+
+static void
+bkn_get_ethtool_stats(struct net_device *dev, struct ethtool_stats *stats,
+                      u64 *data)
+{
+    bkn_priv_t *priv = netdev_priv(dev);
+    bkn_switch_info_t *sinfo = priv->sinfo;
+    unsigned long flags;
+    int chan;
+
+    spin_lock_irqsave(&sinfo->lock, flags);
+    for (chan = 0; chan < NUM_RX_CHAN; chan++) {
+        *data++ = priv->rxq_stats[chan].pkts;
+        *data++ = priv->rxq_stats[chan].bytes;
+    }
+    spin_unlock_irqrestore(&sinfo->lock, flags);
+}
+#endif
+
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(3,5,0))
 static int
 bkn_get_ts_info(struct net_device *dev, struct ethtool_ts_info *info)
@@ -6717,6 +8346,11 @@ static int bkn_set_link_ksettings(struct net_device *netdev,
 
 static const struct ethtool_ops bkn_ethtool_ops = {
     .get_drvinfo        = bkn_get_drvinfo,
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,33))
+    .get_sset_count     = bkn_get_sset_count,
+    .get_strings        = bkn_get_strings,
+    .get_ethtool_stats  = bkn_get_ethtool_stats,
+#endif
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(3,5,0))
     .get_ts_info        = bkn_get_ts_info,
 #endif
@@ -6732,7 +8366,13 @@ bkn_init_ndev(u8 *mac, char *name)
     struct net_device *dev;
 
     /* Create Ethernet device */
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,38))
+    /* With channel NAPI there is one Rx queue per Rx DMA channel */
+    dev = alloc_etherdev_mqs(sizeof(bkn_priv_t), 1,
+                             rx_chan_napi ? NUM_RX_CHAN : 1);
+#else
     dev = alloc_etherdev(sizeof(bkn_priv_t));
+#endif
 
     if (dev == NULL) {
         DBG_WARN(("Error allocating Ethernet device.\n"));
@@ -6935,94 +8575,252 @@ bkn_proc_rate_show(struct seq_file *m, void *v)
             if (UNET_CH(sinfo, XGS_DMA_RX_CHAN + chan)) {
                 continue;
             }
-            seq_printf(m, "  Rx%d max rate  %8u\n",
-                            chan, sinfo->rx[chan].rate_max);
-            seq_printf(m, "  Rx%d max burst %8u\n",
-                            chan, sinfo->rx[chan].burst_max);
-            seq_printf(m, "  Rx%d rate      %8u\n",
-                            chan, sinfo->rx[chan].rate);
-            seq_printf(m, "  Rx%d tokens    %8u\n",
-                            chan, sinfo->rx[chan].tokens);
+            seq_printf(m, "  Rx%d max rate  %8u\n",
+                            chan, sinfo->rx[chan].rate_max);
+            seq_printf(m, "  Rx%d max burst %8u\n",
+                            chan, sinfo->rx[chan].burst_max);
+            seq_printf(m, "  Rx%d rate      %8u\n",
+                            chan, sinfo->rx[chan].rate);
+            seq_printf(m, "  Rx%d tokens    %8u\n",
+                            chan, sinfo->rx[chan].tokens);
+        }
+
+        unit++;
+    }
+    return 0;
+}
+
+static int
+bkn_proc_rate_open(struct inode * inode, struct file * file)
+{
+    return single_open(file, bkn_proc_rate_show, NULL);
+}
+
+/*
+ * Device Rate Control Proc Write Entry
+ *
+ *   Syntax:
+ *   [<unit>:]rx_rate=<rate0>[,<rate1>[,<rate2]]
+ *
+ *   Where <rate0> is packets/sec for the first Rx DMA channel,
+ *   <rate1> is packets/sec for the second Rx DMA channel, etc.
+ *
+ *   Examples:
+ *   rx_rate=5000
+ *   0:rx_rate=10000,10000
+ *   1:rx_rate=10000,5000
+ */
+static ssize_t
+bkn_proc_rate_write(struct file *file, const char *buf,
+                    size_t count, loff_t *loff)
+{
+    bkn_switch_info_t *sinfo;
+    char rate_str[80];
+    char *ptr;
+    int unit, chan;
+
+    if (count > sizeof(rate_str)) {
+        count = sizeof(rate_str) - 1;
+        rate_str[count] = '\0';
+    }
+    if (copy_from_user(rate_str, buf, count)) {
+        return -EFAULT;
+    }
+
+    unit = simple_strtol(rate_str, NULL, 10);
+    sinfo = bkn_sinfo_from_unit(unit);
+    if (sinfo == NULL) {
+        gprintk("Warning: unknown unit: %d\n", unit);
+        return count;
+    }
+
+    if ((ptr = strstr(rate_str, "rx_rate=")) != NULL) {
+        ptr += 7;
+        chan = 0;
+        do {
+            ptr++;
+            sinfo->rx[chan].rate_max = simple_strtol(ptr, NULL, 10);
+        } while ((ptr = strchr(ptr, ',')) != NULL && ++chan < sinfo->rx_chans);
+        bkn_rx_rate_config(sinfo);
+    } else if ((ptr = strstr(rate_str, "rx_burst=")) != NULL) {
+        ptr += 8;
+        chan = 0;
+        do {
+            ptr++;
+            sinfo->rx[chan].burst_max = simple_strtol(ptr, NULL, 10);
+        } while ((ptr = strchr(ptr, ',')) != NULL && ++chan < sinfo->rx_chans);
+        bkn_rx_rate_config(sinfo);
+    } else {
+        gprintk("Warning: unknown configuration setting\n");
+    }
+
+    return count;
+}
+
+struct proc_ops bkn_proc_rate_file_ops = {
+    PROC_OWNER(THIS_MODULE)
+    .proc_open =       bkn_proc_rate_open,
+    .proc_read =       seq_read,
+    .proc_lseek =      seq_lseek,
+    .proc_write =      bkn_proc_rate_write,
+    .proc_release =    single_release,
+};
+
+/*
+ * Filter and Netif Rate Limit Proc Read Entry
+ */
+static int
+bkn_proc_rate_limit_show(struct seq_file *m, void *v)
+{
+    int unit = 0;
+    struct list_head *slist, *list;
+    bkn_switch_info_t *sinfo;
+    bkn_priv_t *priv;
+    bkn_filter_t *filter;
+    unsigned long flags;
+
+    list_for_each(slist, &_sinfo_list) {
+        sinfo = (bkn_switch_info_t *)slist;
+
+        seq_printf(m, "Rate limits (unit %d):\n", unit);
+        spin_lock_irqsave(&sinfo->lock, flags);
+        list_for_each(list, &sinfo->ndev_list) {
+            priv = (bkn_priv_t *)list;
+            if (priv->rate.rate_max == 0 && priv->rate.drops == 0) {
+                continue;
+            }
+            seq_printf(m, "  netif  %3d %-14s rate %8u burst %8u drops %10llu\n",
+                       priv->id, priv->dev->name, priv->rate.rate_max,
+                       priv->rate.burst_max, priv->rate.drops);
         }
-
+        list_for_each(list, &sinfo->rxpf_list) {
+            filter = (bkn_filter_t *)list;
+            if (filter->rate.rate_max == 0 && filter->rate.drops == 0) {
+                continue;
+            }
+            seq_printf(m, "  filter %3d %-14s rate %8u burst %8u drops %10llu\n",
+                       filter->kf.id, filter->kf.desc, filter->rate.rate_max,
+                       filter->rate.burst_max, filter->rate.drops);
+        }
+        spin_unlock_irqrestore(&sinfo->lock, flags);
         unit++;
     }
     return 0;
 }
 
 static int
-bkn_proc_rate_open(struct inode * inode, struct file * file)
+bkn_proc_rate_limit_open(struct inode * inode, struct file * file)
 {
-    return single_open(file, bkn_proc_rate_show, NULL);
+    return single_open(file, bkn_proc_rate_limit_show, NULL);
 }
 
 /*
- * Device Rate Control Proc Write Entry
+ * Filter and Netif Rate Limit Proc Write Entry
  *
  *   Syntax:
- *   [<unit>:]rx_rate=<rate0>[,<rate1>[,<rate2]]
+ *   [<unit>:]netif=<id>,rate=<pps>[,burst=<packets>]
+ *   [<unit>:]filter=<id>,rate=<pps>[,burst=<packets>]
+ *   [<unit>:]clear
  *
- *   Where <rate0> is packets/sec for the first Rx DMA channel,
- *   <rate1> is packets/sec for the second Rx DMA channel, etc.
+ *   Where <id> is a network interface or filter ID. A rate of zero
+ *   removes the limit, and the default burst size is rate/10.
+ *   The clear command resets all rate limit drop counters.
  *
  *   Examples:
- *   rx_rate=5000
- *   0:rx_rate=10000,10000
- *   1:rx_rate=10000,5000
+ *   netif=1,rate=10000
+ *   0:filter=3,rate=500,burst=100
+ *   0:clear
  */
 static ssize_t
-bkn_proc_rate_write(struct file *file, const char *buf,
-                    size_t count, loff_t *loff)
+bkn_proc_rate_limit_write(struct file *file, const char *buf,
+                          size_t count, loff_t *loff)
 {
     bkn_switch_info_t *sinfo;
-    char rate_str[80];
+    struct list_head *list;
+    bkn_priv_t *priv;
+    bkn_filter_t *filter;
+    bkn_rate_t *rl;
+    unsigned long flags;
+    char limit_str[80];
     char *ptr;
-    int unit, chan;
+    int unit, rate, burst;
 
-    if (count > sizeof(rate_str)) {
-        count = sizeof(rate_str) - 1;
-        rate_str[count] = '\0';
+    if (count >= sizeof(limit_str)) {
+        count = sizeof(limit_str) - 1;
     }
-    if (copy_from_user(rate_str, buf, count)) {
+    if (copy_from_user(limit_str, buf, count)) {
         return -EFAULT;
     }
+    limit_str[count] = 0;
 
-    unit = simple_strtol(rate_str, NULL, 10);
+    unit = 0;
+    if (strchr(limit_str, ':') != NULL) {
+        unit = simple_strtol(limit_str, NULL, 10);
+    }
     sinfo = bkn_sinfo_from_unit(unit);
     if (sinfo == NULL) {
         gprintk("Warning: unknown unit: %d\n", unit);
         return count;
     }
 
-    if ((ptr = strstr(rate_str, "rx_rate=")) != NULL) {
-        ptr += 7;
-        chan = 0;
-        do {
-            ptr++;
-            sinfo->rx[chan].rate_max = simple_strtol(ptr, NULL, 10);
-        } while ((ptr = strchr(ptr, ',')) != NULL && ++chan < sinfo->rx_chans);
-        bkn_rx_rate_config(sinfo);
-    } else if ((ptr = strstr(rate_str, "rx_burst=")) != NULL) {
-        ptr += 8;
-        chan = 0;
-        do {
-            ptr++;
-            sinfo->rx[chan].burst_max = simple_strtol(ptr, NULL, 10);
-        } while ((ptr = strchr(ptr, ',')) != NULL && ++chan < sinfo->rx_chans);
-        bkn_rx_rate_config(sinfo);
-    } else {
-        gprintk("Warning: unknown configuration setting\n");
+    if (strstr(limit_str, "clear") != NULL) {
+        spin_lock_irqsave(&sinfo->lock, flags);
+        list_for_each(list, &sinfo->ndev_list) {
+            priv = (bkn_priv_t *)list;
+            priv->rate.drops = 0;
+        }
+        list_for_each(list, &sinfo->rxpf_list) {
+            filter = (bkn_filter_t *)list;
+            filter->rate.drops = 0;
+        }
+        spin_unlock_irqrestore(&sinfo->lock, flags);
+        return count;
+    }
+
+    rate = -1;
+    if ((ptr = strstr(limit_str, "rate=")) != NULL) {
+        rate = simple_strtol(ptr + 5, NULL, 10);
+    }
+    burst = 0;
+    if ((ptr = strstr(limit_str, "burst=")) != NULL) {
+        burst = simple_strtol(ptr + 6, NULL, 10);
+    }
+    if (rate < 0 || burst < 0) {
+        gprintk("Warning: invalid rate limit setting\n");
+        return count;
+    }
+
+    spin_lock_irqsave(&sinfo->lock, flags);
+    rl = NULL;
+    if ((ptr = strstr(limit_str, "netif=")) != NULL) {
+        priv = bkn_netif_lookup(sinfo, simple_strtol(ptr + 6, NULL, 10));
+        if (priv) {
+            rl = &priv->rate;
+        }
+    } else if ((ptr = strstr(limit_str, "filter=")) != NULL) {
+        filter = bkn_filter_lookup(sinfo, simple_strtol(ptr + 7, NULL, 10));
+        if (filter) {
+            rl = &filter->rate;
+        }
+    }
+    if (rl) {
+        bkn_rate_set(rl, rate, burst);
+    }
+    spin_unlock_irqrestore(&sinfo->lock, flags);
+
+    if (rl == NULL) {
+        gprintk("Warning: unknown network interface or filter\n");
     }
 
     return count;
 }
 
-struct proc_ops bkn_proc_rate_file_ops = {
+struct proc_ops bkn_proc_rate_limit_file_ops = {
     PROC_OWNER(THIS_MODULE)
-    .proc_open =       bkn_proc_rate_open,
+    .proc_open =       bkn_proc_rate_limit_open,
     .proc_read =       seq_read,
     .proc_lseek =      seq_lseek,
-    .proc_write =      bkn_proc_rate_write,
+    .proc_write =      bkn_proc_rate_limit_write,
     .proc_release =    single_release,
 };
 
@@ -7420,10 +9218,15 @@ static int
 bkn_proc_stats_show(struct seq_file *m, void *v)
 {
     int unit = 0;
-    struct list_head *list, *flist;
+    struct list_head *list;
     bkn_switch_info_t *sinfo;
     bkn_filter_t *filter;
-    int chan;
+    bkn_filter_cls_t *cls;
+    bkn_filter_tuple_t *tuple;
+    unsigned long flags;
+    u64 rx_pkts[NUM_RX_CHAN];
+    u64 pkts, bytes;
+    int chan, idx;
 
 
     list_for_each(list, &_sinfo_list) {
@@ -7431,28 +9234,59 @@ bkn_proc_stats_show(struct seq_file *m, void *v)
 
         seq_printf(m, "Device stats (unit %d):\n", unit);
         seq_printf(m, "  Interrupts  %10u\n", sinfo->interrupts);
-        seq_printf(m, "  Tx packets  %10u\n", sinfo->tx.pkts);
+        seq_printf(m, "  Tx packets  %10llu\n",
+                   bkn_stats_get(sinfo, BKN_STATS_TX(BKN_TX_STATS_PKTS)));
+        seq_printf(m, "  Tx bytes    %10llu\n",
+                   bkn_stats_get(sinfo, BKN_STATS_TX(BKN_TX_STATS_BYTES)));
         for (chan = 0; chan < sinfo->rx_chans; chan++) {
-            seq_printf(m, "  Rx%d packets %10u\n", chan, sinfo->rx[chan].pkts);
+            rx_pkts[chan] = bkn_stats_get(sinfo,
+                                          BKN_STATS_RX(chan, BKN_RX_STATS_PKTS));
+            seq_printf(m, "  Rx%d packets %10llu\n", chan, rx_pkts[chan]);
+            seq_printf(m, "  Rx%d bytes   %10llu\n", chan,
+                       bkn_stats_get(sinfo,
+                                     BKN_STATS_RX(chan, BKN_RX_STATS_BYTES)));
         }
         for (chan = 0; chan < sinfo->rx_chans; chan++) {
             if (sinfo->interrupts == 0) {
                 /* Avoid divide-by-zero */
                 seq_printf(m, "  Rx%d pkts/intr        -\n", chan);
             } else {
-                seq_printf(m, "  Rx%d pkts/intr %8u\n",
-                           chan, sinfo->rx[chan].pkts / sinfo->interrupts);
+                seq_printf(m, "  Rx%d pkts/intr %8llu\n",
+                           chan, div_u64(rx_pkts[chan], sinfo->interrupts));
             }
         }
         seq_printf(m, "  Timer runs  %10u\n", sinfo->timer_runs);
         seq_printf(m, "  NAPI reruns %10u\n", sinfo->napi_not_done);
 
-        list_for_each(flist, &sinfo->rxpf_list) {
-            filter = (bkn_filter_t *)flist;
-
+        rcu_read_lock();
+        list_for_each_entry_rcu(filter, &sinfo->rxpf_list, list) {
+            bkn_filter_stats_get(sinfo, filter, &pkts, &bytes);
             seq_printf(m, "  Filter %d stats:\n", filter->kf.id);
-            seq_printf(m, "    Hits      %10lu\n", filter->hits);
+            seq_printf(m, "    Hits      %10llu\n", pkts);
+            seq_printf(m, "    Bytes     %10llu\n", bytes);
+        }
+        rcu_read_unlock();
+
+        spin_lock_irqsave(&sinfo->lock, flags);
+        cls = sinfo->rxpf_cls;
+        if (cls) {
+            seq_printf(m, "  Filter tables (%s):\n",
+                       filter_cls ? "enabled" : "disabled");
+            for (idx = 0; idx < cls->num_tuples; idx++) {
+                tuple = cls->tuples[idx];
+                seq_printf(m, "    Table %d: oob %d/%d pkt %d/%d filters %d\n",
+                           idx, tuple->oob_data_offset, tuple->oob_data_size,
+                           tuple->pkt_data_offset, tuple->pkt_data_size,
+                           tuple->filters);
+                seq_printf(m, "      Lookups %10lu\n", tuple->lookups);
+                seq_printf(m, "      Hits    %10lu\n", tuple->hits);
+                seq_printf(m, "      Matches %10lu\n", tuple->matches);
+            }
+            seq_printf(m, "    Linear: filters %d\n", cls->num_linear);
+            seq_printf(m, "      Checks  %10lu\n", cls->linear_checks);
+            seq_printf(m, "      Matches %10lu\n", cls->linear_matches);
         }
+        spin_unlock_irqrestore(&sinfo->lock, flags);
 
         unit++;
     }
@@ -7481,13 +9315,14 @@ bkn_proc_stats_write(struct file *file, const char *buf,
                      size_t count, loff_t *loff)
 {
     bkn_switch_info_t *sinfo;
-    struct list_head *flist;
     bkn_filter_t *filter;
+    bkn_filter_cls_t *cls;
+    unsigned long flags;
     char debug_str[40];
     char *ptr;
     int unit;
     int clear_mask;
-    int chan;
+    int chan, idx;
 
     if (count > sizeof(debug_str)) {
         count = sizeof(debug_str) - 1;
@@ -7517,17 +9352,32 @@ bkn_proc_stats_write(struct file *file, const char *buf,
     }
 
     if (clear_mask) {
-        sinfo->tx.pkts = 0;
+        bkn_stats_clear(sinfo, BKN_STATS_TX(BKN_TX_STATS_PKTS));
+        bkn_stats_clear(sinfo, BKN_STATS_TX(BKN_TX_STATS_BYTES));
         for (chan = 0; chan < sinfo->rx_chans; chan++) {
-            sinfo->rx[chan].pkts = 0;
+            bkn_stats_clear(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_PKTS));
+            bkn_stats_clear(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_BYTES));
         }
         sinfo->interrupts = 0;
         sinfo->timer_runs = 0;
         sinfo->napi_not_done = 0;
-        list_for_each(flist, &sinfo->rxpf_list) {
-            filter = (bkn_filter_t *)flist;
-            filter->hits = 0;
+        rcu_read_lock();
+        list_for_each_entry_rcu(filter, &sinfo->rxpf_list, list) {
+            bkn_filter_stats_clear(sinfo, filter);
+        }
+        rcu_read_unlock();
+        spin_lock_irqsave(&sinfo->lock, flags);
+        cls = sinfo->rxpf_cls;
+        if (cls) {
+            for (idx = 0; idx < cls->num_tuples; idx++) {
+                cls->tuples[idx]->lookups = 0;
+                cls->tuples[idx]->hits = 0;
+                cls->tuples[idx]->matches = 0;
+            }
+            cls->linear_checks = 0;
+            cls->linear_matches = 0;
         }
+        spin_unlock_irqrestore(&sinfo->lock, flags);
     }
 
     return count;
@@ -7554,168 +9404,455 @@ bkn_proc_dstats_show(struct seq_file *m, void *v)
     bkn_switch_info_t *sinfo;
     int chan;
 
-    list_for_each(list, &_sinfo_list) {
-        sinfo = (bkn_switch_info_t *)list;
+    list_for_each(list, &_sinfo_list) {
+        sinfo = (bkn_switch_info_t *)list;
+
+        seq_printf(m, "Device debug stats (unit %d):\n", unit);
+        seq_printf(m, "  Tx drop no skb      %10llu\n",
+                   bkn_stats_get(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_NO_SKB)));
+        seq_printf(m, "  Tx drop rcpu encap  %10llu\n",
+                   bkn_stats_get(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_RCPU_ENCAP)));
+        seq_printf(m, "  Tx drop rcpu sig    %10llu\n",
+                   bkn_stats_get(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_RCPU_SIG)));
+        seq_printf(m, "  Tx drop rcpu meta   %10llu\n",
+                   bkn_stats_get(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_RCPU_META)));
+        seq_printf(m, "  Tx drop pad failed  %10llu\n",
+                   bkn_stats_get(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_PAD_FAIL)));
+        seq_printf(m, "  Tx drop no resource %10llu\n",
+                   bkn_stats_get(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_DMA_RESRC)));
+        seq_printf(m, "  Tx drop callback    %10llu\n",
+                   bkn_stats_get(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_CALLBACK)));
+        seq_printf(m, "  Tx drop no link     %10llu\n",
+                   bkn_stats_get(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_NO_LINK)));
+        seq_printf(m, "  Tx drop oversized   %10llu\n",
+                   bkn_stats_get(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_OVER_LIMIT)));
+        seq_printf(m, "  Tx doorbells        %10llu\n",
+                   bkn_stats_get(sinfo, BKN_STATS_TX(BKN_TX_STATS_DOORBELLS)));
+        seq_printf(m, "  Tx skb realloc      %10llu\n",
+                   bkn_stats_get(sinfo, BKN_STATS_TX(BKN_TX_STATS_REALLOC)));
+        seq_printf(m, "  Tx suspends         %10u\n",
+                        sinfo->tx.suspends);
+        for (chan = 0; chan < sinfo->rx_chans; chan++) {
+            seq_printf(m, "  Rx%d filter to api   %10llu\n", chan,
+                       bkn_stats_get(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_F_API)));
+            seq_printf(m, "  Rx%d filter to netif %10llu\n", chan,
+                       bkn_stats_get(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_F_NETIF)));
+            seq_printf(m, "  Rx%d mirror to api   %10llu\n", chan,
+                       bkn_stats_get(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_M_API)));
+            seq_printf(m, "  Rx%d mirror to netif %10llu\n", chan,
+                       bkn_stats_get(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_M_NETIF)));
+            seq_printf(m, "  Rx%d drop no skb     %10llu\n", chan,
+                       bkn_stats_get(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_NO_SKB)));
+            seq_printf(m, "  Rx%d drop no match   %10llu\n", chan,
+                       bkn_stats_get(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_NO_MATCH)));
+            seq_printf(m, "  Rx%d drop unkn netif %10llu\n", chan,
+                       bkn_stats_get(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_UNKN_NETIF)));
+            seq_printf(m, "  Rx%d drop unkn dest  %10llu\n", chan,
+                       bkn_stats_get(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_UNKN_DEST)));
+            seq_printf(m, "  Rx%d drop callback   %10llu\n", chan,
+                       bkn_stats_get(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_CALLBACK)));
+            seq_printf(m, "  Rx%d drop no link    %10llu\n", chan,
+                       bkn_stats_get(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_NO_LINK)));
+            seq_printf(m, "  Rx%d sync error      %10u\n",
+                            chan, sinfo->rx[chan].sync_err);
+            seq_printf(m, "  Rx%d sync retry      %10u\n",
+                            chan, sinfo->rx[chan].sync_retry);
+            seq_printf(m, "  Rx%d sync maxloop    %10u\n",
+                            chan, sinfo->rx[chan].sync_maxloop);
+            seq_printf(m, "  Rx%d drop no buffer  %10llu\n", chan,
+                       bkn_stats_get(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_NO_API_BUF)));
+            seq_printf(m, "  Rx%d batches         %10llu\n", chan,
+                       bkn_stats_get(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_BATCHES)));
+            seq_printf(m, "  Rx%d batch packets   %10llu\n", chan,
+                       bkn_stats_get(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_BATCH_PKTS)));
+            seq_printf(m, "  Rx%d GRO merged      %10llu\n", chan,
+                       bkn_stats_get(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_GRO_MERGED)));
+            seq_printf(m, "  Rx%d drop backlog    %10llu\n", chan,
+                       bkn_stats_get(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_BACKLOG)));
+            seq_printf(m, "  Rx%d drop rate limit %10llu\n", chan,
+                       bkn_stats_get(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_RATE_LIMIT)));
+            seq_printf(m, "  Rx%d ring            %10llu\n", chan,
+                       bkn_stats_get(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_RING)));
+            seq_printf(m, "  Rx%d drop ring full  %10llu\n", chan,
+                       bkn_stats_get(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_RING_FULL)));
+#ifdef BKN_PAGE_POOL_SUPPORT
+            if (sinfo->rx[chan].page_pool == NULL) {
+                continue;
+            }
+            seq_printf(m, "  Rx%d pool alloc      %10llu\n", chan,
+                       bkn_stats_get(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_POOL_ALLOC)));
+            seq_printf(m, "  Rx%d pool no page    %10llu\n", chan,
+                       bkn_stats_get(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_POOL_NO_PAGE)));
+#ifdef CONFIG_PAGE_POOL_STATS
+            {
+                struct page_pool_stats pp_stats;
+
+                memset(&pp_stats, 0, sizeof(pp_stats));
+                page_pool_get_stats(sinfo->rx[chan].page_pool, &pp_stats);
+                seq_printf(m, "  Rx%d pool fast alloc %10llu\n", chan,
+                           pp_stats.alloc_stats.fast);
+                seq_printf(m, "  Rx%d pool slow alloc %10llu\n", chan,
+                           pp_stats.alloc_stats.slow +
+                           pp_stats.alloc_stats.slow_high_order);
+                seq_printf(m, "  Rx%d pool refill     %10llu\n", chan,
+                           pp_stats.alloc_stats.refill);
+                seq_printf(m, "  Rx%d pool recycled   %10llu\n", chan,
+                           pp_stats.recycle_stats.cached +
+                           pp_stats.recycle_stats.ring);
+                seq_printf(m, "  Rx%d pool ring full  %10llu\n", chan,
+                           pp_stats.recycle_stats.ring_full);
+                seq_printf(m, "  Rx%d pool released   %10llu\n", chan,
+                           pp_stats.recycle_stats.released_refcnt);
+            }
+#endif
+#endif
+        }
+        unit++;
+    }
+    return 0;
+}
+
+static int bkn_proc_dstats_open(struct inode * inode, struct file * file)
+{
+    return single_open(file, bkn_proc_dstats_show, NULL);
+}
+
+/*
+ * Device Debug Statistics Proc Write Entry
+ *
+ *   Syntax:
+ *   [<unit>:]clear[=all|tx|rx[<chan>]]
+ *
+ *   Where <mask> corresponds to the debug module parameter.
+ *
+ *   Examples:
+ *   clear
+ *   0:clear=rx1
+ */
+static ssize_t
+bkn_proc_dstats_write(struct file *file, const char *buf,
+                      size_t count, loff_t *loff)
+{
+    bkn_switch_info_t *sinfo;
+    char debug_str[40];
+    char *ptr;
+    int unit;
+    int clear_mask;
+    int chan;
+
+    if (count > sizeof(debug_str)) {
+        count = sizeof(debug_str) - 1;
+        debug_str[count] = '\0';
+    }
+    if (copy_from_user(debug_str, buf, count)) {
+        return -EFAULT;
+    }
+
+    unit = simple_strtol(debug_str, NULL, 10);
+    sinfo = bkn_sinfo_from_unit(unit);
+    if (sinfo == NULL) {
+        gprintk("Warning: unknown unit: %d\n", unit);
+        return count;
+    }
+
+    clear_mask = 0;
+    if ((ptr = strstr(debug_str, "clear=")) != NULL) {
+        ptr += 6;
+        if (strncmp(ptr, "all", 3) == 0) {
+            clear_mask = ~0;
+        } else if (strncmp(ptr, "dev", 3) == 0) {
+            clear_mask = 0x20;
+        } else if (strncmp(ptr, "tx", 2) == 0) {
+            clear_mask = 0x10;
+        } else if (strncmp(ptr, "rx0", 3) == 0) {
+            clear_mask = (1 << 0);
+        } else if (strncmp(ptr, "rx1", 3) == 0) {
+            clear_mask = (1 << 1);
+        } else if (strncmp(ptr, "rx", 2) == 0) {
+            clear_mask = 0xf;
+        }
+    } else if ((ptr = strstr(debug_str, "clear")) != NULL) {
+        clear_mask = ~0;
+    } else {
+        gprintk("Warning: unknown configuration setting\n");
+    }
+
+    /* Tx counters */
+    if (clear_mask & 0x10) {
+        bkn_stats_clear(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_NO_SKB));
+        bkn_stats_clear(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_RCPU_ENCAP));
+        bkn_stats_clear(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_RCPU_SIG));
+        bkn_stats_clear(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_RCPU_META));
+        bkn_stats_clear(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_PAD_FAIL));
+        bkn_stats_clear(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_OVER_LIMIT));
+        bkn_stats_clear(sinfo, BKN_STATS_TX(BKN_TX_STATS_D_DMA_RESRC));
+        bkn_stats_clear(sinfo, BKN_STATS_TX(BKN_TX_STATS_DOORBELLS));
+        bkn_stats_clear(sinfo, BKN_STATS_TX(BKN_TX_STATS_REALLOC));
+        sinfo->tx.suspends = 0;
+    }
+    /* Rx counters */
+    for (chan = 0; chan < sinfo->rx_chans; chan++) {
+        if (clear_mask & (1 << chan)) {
+            bkn_stats_clear(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_F_API));
+            bkn_stats_clear(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_F_NETIF));
+            bkn_stats_clear(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_M_API));
+            bkn_stats_clear(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_M_NETIF));
+            bkn_stats_clear(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_NO_SKB));
+            bkn_stats_clear(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_NO_MATCH));
+            bkn_stats_clear(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_UNKN_NETIF));
+            bkn_stats_clear(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_UNKN_DEST));
+            bkn_stats_clear(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_NO_API_BUF));
+            bkn_stats_clear(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_BATCHES));
+            bkn_stats_clear(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_BATCH_PKTS));
+            bkn_stats_clear(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_GRO_MERGED));
+            bkn_stats_clear(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_BACKLOG));
+            bkn_stats_clear(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_RATE_LIMIT));
+            bkn_stats_clear(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_RING));
+            bkn_stats_clear(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_D_RING_FULL));
+            bkn_stats_clear(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_POOL_ALLOC));
+            bkn_stats_clear(sinfo, BKN_STATS_RX(chan, BKN_RX_STATS_POOL_NO_PAGE));
+            sinfo->rx[chan].sync_err = 0;
+            sinfo->rx[chan].sync_retry = 0;
+            sinfo->rx[chan].sync_maxloop = 0;
+        }
+    }
+
+    return count;
+}
+
+struct proc_ops bkn_proc_dstats_file_ops = {
+    PROC_OWNER(THIS_MODULE)
+    .proc_open =       bkn_proc_dstats_open,
+    .proc_read =       seq_read,
+    .proc_lseek =      seq_lseek,
+    .proc_write =      bkn_proc_dstats_write,
+    .proc_release =    single_release,
+};
+
+/*
+ * Rx Delivery Benchmark Proc Read Entry
+ */
+static int
+bkn_proc_rx_bench_show(struct seq_file *m, void *v)
+{
+    int unit = 0;
+    struct list_head *list;
+    bkn_switch_info_t *sinfo;
+    u64 pps;
+
+    list_for_each(list, &_sinfo_list) {
+        sinfo = (bkn_switch_info_t *)list;
+
+        seq_printf(m, "Rx delivery benchmark (unit %d):\n", unit);
+        if (sinfo->rx_bench.pkts) {
+            pps = sinfo->rx_bench.ns ?
+                div64_u64(sinfo->rx_bench.pkts * NSEC_PER_SEC,
+                          sinfo->rx_bench.ns) : 0;
+            seq_printf(m, "  netif %d, Rx%d, %d bytes, %s\n",
+                       sinfo->rx_bench.netif, sinfo->rx_bench.chan,
+                       sinfo->rx_bench.size,
+                       rx_chan_napi ? "channel NAPI" : "backlog");
+            seq_printf(m, "  packets  %10llu\n", sinfo->rx_bench.pkts);
+            seq_printf(m, "  time ns  %10llu\n", sinfo->rx_bench.ns);
+            seq_printf(m, "  pps      %10llu\n", pps);
+        }
+        unit++;
+    }
+    return 0;
+}
+
+static int
+bkn_proc_rx_bench_open(struct inode * inode, struct file * file)
+{
+    return single_open(file, bkn_proc_rx_bench_show, NULL);
+}
+
+#define BKN_RX_BENCH_BATCH      64
+#define BKN_RX_BENCH_ETHERTYPE  0x88b5  /* Local experimental Ethertype */
+
+static const uint8_t bkn_rx_bench_smac[6] = { 0x02, 0, 0, 0, 0, 0x01 };
+
+/*
+ * Inject packets into the Rx delivery path of a network interface,
+ * returns the number of packets delivered.
+ */
+static int
+bkn_rx_bench_run(bkn_switch_info_t *sinfo, int id, int count, int size,
+                 int chan)
+{
+    struct sk_buff_head queue;
+    struct sk_buff *skb;
+    struct net_device *dev;
+    bkn_priv_t *priv;
+    unsigned long flags, timeout;
+    ktime_t start;
+    uint8_t *pkt;
+    int sent = 0;
+    int batch, idx;
+
+    spin_lock_irqsave(&sinfo->lock, flags);
+    priv = bkn_netif_lookup(sinfo, id);
+    dev = priv ? priv->dev : NULL;
+    if (dev) {
+        dev_hold(dev);
+    }
+    spin_unlock_irqrestore(&sinfo->lock, flags);
+    if (dev == NULL) {
+        gprintk("Warning: unknown netif ID: %d\n", id);
+        return 0;
+    }
+
+    start = ktime_get();
+    while (sent < count) {
+        batch = count - sent;
+        if (batch > BKN_RX_BENCH_BATCH) {
+            batch = BKN_RX_BENCH_BATCH;
+        }
+        __skb_queue_head_init(&queue);
+        for (idx = 0; idx < batch; idx++) {
+            skb = netdev_alloc_skb_ip_align(dev, size);
+            if (skb == NULL) {
+                break;
+            }
+            pkt = skb_put(skb, size);
+            memset(pkt, 0, size);
+            memcpy(pkt, dev->dev_addr, 6);
+            memcpy(pkt + 6, bkn_rx_bench_smac, 6);
+            pkt[12] = BKN_RX_BENCH_ETHERTYPE >> 8;
+            pkt[13] = BKN_RX_BENCH_ETHERTYPE & 0xff;
+            skb->protocol = eth_type_trans(skb, dev);
+            __skb_queue_tail(&queue, skb);
+        }
+        if (skb_queue_len(&queue) == 0) {
+            break;
+        }
+        sent += skb_queue_len(&queue);
+
+        spin_lock_irqsave(&sinfo->lock, flags);
+        skb_queue_walk(&queue, skb) {
+            bkn_rx_queue_count(sinfo, chan, skb);
+        }
+        spin_unlock_irqrestore(&sinfo->lock, flags);
 
-        seq_printf(m, "Device debug stats (unit %d):\n", unit);
-        seq_printf(m, "  Tx drop no skb      %10u\n",
-                        sinfo->tx.pkts_d_no_skb);
-        seq_printf(m, "  Tx drop rcpu encap  %10u\n",
-                        sinfo->tx.pkts_d_rcpu_encap);
-        seq_printf(m, "  Tx drop rcpu sig    %10u\n",
-                        sinfo->tx.pkts_d_rcpu_sig);
-        seq_printf(m, "  Tx drop rcpu meta   %10u\n",
-                        sinfo->tx.pkts_d_rcpu_meta);
-        seq_printf(m, "  Tx drop pad failed  %10u\n",
-                        sinfo->tx.pkts_d_pad_fail);
-        seq_printf(m, "  Tx drop no resource %10u\n",
-                        sinfo->tx.pkts_d_dma_resrc);
-        seq_printf(m, "  Tx drop callback    %10u\n",
-                        sinfo->tx.pkts_d_callback);
-        seq_printf(m, "  Tx drop no link     %10u\n",
-                        sinfo->tx.pkts_d_no_link);
-        seq_printf(m, "  Tx drop oversized   %10u\n",
-                        sinfo->tx.pkts_d_over_limit);
-        seq_printf(m, "  Tx suspends         %10u\n",
-                        sinfo->tx.suspends);
-        for (chan = 0; chan < sinfo->rx_chans; chan++) {
-            seq_printf(m, "  Rx%d filter to api   %10u\n",
-                            chan, sinfo->rx[chan].pkts_f_api);
-            seq_printf(m, "  Rx%d filter to netif %10u\n",
-                            chan, sinfo->rx[chan].pkts_f_netif);
-            seq_printf(m, "  Rx%d mirror to api   %10u\n",
-                            chan, sinfo->rx[chan].pkts_m_api);
-            seq_printf(m, "  Rx%d mirror to netif %10u\n",
-                            chan, sinfo->rx[chan].pkts_m_netif);
-            seq_printf(m, "  Rx%d drop no skb     %10u\n",
-                            chan, sinfo->rx[chan].pkts_d_no_skb);
-            seq_printf(m, "  Rx%d drop no match   %10u\n",
-                            chan, sinfo->rx[chan].pkts_d_no_match);
-            seq_printf(m, "  Rx%d drop unkn netif %10u\n",
-                            chan, sinfo->rx[chan].pkts_d_unkn_netif);
-            seq_printf(m, "  Rx%d drop unkn dest  %10u\n",
-                            chan, sinfo->rx[chan].pkts_d_unkn_dest);
-            seq_printf(m, "  Rx%d drop callback   %10u\n",
-                            chan, sinfo->rx[chan].pkts_d_callback);
-            seq_printf(m, "  Rx%d drop no link    %10u\n",
-                            chan, sinfo->rx[chan].pkts_d_no_link);
-            seq_printf(m, "  Rx%d sync error      %10u\n",
-                            chan, sinfo->rx[chan].sync_err);
-            seq_printf(m, "  Rx%d sync retry      %10u\n",
-                            chan, sinfo->rx[chan].sync_retry);
-            seq_printf(m, "  Rx%d sync maxloop    %10u\n",
-                            chan, sinfo->rx[chan].sync_maxloop);
-            seq_printf(m, "  Rx%d drop no buffer  %10u\n",
-                            chan, sinfo->rx[chan].pkts_d_no_api_buf);
+        /* Pending softirqs run when bottom halves are enabled again */
+        local_bh_disable();
+        if (rx_chan_napi) {
+            bkn_rx_chan_napi_queue(sinfo, chan, &queue);
+        } else {
+            while ((skb = __skb_dequeue(&queue)) != NULL) {
+                netif_rx(skb);
+            }
         }
-        unit++;
+        local_bh_enable();
+
+        if (idx < batch) {
+            break;
+        }
+        cond_resched();
     }
-    return 0;
-}
 
-static int bkn_proc_dstats_open(struct inode * inode, struct file * file)
-{
-    return single_open(file, bkn_proc_dstats_show, NULL);
+    if (rx_chan_napi) {
+        /* Wait for the channel NAPI to drain its queue */
+        timeout = jiffies + HZ;
+        while (skb_queue_len(&sinfo->rx[chan].rxn.queue) &&
+               time_before(jiffies, timeout)) {
+            usleep_range(50, 100);
+        }
+    }
+
+    sinfo->rx_bench.ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+    sinfo->rx_bench.netif = id;
+    sinfo->rx_bench.chan = chan;
+    sinfo->rx_bench.size = size;
+    sinfo->rx_bench.pkts = sent;
+    dev_put(dev);
+
+    return sent;
 }
 
 /*
- * Device Debug Statistics Proc Write Entry
+ * Rx Delivery Benchmark Proc Write Entry
  *
  *   Syntax:
- *   [<unit>:]clear[=all|tx|rx[<chan>]]
+ *   [<unit>:]netif=<id>,count=<packets>[,size=<bytes>][,chan=<chan>]
  *
- *   Where <mask> corresponds to the debug module parameter.
+ *   Injects synthetic packets into the Rx delivery path of the network
+ *   interface, as if they were received on Rx DMA channel <chan> and
+ *   matched by a filter to the interface. The packets carry the
+ *   interface MAC address and the local experimental Ethertype 0x88b5.
+ *   Packets are delivered by the channel NAPI if rx_chan_napi is set,
+ *   otherwise through the network stack backlog.
  *
  *   Examples:
- *   clear
- *   0:clear=rx1
+ *   netif=1,count=1000000
+ *   0:netif=2,count=100000,size=1500,chan=1
  */
 static ssize_t
-bkn_proc_dstats_write(struct file *file, const char *buf,
-                      size_t count, loff_t *loff)
+bkn_proc_rx_bench_write(struct file *file, const char *buf,
+                        size_t count, loff_t *loff)
 {
     bkn_switch_info_t *sinfo;
-    char debug_str[40];
+    char bench_str[80];
     char *ptr;
-    int unit;
-    int clear_mask;
-    int chan;
+    int unit, id, pkts, size, chan;
 
-    if (count > sizeof(debug_str)) {
-        count = sizeof(debug_str) - 1;
-        debug_str[count] = '\0';
+    if (count >= sizeof(bench_str)) {
+        count = sizeof(bench_str) - 1;
     }
-    if (copy_from_user(debug_str, buf, count)) {
+    if (copy_from_user(bench_str, buf, count)) {
         return -EFAULT;
     }
+    bench_str[count] = 0;
 
-    unit = simple_strtol(debug_str, NULL, 10);
+    unit = 0;
+    if (strchr(bench_str, ':') != NULL) {
+        unit = simple_strtol(bench_str, NULL, 10);
+    }
     sinfo = bkn_sinfo_from_unit(unit);
     if (sinfo == NULL) {
         gprintk("Warning: unknown unit: %d\n", unit);
         return count;
     }
 
-    clear_mask = 0;
-    if ((ptr = strstr(debug_str, "clear=")) != NULL) {
-        ptr += 6;
-        if (strncmp(ptr, "all", 3) == 0) {
-            clear_mask = ~0;
-        } else if (strncmp(ptr, "dev", 3) == 0) {
-            clear_mask = 0x20;
-        } else if (strncmp(ptr, "tx", 2) == 0) {
-            clear_mask = 0x10;
-        } else if (strncmp(ptr, "rx0", 3) == 0) {
-            clear_mask = (1 << 0);
-        } else if (strncmp(ptr, "rx1", 3) == 0) {
-            clear_mask = (1 << 1);
-        } else if (strncmp(ptr, "rx", 2) == 0) {
-            clear_mask = 0xf;
-        }
-    } else if ((ptr = strstr(debug_str, "clear")) != NULL) {
-        clear_mask = ~0;
-    } else {
+    if ((ptr = strstr(bench_str, "netif=")) == NULL) {
         gprintk("Warning: unknown configuration setting\n");
+        return count;
+    }
+    id = simple_strtol(ptr + 6, NULL, 10);
+    pkts = 0;
+    if ((ptr = strstr(bench_str, "count=")) != NULL) {
+        pkts = simple_strtol(ptr + 6, NULL, 10);
+    }
+    size = 64;
+    if ((ptr = strstr(bench_str, "size=")) != NULL) {
+        size = simple_strtol(ptr + 5, NULL, 10);
+    }
+    chan = 0;
+    if ((ptr = strstr(bench_str, "chan=")) != NULL) {
+        chan = simple_strtol(ptr + 5, NULL, 10);
     }
 
-    /* Tx counters */
-    if (clear_mask & 0x10) {
-        sinfo->tx.pkts_d_no_skb = 0;
-        sinfo->tx.pkts_d_rcpu_encap = 0;
-        sinfo->tx.pkts_d_rcpu_sig = 0;
-        sinfo->tx.pkts_d_rcpu_meta = 0;
-        sinfo->tx.pkts_d_pad_fail = 0;
-        sinfo->tx.pkts_d_over_limit = 0;
-        sinfo->tx.pkts_d_dma_resrc = 0;
-        sinfo->tx.suspends = 0;
+    if (pkts <= 0 || size < ETH_ZLEN || size > rx_buffer_size ||
+        chan < 0 || chan >= NUM_RX_CHAN) {
+        gprintk("Warning: invalid benchmark setting\n");
+        return count;
     }
-    /* Rx counters */
-    for (chan = 0; chan < sinfo->rx_chans; chan++) {
-        if (clear_mask & (1 << chan)) {
-            sinfo->rx[chan].pkts_f_api = 0;
-            sinfo->rx[chan].pkts_f_netif = 0;
-            sinfo->rx[chan].pkts_m_api = 0;
-            sinfo->rx[chan].pkts_m_netif = 0;
-            sinfo->rx[chan].pkts_d_no_skb = 0;
-            sinfo->rx[chan].pkts_d_no_match = 0;
-            sinfo->rx[chan].pkts_d_unkn_netif = 0;
-            sinfo->rx[chan].pkts_d_unkn_dest = 0;
-            sinfo->rx[chan].pkts_d_no_api_buf = 0;
-            sinfo->rx[chan].sync_err = 0;
-            sinfo->rx[chan].sync_retry = 0;
-            sinfo->rx[chan].sync_maxloop = 0;
-        }
+    if (rx_chan_napi && !netif_running(sinfo->dev)) {
+        gprintk("Warning: base device is not up\n");
+        return count;
     }
 
+    bkn_rx_bench_run(sinfo, id, pkts, size, chan);
+
     return count;
 }
 
-struct proc_ops bkn_proc_dstats_file_ops = {
+struct proc_ops bkn_proc_rx_bench_file_ops = {
     PROC_OWNER(THIS_MODULE)
-    .proc_open =       bkn_proc_dstats_open,
+    .proc_open =       bkn_proc_rx_bench_open,
     .proc_read =       seq_read,
     .proc_lseek =      seq_lseek,
-    .proc_write =      bkn_proc_dstats_write,
+    .proc_write =      bkn_proc_rx_bench_write,
     .proc_release =    single_release,
 };
 
@@ -7841,6 +9978,10 @@ bkn_proc_init(void)
     if (entry == NULL) {
         return -1;
     }
+    PROC_CREATE(entry, "rate_limit", 0666, bkn_proc_root, &bkn_proc_rate_limit_file_ops);
+    if (entry == NULL) {
+        return -1;
+    }
     PROC_CREATE(entry, "dma", 0, bkn_proc_root, &bkn_seq_dma_file_ops);
     if (entry == NULL) {
         return -1;
@@ -7861,6 +10002,10 @@ bkn_proc_init(void)
     if (entry == NULL) {
         return -1;
     }
+    PROC_CREATE(entry, "rx_bench", 0666, bkn_proc_root, &bkn_proc_rx_bench_file_ops);
+    if (entry == NULL) {
+        return -1;
+    }
 
     return 0;
 }
@@ -7870,14 +10015,199 @@ bkn_proc_cleanup(void)
 {
     remove_proc_entry("link", bkn_proc_root);
     remove_proc_entry("rate", bkn_proc_root);
+    remove_proc_entry("rate_limit", bkn_proc_root);
     remove_proc_entry("dma", bkn_proc_root);
     remove_proc_entry("debug", bkn_proc_root);
     remove_proc_entry("stats", bkn_proc_root);
     remove_proc_entry("dstats", bkn_proc_root);
     remove_proc_entry("ptp_stats", bkn_proc_root);
+    remove_proc_entry("rx_bench", bkn_proc_root);
+    return 0;
+}
+
+#ifdef BKN_STATS_GENL_SUPPORT
+/*
+ * Statistics Generic Netlink Family
+ *
+ * Counters are read the same way as for the proc files, so monitoring
+ * can poll frequently without contending with the Rx and Tx paths.
+ */
+static struct genl_family bkn_stats_genl_family;
+static int bkn_stats_genl_registered;
+
+static int
+bkn_stats_genl_fill_dev(struct sk_buff *skb, bkn_switch_info_t *sinfo)
+{
+    struct nlattr *attr;
+    u64 *cnt;
+    int chan, idx;
+
+    attr = nla_reserve_64bit(skb, BKN_STATS_A_TX,
+                             BKN_TX_STATS_MAX * sizeof(u64), BKN_STATS_A_PAD);
+    if (attr == NULL) {
+        return -EMSGSIZE;
+    }
+    cnt = nla_data(attr);
+    for (idx = 0; idx < BKN_TX_STATS_MAX; idx++) {
+        *cnt++ = bkn_stats_get(sinfo, BKN_STATS_TX(idx));
+    }
+
+    attr = nla_reserve_64bit(skb, BKN_STATS_A_RX,
+                             sinfo->rx_chans * BKN_RX_STATS_MAX * sizeof(u64),
+                             BKN_STATS_A_PAD);
+    if (attr == NULL) {
+        return -EMSGSIZE;
+    }
+    cnt = nla_data(attr);
+    for (chan = 0; chan < sinfo->rx_chans; chan++) {
+        for (idx = 0; idx < BKN_RX_STATS_MAX; idx++) {
+            *cnt++ = bkn_stats_get(sinfo, BKN_STATS_RX(chan, idx));
+        }
+    }
+    return 0;
+}
+
+static int
+bkn_stats_genl_fill_filter(struct sk_buff *skb, bkn_switch_info_t *sinfo,
+                           bkn_filter_t *filter)
+{
+    struct nlattr *nest;
+    u64 pkts, bytes;
+
+    bkn_filter_stats_get(sinfo, filter, &pkts, &bytes);
+
+    nest = nla_nest_start(skb, BKN_STATS_A_FILTER);
+    if (nest == NULL) {
+        return -EMSGSIZE;
+    }
+    if (nla_put_u32(skb, BKN_STATS_FILTER_A_ID, filter->kf.id) ||
+        nla_put_u64_64bit(skb, BKN_STATS_FILTER_A_PKTS, pkts,
+                          BKN_STATS_FILTER_A_PAD) ||
+        nla_put_u64_64bit(skb, BKN_STATS_FILTER_A_BYTES, bytes,
+                          BKN_STATS_FILTER_A_PAD)) {
+        nla_nest_cancel(skb, nest);
+        return -EMSGSIZE;
+    }
+    nla_nest_end(skb, nest);
     return 0;
 }
 
+/*
+ * Dump position is kept in cb->args[0] (unit) and cb->args[1] (zero
+ * until the device counters are sent, then one plus the number of
+ * filters sent).
+ */
+static int
+bkn_stats_genl_dump(struct sk_buff *skb, struct netlink_callback *cb)
+{
+    struct list_head *list;
+    bkn_switch_info_t *sinfo;
+    bkn_filter_t *filter;
+    void *hdr;
+    int unit = 0;
+    int added, full;
+    long fidx;
+
+    list_for_each(list, &_sinfo_list) {
+        sinfo = (bkn_switch_info_t *)list;
+
+        if (unit < cb->args[0]) {
+            unit++;
+            continue;
+        }
+
+        hdr = genlmsg_put(skb, NETLINK_CB(cb->skb).portid,
+                          cb->nlh->nlmsg_seq, &bkn_stats_genl_family,
+                          NLM_F_MULTI, BKN_STATS_CMD_GET);
+        if (hdr == NULL) {
+            break;
+        }
+        if (nla_put_u32(skb, BKN_STATS_A_UNIT, unit)) {
+            genlmsg_cancel(skb, hdr);
+            break;
+        }
+
+        added = 0;
+        full = 0;
+        if (cb->args[1] == 0) {
+            if (bkn_stats_genl_fill_dev(skb, sinfo)) {
+                genlmsg_cancel(skb, hdr);
+                break;
+            }
+            cb->args[1] = 1;
+            added++;
+        }
+
+        fidx = 1;
+        rcu_read_lock();
+        list_for_each_entry_rcu(filter, &sinfo->rxpf_list, list) {
+            if (fidx++ < cb->args[1]) {
+                continue;
+            }
+            if (bkn_stats_genl_fill_filter(skb, sinfo, filter)) {
+                full = 1;
+                break;
+            }
+            cb->args[1]++;
+            added++;
+        }
+        rcu_read_unlock();
+
+        if (added == 0 && full) {
+            genlmsg_cancel(skb, hdr);
+            break;
+        }
+        genlmsg_end(skb, hdr);
+        if (full) {
+            /* Continue with the remaining filters in the next message */
+            break;
+        }
+        cb->args[0] = ++unit;
+        cb->args[1] = 0;
+    }
+
+    return skb->len;
+}
+
+static const struct genl_ops bkn_stats_genl_ops[] = {
+    {
+        .cmd = BKN_STATS_CMD_GET,
+        .dumpit = bkn_stats_genl_dump,
+    },
+};
+
+static struct genl_family bkn_stats_genl_family = {
+    .name = BKN_STATS_GENL_NAME,
+    .version = BKN_STATS_GENL_VERSION,
+    .module = THIS_MODULE,
+    .ops = bkn_stats_genl_ops,
+    .n_ops = ARRAY_SIZE(bkn_stats_genl_ops),
+};
+
+static void
+bkn_stats_genl_init(void)
+{
+    if (genl_register_family(&bkn_stats_genl_family) < 0) {
+        gprintk("Warning: failed to register %s netlink family\n",
+                BKN_STATS_GENL_NAME);
+        return;
+    }
+    bkn_stats_genl_registered = 1;
+}
+
+static void
+bkn_stats_genl_cleanup(void)
+{
+    if (bkn_stats_genl_registered) {
+        genl_unregister_family(&bkn_stats_genl_family);
+        bkn_stats_genl_registered = 0;
+    }
+}
+#else
+#define bkn_stats_genl_init()
+#define bkn_stats_genl_cleanup()
+#endif /* BKN_STATS_GENL_SUPPORT */
+
 /*
  * Generic module functions
  */
@@ -8256,6 +10586,9 @@ bkn_knet_hw_init(kcom_msg_hw_init_t *kmsg, int len)
         return sizeof(kcom_msg_hdr_t);
     }
 
+    /* Page pools may sleep, so they are created before taking the lock */
+    bkn_rx_pool_create(sinfo);
+
     cfg_api_lock(sinfo, &flags);
 
     sinfo->cmic_type = kmsg->cmic_type;
@@ -8524,6 +10857,8 @@ bkn_knet_netif_create(kcom_msg_netif_create_t *kmsg, int len)
         DBG_RCPU(("RCPU auto-enabled\n"));
     }
 
+    bkn_tx_headroom_set(sinfo, priv);
+
     /* Prevent (incorrect) compiler warning */
     lpriv = NULL;
 
@@ -8654,6 +10989,7 @@ bkn_knet_netif_destroy(kcom_msg_netif_destroy_t *kmsg, int len)
     dev = priv->dev;
     DBG_VERB(("Removing virtual Ethernet device %s (%d).\n",
               dev->name, priv->id));
+    bkn_rx_chan_napi_flush(sinfo, dev);
     unregister_netdev(dev);
     free_netdev(dev);
 
@@ -8665,9 +11001,89 @@ bkn_knet_netif_list(kcom_msg_netif_list_t *kmsg, int len)
 {
     bkn_switch_info_t *sinfo;
     bkn_priv_t *priv;
-    struct list_head *list;
+    struct list_head *list;
+    unsigned long flags;
+    int idx;
+
+    kmsg->hdr.type = KCOM_MSG_TYPE_RSP;
+
+    sinfo = bkn_sinfo_from_unit(kmsg->hdr.unit);
+    if (sinfo == NULL) {
+        kmsg->hdr.status = KCOM_E_PARAM;
+        return sizeof(kcom_msg_hdr_t);
+    }
+
+    spin_lock_irqsave(&sinfo->lock, flags);
+
+    idx = 0;
+    list_for_each(list, &sinfo->ndev_list) {
+        if (idx >= KCOM_NETIF_MAX) {
+            DBG_WARN(("Too many network interfaces to list (max %d).\n",
+                      KCOM_NETIF_MAX));
+            break;
+        }
+        priv = (bkn_priv_t *)list;
+        kmsg->id[idx] = priv->id;
+        idx++;
+    }
+    kmsg->ifcnt = idx;
+
+    spin_unlock_irqrestore(&sinfo->lock, flags);
+
+    return sizeof(*kmsg) - sizeof(kmsg->id) + (idx * sizeof(kmsg->id[0]));
+}
+
+static int
+bkn_knet_netif_get(kcom_msg_netif_get_t *kmsg, int len)
+{
+    bkn_switch_info_t *sinfo;
+    bkn_priv_t *priv;
+    unsigned long flags;
+
+    kmsg->hdr.type = KCOM_MSG_TYPE_RSP;
+
+    sinfo = bkn_sinfo_from_unit(kmsg->hdr.unit);
+    if (sinfo == NULL) {
+        kmsg->hdr.status = KCOM_E_PARAM;
+        return sizeof(kcom_msg_hdr_t);
+    }
+
+    spin_lock_irqsave(&sinfo->lock, flags);
+
+    priv = bkn_netif_lookup(sinfo, kmsg->hdr.id);
+
+    if (priv == NULL) {
+        spin_unlock_irqrestore(&sinfo->lock, flags);
+        kmsg->hdr.status = KCOM_E_NOT_FOUND;
+        return sizeof(kcom_msg_hdr_t);
+    }
+
+    memcpy(kmsg->netif.macaddr, priv->dev->dev_addr, 6);
+    memcpy(kmsg->netif.name, priv->dev->name, KCOM_NETIF_NAME_MAX - 1);
+    kmsg->netif.vlan = priv->vlan;
+    kmsg->netif.type = priv->type;
+    kmsg->netif.id = priv->id;
+    kmsg->netif.flags = priv->flags;
+    kmsg->netif.cb_user_data = priv->cb_user_data;
+
+    if (priv->port < 0) {
+        kmsg->netif.port = 0;
+    } else {
+        kmsg->netif.port = priv->port;
+    }
+    kmsg->netif.qnum = priv->qnum;
+
+    spin_unlock_irqrestore(&sinfo->lock, flags);
+
+    return sizeof(*kmsg);
+}
+
+static int
+bkn_knet_netif_rate_set(kcom_msg_netif_rate_t *kmsg, int len)
+{
+    bkn_switch_info_t *sinfo;
+    bkn_priv_t *priv;
     unsigned long flags;
-    int idx;
 
     kmsg->hdr.type = KCOM_MSG_TYPE_RSP;
 
@@ -8677,28 +11093,27 @@ bkn_knet_netif_list(kcom_msg_netif_list_t *kmsg, int len)
         return sizeof(kcom_msg_hdr_t);
     }
 
-    spin_lock_irqsave(&sinfo->lock, flags);
+    cfg_api_lock(sinfo, &flags);
 
-    idx = 0;
-    list_for_each(list, &sinfo->ndev_list) {
-        if (idx >= KCOM_NETIF_MAX) {
-            DBG_WARN(("Too many network interfaces to list (max %d).\n",
-                      KCOM_NETIF_MAX));
-            break;
-        }
-        priv = (bkn_priv_t *)list;
-        kmsg->id[idx] = priv->id;
-        idx++;
+    priv = bkn_netif_lookup(sinfo, kmsg->hdr.id);
+    if (priv == NULL) {
+        cfg_api_unlock(sinfo, &flags);
+        kmsg->hdr.status = KCOM_E_NOT_FOUND;
+        return sizeof(kcom_msg_hdr_t);
     }
-    kmsg->ifcnt = idx;
 
-    spin_unlock_irqrestore(&sinfo->lock, flags);
+    bkn_rate_set(&priv->rate, kmsg->rate.rate_max, kmsg->rate.burst_max);
 
-    return sizeof(*kmsg) - sizeof(kmsg->id) + (idx * sizeof(kmsg->id[0]));
+    cfg_api_unlock(sinfo, &flags);
+
+    DBG_VERB(("Netif ID %d rate %u burst %u\n", kmsg->hdr.id,
+              kmsg->rate.rate_max, kmsg->rate.burst_max));
+
+    return sizeof(kcom_msg_hdr_t);
 }
 
 static int
-bkn_knet_netif_get(kcom_msg_netif_get_t *kmsg, int len)
+bkn_knet_netif_rate_get(kcom_msg_netif_rate_t *kmsg, int len)
 {
     bkn_switch_info_t *sinfo;
     bkn_priv_t *priv;
@@ -8715,39 +11130,250 @@ bkn_knet_netif_get(kcom_msg_netif_get_t *kmsg, int len)
     spin_lock_irqsave(&sinfo->lock, flags);
 
     priv = bkn_netif_lookup(sinfo, kmsg->hdr.id);
-
     if (priv == NULL) {
         spin_unlock_irqrestore(&sinfo->lock, flags);
         kmsg->hdr.status = KCOM_E_NOT_FOUND;
         return sizeof(kcom_msg_hdr_t);
     }
 
-    memcpy(kmsg->netif.macaddr, priv->dev->dev_addr, 6);
-    memcpy(kmsg->netif.name, priv->dev->name, KCOM_NETIF_NAME_MAX - 1);
-    kmsg->netif.vlan = priv->vlan;
-    kmsg->netif.type = priv->type;
-    kmsg->netif.id = priv->id;
-    kmsg->netif.flags = priv->flags;
-    kmsg->netif.cb_user_data = priv->cb_user_data;
-
-    if (priv->port < 0) {
-        kmsg->netif.port = 0;
-    } else {
-        kmsg->netif.port = priv->port;
-    }
-    kmsg->netif.qnum = priv->qnum;
+    kmsg->rate.rate_max = priv->rate.rate_max;
+    kmsg->rate.burst_max = priv->rate.burst_max;
+    kmsg->rate.drops = priv->rate.drops;
 
     spin_unlock_irqrestore(&sinfo->lock, flags);
 
     return sizeof(*kmsg);
 }
 
+/*
+ * Add filter to Rx filter list according to priority.
+ */
+static void
+bkn_filter_insert(bkn_switch_info_t *sinfo, bkn_filter_t *filter)
+{
+    struct list_head *list;
+    bkn_filter_t *lfilter;
+
+    list_for_each(list, &sinfo->rxpf_list) {
+        lfilter = (bkn_filter_t *)list;
+        if (filter->kf.priority < lfilter->kf.priority) {
+            list_add_tail_rcu(&filter->list, &lfilter->list);
+            return;
+        }
+    }
+    list_add_tail_rcu(&filter->list, &sinfo->rxpf_list);
+}
+
+/*
+ * Filter classifier self-test
+ *
+ * Builds a synthetic filter set resembling the trap filters installed by
+ * applications (per reason, per port and per protocol filters, a catch-all
+ * filter and filters which can't be compiled into tables), then replays
+ * synthetic DCB metadata and packets through compiled and linear filter
+ * matching. Compiled matching is disabled if the results differ.
+ */
+#define BKN_FILTER_SELFTEST_FILTERS     96
+#define BKN_FILTER_SELFTEST_PKTS        4096
+#define BKN_FILTER_SELFTEST_META_SIZE   64
+#define BKN_FILTER_SELFTEST_PKT_SIZE    128
+#define BKN_FILTER_SELFTEST_CHANS       4
+
+static uint32_t
+bkn_filter_selftest_rand(uint32_t *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return (*seed >> 16) | (*seed << 16);
+}
+
+static void
+bkn_filter_selftest_set(kcom_filter_t *kf, uint32_t *seed, int type)
+{
+    int size, idx;
+
+    switch (type) {
+    case 0:
+        /* Per reason filter */
+        kf->oob_data_offset = 8;
+        kf->oob_data_size = 8;
+        kf->mask.b[0] = 0xff;
+        kf->mask.b[1] = 0x3f;
+        kf->mask.b[4] = 0x0f;
+        break;
+    case 1:
+        /* Per port and reason filter */
+        kf->oob_data_offset = 4;
+        kf->oob_data_size = 4;
+        kf->pkt_data_offset = 12;
+        kf->pkt_data_size = 2;
+        kf->mask.b[0] = 0xff;
+        kf->mask.b[3] = 0x7f;
+        kf->mask.b[4] = 0xff;
+        kf->mask.b[5] = 0xff;
+        break;
+    case 2:
+        /* Per protocol filter */
+        kf->pkt_data_offset = 12;
+        kf->pkt_data_size = 2;
+        kf->mask.b[0] = 0xff;
+        kf->mask.b[1] = 0xff;
+        break;
+    case 3:
+        /* Catch-all filter */
+        kf->priority = 255;
+        return;
+    case 4:
+        /* Data outside mask, never matches */
+        kf->oob_data_offset = 0;
+        kf->oob_data_size = 4;
+        kf->mask.b[0] = 0xf0;
+        kf->data.b[0] = 0x0f;
+        return;
+    default:
+        /* Random tuple */
+        kf->pkt_data_offset = bkn_filter_selftest_rand(seed) % 40;
+        kf->pkt_data_size = 1 + bkn_filter_selftest_rand(seed) % 4;
+        for (idx = 0; idx < kf->pkt_data_size; idx++) {
+            kf->mask.b[idx] = bkn_filter_selftest_rand(seed) & 0xff;
+        }
+        /* Few distinct values so packets hit several filters */
+        for (idx = 0; idx < kf->pkt_data_size; idx++) {
+            kf->data.b[idx] = (bkn_filter_selftest_rand(seed) % 3) &
+                              kf->mask.b[idx];
+        }
+        return;
+    }
+
+    size = kf->oob_data_size + kf->pkt_data_size;
+    for (idx = 0; idx < size; idx++) {
+        kf->data.b[idx] = bkn_filter_selftest_rand(seed) & kf->mask.b[idx];
+    }
+}
+
+static void
+bkn_filter_selftest(void)
+{
+    bkn_switch_info_t *sinfo;
+    bkn_filter_t *filters[BKN_FILTER_SELFTEST_FILTERS];
+    bkn_filter_t *filter, *r_linear, *r_cls;
+    bkn_filter_cls_t *cls;
+    kcom_filter_t *kf;
+    uint8_t meta[BKN_FILTER_SELFTEST_META_SIZE];
+    uint8_t pkt[BKN_FILTER_SELFTEST_PKT_SIZE];
+    uint32_t seed = 1;
+    uint64_t ns_linear = 0, ns_cls = 0;
+    ktime_t start;
+    int num_filters = 0;
+    int mismatches = 0;
+    int matches = 0;
+    int idx, pidx, chan;
+
+    sinfo = kzalloc(sizeof(*sinfo), GFP_KERNEL);
+    if (sinfo == NULL) {
+        gprintk("Filter self-test: out of memory\n");
+        return;
+    }
+    INIT_LIST_HEAD(&sinfo->rxpf_list);
+    sinfo->rx_chans = BKN_FILTER_SELFTEST_CHANS;
+
+    for (idx = 0; idx < BKN_FILTER_SELFTEST_FILTERS; idx++) {
+        filter = bkn_filter_alloc();
+        if (filter == NULL) {
+            break;
+        }
+        kf = &filter->kf;
+        kf->id = idx + 1;
+        kf->type = KCOM_FILTER_T_RX_PKT;
+        kf->dest_type = KCOM_DEST_T_NETIF;
+        kf->priority = bkn_filter_selftest_rand(&seed) % 16;
+        /* One catch-all, a few unusual filters, the rest in few tuples */
+        bkn_filter_selftest_set(kf, &seed,
+                                idx == 0 ? 3 : idx < 4 ? 4 :
+                                idx < 12 ? 5 : idx % 3);
+        bkn_filter_insert(sinfo, filter);
+        filters[num_filters++] = filter;
+    }
+
+    cls = bkn_filter_cls_compile(sinfo, NULL, GFP_KERNEL);
+    if (cls == NULL) {
+        gprintk("Filter self-test: failed to compile filters\n");
+        goto cleanup;
+    }
+
+    for (pidx = 0; pidx < BKN_FILTER_SELFTEST_PKTS; pidx++) {
+        for (idx = 0; idx < sizeof(meta); idx++) {
+            meta[idx] = bkn_filter_selftest_rand(&seed) % 4;
+        }
+        for (idx = 0; idx < sizeof(pkt); idx++) {
+            pkt[idx] = bkn_filter_selftest_rand(&seed) % 4;
+        }
+
+        /* Most packets are crafted to match a filter */
+        if (bkn_filter_selftest_rand(&seed) % 4) {
+            kf = &filters[bkn_filter_selftest_rand(&seed) % num_filters]->kf;
+            for (idx = 0; idx < kf->oob_data_size; idx++) {
+                meta[kf->oob_data_offset + idx] &= ~kf->mask.b[idx];
+                meta[kf->oob_data_offset + idx] |= kf->data.b[idx];
+            }
+            for (idx = 0; idx < kf->pkt_data_size; idx++) {
+                pkt[kf->pkt_data_offset + idx] &=
+                    ~kf->mask.b[kf->oob_data_size + idx];
+                pkt[kf->pkt_data_offset + idx] |=
+                    kf->data.b[kf->oob_data_size + idx];
+            }
+        }
+        chan = bkn_filter_selftest_rand(&seed) % BKN_FILTER_SELFTEST_CHANS;
+
+        start = ktime_get();
+        r_linear = bkn_match_rx_pkt_linear(sinfo, pkt, sizeof(pkt),
+                                           meta, chan, NULL);
+        ns_linear += ktime_to_ns(ktime_sub(ktime_get(), start));
+
+        start = ktime_get();
+        r_cls = bkn_match_rx_pkt_cls(sinfo, cls, pkt, sizeof(pkt),
+                                     meta, chan, NULL);
+        ns_cls += ktime_to_ns(ktime_sub(ktime_get(), start));
+
+        if (r_linear != r_cls) {
+            if (mismatches++ < 8) {
+                gprintk("Filter self-test: packet %d matched filter %d, "
+                        "compiled filters matched %d\n", pidx,
+                        r_linear ? r_linear->kf.id : 0,
+                        r_cls ? r_cls->kf.id : 0);
+            }
+        } else if (r_linear) {
+            matches++;
+        }
+    }
+
+    gprintk("Filter self-test: %d filters in %d tables and %d linear, "
+            "%d packets, %d matched, %d mismatches\n",
+            num_filters, cls->num_tuples, cls->num_linear,
+            BKN_FILTER_SELFTEST_PKTS, matches, mismatches);
+    gprintk("Filter self-test: linear match %llu ns, compiled match %llu ns\n",
+            (unsigned long long)ns_linear, (unsigned long long)ns_cls);
+    if (mismatches) {
+        gprintk("Filter self-test failed, compiled filters disabled\n");
+        filter_cls = 0;
+    }
+
+    bkn_filter_cls_free(cls);
+
+cleanup:
+    for (idx = 0; idx < num_filters; idx++) {
+        list_del(&filters[idx]->list);
+        bkn_filter_free(filters[idx]);
+    }
+    kfree(sinfo);
+}
+
 static int
 bkn_knet_filter_create(kcom_msg_filter_create_t *kmsg, int len)
 {
     bkn_switch_info_t *sinfo;
     struct list_head *list;
     bkn_filter_t *filter, *lfilter;
+    bkn_filter_cls_t *old_cls;
     unsigned long flags;
     int found, id;
     int oob_offset_max;
@@ -8787,6 +11413,13 @@ bkn_knet_filter_create(kcom_msg_filter_create_t *kmsg, int len)
         return sizeof(kcom_msg_hdr_t);
     }
 
+    filter = bkn_filter_alloc();
+    if (filter == NULL) {
+        kmsg->hdr.status = KCOM_E_PARAM;
+        return sizeof(kcom_msg_hdr_t);
+    }
+    memcpy(&filter->kf, &kmsg->filter, sizeof(filter->kf));
+
     spin_lock_irqsave(&sinfo->lock, flags);
 
     /*
@@ -8807,37 +11440,22 @@ bkn_knet_filter_create(kcom_msg_filter_create_t *kmsg, int len)
     if (found) {
         /* Too many filters */
         spin_unlock_irqrestore(&sinfo->lock, flags);
+        bkn_filter_free(filter);
         kmsg->hdr.status = KCOM_E_RESOURCE;
         return sizeof(kcom_msg_hdr_t);
     }
-    filter = kmalloc(sizeof(*filter), GFP_ATOMIC);
-    if (filter == NULL) {
-        spin_unlock_irqrestore(&sinfo->lock, flags);
-        kmsg->hdr.status = KCOM_E_PARAM;
-        return sizeof(kcom_msg_hdr_t);
-    }
-    memset(filter, 0, sizeof(*filter));
-    memcpy(&filter->kf, &kmsg->filter, sizeof(filter->kf));
     filter->kf.id = id;
 
     /* Add according to priority */
-    found = 0;
-    list_for_each(list, &sinfo->rxpf_list) {
-        lfilter = (bkn_filter_t *)list;
-        if (filter->kf.priority < lfilter->kf.priority) {
-            list_add_tail(&filter->list, &lfilter->list);
-            found = 1;
-            break;
-        }
-    }
-    if (!found) {
-        list_add_tail(&filter->list, &sinfo->rxpf_list);
-    }
+    bkn_filter_insert(sinfo, filter);
+    old_cls = bkn_filter_cls_update(sinfo);
 
     kmsg->filter.id = filter->kf.id;
 
     spin_unlock_irqrestore(&sinfo->lock, flags);
 
+    bkn_filter_cls_free(old_cls);
+
     DBG_VERB(("Created filter ID %d (%s).\n",
               filter->kf.id, filter->kf.desc));
     if (device_is_sand(sinfo)) {
@@ -8866,6 +11484,7 @@ bkn_knet_filter_destroy(kcom_msg_filter_destroy_t *kmsg, int len)
 {
     bkn_switch_info_t *sinfo;
     bkn_filter_t *filter;
+    bkn_filter_cls_t *old_cls;
     struct list_head *list;
     unsigned long flags;
     int found;
@@ -8895,12 +11514,16 @@ bkn_knet_filter_destroy(kcom_msg_filter_destroy_t *kmsg, int len)
         return sizeof(kcom_msg_hdr_t);
     }
 
-    list_del(&filter->list);
+    list_del_rcu(&filter->list);
+    old_cls = bkn_filter_cls_update(sinfo);
 
     cfg_api_unlock(sinfo, &flags);
 
+    bkn_filter_cls_free(old_cls);
+
     DBG_VERB(("Removing filter ID %d.\n", filter->kf.id));
-    kfree(filter);
+    /* Statistics readers may still walk the filter list */
+    call_rcu(&filter->rcu, bkn_filter_free_rcu);
 
     return sizeof(kcom_msg_hdr_t);
 }
@@ -8982,6 +11605,73 @@ bkn_knet_filter_get(kcom_msg_filter_get_t *kmsg, int len)
     return sizeof(*kmsg);
 }
 
+static int
+bkn_knet_filter_rate_set(kcom_msg_filter_rate_t *kmsg, int len)
+{
+    bkn_switch_info_t *sinfo;
+    bkn_filter_t *filter;
+    unsigned long flags;
+
+    kmsg->hdr.type = KCOM_MSG_TYPE_RSP;
+
+    sinfo = bkn_sinfo_from_unit(kmsg->hdr.unit);
+    if (sinfo == NULL) {
+        kmsg->hdr.status = KCOM_E_PARAM;
+        return sizeof(kcom_msg_hdr_t);
+    }
+
+    cfg_api_lock(sinfo, &flags);
+
+    filter = bkn_filter_lookup(sinfo, kmsg->hdr.id);
+    if (filter == NULL) {
+        cfg_api_unlock(sinfo, &flags);
+        kmsg->hdr.status = KCOM_E_NOT_FOUND;
+        return sizeof(kcom_msg_hdr_t);
+    }
+
+    bkn_rate_set(&filter->rate, kmsg->rate.rate_max, kmsg->rate.burst_max);
+
+    cfg_api_unlock(sinfo, &flags);
+
+    DBG_VERB(("Filter ID %d rate %u burst %u\n", kmsg->hdr.id,
+              kmsg->rate.rate_max, kmsg->rate.burst_max));
+
+    return sizeof(kcom_msg_hdr_t);
+}
+
+static int
+bkn_knet_filter_rate_get(kcom_msg_filter_rate_t *kmsg, int len)
+{
+    bkn_switch_info_t *sinfo;
+    bkn_filter_t *filter;
+    unsigned long flags;
+
+    kmsg->hdr.type = KCOM_MSG_TYPE_RSP;
+
+    sinfo = bkn_sinfo_from_unit(kmsg->hdr.unit);
+    if (sinfo == NULL) {
+        kmsg->hdr.status = KCOM_E_PARAM;
+        return sizeof(kcom_msg_hdr_t);
+    }
+
+    spin_lock_irqsave(&sinfo->lock, flags);
+
+    filter = bkn_filter_lookup(sinfo, kmsg->hdr.id);
+    if (filter == NULL) {
+        spin_unlock_irqrestore(&sinfo->lock, flags);
+        kmsg->hdr.status = KCOM_E_NOT_FOUND;
+        return sizeof(kcom_msg_hdr_t);
+    }
+
+    kmsg->rate.rate_max = filter->rate.rate_max;
+    kmsg->rate.burst_max = filter->rate.burst_max;
+    kmsg->rate.drops = filter->rate.drops;
+
+    spin_unlock_irqrestore(&sinfo->lock, flags);
+
+    return sizeof(*kmsg);
+}
+
 static int
 bkn_knet_dbg_pkt_set(kcom_msg_dbg_pkt_set_t *kmsg, int len)
 {
@@ -9106,6 +11796,16 @@ bkn_handle_cmd_req(kcom_msg_t *kmsg, int len)
         /* Return network interface info */
         len = bkn_knet_netif_get(&kmsg->netif_get, len);
         break;
+    case KCOM_M_NETIF_RATE_SET:
+        DBG_CMD(("KCOM_M_NETIF_RATE_SET\n"));
+        /* Set network interface Rx rate limit */
+        len = bkn_knet_netif_rate_set(&kmsg->netif_rate, len);
+        break;
+    case KCOM_M_NETIF_RATE_GET:
+        DBG_CMD(("KCOM_M_NETIF_RATE_GET\n"));
+        /* Return network interface Rx rate limit */
+        len = bkn_knet_netif_rate_get(&kmsg->netif_rate, len);
+        break;
     case KCOM_M_FILTER_CREATE:
         DBG_CMD(("KCOM_M_FILTER_CREATE\n"));
         /* Create packet filter */
@@ -9126,6 +11826,16 @@ bkn_handle_cmd_req(kcom_msg_t *kmsg, int len)
         /* Return packet filter info */
         len = bkn_knet_filter_get(&kmsg->filter_get, len);
         break;
+    case KCOM_M_FILTER_RATE_SET:
+        DBG_CMD(("KCOM_M_FILTER_RATE_SET\n"));
+        /* Set packet filter rate limit */
+        len = bkn_knet_filter_rate_set(&kmsg->filter_rate, len);
+        break;
+    case KCOM_M_FILTER_RATE_GET:
+        DBG_CMD(("KCOM_M_FILTER_RATE_GET\n"));
+        /* Return packet filter rate limit */
+        len = bkn_knet_filter_rate_get(&kmsg->filter_rate, len);
+        break;
     case KCOM_M_DBGPKT_SET:
         DBG_CMD(("KCOM_M_DBGPKT_SET\n"));
         /* Set debugging packet function */
@@ -9255,6 +11965,7 @@ _cleanup(void)
     /* Inidicate that we are shutting down */
     module_initialized = 0;
 
+    bkn_stats_genl_cleanup();
     bkn_proc_cleanup();
     remove_proc_entry("bcm/knet", NULL);
     remove_proc_entry("bcm", NULL);
@@ -9292,11 +12003,13 @@ _cleanup(void)
         sinfo = list_entry(_sinfo_list.next, bkn_switch_info_t, list);
 
         /* Destroy all associated Rx packet filters */
+        bkn_filter_cls_free(sinfo->rxpf_cls);
+        sinfo->rxpf_cls = NULL;
         while (!list_empty(&sinfo->rxpf_list)) {
             filter = list_entry(sinfo->rxpf_list.next, bkn_filter_t, list);
             list_del(&filter->list);
             DBG_VERB(("Removing filter ID %d.\n", filter->kf.id));
-            kfree(filter);
+            bkn_filter_free(filter);
         }
 
         /* Destroy all associated virtual net devices */
@@ -9305,6 +12018,7 @@ _cleanup(void)
             list_del(&priv->list);
             dev = priv->dev;
             DBG_VERB(("Removing virtual Ethernet device %s.\n", dev->name));
+            bkn_rx_chan_napi_flush(sinfo, dev);
             unregister_netdev(dev);
             free_netdev(dev);
         }
@@ -9323,6 +12037,9 @@ _cleanup(void)
         bkn_destroy_sinfo(sinfo);
     }
 
+    /* Wait for filters removed while the module was running */
+    rcu_barrier();
+
     return 0;
 }
 
@@ -9424,6 +12141,16 @@ bkn_knet_dev_init(int d)
 
     if (use_napi) {
         netif_napi_add(dev, &sinfo->napi, bkn_poll, napi_weight);
+#if NAPI_SUPPORT && (LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,24))
+        if (rx_chan_napi) {
+            int chan;
+
+            for (chan = 0; chan < NUM_RX_CHAN; chan++) {
+                netif_napi_add(dev, &sinfo->rx[chan].rxn.napi,
+                               bkn_rx_chan_poll, napi_weight);
+            }
+        }
+#endif
     }
     return 0;
 }
@@ -9470,6 +12197,11 @@ _init(void)
         basedev_suspend = 1;
     }
 
+    /* Channel NAPI instances are added to the base device in NAPI mode */
+    if (!use_napi) {
+        rx_chan_napi = 0;
+    }
+
     num_dev = kernel_bde->num_devices(BDE_ALL_DEVICES);
     for (idx = 0; idx < num_dev; idx++) {
         rv = bkn_knet_dev_init(idx);
@@ -9483,6 +12215,11 @@ _init(void)
     bkn_proc_root = proc_mkdir("bcm/knet", NULL);
 
     bkn_proc_init();
+    bkn_stats_genl_init();
+
+    if (filter_selftest) {
+        bkn_filter_selftest();
+    }
 
     /* Initialize event queue */
     for (idx = 0; idx < LINUX_BDE_MAX_DEVICES; idx++) {
@@ -9497,11 +12234,75 @@ _init(void)
     return 0;
 }
 
+#ifdef BKN_RX_RING_SUPPORT
+/*
+ * Create or destroy (zero slots) the shared Rx ring of a unit.
+ */
+static int
+bkn_rx_ring_ioctl(bkn_rx_ring_cfg_t *cfg)
+{
+    bkn_switch_info_t *sinfo;
+    int rv;
+
+    sinfo = bkn_sinfo_from_unit(cfg->unit);
+    if (sinfo == NULL) {
+        return -ENODEV;
+    }
+
+    mutex_lock(&bkn_rx_ring_mutex);
+    if (cfg->slots == 0) {
+        rv = bkn_rx_ring_destroy(sinfo);
+    } else {
+        rv = bkn_rx_ring_create(sinfo, cfg);
+    }
+    mutex_unlock(&bkn_rx_ring_mutex);
+
+    return rv;
+}
+
+/*
+ * Map the shared Rx ring of the unit given by the page offset.
+ */
+static int
+_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    bkn_switch_info_t *sinfo;
+    int rv = -ENODEV;
+
+    if (!module_initialized) {
+        return -EFAULT;
+    }
+
+    if (vma->vm_pgoff >= LINUX_BDE_MAX_DEVICES) {
+        return -EINVAL;
+    }
+    sinfo = bkn_sinfo_from_unit(vma->vm_pgoff);
+    if (sinfo == NULL) {
+        return -ENODEV;
+    }
+
+    mutex_lock(&bkn_rx_ring_mutex);
+    if (sinfo->rx_ring) {
+        if (vma->vm_end - vma->vm_start > sinfo->rx_ring->size) {
+            rv = -EINVAL;
+        } else {
+            rv = remap_vmalloc_range(vma, sinfo->rx_ring->hdr, 0);
+        }
+    }
+    mutex_unlock(&bkn_rx_ring_mutex);
+
+    return rv;
+}
+#endif
+
 static int
 _ioctl(unsigned int cmd, unsigned long arg)
 {
     bkn_ioctl_t io;
     kcom_msg_t kmsg;
+#ifdef BKN_RX_RING_SUPPORT
+    bkn_rx_ring_cfg_t ring_cfg;
+#endif
 
     if (!module_initialized) {
         return -EFAULT;
@@ -9518,7 +12319,7 @@ _ioctl(unsigned int cmd, unsigned long arg)
     io.rc = 0;
 
     switch(cmd) {
-    case 0:
+    case BKN_IOCTL_KCOM:
         if (io.len > 0) {
             if (copy_from_user(&kmsg, (void *)(unsigned long)io.buf, io.len)) {
                 return -EFAULT;
@@ -9547,6 +12348,20 @@ _ioctl(unsigned int cmd, unsigned long arg)
             }
         }
         break;
+#ifdef BKN_RX_RING_SUPPORT
+    case BKN_IOCTL_RX_RING:
+        if (io.len != sizeof(bkn_rx_ring_cfg_t)) {
+            return -EINVAL;
+        }
+        if (copy_from_user(&ring_cfg, (void *)(unsigned long)io.buf, io.len)) {
+            return -EFAULT;
+        }
+        io.rc = bkn_rx_ring_ioctl(&ring_cfg);
+        if (copy_to_user((void *)(unsigned long)io.buf, &ring_cfg, io.len)) {
+            return -EFAULT;
+        }
+        break;
+#endif
     default:
         gprintk("Invalid IOCTL");
         io.rc = -1;
@@ -9569,6 +12384,9 @@ static gmodule_t _gmodule = {
     ioctl: _ioctl,
     open: NULL,
     close: NULL,
+#ifdef BKN_RX_RING_SUPPORT
+    mmap: _mmap,
+#endif
 };
 
 gmodule_t *
@@ -44,6 +44,146 @@ typedef struct  {
     uint64_t buf;
 } bkn_ioctl_t;
 
+/* ioctl commands, io.buf points to the command data */
+#define BKN_IOCTL_KCOM              0   /* KCOM message or DMA event */
+#define BKN_IOCTL_RX_RING           1   /* bkn_rx_ring_cfg_t */
+
+/*
+ * Shared Rx ring.
+ *
+ * Packets filtered to the Rx API can be delivered through a ring
+ * shared with user space instead of the Rx API DCB chains and DMA
+ * events. The ring of a unit is created with BKN_IOCTL_RX_RING and
+ * mapped with mmap() on the KNET device at offset unit * page size,
+ * using the returned mmap_size. Setting slots to zero destroys it.
+ *
+ * The mapping starts with bkn_rx_ring_hdr_t, followed by one
+ * bkn_rx_ring_desc_t per slot at desc_offset and one packet buffer of
+ * slot_size bytes per slot at buf_offset. The driver fills slot
+ * (head % slots) and then advances head; the consumer processes slots
+ * until tail equals head and then advances tail. Before sleeping on
+ * the eventfd the consumer sets wakeup and checks head again.
+ */
+#define BKN_RX_RING_MAGIC           0x424b5252  /* "BKRR" */
+#define BKN_RX_RING_VERSION         1
+#define BKN_RX_RING_DCB_WORDS       16
+
+typedef struct {
+    int unit;
+    uint32_t slots;             /* Number of slots, power of 2 */
+    uint32_t slot_size;         /* Packet buffer size */
+    int eventfd;                /* Notification eventfd or -1 */
+    uint32_t mmap_size;         /* Returned size of mapping */
+} bkn_rx_ring_cfg_t;
+
+typedef struct {
+    uint32_t len;               /* Packet length */
+    uint16_t chan;              /* Rx DMA channel */
+    uint16_t dcb_words;         /* Valid words in dcb */
+    uint32_t dcb[BKN_RX_RING_DCB_WORDS]; /* Rx DCB with packet meta data */
+} bkn_rx_ring_desc_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint32_t slot_size;
+    uint32_t desc_offset;
+    uint32_t buf_offset;
+    volatile uint32_t wakeup;   /* Set by consumer to request an event */
+    uint32_t reserved[9];
+    volatile uint32_t head;     /* Written by driver */
+    uint32_t pad0[15];
+    volatile uint32_t tail;     /* Written by consumer */
+    uint32_t pad1[15];
+    volatile uint64_t drops;    /* Packets dropped on full ring */
+} bkn_rx_ring_hdr_t;
+
+/*
+ * Statistics generic netlink family.
+ *
+ * BKN_STATS_CMD_GET is a dump request returning one message per device
+ * with the Tx and Rx counters, followed by messages with the counters
+ * of the device Rx filters. Counters are arrays of 64-bit values
+ * indexed by BKN_TX_STATS_* and BKN_RX_STATS_* (one array per Rx DMA
+ * channel).
+ */
+#define BKN_STATS_GENL_NAME         "bcm_knet_stats"
+#define BKN_STATS_GENL_VERSION      1
+
+enum {
+    BKN_STATS_CMD_UNSPEC,
+    BKN_STATS_CMD_GET,
+    __BKN_STATS_CMD_MAX
+};
+#define BKN_STATS_CMD_MAX           (__BKN_STATS_CMD_MAX - 1)
+
+enum {
+    BKN_STATS_A_UNSPEC,
+    BKN_STATS_A_PAD,
+    BKN_STATS_A_UNIT,               /* u32 */
+    BKN_STATS_A_TX,                 /* u64[BKN_TX_STATS_MAX] */
+    BKN_STATS_A_RX,                 /* u64[rx_chans][BKN_RX_STATS_MAX] */
+    BKN_STATS_A_FILTER,             /* nested BKN_STATS_FILTER_A_* */
+    __BKN_STATS_A_MAX
+};
+#define BKN_STATS_A_MAX             (__BKN_STATS_A_MAX - 1)
+
+enum {
+    BKN_STATS_FILTER_A_UNSPEC,
+    BKN_STATS_FILTER_A_PAD,
+    BKN_STATS_FILTER_A_ID,          /* u32 */
+    BKN_STATS_FILTER_A_PKTS,        /* u64 */
+    BKN_STATS_FILTER_A_BYTES,       /* u64 */
+    __BKN_STATS_FILTER_A_MAX
+};
+#define BKN_STATS_FILTER_A_MAX      (__BKN_STATS_FILTER_A_MAX - 1)
+
+/* Tx counters */
+enum {
+    BKN_TX_STATS_PKTS,          /* Tx packet counter */
+    BKN_TX_STATS_BYTES,         /* Tx byte counter */
+    BKN_TX_STATS_D_NO_SKB,      /* Tx drop - skb allocation failed */
+    BKN_TX_STATS_D_RCPU_ENCAP,  /* Tx drop - bad RCPU encapsulation */
+    BKN_TX_STATS_D_RCPU_SIG,    /* Tx drop - bad RCPU signature */
+    BKN_TX_STATS_D_RCPU_META,   /* Tx drop - bad RCPU meta data */
+    BKN_TX_STATS_D_PAD_FAIL,    /* Tx drop - pad to minimum size failed */
+    BKN_TX_STATS_D_DMA_RESRC,   /* Tx drop - no DMA resources */
+    BKN_TX_STATS_D_CALLBACK,    /* Tx drop - consumed by call-back */
+    BKN_TX_STATS_D_NO_LINK,     /* Tx drop - software link down */
+    BKN_TX_STATS_D_OVER_LIMIT,  /* Tx drop - length is out of range */
+    BKN_TX_STATS_DOORBELLS,     /* Tx DMA restarts for new packets */
+    BKN_TX_STATS_REALLOC,       /* Tx skbs copied for lack of headroom */
+    BKN_TX_STATS_MAX
+};
+
+/* Rx counters, one set per Rx DMA channel */
+enum {
+    BKN_RX_STATS_PKTS,          /* Rx packet counter */
+    BKN_RX_STATS_BYTES,         /* Rx byte counter */
+    BKN_RX_STATS_F_API,         /* Rx packets filtered to API */
+    BKN_RX_STATS_F_NETIF,       /* Rx packets filtered to net interface */
+    BKN_RX_STATS_M_API,         /* Rx packets mirrored to API */
+    BKN_RX_STATS_M_NETIF,       /* Rx packets mirrored to net interface */
+    BKN_RX_STATS_D_NO_SKB,      /* Rx drop - skb allocation failed */
+    BKN_RX_STATS_D_NO_MATCH,    /* Rx drop - no matching filters */
+    BKN_RX_STATS_D_UNKN_NETIF,  /* Rx drop - unknown net interface ID */
+    BKN_RX_STATS_D_UNKN_DEST,   /* Rx drop - unknown destination type */
+    BKN_RX_STATS_D_CALLBACK,    /* Rx drop - consumed by call-back */
+    BKN_RX_STATS_D_NO_LINK,     /* Rx drop - software link down */
+    BKN_RX_STATS_D_NO_API_BUF,  /* Rx drop - no API buffers */
+    BKN_RX_STATS_BATCHES,       /* Rx batches delivered to network stack */
+    BKN_RX_STATS_BATCH_PKTS,    /* Rx packets delivered in batches */
+    BKN_RX_STATS_GRO_MERGED,    /* Rx packets merged by GRO */
+    BKN_RX_STATS_POOL_ALLOC,    /* Rx buffers taken from page pool */
+    BKN_RX_STATS_POOL_NO_PAGE,  /* Rx page pool allocation failures */
+    BKN_RX_STATS_D_BACKLOG,     /* Rx drop - channel NAPI backlog full */
+    BKN_RX_STATS_D_RATE_LIMIT,  /* Rx drop - filter or netif rate limit */
+    BKN_RX_STATS_RING,          /* Rx packets delivered to shared ring */
+    BKN_RX_STATS_D_RING_FULL,   /* Rx drop - shared ring full */
+    BKN_RX_STATS_MAX
+};
+
 #ifdef __KERNEL__
 
 /*
@@ -27,6 +27,25 @@
  * applications such as Host Sflow (https://github.com/sflow/host-sflow) 
  * using genetlink interfaces.  
  *
+ * Sampled pkts are copied by the filter call-back into a per-CPU ring
+ * of preallocated sample slots, so no memory is allocated per sample.
+ * A work item drains the rings in batches of up to psample_budget
+ * samples per CPU and sends them to the psample module, using cached
+ * references to the psample groups.
+ *
+ * Samples can be aggregated: as long as a process listens on the
+ * PSAMPLE_AGG_GENL_NAME genetlink family, samples are sent to that
+ * family instead of the psample module, packing up to psample_agg_batch
+ * PSAMPLE_CMD_SAMPLE messages into one netlink datagram. A datagram is
+ * sent when full or
+ * psample_agg_latency usecs after its first sample. Both settings can
+ * be changed in /proc/bcm/knet-cb/psample/aggregate.
+ *
+ * Source and destination ports are translated to network interfaces
+ * through a direct-mapped (unit, port) table updated under RCU when
+ * interfaces are created and destroyed. /proc/bcm/knet-cb/psample/bench
+ * measures the per-sample metadata processing cost.
+ *
  * The module can be built from the standard Linux user mode target
  * directories using the following command (assuming bash), e.g.
  *
@@ -44,6 +63,7 @@
 #include <linux/netdevice.h>
 #include <net/net_namespace.h>
 #include <net/psample.h>
+#include <net/genetlink.h>
 #include "psample-cb.h"
 
 #define PSAMPLE_CB_DBG
@@ -96,22 +116,75 @@ MODULE_PARM_DESC(psample_size,
 static int psample_qlen = PSAMPLE_QLEN_DFLT;
 LKM_MOD_PARAM(psample_qlen, "i", int, 0);
 MODULE_PARM_DESC(psample_qlen,
-"psample queue length (default 1024 buffers)");
+"psample queue length per CPU, rounded up to a power of 2 (default 1024 buffers)");
+
+#define PSAMPLE_SLOT_SIZE_DFLT 512
+static int psample_slot_size = PSAMPLE_SLOT_SIZE_DFLT;
+LKM_MOD_PARAM(psample_slot_size, "i", int, 0);
+MODULE_PARM_DESC(psample_slot_size,
+"psample max pkt bytes per queue buffer (default 512 bytes)");
+
+#define PSAMPLE_BUDGET_DFLT 64
+static int psample_budget = PSAMPLE_BUDGET_DFLT;
+LKM_MOD_PARAM(psample_budget, "i", int, 0);
+MODULE_PARM_DESC(psample_budget,
+"psample pkts sent per CPU queue in one work run (default 64)");
+
+#define PSAMPLE_AGG_BATCH_DFLT 32
+static int psample_agg_batch = PSAMPLE_AGG_BATCH_DFLT;
+LKM_MOD_PARAM(psample_agg_batch, "i", int, 0);
+MODULE_PARM_DESC(psample_agg_batch,
+"psample max pkts per aggregated netlink msg (default 32)");
+
+#define PSAMPLE_AGG_LATENCY_DFLT 1000
+static int psample_agg_latency = PSAMPLE_AGG_LATENCY_DFLT;
+LKM_MOD_PARAM(psample_agg_latency, "i", int, 0);
+MODULE_PARM_DESC(psample_agg_latency,
+"psample max usecs a pkt waits in an aggregated netlink msg (default 1000)");
+
+/* Max size of an aggregated netlink datagram, must fit consumer receive buffers */
+#define PSAMPLE_AGG_MSG_MAX (8 * 1024)
 
 /* driver proc entry root */
 static struct proc_dir_entry *psample_proc_root = NULL;
 static struct proc_dir_entry *knet_cb_proc_root = NULL;
 
+#define PSAMPLE_MAX_UNITS 16
+#define PSAMPLE_MAX_PORTS 256
+
+/* psample netif per port of a unit */
+typedef struct psample_port_map_s {
+    psample_netif_t __rcu *netif[PSAMPLE_MAX_PORTS];
+} psample_port_map_t;
+
 /* psample general info */
 typedef struct {
     struct list_head netif_list;
     int netif_count;
     knet_hw_info_t hw;
+    int hw_valid;
     struct net *netns;
     spinlock_t lock;
+    psample_port_map_t *port_map[PSAMPLE_MAX_UNITS];
+    /* DCB metadata word offsets for hw.dcb_type */
+    int src_hg_offset;
+    int dst_hg_offset;
+    int reason_hi_offset;
+    int reason_offset;
+    uint32 sample_reason_mask;
 } psample_info_t;
 static psample_info_t g_psample_info = {0};
 
+/* Last per-sample processing benchmark */
+typedef struct psample_bench_s {
+    int unit;
+    int port;
+    int count;
+    u64 map_ns;
+    u64 list_ns;
+} psample_bench_t;
+static psample_bench_t g_psample_bench = {0};
+
 /* Maintain sampled pkt statistics */
 typedef struct psample_stats_s {
     unsigned long pkts_f_psample_cb;
@@ -119,10 +192,10 @@ typedef struct psample_stats_s {
     unsigned long pkts_f_handled;
     unsigned long pkts_f_pass_through;
     unsigned long pkts_f_dst_mc;
-    unsigned long pkts_c_qlen_cur;
-    unsigned long pkts_c_qlen_hi;
-    unsigned long pkts_d_qlen_max;
-    unsigned long pkts_d_no_mem;
+    unsigned long pkts_c_slot_trunc;
+    unsigned long pkts_c_overrun;
+    unsigned long pkts_c_agg_msgs;
+    unsigned long pkts_d_agg;
     unsigned long pkts_d_no_group;
     unsigned long pkts_d_sampling_disabled;
     unsigned long pkts_d_not_ready;
@@ -140,22 +213,69 @@ typedef struct psample_meta_s {
     int sample_rate;
 } psample_meta_t;
 
-typedef struct psample_pkt_s {
-    struct list_head list;
-    struct psample_group *group;
+/* Sampled pkt queue buffer, followed by psample_slot_size bytes of pkt */
+typedef struct psample_slot_s {
+    int group_num;
+    int size;
     psample_meta_t meta;
-    struct sk_buff *skb;
-} psample_pkt_t;
+    uint8_t data[0];
+} psample_slot_t;
+
+/* Per-CPU sampled pkt queue, filled by one CPU and drained by the work */
+typedef struct psample_ring_s {
+    uint8_t *slots;
+    uint32 size;
+    uint32 head;
+    uint32 tail;
+    unsigned long qlen_hi;
+    unsigned long full;
+} psample_ring_t;
+
+#define PSAMPLE_GROUP_CACHE_MAX 16
 
 typedef struct psample_work_s {
-    struct list_head pkt_list;
     struct work_struct wq;
-    spinlock_t lock;
+    psample_ring_t __percpu *ring;
+    uint32 slot_stride;
+    struct sk_buff *skb;
+    struct psample_group *groups[PSAMPLE_GROUP_CACHE_MAX];
+    int group_count;
 } psample_work_t;
 static psample_work_t g_psample_work = {0};
 
+/* Aggregated netlink datagram being filled by the work */
+typedef struct psample_agg_s {
+    struct mutex lock;
+    struct sk_buff *skb;
+    int count;
+    struct delayed_work flush;
+} psample_agg_t;
+static psample_agg_t g_psample_agg;
+
+static const struct genl_multicast_group psample_agg_mcgrps[] = {
+    { .name = PSAMPLE_AGG_MCGRP_NAME },
+};
+
+static struct genl_family psample_agg_family = {
+    .name = PSAMPLE_AGG_GENL_NAME,
+    .version = PSAMPLE_AGG_GENL_VERSION,
+    .maxattr = PSAMPLE_ATTR_MAX,
+    .netnsok = true,
+    .module = THIS_MODULE,
+    .mcgrps = psample_agg_mcgrps,
+    .n_mcgrps = ARRAY_SIZE(psample_agg_mcgrps),
+};
+static int psample_agg_registered = 0;
+
+static inline psample_slot_t *
+psample_ring_slot(psample_ring_t *ring, uint32 idx)
+{
+    return (psample_slot_t *)(ring->slots +
+                              (idx & (ring->size - 1)) * g_psample_work.slot_stride);
+}
+
 static psample_netif_t*
-psample_netif_lookup_by_port(int unit, int port)
+psample_netif_list_lookup(int unit, int port)
 {
     struct list_head *list;
     psample_netif_t *psample_netif = NULL;
@@ -165,7 +285,7 @@ psample_netif_lookup_by_port(int unit, int port)
     spin_lock_irqsave(&g_psample_info.lock, flags);
     list_for_each(list, &g_psample_info.netif_list) {
         psample_netif = (psample_netif_t*)list;
-        if (psample_netif->port == port) {
+        if (psample_netif->unit == unit && psample_netif->port == port) {
             spin_unlock_irqrestore(&g_psample_info.lock, flags);
             return psample_netif;
         }
@@ -173,6 +293,104 @@ psample_netif_lookup_by_port(int unit, int port)
     spin_unlock_irqrestore(&g_psample_info.lock, flags);
     return (NULL);
 }
+
+/*
+ * Must be called under rcu_read_lock, the netif is freed after
+ * a grace period when destroyed.
+ */
+static psample_netif_t*
+psample_netif_lookup_by_port(int unit, int port)
+{
+    psample_port_map_t *port_map;
+
+    if (unit < 0 || unit >= PSAMPLE_MAX_UNITS) {
+        return psample_netif_list_lookup(unit, port);
+    }
+    if (port < 0 || port >= PSAMPLE_MAX_PORTS) {
+        return (NULL);
+    }
+    port_map = READ_ONCE(g_psample_info.port_map[unit]);
+    if (!port_map) {
+        return (NULL);
+    }
+    return rcu_dereference(port_map->netif[port]);
+}
+
+static int
+psample_port_map_alloc(int unit)
+{
+    psample_port_map_t *port_map;
+
+    if (unit < 0 || unit >= PSAMPLE_MAX_UNITS ||
+        g_psample_info.port_map[unit]) {
+        return (0);
+    }
+    if ((port_map = kzalloc(sizeof(*port_map), GFP_ATOMIC)) == NULL) {
+        return (-1);
+    }
+    /* maps are only freed on module cleanup */
+    if (cmpxchg(&g_psample_info.port_map[unit], NULL, port_map) != NULL) {
+        kfree(port_map);
+    }
+    return (0);
+}
+
+/*
+ * Point (unit, port) to the first netif of the port like the list lookup.
+ * Must be called with g_psample_info.lock held.
+ */
+static void
+psample_port_map_update(int unit, int port)
+{
+    struct list_head *list;
+    psample_netif_t *psample_netif, *found = NULL;
+    psample_port_map_t *port_map;
+
+    if (unit < 0 || unit >= PSAMPLE_MAX_UNITS ||
+        (port_map = g_psample_info.port_map[unit]) == NULL) {
+        return;
+    }
+
+    list_for_each(list, &g_psample_info.netif_list) {
+        psample_netif = (psample_netif_t*)list;
+        if (psample_netif->unit == unit && psample_netif->port == port) {
+            found = psample_netif;
+            break;
+        }
+    }
+    rcu_assign_pointer(port_map->netif[port], found);
+}
+
+static void
+psample_dcb_offsets_init(psample_info_t *psample_info)
+{
+    switch(psample_info->hw.dcb_type) {
+        case 36: /* TD3 */
+        case 38: /* TH3 */
+            psample_info->src_hg_offset = 0;
+            psample_info->dst_hg_offset = 0;
+            psample_info->reason_hi_offset = 4;
+            psample_info->reason_offset = 5;
+            psample_info->sample_reason_mask = (1 << 3);
+            break;
+        case 32: /* TH1/TH2 */
+        case 26: /* TD2 */
+        case 23: /* HX4 */
+            psample_info->src_hg_offset = SOC_DCB32_HG_OFFSET;
+            psample_info->dst_hg_offset = SOC_DCB32_HG_OFFSET;
+            psample_info->reason_hi_offset = 2;
+            psample_info->reason_offset = 3;
+            psample_info->sample_reason_mask = (1 << 5);
+            break;
+        default:
+            psample_info->src_hg_offset = 0;
+            psample_info->dst_hg_offset = SOC_DCB32_HG_OFFSET;
+            psample_info->reason_hi_offset = 2;
+            psample_info->reason_offset = 3;
+            psample_info->sample_reason_mask = (1 << 5);
+            break;
+    }
+}
         
 static int
 psample_info_get (int unit, psample_info_t *psample_info)
@@ -189,6 +407,8 @@ psample_info_get (int unit, psample_info_t *psample_info)
         gprintk("%s: failed to get hw info\n", __func__);
         return (-1);
     }
+    psample_dcb_offsets_init(psample_info);
+    psample_info->hw_valid = 1;
 
     PSAMPLE_CB_DBG_PRINT("%s: DCB type %d\n",
             __func__, psample_info->hw.dcb_type);
@@ -199,19 +419,7 @@ static int
 psample_meta_srcport_get(uint8_t *pkt, void *pkt_meta)
 {
     int srcport = 0;
-    uint32_t *metadata = (uint32_t*)pkt_meta;
-
-    switch(g_psample_info.hw.dcb_type) {
-        case 36: /* TD3 */
-        case 38: /* TH3 */
-            break;
-        case 32: /* TH1/TH2 */
-        case 26: /* TD2 */
-        case 23: /* HX4 */
-            metadata += SOC_DCB32_HG_OFFSET;
-        default:
-            break;
-    }
+    uint32_t *metadata = (uint32_t*)pkt_meta + g_psample_info.src_hg_offset;
 
     if (SOC_HIGIG2_START(metadata) == SOC_HIGIG2_SOP) 
     {
@@ -234,20 +442,8 @@ static int
 psample_meta_dstport_get(uint8_t *pkt, void *pkt_meta)
 {
     int dstport = 0;
-    uint32_t *metadata = (uint32_t*)pkt_meta;
+    uint32_t *metadata = (uint32_t*)pkt_meta + g_psample_info.dst_hg_offset;
 
-    switch(g_psample_info.hw.dcb_type) {
-        case 36: /* TD3 */
-        case 38: /* TH3 */
-            break;
-        case 32: /* TH1/TH2 */
-        case 26: /* TD2 */
-        case 23: /* HX4 */
-        default:
-            metadata += SOC_DCB32_HG_OFFSET;
-            break;
-    }
-    
     if (SOC_HIGIG2_START(metadata) == SOC_HIGIG2_SOP) 
     {
         if (SOC_HIGIG2_IS_MC(metadata))
@@ -282,22 +478,9 @@ psample_meta_sample_reason(uint8_t *pkt, void *pkt_meta)
     uint32_t sample_rx_reason_mask = 0;
 
     /* Sample Pkt reason code (bcmRxReasonSampleSource) */
-    switch(g_psample_info.hw.dcb_type) {
-        case 36: /* TD3 */
-        case 38: /* TH3 */
-            reason_hi = *(metadata + 4);
-            reason    = *(metadata + 5);
-            sample_rx_reason_mask = (1 << 3);
-            break;
-        case 32: /* TH1/TH2 */
-        case 26: /* TD2 */
-        case 23: /* HX4 */
-        default:
-            reason_hi = *(metadata + 2);
-            reason    = *(metadata + 3);
-            sample_rx_reason_mask = (1 << 5);
-            break;
-    }
+    reason_hi = *(metadata + g_psample_info.reason_hi_offset);
+    reason    = *(metadata + g_psample_info.reason_offset);
+    sample_rx_reason_mask = g_psample_info.sample_reason_mask;
         
     PSAMPLE_CB_DBG_PRINT("%s: DCB%d sample_rx_reason_mask: 0x%08x, reason: 0x%08x, reason_hi: 0x%08x\n", 
             __func__, g_psample_info.hw.dcb_type, sample_rx_reason_mask, reason, reason_hi);
@@ -346,6 +529,8 @@ psample_meta_get(int unit, uint8_t *pkt, void *pkt_meta, psample_meta_t *sflow_m
         return (-1);
     }
 
+    rcu_read_lock();
+
     /* find src port netif (no need to lookup CPU port) */
     if (srcport != 0) {
         if ((psample_netif = psample_netif_lookup_by_port(unit, srcport))) {
@@ -376,6 +561,8 @@ psample_meta_get(int unit, uint8_t *pkt, void *pkt_meta, psample_meta_t *sflow_m
         }
     }
 
+    rcu_read_unlock();
+
     PSAMPLE_CB_DBG_PRINT("%s: srcport %d, dstport %d, src_ifindex 0x%x, dst_ifindex 0x%x, trunc_size %d, sample_rate %d\n", 
             __func__, srcport, dstport, src_ifindex, dst_ifindex, sample_size, sample_rate);
 
@@ -387,77 +574,272 @@ psample_meta_get(int unit, uint8_t *pkt, void *pkt_meta, psample_meta_t *sflow_m
     return (0);
 }
 
+/*
+ * Get psample group, keeping a reference to the first groups used.
+ * *uncached is set when the caller must release the group.
+ */
+static struct psample_group *
+psample_group_cache_get(psample_work_t *psample_work, int group_num, int *uncached)
+{
+    struct psample_group *group;
+    int idx;
+
+    *uncached = 0;
+    for (idx = 0; idx < psample_work->group_count; idx++) {
+        if (psample_work->groups[idx]->group_num == group_num) {
+            return psample_work->groups[idx];
+        }
+    }
+
+    group = psample_group_get(g_psample_info.netns, group_num);
+    if (group) {
+        if (psample_work->group_count < PSAMPLE_GROUP_CACHE_MAX) {
+            psample_work->groups[psample_work->group_count++] = group;
+        } else {
+            *uncached = 1;
+        }
+    }
+    return group;
+}
+
+static void
+psample_group_cache_clear(psample_work_t *psample_work)
+{
+    while (psample_work->group_count > 0) {
+        psample_group_put(psample_work->groups[--psample_work->group_count]);
+    }
+}
+
+/*
+ * Send the aggregated netlink datagram.
+ * Must be called with g_psample_agg.lock held.
+ */
+static void
+psample_agg_send(psample_agg_t *agg)
+{
+    int rv;
+
+    if (!agg->skb) {
+        return;
+    }
+    rv = genlmsg_multicast_netns(&psample_agg_family, g_psample_info.netns,
+                                 agg->skb, 0, 0, GFP_KERNEL);
+    if (rv < 0 && rv != -ESRCH) {
+        g_psample_stats.pkts_d_agg += agg->count;
+    } else {
+        g_psample_stats.pkts_c_agg_msgs++;
+    }
+    agg->skb = NULL;
+    agg->count = 0;
+}
+
+/*
+ * Take the next sequence number of a psample group. The cmpxchg only
+ * keeps numbers unique among callers in this module. psample_sample_packet()
+ * does a plain group->seq++ with no lock exported, so a sample sent through
+ * psample at the same moment may still repeat or skip a number.
+ */
+static inline u32
+psample_group_seq_next(struct psample_group *group)
+{
+    u32 seq;
+
+    do {
+        seq = READ_ONCE(group->seq);
+    } while (cmpxchg(&group->seq, seq, seq + 1) != seq);
+    return seq;
+}
+
+/* Size of one PSAMPLE_CMD_SAMPLE msg in the aggregated datagram */
+static inline size_t
+psample_agg_sample_size(int trunc_size)
+{
+    return nlmsg_total_size(GENL_HDRLEN +
+                            2 * nla_total_size(sizeof(u16)) +
+                            4 * nla_total_size(sizeof(u32)) +
+                            nla_total_size(trunc_size));
+}
+
+static int
+psample_agg_sample_put(struct sk_buff *skb, struct psample_group *group,
+                       psample_slot_t *slot)
+{
+    struct nlattr *seq, *data;
+    void *hdr;
+
+    if ((hdr = genlmsg_put(skb, 0, 0, &psample_agg_family, 0,
+                           PSAMPLE_CMD_SAMPLE)) == NULL) {
+        return -EMSGSIZE;
+    }
+    if (nla_put_u16(skb, PSAMPLE_ATTR_IIFINDEX, slot->meta.src_ifindex) ||
+        nla_put_u16(skb, PSAMPLE_ATTR_OIFINDEX, slot->meta.dst_ifindex) ||
+        nla_put_u32(skb, PSAMPLE_ATTR_ORIGSIZE, slot->size) ||
+        nla_put_u32(skb, PSAMPLE_ATTR_SAMPLE_GROUP, group->group_num) ||
+        (seq = nla_reserve(skb, PSAMPLE_ATTR_GROUP_SEQ, sizeof(u32))) == NULL ||
+        nla_put_u32(skb, PSAMPLE_ATTR_SAMPLE_RATE, slot->meta.sample_rate) ||
+        (data = nla_reserve(skb, PSAMPLE_ATTR_DATA, slot->meta.trunc_size)) == NULL) {
+        genlmsg_cancel(skb, hdr);
+        return -EMSGSIZE;
+    }
+    memcpy(nla_data(data), slot->data, slot->meta.trunc_size);
+    /* only numbers samples that fit, so a full datagram leaves no gap */
+    *(u32 *)nla_data(seq) = psample_group_seq_next(group);
+    genlmsg_end(skb, hdr);
+    return 0;
+}
+
+/*
+ * Add a sample to the aggregated netlink datagram, sending it when full.
+ * Returns -1 if the sample should be sent to psample instead.
+ */
+static int
+psample_agg_add(psample_agg_t *agg, struct psample_group *group,
+                psample_slot_t *slot)
+{
+    size_t size;
+    int batch, retry;
+
+    if (!psample_agg_registered ||
+        !genl_has_listeners(&psample_agg_family, g_psample_info.netns, 0)) {
+        return -1;
+    }
+
+    mutex_lock(&agg->lock);
+    batch = max(READ_ONCE(psample_agg_batch), 1);
+
+    for (retry = 0; retry < 2; retry++) {
+        if (!agg->skb) {
+            size = min_t(size_t, batch * psample_agg_sample_size(psample_slot_size),
+                         PSAMPLE_AGG_MSG_MAX);
+            if ((agg->skb = alloc_skb(size, GFP_KERNEL)) == NULL) {
+                g_psample_stats.pkts_d_agg++;
+                break;
+            }
+        }
+        if (psample_agg_sample_put(agg->skb, group, slot) == 0) {
+            if (++agg->count >= batch) {
+                psample_agg_send(agg);
+            }
+            break;
+        }
+        /* datagram full, send it and start a new one */
+        if (agg->count == 0) {
+            g_psample_stats.pkts_d_agg++;
+            break;
+        }
+        psample_agg_send(agg);
+    }
+
+    /* bound the time the first sample waits for the msg to fill up */
+    if (agg->skb) {
+        schedule_delayed_work(&agg->flush,
+                              usecs_to_jiffies(READ_ONCE(psample_agg_latency)));
+    }
+    mutex_unlock(&agg->lock);
+    return 0;
+}
+
+static void
+psample_agg_flush(struct work_struct *work)
+{
+    psample_agg_t *agg = container_of(to_delayed_work(work), psample_agg_t, flush);
+
+    mutex_lock(&agg->lock);
+    psample_agg_send(agg);
+    mutex_unlock(&agg->lock);
+}
+
 static void
 psample_task(struct work_struct *work)
 {
     psample_work_t *psample_work = container_of(work, psample_work_t, wq);
-    unsigned long flags;
-    struct list_head *list_ptr, *list_next;
-    psample_pkt_t *pkt;
+    struct sk_buff *skb = psample_work->skb;
+    struct psample_group *group;
     struct psample_metadata md = {0};
+    psample_ring_t *ring;
+    psample_slot_t *slot;
+    uint32 head, tail;
+    int cpu, budget, uncached;
+    int more = 0;
+
+    for_each_possible_cpu(cpu) {
+        ring = per_cpu_ptr(psample_work->ring, cpu);
+        tail = ring->tail;
+        head = smp_load_acquire(&ring->head);
+        for (budget = psample_budget; tail != head && budget > 0; budget--) {
+            slot = psample_ring_slot(ring, tail++);
+
+            group = psample_group_cache_get(psample_work, slot->group_num, &uncached);
+            if (!group) {
+                gprintk("%s: Could not find psample genetlink group %d\n", __func__, slot->group_num);
+                g_psample_stats.pkts_d_no_group++;
+                continue;
+            }
 
-    spin_lock_irqsave(&psample_work->lock, flags);
-    list_for_each_safe(list_ptr, list_next, &psample_work->pkt_list) {
-        /* dequeue pkt from list */
-        pkt = list_entry(list_ptr, psample_pkt_t, list);
-        list_del(list_ptr);
-        g_psample_stats.pkts_c_qlen_cur--;
-        spin_unlock_irqrestore(&psample_work->lock, flags);
- 
-        /* send to psample */
-        if (pkt) {
             PSAMPLE_CB_DBG_PRINT("%s: group 0x%x, trunc_size %d, src_ifdx 0x%x, dst_ifdx 0x%x, sample_rate %d\n",
-                    __func__, pkt->group->group_num, 
-                    pkt->meta.trunc_size, pkt->meta.src_ifindex, 
-                    pkt->meta.dst_ifindex, pkt->meta.sample_rate);
-
-            md.trunc_size = pkt->meta.trunc_size;
-            md.in_ifindex = pkt->meta.src_ifindex;
-            md.out_ifindex = pkt->meta.dst_ifindex;
-            psample_sample_packet(pkt->group, 
-                                  pkt->skb,
-                                  pkt->meta.sample_rate,
+                    __func__, group->group_num,
+                    slot->meta.trunc_size, slot->meta.src_ifindex,
+                    slot->meta.dst_ifindex, slot->meta.sample_rate);
+
+            if (psample_agg_add(&g_psample_agg, group, slot) == 0) {
+                g_psample_stats.pkts_f_psample_mod++;
+                if (uncached) {
+                    psample_group_put(group);
+                }
+                continue;
+            }
+
+            /* point work skb to sampled pkt */
+            memcpy(skb->data, slot->data, slot->meta.trunc_size);
+            skb_set_tail_pointer(skb, slot->meta.trunc_size);
+            skb->len = slot->size; /* SONIC-55684 */
+
+            md.trunc_size = slot->meta.trunc_size;
+            md.in_ifindex = slot->meta.src_ifindex;
+            md.out_ifindex = slot->meta.dst_ifindex;
+            psample_sample_packet(group,
+                                  skb,
+                                  slot->meta.sample_rate,
                                   &md);
             g_psample_stats.pkts_f_psample_mod++;
- 
-            dev_kfree_skb_any(pkt->skb);
-            kfree(pkt);
+
+            if (uncached) {
+                psample_group_put(group);
+            }
         }
-        spin_lock_irqsave(&psample_work->lock, flags);
+        /* return slots to the filter call-back */
+        smp_store_release(&ring->tail, tail);
+        if (tail != head) {
+            more = 1;
+        }
+    }
+
+    if (more) {
+        /* budget exhausted, let other work run before continuing */
+        g_psample_stats.pkts_c_overrun++;
+        schedule_work(work);
     }
-    spin_unlock_irqrestore(&psample_work->lock, flags);
 }
 
 int 
 psample_filter_cb(uint8_t * pkt, int size, int dev_no, void *pkt_meta,
                   int chan, kcom_filter_t *kf)
 {
-    struct psample_group *group;
     psample_meta_t meta;   
     int rv = 0;
-    static int info_get = 0;
 
-    if (!info_get) {
+    if (!g_psample_info.hw_valid) {
         rv = psample_info_get (dev_no, &g_psample_info);
         if (rv < 0) {
             gprintk("%s: failed to get psample info\n", __func__);
             goto PSAMPLE_FILTER_CB_PKT_HANDLED;
         }
-        info_get = 1;
     }
 
     PSAMPLE_CB_DBG_PRINT("%s: pkt size %d, kf->dest_id %d, kf->cb_user_data %d\n",
             __func__, size, kf->dest_id, kf->cb_user_data);
     g_psample_stats.pkts_f_psample_cb++;
 
-    /* get psample group info. psample genetlink group ID passed in kf->dest_id */
-    group = psample_group_get(g_psample_info.netns, kf->dest_id);
-    if (!group) {
-        gprintk("%s: Could not find psample genetlink group %d\n", __func__, kf->cb_user_data);
-        g_psample_stats.pkts_d_no_group++;
-        goto PSAMPLE_FILTER_CB_PKT_HANDLED;
-    }
-
     /* get psample metadata */
     rv = psample_meta_get(dev_no, pkt, pkt_meta, &meta);
     if (rv < 0) {
@@ -478,52 +860,60 @@ psample_filter_cb(uint8_t * pkt, int size, int dev_no, void *pkt_meta,
     if (meta.trunc_size >= size) {
         meta.trunc_size = size - PSAMPLE_NLA_PADDING;
     }
+    if (meta.trunc_size < 0) {
+        g_psample_stats.pkts_d_invalid_size++;
+        goto PSAMPLE_FILTER_CB_PKT_HANDLED;
+    }
 
+    /* psample genetlink group ID passed in kf->dest_id */
     PSAMPLE_CB_DBG_PRINT("%s: group 0x%x, trunc_size %d, src_ifdx 0x%x, dst_ifdx 0x%x, sample_rate %d\n",
-            __func__, group->group_num, meta.trunc_size, meta.src_ifindex, meta.dst_ifindex, meta.sample_rate);
+            __func__, kf->dest_id, meta.trunc_size, meta.src_ifindex, meta.dst_ifindex, meta.sample_rate);
 
     /* drop if configured sample rate is 0 */
     if (meta.sample_rate > 0) {
         unsigned long flags;
-        psample_pkt_t *psample_pkt;
-        struct sk_buff *skb;
+        psample_ring_t *ring;
+        psample_slot_t *slot;
+        uint32 head, qlen;
 
-        if (g_psample_stats.pkts_c_qlen_cur >= psample_qlen) {
-            gprintk("%s: tail drop due to max qlen %d reached\n", __func__, psample_qlen);
-            g_psample_stats.pkts_d_qlen_max++;
-            goto PSAMPLE_FILTER_CB_PKT_HANDLED;
+        if (meta.trunc_size > psample_slot_size) {
+            meta.trunc_size = psample_slot_size;
+            g_psample_stats.pkts_c_slot_trunc++;
         }
 
-        if ((psample_pkt = kmalloc(sizeof(psample_pkt_t), GFP_ATOMIC)) == NULL) {
-            gprintk("%s: failed to alloc psample mem for pkt\n", __func__);
-            g_psample_stats.pkts_d_no_mem++;
+        if (!g_psample_work.ring) {
+            g_psample_stats.pkts_d_not_ready++;
             goto PSAMPLE_FILTER_CB_PKT_HANDLED;
         }
-        memcpy(&psample_pkt->meta, &meta, sizeof(psample_meta_t));
-        psample_pkt->group = group;
 
-        if ((skb = dev_alloc_skb(meta.trunc_size)) == NULL) {
-            gprintk("%s: failed to alloc psample mem for pkt skb\n", __func__);
-            g_psample_stats.pkts_d_no_mem++;
+        local_irq_save(flags);
+        ring = this_cpu_ptr(g_psample_work.ring);
+        head = ring->head;
+        qlen = head - smp_load_acquire(&ring->tail);
+        if (qlen >= ring->size) {
+            ring->full++;
+            local_irq_restore(flags);
             goto PSAMPLE_FILTER_CB_PKT_HANDLED;
         }
 
-        /* setup skb to point to pkt */
-        memcpy(skb->data, pkt, meta.trunc_size);
-        skb_put(skb, meta.trunc_size);
-        skb->len = size; /* SONIC-55684 */
-        psample_pkt->skb = skb;
+        /* copy pkt to queue buffer */
+        slot = psample_ring_slot(ring, head);
+        slot->group_num = kf->dest_id;
+        slot->size = size;
+        slot->meta = meta;
+        memcpy(slot->data, pkt, meta.trunc_size);
+        smp_store_release(&ring->head, head + 1);
 
-        spin_lock_irqsave(&g_psample_work.lock, flags);
-        list_add_tail(&psample_pkt->list, &g_psample_work.pkt_list); 
-        
-        g_psample_stats.pkts_c_qlen_cur++;
-        if (g_psample_stats.pkts_c_qlen_cur > g_psample_stats.pkts_c_qlen_hi) {
-            g_psample_stats.pkts_c_qlen_hi = g_psample_stats.pkts_c_qlen_cur;
+        if (++qlen > ring->qlen_hi) {
+            ring->qlen_hi = qlen;
         }
+        local_irq_restore(flags);
 
-        schedule_work(&g_psample_work.wq);
-        spin_unlock_irqrestore(&g_psample_work.lock, flags);
+        /* pairs with the work clearing its pending state before it runs */
+        smp_mb();
+        if (!work_pending(&g_psample_work.wq)) {
+            schedule_work(&g_psample_work.wq);
+        }
     } else {
         g_psample_stats.pkts_d_sampling_disabled++;
     }    
@@ -552,9 +942,16 @@ psample_netif_create_cb(int unit, kcom_netif_t *netif, struct net_device *dev)
                 __func__, dev->name);
         return (-1);
     }
+    if (psample_port_map_alloc(unit) < 0) {
+        gprintk("%s: failed to alloc psample port map for unit %d\n",
+                __func__, unit);
+        kfree(psample_netif);
+        return (-1);
+    }
 
     spin_lock_irqsave(&g_psample_info.lock, flags);
 
+    psample_netif->unit = unit;
     psample_netif->dev = dev;
     psample_netif->id = netif->id;
     psample_netif->port = netif->port;
@@ -581,6 +978,7 @@ psample_netif_create_cb(int unit, kcom_netif_t *netif, struct net_device *dev)
         /* No holes - add to end of list */
         list_add_tail(&psample_netif->list, &g_psample_info.netif_list);
     }
+    psample_port_map_update(unit, psample_netif->port);
     
     spin_unlock_irqrestore(&g_psample_info.lock, flags);
 
@@ -591,7 +989,7 @@ psample_netif_create_cb(int unit, kcom_netif_t *netif, struct net_device *dev)
 int
 psample_netif_destroy_cb(int unit, kcom_netif_t *netif, struct net_device *dev)
 {
-    int found;
+    int found = 0;
     struct list_head *list;
     psample_netif_t *psample_netif;
     unsigned long flags; 
@@ -608,8 +1006,9 @@ psample_netif_destroy_cb(int unit, kcom_netif_t *netif, struct net_device *dev)
         if (netif->id == psample_netif->id) {
             found = 1; 
             list_del(&psample_netif->list);
+            psample_port_map_update(psample_netif->unit, psample_netif->port);
             PSAMPLE_CB_DBG_PRINT("%s: removing psample netif '%s'\n", __func__, dev->name);
-            kfree(psample_netif);
+            kfree_rcu(psample_netif, rcu);
             g_psample_info.netif_count--; 
             break;
         }
@@ -832,18 +1231,29 @@ psample_proc_map_show(struct seq_file *m, void *v)
 {
     struct list_head *list;
     psample_netif_t *psample_netif;
+    psample_port_map_t *port_map;
     unsigned long flags;
+    int mapped;
 
-    seq_printf(m, "  Interface      logical port   ifindex\n");
-    seq_printf(m, "-------------    ------------   -------\n");
+    seq_printf(m, "  Interface      unit   logical port   ifindex   mapped\n");
+    seq_printf(m, "-------------    ----   ------------   -------   ------\n");
     spin_lock_irqsave(&g_psample_info.lock, flags);
     
     list_for_each(list, &g_psample_info.netif_list) {
         psample_netif = (psample_netif_t*)list;
-        seq_printf(m, "  %-14s %-14d %d\n",
+        /* netifs not mapped are shadowed by another netif of the port */
+        mapped = 0;
+        if (psample_netif->unit >= 0 && psample_netif->unit < PSAMPLE_MAX_UNITS) {
+            port_map = g_psample_info.port_map[psample_netif->unit];
+            mapped = port_map &&
+                rcu_access_pointer(port_map->netif[psample_netif->port]) == psample_netif;
+        }
+        seq_printf(m, "  %-14s %-6d %-14d %-9d %s\n",
                 psample_netif->dev->name,
+                psample_netif->unit,
                 psample_netif->port,
-                psample_netif->dev->ifindex);
+                psample_netif->dev->ifindex,
+                mapped ? "yes" : "no");
     }
 
     spin_unlock_irqrestore(&g_psample_info.lock, flags);
@@ -880,6 +1290,9 @@ psample_proc_debug_show(struct seq_file *m, void *v)
     seq_printf(m, "  cdma_channels:   %d\n",   g_psample_info.hw.cdma_channels);
     seq_printf(m, "  netif_count:     %d\n",   g_psample_info.netif_count);
     seq_printf(m, "  queue length:    %d\n",   psample_qlen);
+    seq_printf(m, "  queue buf size:  %d\n",   psample_slot_size);
+    seq_printf(m, "  work budget:     %d\n",   psample_budget);
+    seq_printf(m, "  cached groups:   %d\n",   g_psample_work.group_count);
 
     return 0;
 }
@@ -935,9 +1348,238 @@ struct proc_ops psample_proc_debug_file_ops = {
     .proc_release =    single_release,
 };
 
+/*
+ * psample bench Proc Read Entry
+ */
+static int
+psample_proc_bench_show(struct seq_file *m, void *v)
+{
+    psample_bench_t *bench = &g_psample_bench;
+
+    if (bench->count == 0) {
+        seq_printf(m, "No benchmark run\n");
+        return 0;
+    }
+    seq_printf(m, "BCM KNET %s Callback Benchmark\n", PSAMPLE_CB_NAME);
+    seq_printf(m, "  unit %d, port %d, %d samples\n",
+               bench->unit, bench->port, bench->count);
+    seq_printf(m, "  metadata processing       %10llu ns/sample\n",
+               bench->map_ns / bench->count);
+    seq_printf(m, "  netif list lookups        %10llu ns/sample\n",
+               bench->list_ns / bench->count);
+    return 0;
+}
+
+static int
+psample_proc_bench_open(struct inode * inode, struct file * file)
+{
+    return single_open(file, psample_proc_bench_show, NULL);
+}
+
+/*
+ * Run psample_meta_get on HiGig metadata with <port> as source and
+ * destination port, and compare with looking the port up twice in the
+ * netif list. The port should belong to a psample netif.
+ */
+static void
+psample_bench_run(psample_bench_t *bench)
+{
+    uint32_t metadata[16];
+    uint32_t *hg;
+    psample_meta_t sflow_meta;
+    ktime_t start;
+    int idx;
+
+    memset(metadata, 0, sizeof(metadata));
+    hg = metadata + g_psample_info.src_hg_offset;
+    hg[0] |= SOC_HIGIG2_SOP << 24;
+    hg[1] |= bench->port << 16;
+    hg = metadata + g_psample_info.dst_hg_offset;
+    hg[0] |= SOC_HIGIG2_SOP << 24 | bench->port;
+
+    start = ktime_get();
+    for (idx = 0; idx < bench->count; idx++) {
+        psample_meta_get(bench->unit, NULL, metadata, &sflow_meta);
+    }
+    bench->map_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+    start = ktime_get();
+    for (idx = 0; idx < bench->count; idx++) {
+        psample_netif_list_lookup(bench->unit, bench->port);
+        psample_netif_list_lookup(bench->unit, bench->port);
+    }
+    bench->list_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+/*
+ * psample bench Proc Write Entry
+ *
+ *   Syntax:
+ *   [unit=<unit>,]port=<logical port>[,count=<samples>]
+ *
+ *   Examples:
+ *   port=1,count=1000000
+ */
+static ssize_t
+psample_proc_bench_write(struct file *file, const char *buf,
+                    size_t count, loff_t *loff)
+{
+    char bench_str[64];
+    char *ptr;
+    psample_bench_t bench;
+
+    if (count > sizeof(bench_str) - 1) {
+        count = sizeof(bench_str) - 1;
+    }
+    if (copy_from_user(bench_str, buf, count)) {
+        return -EFAULT;
+    }
+    bench_str[count] = 0;
+
+    memset(&bench, 0, sizeof(bench));
+    bench.count = 100000;
+    if ((ptr = strstr(bench_str, "unit=")) != NULL) {
+        bench.unit = simple_strtol(ptr + 5, NULL, 0);
+    }
+    if ((ptr = strstr(bench_str, "count=")) != NULL) {
+        bench.count = simple_strtol(ptr + 6, NULL, 0);
+    }
+    if ((ptr = strstr(bench_str, "port=")) == NULL) {
+        gprintk("Error: Benchmark syntax not recognized: '%s'\n", bench_str);
+        return count;
+    }
+    bench.port = simple_strtol(ptr + 5, NULL, 0);
+    if (bench.port <= 0 || bench.port >= PSAMPLE_MAX_PORTS ||
+        bench.count <= 0 || bench.count > 10000000) {
+        gprintk("Error: Invalid benchmark port or count\n");
+        return count;
+    }
+    if (!g_psample_info.hw_valid &&
+        psample_info_get(bench.unit, &g_psample_info) < 0) {
+        return count;
+    }
+
+    psample_bench_run(&bench);
+    g_psample_bench = bench;
+
+    return count;
+}
+
+struct proc_ops psample_proc_bench_file_ops = {
+    PROC_OWNER(THIS_MODULE)
+    .proc_open =       psample_proc_bench_open,
+    .proc_read =       seq_read,
+    .proc_lseek =      seq_lseek,
+    .proc_write =      psample_proc_bench_write,
+    .proc_release =    single_release,
+};
+
+/*
+ * psample aggregate Proc Read Entry
+ */
+static int
+psample_proc_aggregate_show(struct seq_file *m, void *v)
+{
+    seq_printf(m, "BCM KNET %s Callback Aggregation\n", PSAMPLE_CB_NAME);
+    seq_printf(m, "  genetlink family: %s\n", PSAMPLE_AGG_GENL_NAME);
+    seq_printf(m, "  registered:       %s\n", psample_agg_registered ? "yes" : "no");
+    seq_printf(m, "  listeners:        %s\n",
+               psample_agg_registered &&
+               genl_has_listeners(&psample_agg_family, g_psample_info.netns, 0) ?
+               "yes" : "no");
+    seq_printf(m, "  batch:            %d\n", psample_agg_batch);
+    seq_printf(m, "  latency:          %d usecs\n", psample_agg_latency);
+    return 0;
+}
+
+static int
+psample_proc_aggregate_open(struct inode * inode, struct file * file)
+{
+    return single_open(file, psample_proc_aggregate_show, NULL);
+}
+
+/*
+ * psample aggregate Proc Write Entry
+ *
+ *   Syntax:
+ *   batch=<pkts per msg>,latency=<usecs>
+ *
+ *   Where a batch of 1 sends every pkt in its own msg.
+ *
+ *   Examples:
+ *   batch=32,latency=2000
+ *   batch=1
+ */
+static ssize_t
+psample_proc_aggregate_write(struct file *file, const char *buf,
+                    size_t count, loff_t *loff)
+{
+    char agg_str[64];
+    char *ptr;
+    int val;
+
+    if (count > sizeof(agg_str) - 1) {
+        count = sizeof(agg_str) - 1;
+    }
+    if (copy_from_user(agg_str, buf, count)) {
+        return -EFAULT;
+    }
+    agg_str[count] = 0;
+
+    if ((ptr = strstr(agg_str, "batch=")) != NULL) {
+        val = simple_strtol(ptr + 6, NULL, 0);
+        if (val < 0) {
+            gprintk("Error: Invalid aggregation batch %d\n", val);
+            return count;
+        }
+        WRITE_ONCE(psample_agg_batch, val);
+    }
+    if ((ptr = strstr(agg_str, "latency=")) != NULL) {
+        val = simple_strtol(ptr + 8, NULL, 0);
+        if (val < 0) {
+            gprintk("Error: Invalid aggregation latency %d\n", val);
+            return count;
+        }
+        WRITE_ONCE(psample_agg_latency, val);
+    }
+    if (!strstr(agg_str, "batch=") && !strstr(agg_str, "latency=")) {
+        gprintk("Warning: unknown configuration setting\n");
+        return count;
+    }
+
+    /* send pending samples with the previous settings */
+    mod_delayed_work(system_wq, &g_psample_agg.flush, 0);
+
+    return count;
+}
+
+struct proc_ops psample_proc_aggregate_file_ops = {
+    PROC_OWNER(THIS_MODULE)
+    .proc_open =       psample_proc_aggregate_open,
+    .proc_read =       seq_read,
+    .proc_lseek =      seq_lseek,
+    .proc_write =      psample_proc_aggregate_write,
+    .proc_release =    single_release,
+};
+
 static int
 psample_proc_stats_show(struct seq_file *m, void *v)
 {
+    psample_ring_t *ring;
+    unsigned long qlen_cur = 0, qlen_hi = 0, ring_full = 0;
+    int cpu;
+
+    if (g_psample_work.ring) {
+        for_each_possible_cpu(cpu) {
+            ring = per_cpu_ptr(g_psample_work.ring, cpu);
+            qlen_cur += READ_ONCE(ring->head) - READ_ONCE(ring->tail);
+            if (ring->qlen_hi > qlen_hi) {
+                qlen_hi = ring->qlen_hi;
+            }
+            ring_full += ring->full;
+        }
+    }
+
     seq_printf(m, "BCM KNET %s Callback Stats\n", PSAMPLE_CB_NAME);
     seq_printf(m, "  DCB type %d\n",                          g_psample_info.hw.dcb_type);
     seq_printf(m, "  pkts filter psample cb         %10lu\n", g_psample_stats.pkts_f_psample_cb);
@@ -945,10 +1587,13 @@ psample_proc_stats_show(struct seq_file *m, void *v)
     seq_printf(m, "  pkts handled by psample        %10lu\n", g_psample_stats.pkts_f_handled);
     seq_printf(m, "  pkts pass through              %10lu\n", g_psample_stats.pkts_f_pass_through);
     seq_printf(m, "  pkts with mc destination       %10lu\n", g_psample_stats.pkts_f_dst_mc);
-    seq_printf(m, "  pkts current queue length      %10lu\n", g_psample_stats.pkts_c_qlen_cur);
-    seq_printf(m, "  pkts high queue length         %10lu\n", g_psample_stats.pkts_c_qlen_hi);
-    seq_printf(m, "  pkts drop max queue length     %10lu\n", g_psample_stats.pkts_d_qlen_max);
-    seq_printf(m, "  pkts drop no memory            %10lu\n", g_psample_stats.pkts_d_no_mem);
+    seq_printf(m, "  pkts current queue length      %10lu\n", qlen_cur);
+    seq_printf(m, "  pkts high queue length (cpu)   %10lu\n", qlen_hi);
+    seq_printf(m, "  pkts truncated to queue buf    %10lu\n", g_psample_stats.pkts_c_slot_trunc);
+    seq_printf(m, "  queue drain overruns           %10lu\n", g_psample_stats.pkts_c_overrun);
+    seq_printf(m, "  aggregated msgs sent           %10lu\n", g_psample_stats.pkts_c_agg_msgs);
+    seq_printf(m, "  pkts drop aggregation          %10lu\n", g_psample_stats.pkts_d_agg);
+    seq_printf(m, "  pkts drop queue full           %10lu\n", ring_full);
     seq_printf(m, "  pkts drop no psample group     %10lu\n", g_psample_stats.pkts_d_no_group);
     seq_printf(m, "  pkts drop sampling disabled    %10lu\n", g_psample_stats.pkts_d_sampling_disabled);
     seq_printf(m, "  pkts drop psample not ready    %10lu\n", g_psample_stats.pkts_d_not_ready);
@@ -975,14 +1620,17 @@ static ssize_t
 psample_proc_stats_write(struct file *file, const char *buf,
                     size_t count, loff_t *loff)
 {
-    int qlen_cur = 0;
-    unsigned long flags;
+    psample_ring_t *ring;
+    int cpu;
 
-    spin_lock_irqsave(&g_psample_work.lock, flags);
-    qlen_cur = g_psample_stats.pkts_c_qlen_cur;
     memset(&g_psample_stats, 0, sizeof(psample_stats_t));
-    g_psample_stats.pkts_c_qlen_cur = qlen_cur;
-    spin_unlock_irqrestore(&g_psample_work.lock, flags);
+    if (g_psample_work.ring) {
+        for_each_possible_cpu(cpu) {
+            ring = per_cpu_ptr(g_psample_work.ring, cpu);
+            ring->qlen_hi = 0;
+            ring->full = 0;
+        }
+    }
 
     return count;
 }
@@ -995,14 +1643,95 @@ struct proc_ops psample_proc_stats_file_ops = {
     .proc_release =   single_release,
 };
 
+static void
+psample_ring_free(void)
+{
+    int cpu;
+
+    if (g_psample_work.ring) {
+        for_each_possible_cpu(cpu) {
+            kvfree(per_cpu_ptr(g_psample_work.ring, cpu)->slots);
+        }
+        free_percpu(g_psample_work.ring);
+        g_psample_work.ring = NULL;
+    }
+    if (g_psample_work.skb) {
+        dev_kfree_skb_any(g_psample_work.skb);
+        g_psample_work.skb = NULL;
+    }
+}
+
+static int
+psample_ring_alloc(void)
+{
+    psample_ring_t *ring;
+    uint32 size;
+    int cpu;
+
+    if (psample_qlen <= 0 || psample_slot_size <= 0) {
+        gprintk("%s: invalid psample_qlen %d or psample_slot_size %d\n",
+                __func__, psample_qlen, psample_slot_size);
+        return -1;
+    }
+    size = roundup_pow_of_two(psample_qlen);
+    g_psample_work.slot_stride = ALIGN(sizeof(psample_slot_t) + psample_slot_size,
+                                       SMP_CACHE_BYTES);
+
+    g_psample_work.ring = alloc_percpu(psample_ring_t);
+    if (!g_psample_work.ring) {
+        return -1;
+    }
+    for_each_possible_cpu(cpu) {
+        ring = per_cpu_ptr(g_psample_work.ring, cpu);
+        ring->size = size;
+        ring->slots = kvzalloc_node(size * g_psample_work.slot_stride,
+                                    GFP_KERNEL, cpu_to_node(cpu));
+        if (!ring->slots) {
+            psample_ring_free();
+            return -1;
+        }
+    }
+
+    /* work skb, reused for every pkt sent to psample */
+    g_psample_work.skb = dev_alloc_skb(psample_slot_size);
+    if (!g_psample_work.skb) {
+        psample_ring_free();
+        return -1;
+    }
+    return 0;
+}
+
 int psample_cleanup(void)
 {
+    int unit;
+
     cancel_work_sync(&g_psample_work.wq);
+    cancel_delayed_work_sync(&g_psample_agg.flush);
+    if (g_psample_agg.skb) {
+        nlmsg_free(g_psample_agg.skb);
+        g_psample_agg.skb = NULL;
+    }
+    if (psample_agg_registered) {
+        genl_unregister_family(&psample_agg_family);
+        psample_agg_registered = 0;
+    }
+    psample_group_cache_clear(&g_psample_work);
+    psample_ring_free();
+
+    /* wait for netifs freed after a grace period */
+    rcu_barrier();
+    for (unit = 0; unit < PSAMPLE_MAX_UNITS; unit++) {
+        kfree(g_psample_info.port_map[unit]);
+        g_psample_info.port_map[unit] = NULL;
+    }
+
     remove_proc_entry("stats", psample_proc_root);
     remove_proc_entry("rate",  psample_proc_root);
     remove_proc_entry("size",  psample_proc_root);
     remove_proc_entry("debug", psample_proc_root);
     remove_proc_entry("map"  , psample_proc_root);
+    remove_proc_entry("bench", psample_proc_root);
+    remove_proc_entry("aggregate", psample_proc_root);
     remove_proc_entry("psample", knet_cb_proc_root);
     remove_proc_entry("bcm/knet-cb", NULL);
     return 0;
@@ -1048,6 +1777,20 @@ int psample_init(void)
         return -1;
     }
 
+    /* create procfs for per-sample processing benchmark */
+    PROC_CREATE(entry, "bench", 0666, psample_proc_root, &psample_proc_bench_file_ops);
+    if (entry == NULL) {
+        gprintk("%s: Unable to create procfs entry '/procfs/%s/bench'\n", __func__, psample_procfs_path);
+        return -1;
+    }
+
+    /* create procfs for sample aggregation settings */
+    PROC_CREATE(entry, "aggregate", 0666, psample_proc_root, &psample_proc_aggregate_file_ops);
+    if (entry == NULL) {
+        gprintk("%s: Unable to create procfs entry '/procfs/%s/aggregate'\n", __func__, psample_procfs_path);
+        return -1;
+    }
+
     /* create procfs for debug log */
     PROC_CREATE(entry, "debug", 0666, psample_proc_root, &psample_proc_debug_file_ops);
     if (entry == NULL) {
@@ -1065,10 +1808,23 @@ int psample_init(void)
     spin_lock_init(&g_psample_info.lock);
 
     /* setup psample work queue */
-    spin_lock_init(&g_psample_work.lock);
-    INIT_LIST_HEAD(&g_psample_work.pkt_list);
     INIT_WORK(&g_psample_work.wq, psample_task);
 
+    /* setup sample aggregation, samples go to psample if this fails */
+    memset(&g_psample_agg, 0, sizeof(psample_agg_t));
+    mutex_init(&g_psample_agg.lock);
+    INIT_DELAYED_WORK(&g_psample_agg.flush, psample_agg_flush);
+    if (genl_register_family(&psample_agg_family) < 0) {
+        gprintk("%s: Unable to register genetlink family '%s'\n", __func__, PSAMPLE_AGG_GENL_NAME);
+    } else {
+        psample_agg_registered = 1;
+    }
+
+    if (psample_ring_alloc() < 0) {
+        gprintk("%s: Unable to allocate psample queues\n", __func__);
+        return (-1);
+    }
+
     /* get net namespace */
     g_psample_info.netns = get_net_ns_by_pid(current->pid);
     if (!g_psample_info.netns) {
@@ -27,6 +27,17 @@
 
 #define PSAMPLE_CB_NAME "psample"
 
+/*
+ * Aggregated sample genetlink family.
+ *
+ * Samples are regular psample PSAMPLE_CMD_SAMPLE messages, with the
+ * PSAMPLE_ATTR_* attributes. Several of them are packed back to back in
+ * one netlink datagram, which consumers walk with NLMSG_NEXT as usual.
+ */
+#define PSAMPLE_AGG_GENL_NAME    "bcm_psample"
+#define PSAMPLE_AGG_GENL_VERSION 1
+#define PSAMPLE_AGG_MCGRP_NAME   "packets"
+
 extern int
 psample_init(void);
 
@@ -47,6 +58,8 @@ typedef struct {
     uint16 qnum;
     uint32 sample_rate;
     uint32 sample_size;
+    int unit;
+    struct rcu_head rcu;
 } psample_netif_t;
 
 extern int
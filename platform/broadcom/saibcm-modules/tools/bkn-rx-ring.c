@@ -0,0 +1,239 @@
+/*
+ * Copyright 2007-2020 Broadcom Inc. All rights reserved.
+ *
+ * Permission is granted to use, copy, modify and/or distribute this
+ * software under either one of the licenses below.
+ *
+ * License Option 1: GPL
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation (the "GPL").
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 (GPLv2) for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 (GPLv2) along with this source code.
+ *
+ *
+ * License Option 2: Broadcom Open Network Switch APIs (OpenNSA) license
+ *
+ * This software is governed by the Broadcom Open Network Switch APIs license:
+ * https://www.broadcom.com/products/ethernet-connectivity/software/opennsa
+ */
+/*
+ * Reference consumer and benchmark for the bcm-knet shared Rx ring.
+ *
+ * The program creates the shared Rx ring of a unit, maps it and
+ * consumes packets filtered to the Rx API for a number of seconds.
+ * It then reports the packet rate, the CPU time used per packet and
+ * the packets dropped because the ring was full. By default the
+ * program sleeps on an eventfd when the ring is empty; with -p it
+ * busy-polls the ring instead.
+ *
+ * Build:
+ *   cc -O2 -I../systems/linux/kernel/modules/include \
+ *      -o bkn-rx-ring bkn-rx-ring.c
+ *
+ * Usage:
+ *   bkn-rx-ring [-u <unit>] [-n <slots>] [-s <slot size>]
+ *               [-t <seconds>] [-p] [-v]
+ *
+ * For comparison with the DMA event path, run the same traffic with
+ * the Rx API application and compare the CPU time per packet of the
+ * two processes (e.g. with "pidstat -u").
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include <bcm-knet.h>
+
+#define KNET_DEV_NAME   "/dev/linux-bcm-knet"
+
+static int
+rx_ring_ioctl(int fd, bkn_rx_ring_cfg_t *cfg)
+{
+    bkn_ioctl_t io;
+
+    memset(&io, 0, sizeof(io));
+    io.len = sizeof(*cfg);
+    io.buf = (uint64_t)(unsigned long)cfg;
+    if (ioctl(fd, BKN_IOCTL_RX_RING, &io) < 0) {
+        return -errno;
+    }
+    return io.rc;
+}
+
+static double
+time_now(clockid_t clk)
+{
+    struct timespec ts;
+
+    clock_gettime(clk, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+pkt_dump(bkn_rx_ring_desc_t *desc, uint8_t *pkt)
+{
+    uint32_t idx;
+
+    printf("Rx%d packet (%u bytes):", desc->chan, desc->len);
+    for (idx = 0; idx < desc->len && idx < 32; idx++) {
+        printf(" %02x", pkt[idx]);
+    }
+    printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    bkn_rx_ring_cfg_t cfg;
+    bkn_rx_ring_hdr_t *hdr;
+    bkn_rx_ring_desc_t *desc;
+    uint8_t *map;
+    uint32_t head, tail, slot;
+    uint64_t pkts = 0, bytes = 0, wakeups = 0, evt;
+    double start, end, cpu;
+    struct pollfd pfd;
+    int unit = 0, slots = 4096, slot_size = 2048, secs = 10;
+    int busy_poll = 0, verbose = 0;
+    int fd, efd = -1;
+    int opt, rv;
+
+    while ((opt = getopt(argc, argv, "u:n:s:t:pv")) != -1) {
+        switch (opt) {
+        case 'u':
+            unit = atoi(optarg);
+            break;
+        case 'n':
+            slots = atoi(optarg);
+            break;
+        case 's':
+            slot_size = atoi(optarg);
+            break;
+        case 't':
+            secs = atoi(optarg);
+            break;
+        case 'p':
+            busy_poll = 1;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-u unit] [-n slots] [-s slot_size] "
+                    "[-t seconds] [-p] [-v]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if ((fd = open(KNET_DEV_NAME, O_RDWR)) < 0) {
+        perror(KNET_DEV_NAME);
+        return 1;
+    }
+    if (!busy_poll && (efd = eventfd(0, EFD_NONBLOCK)) < 0) {
+        perror("eventfd");
+        return 1;
+    }
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.unit = unit;
+    cfg.slots = slots;
+    cfg.slot_size = slot_size;
+    cfg.eventfd = efd;
+    if ((rv = rx_ring_ioctl(fd, &cfg)) < 0) {
+        fprintf(stderr, "Rx ring create failed: %s\n", strerror(-rv));
+        return 1;
+    }
+
+    map = mmap(NULL, cfg.mmap_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+               fd, (off_t)unit * sysconf(_SC_PAGESIZE));
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        cfg.slots = 0;
+        rx_ring_ioctl(fd, &cfg);
+        return 1;
+    }
+    hdr = (bkn_rx_ring_hdr_t *)map;
+    if (hdr->magic != BKN_RX_RING_MAGIC ||
+        hdr->version != BKN_RX_RING_VERSION) {
+        fprintf(stderr, "Unsupported Rx ring\n");
+        return 1;
+    }
+    desc = (bkn_rx_ring_desc_t *)(map + hdr->desc_offset);
+
+    pfd.fd = efd;
+    pfd.events = POLLIN;
+
+    tail = hdr->tail;
+    start = time_now(CLOCK_MONOTONIC);
+    cpu = time_now(CLOCK_PROCESS_CPUTIME_ID);
+    end = start + secs;
+    while (time_now(CLOCK_MONOTONIC) < end) {
+        head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            if (busy_poll) {
+                continue;
+            }
+            /* Ask for an event, then check again before sleeping */
+            hdr->wakeup = 1;
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE) != tail) {
+                continue;
+            }
+            if (poll(&pfd, 1, 100) > 0 &&
+                read(efd, &evt, sizeof(evt)) == sizeof(evt)) {
+                wakeups++;
+            }
+            continue;
+        }
+        while (tail != head) {
+            slot = tail & (hdr->slots - 1);
+            if (verbose) {
+                pkt_dump(&desc[slot],
+                         map + hdr->buf_offset + slot * hdr->slot_size);
+            }
+            bytes += desc[slot].len;
+            pkts++;
+            tail++;
+        }
+        /* Return the slots to the driver */
+        __atomic_store_n(&hdr->tail, tail, __ATOMIC_RELEASE);
+    }
+    cpu = time_now(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+    end = time_now(CLOCK_MONOTONIC) - start;
+
+    printf("Packets:     %llu (%llu bytes)\n",
+           (unsigned long long)pkts, (unsigned long long)bytes);
+    printf("Rate:        %.0f pps\n", pkts / end);
+    printf("CPU:         %.1f%% (%.0f ns/packet)\n", 100 * cpu / end,
+           pkts ? cpu * 1e9 / pkts : 0);
+    printf("Wakeups:     %llu\n", (unsigned long long)wakeups);
+    printf("Ring drops:  %llu\n", (unsigned long long)hdr->drops);
+
+    munmap(map, cfg.mmap_size);
+    cfg.slots = 0;
+    rx_ring_ioctl(fd, &cfg);
+    close(fd);
+    if (efd >= 0) {
+        close(efd);
+    }
+
+    return 0;
+}
@@ -0,0 +1,454 @@
+/*
+ * Copyright 2007-2020 Broadcom Inc. All rights reserved.
+ *
+ * Permission is granted to use, copy, modify and/or distribute this
+ * software under either one of the licenses below.
+ *
+ * License Option 1: GPL
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation (the "GPL").
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 (GPLv2) for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 (GPLv2) along with this source code.
+ *
+ *
+ * License Option 2: Broadcom Open Network Switch APIs (OpenNSA) license
+ *
+ * This software is governed by the Broadcom Open Network Switch APIs license:
+ * https://www.broadcom.com/products/ethernet-connectivity/software/opennsa
+ */
+/*
+ * Sample consumer and loopback benchmark for the ngknet VNET shared area.
+ *
+ * The program creates the VNET shared area of a device in HNET mode,
+ * sets up CMICX descriptor rings in it and docks them, so it takes the
+ * place of the SDK VNET driver, which must not be docked at the same
+ * time. It then consumes the packets filtered to VNET on all the Rx
+ * queues for a number of seconds and reports the packet rate, the CPU
+ * time used per packet and the number of wakeups in both directions.
+ *
+ * With -l the program also transmits test frames on Tx queue 0 from
+ * the shared buffers, keeping up to a window of frames in flight, and
+ * matches the frames coming back to report the loopback rate and
+ * latency. The switch must be set up to return the frames to the CPU,
+ * e.g. with a port in loopback and a VNET filter for the test frames.
+ *
+ * By default the program sleeps on an eventfd when the rings are idle;
+ * with -p it busy-polls the rings instead.
+ *
+ * Build:
+ *   cc -O2 -I../sdklt/linux/include -o ngknet-vnet ngknet-vnet.c
+ *
+ * Usage:
+ *   ngknet-vnet [-u <unit>] [-n <descriptors>] [-s <buffer size>]
+ *               [-t <seconds>] [-l <frame size>] [-w <window>] [-p] [-v]
+ *
+ * Buffers must hold the largest packet with its meta data, which the
+ * driver copies into Rx buffers without checking their size.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <lkm/ngknet_ioctl.h>
+
+#define NGKNET_DEV_NAME     "/dev/" NGKNET_MODULE_NAME
+
+/* Same layout as vnet_sync_t in bcmcnet/bcmcnet_types.h */
+#define NUM_Q_MAX           64
+typedef struct {
+    uint64_t rx_ring_addr[NUM_Q_MAX];
+    uint32_t rx_ring_size[NUM_Q_MAX];
+    uint64_t tx_ring_addr[NUM_Q_MAX];
+    uint32_t tx_ring_size[NUM_Q_MAX];
+} vnet_sync_t;
+
+/* CMICX descriptor, see bcmcnet/bcmcnet_cmicx.h */
+struct cmicx_desc {
+    volatile uint32_t addr_lo;
+    volatile uint32_t addr_hi;
+    volatile uint32_t ctrl;
+    volatile uint32_t status;
+} __attribute__((packed));
+
+#define CMICX_PCIE_SO_OFFSET        0x10000000
+#define CMICX_DESC_CTRL_CNTLD_INTR  (1 << 24)
+#define CMICX_DESC_CTRL_CHAIN       (1 << 16)
+#define CMICX_DESC_CTRL_LEN(len)    ((len) & 0xffff)
+#define CMICX_DESC_STAT_RTX_DONE    (1U << 31)
+#define CMICX_DESC_STAT_LEN(stat)   ((stat) & 0xffff)
+
+/* Loopback test frame, found by its magic after any Rx meta data */
+#define LB_MAGIC            0x4e474b56  /* "NGKV" */
+#define LB_ETHERTYPE        0x88b5      /* Local experimental */
+#define LB_HDR_OFFSET       14
+#define LB_SEARCH_MAX       128
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+    uint64_t tx_ns;
+} lb_hdr_t;
+
+static int
+ngknet_ioctl(int fd, unsigned long cmd, int unit, void *buf, uint32_t len)
+{
+    struct ngknet_ioctl ioc;
+
+    memset(&ioc, 0, sizeof(ioc));
+    ioc.unit = unit;
+    ioc.op.data.buf = (uint64_t)(unsigned long)buf;
+    ioc.op.data.len = len;
+    if (ioctl(fd, cmd, &ioc) < 0) {
+        return -errno;
+    }
+    return (int)ioc.rc;
+}
+
+static uint64_t
+time_ns(clockid_t clk)
+{
+    struct timespec ts;
+
+    clock_gettime(clk, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+desc_config(struct cmicx_desc *desc, uint64_t addr, uint32_t len)
+{
+    desc->addr_lo = (uint32_t)addr;
+    desc->addr_hi = (uint32_t)(addr >> 32) | CMICX_PCIE_SO_OFFSET;
+    desc->status = 0;
+    /* Tx descriptors are fetched by the driver once the length is set */
+    __atomic_store_n(&desc->ctrl, CMICX_DESC_CTRL_CNTLD_INTR |
+                     CMICX_DESC_CTRL_CHAIN | CMICX_DESC_CTRL_LEN(len),
+                     __ATOMIC_RELEASE);
+}
+
+static void
+pkt_dump(int queue, uint8_t *pkt, uint32_t len)
+{
+    uint32_t idx;
+
+    printf("Rx%d packet (%u bytes):", queue, len);
+    for (idx = 0; idx < len && idx < 32; idx++) {
+        printf(" %02x", pkt[idx]);
+    }
+    printf("\n");
+}
+
+static lb_hdr_t *
+lb_find(uint8_t *pkt, uint32_t len)
+{
+    uint32_t off, magic;
+
+    for (off = 0; off + sizeof(lb_hdr_t) <= len && off < LB_SEARCH_MAX; off += 2) {
+        memcpy(&magic, pkt + off, sizeof(magic));
+        if (magic == LB_MAGIC) {
+            return (lb_hdr_t *)(pkt + off);
+        }
+    }
+    return NULL;
+}
+
+static void
+lb_build(uint8_t *pkt, uint32_t len, uint32_t seq)
+{
+    static const uint8_t mac[12] = {
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0x02, 0x10, 0x18, 0x00, 0x00, 0x01
+    };
+    lb_hdr_t hdr;
+
+    memset(pkt, 0, len);
+    memcpy(pkt, mac, sizeof(mac));
+    pkt[12] = LB_ETHERTYPE >> 8;
+    pkt[13] = LB_ETHERTYPE & 0xff;
+    hdr.magic = LB_MAGIC;
+    hdr.seq = seq;
+    hdr.tx_ns = time_ns(CLOCK_MONOTONIC);
+    memcpy(pkt + LB_HDR_OFFSET, &hdr, sizeof(hdr));
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct ngknet_vnet_map_cfg cfg;
+    struct ngknet_vnet_map_hdr *hdr;
+    struct cmicx_desc *rx_ring[NUM_Q_MAX], *tx_ring = NULL, *desc;
+    uint32_t rx_curr[NUM_Q_MAX];
+    uint32_t tx_curr = 0, tx_dirt = 0, tx_buf;
+    vnet_sync_t vsync;
+    uint8_t *map, *pkt;
+    uint32_t qi, di, len, stat;
+    uint64_t pkts = 0, bytes = 0, wakeups = 0, kicks = 0, evt;
+    uint64_t lb_sent = 0, lb_match = 0, lb_lost = 0, lat, lat_sum = 0;
+    uint64_t lat_min = UINT64_MAX, lat_max = 0;
+    uint64_t start, end, now, cpu;
+    lb_hdr_t *lb;
+    struct pollfd pfd;
+    int unit = 0, nb_desc = 256, buf_size = 10240, secs = 10;
+    int lb_size = 0, window = 64, busy_poll = 0, verbose = 0;
+    int fd, efd = -1;
+    int opt, rv, work, kick;
+
+    while ((opt = getopt(argc, argv, "u:n:s:t:l:w:pv")) != -1) {
+        switch (opt) {
+        case 'u':
+            unit = atoi(optarg);
+            break;
+        case 'n':
+            nb_desc = atoi(optarg);
+            break;
+        case 's':
+            buf_size = atoi(optarg);
+            break;
+        case 't':
+            secs = atoi(optarg);
+            break;
+        case 'l':
+            lb_size = atoi(optarg);
+            break;
+        case 'w':
+            window = atoi(optarg);
+            break;
+        case 'p':
+            busy_poll = 1;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-u unit] [-n descriptors] [-s buf_size] "
+                    "[-t seconds] [-l frame_size] [-w window] [-p] [-v]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (lb_size && (lb_size < LB_HDR_OFFSET + (int)sizeof(lb_hdr_t) ||
+                    lb_size > buf_size)) {
+        fprintf(stderr, "Invalid frame size %d\n", lb_size);
+        return 1;
+    }
+
+    if ((fd = open(NGKNET_DEV_NAME, O_RDWR)) < 0) {
+        perror(NGKNET_DEV_NAME);
+        return 1;
+    }
+    if (!busy_poll && (efd = eventfd(0, EFD_NONBLOCK)) < 0) {
+        perror("eventfd");
+        return 1;
+    }
+
+    /* One buffer per descriptor of every ring */
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.nb_desc = nb_desc;
+    cfg.desc_size = sizeof(struct cmicx_desc);
+    cfg.buf_size = buf_size;
+    cfg.eventfd = efd;
+    rv = ngknet_ioctl(fd, NGKNET_DEV_VNET_MMAP, unit, &cfg, sizeof(cfg));
+    if (rv < 0) {
+        fprintf(stderr, "VNET area create failed (%d)\n", rv);
+        return 1;
+    }
+
+    map = mmap(NULL, cfg.mmap_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+               fd, (off_t)unit * sysconf(_SC_PAGESIZE));
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        cfg.nb_desc = 0;
+        ngknet_ioctl(fd, NGKNET_DEV_VNET_MMAP, unit, &cfg, sizeof(cfg));
+        return 1;
+    }
+    hdr = (struct ngknet_vnet_map_hdr *)map;
+    if (hdr->magic != NGKNET_VNET_MAP_MAGIC ||
+        hdr->version != NGKNET_VNET_MAP_VERSION ||
+        hdr->nb_rxq > NUM_Q_MAX || hdr->nb_txq > NUM_Q_MAX) {
+        fprintf(stderr, "Unsupported VNET area\n");
+        return 1;
+    }
+    if (lb_size && hdr->nb_txq == 0) {
+        fprintf(stderr, "No Tx queue for loopback\n");
+        return 1;
+    }
+
+    /* Give each Rx descriptor its buffer, leave the Tx rings empty */
+    memset(&vsync, 0, sizeof(vsync));
+    for (qi = 0; qi < hdr->nb_rxq; qi++) {
+        rx_ring[qi] = (struct cmicx_desc *)
+                      (map + hdr->rx_ring_offset + qi * hdr->ring_size);
+        for (di = 0; di < hdr->nb_desc; di++) {
+            desc_config(&rx_ring[qi][di], hdr->dma_addr + hdr->buf_offset +
+                        (uint64_t)(qi * hdr->nb_desc + di) * hdr->buf_size,
+                        hdr->buf_size);
+        }
+        rx_curr[qi] = 0;
+        vsync.rx_ring_addr[qi] = hdr->dma_addr + hdr->rx_ring_offset +
+                                 qi * hdr->ring_size;
+        vsync.rx_ring_size[qi] = hdr->nb_desc;
+    }
+    for (qi = 0; qi < hdr->nb_txq; qi++) {
+        vsync.tx_ring_addr[qi] = hdr->dma_addr + hdr->tx_ring_offset +
+                                 qi * hdr->ring_size;
+        vsync.tx_ring_size[qi] = hdr->nb_desc;
+    }
+    if (hdr->nb_txq) {
+        tx_ring = (struct cmicx_desc *)(map + hdr->tx_ring_offset);
+    }
+    rv = ngknet_ioctl(fd, NGKNET_DEV_VNET_DOCK, unit, &vsync, sizeof(vsync));
+    if (rv < 0) {
+        fprintf(stderr, "VNET dock failed (%d)\n", rv);
+        return 1;
+    }
+
+    pfd.fd = efd;
+    pfd.events = POLLIN;
+
+    start = time_ns(CLOCK_MONOTONIC);
+    cpu = time_ns(CLOCK_PROCESS_CPUTIME_ID);
+    end = start + secs * 1000000000ULL;
+    while ((now = time_ns(CLOCK_MONOTONIC)) < end) {
+        work = 0;
+        kick = 0;
+
+        /* Consume Rx packets and return the descriptors to the driver */
+        for (qi = 0; qi < hdr->nb_rxq; qi++) {
+            while (1) {
+                desc = &rx_ring[qi][rx_curr[qi]];
+                stat = __atomic_load_n(&desc->status, __ATOMIC_ACQUIRE);
+                if (!(stat & CMICX_DESC_STAT_RTX_DONE)) {
+                    break;
+                }
+                len = CMICX_DESC_STAT_LEN(stat);
+                pkt = map + hdr->buf_offset +
+                      (uint64_t)(qi * hdr->nb_desc + rx_curr[qi]) * hdr->buf_size;
+                if (verbose) {
+                    pkt_dump(qi, pkt, len);
+                }
+                if (lb_size && (lb = lb_find(pkt, len)) != NULL) {
+                    lat = time_ns(CLOCK_MONOTONIC) - lb->tx_ns;
+                    lat_sum += lat;
+                    lat_min = lat < lat_min ? lat : lat_min;
+                    lat_max = lat > lat_max ? lat : lat_max;
+                    lb_match++;
+                }
+                bytes += len;
+                pkts++;
+                __atomic_store_n(&desc->status, 0, __ATOMIC_RELEASE);
+                rx_curr[qi] = (rx_curr[qi] + 1) % hdr->nb_desc;
+                work++;
+                kick = 1;
+            }
+        }
+
+        if (lb_size) {
+            /* Reclaim the transmitted descriptors */
+            while (tx_dirt != tx_curr) {
+                desc = &tx_ring[tx_dirt % hdr->nb_desc];
+                if (!(__atomic_load_n(&desc->status, __ATOMIC_ACQUIRE) &
+                      CMICX_DESC_STAT_RTX_DONE)) {
+                    break;
+                }
+                desc->status = 0;
+                tx_dirt++;
+            }
+
+            /* Post test frames up to the window, straight from the buffers */
+            while (tx_curr - tx_dirt < hdr->nb_desc &&
+                   lb_sent - lb_match - lb_lost < (uint64_t)window) {
+                di = tx_curr % hdr->nb_desc;
+                tx_buf = hdr->nb_rxq * hdr->nb_desc + di;
+                lb_build(map + hdr->buf_offset +
+                         (uint64_t)tx_buf * hdr->buf_size, lb_size, lb_sent);
+                desc_config(&tx_ring[di], hdr->dma_addr + hdr->buf_offset +
+                            (uint64_t)tx_buf * hdr->buf_size, lb_size);
+                tx_curr++;
+                lb_sent++;
+                work++;
+                kick = 1;
+            }
+        }
+
+        /* Only wake HNET up if it is sleeping */
+        if (kick) {
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (hdr->hnet_wakeup) {
+                ngknet_ioctl(fd, NGKNET_DEV_HNET_WAKE, unit, NULL, 0);
+                kicks++;
+            }
+        }
+        if (work || busy_poll) {
+            continue;
+        }
+
+        /* Ask for an event, then check again before sleeping */
+        hdr->vnet_wakeup = 1;
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        for (qi = 0; qi < hdr->nb_rxq; qi++) {
+            if (rx_ring[qi][rx_curr[qi]].status & CMICX_DESC_STAT_RTX_DONE) {
+                break;
+            }
+        }
+        if (qi < hdr->nb_rxq ||
+            (tx_dirt != tx_curr &&
+             tx_ring[tx_dirt % hdr->nb_desc].status & CMICX_DESC_STAT_RTX_DONE)) {
+            continue;
+        }
+        if (poll(&pfd, 1, 100) > 0 &&
+            read(efd, &evt, sizeof(evt)) == sizeof(evt)) {
+            wakeups++;
+        } else if (lb_size) {
+            /* Nothing came back in time, count the frames in flight as lost */
+            lb_lost = lb_sent - lb_match;
+        }
+    }
+    cpu = time_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+    now = time_ns(CLOCK_MONOTONIC) - start;
+
+    printf("Packets:     %llu (%llu bytes)\n",
+           (unsigned long long)pkts, (unsigned long long)bytes);
+    printf("Rate:        %.0f pps\n", pkts * 1e9 / now);
+    printf("CPU:         %.1f%% (%.0f ns/packet)\n", 100.0 * cpu / now,
+           pkts ? (double)cpu / pkts : 0);
+    printf("Wakeups:     %llu (%llu signaled)\n", (unsigned long long)wakeups,
+           (unsigned long long)hdr->vnet_events);
+    printf("HNET wakes:  %llu\n", (unsigned long long)kicks);
+    if (lb_size) {
+        printf("Loopback:    %llu sent, %llu matched (%.0f pps)\n",
+               (unsigned long long)lb_sent, (unsigned long long)lb_match,
+               lb_match * 1e9 / now);
+        if (lb_match) {
+            printf("Latency:     %.1f/%.1f/%.1f us (min/avg/max)\n",
+                   lat_min / 1e3, lat_sum / 1e3 / lb_match, lat_max / 1e3);
+        }
+    }
+
+    ngknet_ioctl(fd, NGKNET_DEV_VNET_UNDOCK, unit, NULL, 0);
+    munmap(map, cfg.mmap_size);
+    cfg.nb_desc = 0;
+    ngknet_ioctl(fd, NGKNET_DEV_VNET_MMAP, unit, &cfg, sizeof(cfg));
+    close(fd);
+    if (efd >= 0) {
+        close(efd);
+    }
+
+    return 0;
+}
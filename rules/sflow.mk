@@ -4,6 +4,7 @@ HSFLOWD_VERSION = 2.0.45
 HSFLOWD_SUBVERSION = 1
 
 export ENABLE_SFLOW_DROPMON
+export ENABLE_SFLOW_PSAMPLE_AGG
 export HSFLOWD_VERSION HSFLOWD_SUBVERSION
 
 HSFLOWD = hsflowd_$(HSFLOWD_VERSION)-$(HSFLOWD_SUBVERSION)_$(CONFIGURED_ARCH).deb
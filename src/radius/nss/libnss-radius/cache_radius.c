@@ -98,7 +98,6 @@ int main(int ac, char * av[]) {
     char file_buf[RADIUS_MAX_NSS_CONF_SZ];
     int ncfd = -1;
     int no_clear_unconfirmed = 0;
-    int clear_unconfirmed_limit = 0;
     int refresh_user = 0;
     char buf[BUFLEN];
     struct passwd pw, *result = NULL;
@@ -183,15 +182,10 @@ int main(int ac, char * av[]) {
 
     }
 
+    /* Clears up to unconfirmed_clear_limit + 1 users in one pass.
+     */
     if (!no_clear_unconfirmed && (conf->many_to_one == 0)) {
-        clear_unconfirmed_limit = conf->unconfirmed_clear_limit;
-        while(radius_clear_unconfirmed_users(conf) == 0) {
-            if (clear_unconfirmed_limit-- <= 0) {
-                syslog(LOG_INFO, "%s: Clear unconfirmed limit %d reached:",
-                    conf->prog, conf->unconfirmed_clear_limit);
-                break;
-            }
-        }
+        radius_clear_unconfirmed_users(conf);
     }
 
     exit(main_cleanup(0, conf, &ncfd));
@@ -9,6 +9,303 @@ The term "Broadcom" refers to Broadcom Inc. and/or its subsidiaries.
  */
 
 #include "nss_radius_common.h"
+#include <sys/mman.h>
+
+/*
+ * Shared cache of resolved users.
+ *
+ * Every getpwnam() of a RADIUS user used to parse RADIUS_NSS_CONF under an
+ * exclusive flock, read the MPL cache file and scan ETC_PASSWD. Resolved
+ * users are kept in RADIUS_NSS_SHM_CACHE, mapped by every process. A hit
+ * costs three stat() calls to validate the config, passwd and MPL file
+ * versions, and takes no lock. Only processes able to open the cache file
+ * for writing (root) populate it.
+ */
+
+int radius_nss_cache_enabled = 1;
+
+static RADIUS_NSS_SHM * radius_shm = NULL;
+static int radius_shm_writable = 0;
+static int radius_shm_failed = 0;
+
+static int radius_file_version(const char * filename,
+    RADIUS_NSS_FILE_VERSION * version) {
+
+    struct stat sb;
+
+    if (stat(filename, &sb) == -1)
+        return -1;
+
+    memset((char *) version, 0, sizeof(*version));
+    version->dev = sb.st_dev;
+    version->ino = sb.st_ino;
+    version->size = sb.st_size;
+    version->mtime = sb.st_mtim;
+    return 0;
+}
+
+static int radius_file_version_equal(const RADIUS_NSS_FILE_VERSION * a,
+    const RADIUS_NSS_FILE_VERSION * b) {
+
+    return (a->dev == b->dev) && (a->ino == b->ino) && (a->size == b->size)
+        && (a->mtime.tv_sec == b->mtime.tv_sec)
+        && (a->mtime.tv_nsec == b->mtime.tv_nsec);
+}
+
+static unsigned int radius_shm_hash(const char * nam) {
+
+    unsigned int hash = 2166136261u;
+
+    for ( ; *nam; nam++) {
+        hash ^= (unsigned char) *nam;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static void radius_shm_reset(RADIUS_NSS_SHM * shm) {
+
+    memset((char *) shm, 0, sizeof(*shm));
+    shm->magic = RADIUS_NSS_SHM_MAGIC;
+    shm->version = RADIUS_NSS_SHM_VERSION;
+}
+
+static RADIUS_NSS_SHM * radius_shm_map(void) {
+
+    RADIUS_NSS_SHM * shm, * expected = NULL;
+    struct stat sb;
+    int fd, writable = 1;
+
+    if ((shm = __atomic_load_n(&radius_shm, __ATOMIC_ACQUIRE)) != NULL)
+        return shm;
+
+    if (radius_shm_failed)
+        return NULL;
+
+    if ((fd = open(RADIUS_NSS_SHM_CACHE, O_RDWR|O_CREAT|O_CLOEXEC, 0644))
+            == -1) {
+        writable = 0;
+        fd = open(RADIUS_NSS_SHM_CACHE, O_RDONLY|O_CLOEXEC);
+    }
+
+    if (fd == -1) {
+        radius_shm_failed = 1;
+        return NULL;
+    }
+
+    /* First writer sizes and formats the cache.
+     */
+    if (writable && (flock(fd, LOCK_EX) == 0)) {
+        if (   (fstat(fd, &sb) == 0)
+            && (sb.st_size != sizeof(RADIUS_NSS_SHM))
+            && (ftruncate(fd, 0) == 0)
+            && (ftruncate(fd, sizeof(RADIUS_NSS_SHM)) == 0)) {
+            syslog(LOG_INFO, "nss: %s: initialized", RADIUS_NSS_SHM_CACHE);
+        }
+        flock(fd, LOCK_UN);
+    }
+
+    if ((fstat(fd, &sb) == -1) || (sb.st_size != sizeof(RADIUS_NSS_SHM))
+        || ((shm = mmap(NULL, sizeof(RADIUS_NSS_SHM),
+                 PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, fd, 0))
+               == MAP_FAILED)) {
+        close(fd);
+        radius_shm_failed = 1;
+        return NULL;
+    }
+
+    close(fd);
+
+    if (!__atomic_compare_exchange_n(&radius_shm, &expected, shm, 0,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        /* Another thread mapped it first.
+         */
+        munmap(shm, sizeof(RADIUS_NSS_SHM));
+        return expected;
+    }
+
+    radius_shm_writable = writable;
+    return shm;
+}
+
+static int radius_shm_versions(const char * nam,
+    RADIUS_NSS_FILE_VERSION * conf_version,
+    RADIUS_NSS_FILE_VERSION * passwd_version,
+    RADIUS_NSS_FILE_VERSION * mpl_version) {
+
+    char cache_filename[PATH_MAX];
+
+    if ((strlen(nam) >= RADIUS_NSS_SHM_NAME_SZ)
+        || (snprintf(cache_filename, sizeof(cache_filename), "%s/%s/%s",
+              RADIUS_ATTRIBUTE_CACHE_DIR, nam, RADIUS_ATTR_MPL)
+              >= sizeof(cache_filename)))
+        return -1;
+
+    if (   (radius_file_version(RADIUS_NSS_CONF, conf_version) == -1)
+        || (radius_file_version(ETC_PASSWD, passwd_version) == -1)
+        || (radius_file_version(cache_filename, mpl_version) == -1))
+        return -1;
+
+    return 0;
+}
+
+/*
+ * Lookup nam in the shared cache. Returns 0 and fills pwd on a hit.
+ */
+static int radius_shm_lookup(const char * nam,
+    const RADIUS_NSS_FILE_VERSION * conf_version,
+    const RADIUS_NSS_FILE_VERSION * passwd_version,
+    const RADIUS_NSS_FILE_VERSION * mpl_version,
+    struct passwd * pwd, char * buf, size_t buflen, int * errnop) {
+
+    RADIUS_NSS_SHM * shm = radius_shm_map();
+    RADIUS_NSS_SHM_ENTRY entry;
+    RADIUS_NSS_CONF_B conf;
+    struct passwd res;
+    unsigned int seq, hash = radius_shm_hash(nam);
+    int retry, probe, found, debug;
+    char * pos;
+
+    if (shm == NULL)
+        return -1;
+
+    for (retry = 0; retry < RADIUS_NSS_SHM_READ_RETRIES; retry++) {
+
+        if ((seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE)) & 1)
+            continue;
+
+        found = 0;
+        if (   (shm->magic == RADIUS_NSS_SHM_MAGIC)
+            && (shm->version == RADIUS_NSS_SHM_VERSION)
+            && radius_file_version_equal(&shm->conf_version, conf_version)
+            && radius_file_version_equal(&shm->passwd_version,
+                   passwd_version)) {
+
+            for (probe = 0; probe < RADIUS_NSS_SHM_PROBES; probe++) {
+                RADIUS_NSS_SHM_ENTRY * e = &(shm->entries[
+                    (hash + probe) % RADIUS_NSS_SHM_ENTRIES]);
+                if (strncmp(e->nam, nam, RADIUS_NSS_SHM_NAME_SZ) == 0) {
+                    entry = *e;
+                    found = radius_file_version_equal(&entry.mpl_version,
+                        mpl_version);
+                    break;
+                }
+            }
+        }
+        debug = shm->debug;
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) != seq)
+            continue;
+
+        if (!found)
+            return -1;
+
+        /* Consistent copy, unpack the entry.
+         */
+        entry.pw[RADIUS_NSS_SHM_PW_SZ - 1] = 0;
+        res.pw_name = pos = entry.pw;
+        res.pw_gecos = pos = pos + strlen(pos) + 1;
+        res.pw_dir = pos = pos + strlen(pos) + 1;
+        res.pw_shell = pos + strlen(pos) + 1;
+        res.pw_uid = entry.uid;
+        res.pw_gid = entry.gid;
+
+        memset((char *) &conf, 0, sizeof(conf));
+        conf.prog = "nss";
+        conf.debug = debug;
+        if (conf.debug)
+            syslog( LOG_DEBUG, "%s: nam: %s: cached", conf.prog, nam);
+
+        radius_copy_pw(&conf, &res, nam, pwd, buf, buflen, errnop);
+        return 0;
+    }
+
+    return -1;
+}
+
+/*
+ * Save a resolved user in the shared cache.
+ */
+static void radius_shm_update(RADIUS_NSS_CONF_B * conf, const char * nam,
+    const RADIUS_NSS_FILE_VERSION * conf_version,
+    const RADIUS_NSS_FILE_VERSION * passwd_version,
+    const RADIUS_NSS_FILE_VERSION * mpl_version, struct passwd * res) {
+
+    RADIUS_NSS_SHM * shm = radius_shm_map();
+    RADIUS_NSS_SHM_ENTRY * e = NULL;
+    unsigned int hash = radius_shm_hash(nam);
+    size_t namlen;
+    int fd, probe, len;
+
+    if ((shm == NULL) || !radius_shm_writable)
+        return;
+
+    if ((fd = open(RADIUS_NSS_SHM_CACHE, O_RDWR|O_CLOEXEC)) == -1)
+        return;
+
+    if (flock(fd, LOCK_EX|LOCK_NB) == -1) {
+        /* Another writer busy, skip. A later lookup will add it.
+         */
+        close(fd);
+        return;
+    }
+
+    __atomic_store_n(&shm->seq, shm->seq | 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    if (   (shm->magic != RADIUS_NSS_SHM_MAGIC)
+        || (shm->version != RADIUS_NSS_SHM_VERSION)
+        || !radius_file_version_equal(&shm->conf_version, conf_version)
+        || !radius_file_version_equal(&shm->passwd_version, passwd_version)) {
+
+        /* Config or passwd changed, all entries are stale.
+         */
+        unsigned int seq = shm->seq;
+        radius_shm_reset(shm);
+        shm->seq = seq;
+        shm->conf_version = *conf_version;
+        shm->passwd_version = *passwd_version;
+    }
+    shm->debug = conf->debug;
+
+    for (probe = 0; probe < RADIUS_NSS_SHM_PROBES; probe++) {
+        e = &(shm->entries[(hash + probe) % RADIUS_NSS_SHM_ENTRIES]);
+        if ((e->nam[0] == 0) || (strcmp(e->nam, nam) == 0))
+            break;
+    }
+
+    if (probe == RADIUS_NSS_SHM_PROBES)
+        e = &(shm->entries[hash % RADIUS_NSS_SHM_ENTRIES]);
+
+    /* Unname the slot while it is rewritten, and name it again last, its
+     * first byte after the rest. A writer dying halfway then leaves an
+     * unnamed slot, never a torn entry under a matching name.
+     */
+    __atomic_store_n(&e->nam[0], 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    namlen = strlen(nam);
+    len = snprintf(e->pw, sizeof(e->pw), "%s%c%s%c%s%c%s", res->pw_name, 0,
+        res->pw_gecos, 0, res->pw_dir, 0, res->pw_shell);
+    if ((len < 0) || (len >= sizeof(e->pw))
+        || (namlen == 0) || (namlen >= sizeof(e->nam))) {
+        memset((char *) e, 0, sizeof(*e));
+    } else {
+        e->mpl_version = *mpl_version;
+        e->uid = res->pw_uid;
+        e->gid = res->pw_gid;
+        memcpy(e->nam + 1, nam + 1, namlen);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        __atomic_store_n(&e->nam[0], nam[0], __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELEASE);
+
+    flock(fd, LOCK_UN);
+    close(fd);
+}
 
 /*
  * NSS entry point for getpwnam().
@@ -25,15 +322,31 @@ enum nss_status _nss_radius_getpwnam_r( const char * nam, struct passwd * pwd,
     char buffer[BUFLEN];
     struct passwd pw, *res = NULL;
     char * prog = "nss";
+    RADIUS_NSS_FILE_VERSION conf_version, passwd_version, mpl_version;
+    int cacheable = 0, mpl_cached;
 
       /* Ignore filename completion.
        */
     if (!nam || !strcmp(nam, "*") || !pwd || !buf || (buflen == 0))
         return NSS_STATUS_NOTFOUND;
 
+      /* Versions are taken before the slow path reads the files, so an
+       * entry saved from a racing update is stale, not wrong.
+       */
+    if (radius_nss_cache_enabled
+        && (radius_shm_versions(nam, &conf_version, &passwd_version,
+               &mpl_version) == 0)) {
+
+        if (radius_shm_lookup(nam, &conf_version, &passwd_version,
+                &mpl_version, pwd, buf, buflen, errnop) == 0)
+            return NSS_STATUS_SUCCESS;
+
+        cacheable = 1;
+    }
+
     parse_nss_config(conf, prog, file_buf, sizeof(file_buf), errnop, &ncfd);
 
-    if (radius_lookup_cache(prog, nam, &mpl) == 0) {
+    if ((mpl_cached = (radius_lookup_cache(prog, nam, &mpl) == 0))) {
 
         /* The MPL exists for this user in the cache.
          */
@@ -75,6 +388,13 @@ enum nss_status _nss_radius_getpwnam_r( const char * nam, struct passwd * pwd,
     if (res) {
         status = NSS_STATUS_SUCCESS;
         radius_copy_pw(conf, res, nam, pwd, buf, buflen, errnop);
+
+          /* Only users with a cached MPL are saved, sshd lookups create
+           * unconfirmed users and depend on the calling process.
+           */
+        if (cacheable && mpl_cached)
+            radius_shm_update(conf, nam, &conf_version, &passwd_version,
+                &mpl_version, res);
     }
 
     unparse_nss_config(conf, errnop, &ncfd);
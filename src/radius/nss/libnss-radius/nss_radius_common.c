@@ -26,6 +26,8 @@ The term "Broadcom" refers to Broadcom Inc. and/or its subsidiaries.
 #include <regex.h>
 #include <time.h>
 #include <sys/wait.h>
+#include <dirent.h>
+#include <shadow.h>
 
 #include "nss_radius_common.h"
 
@@ -286,6 +288,802 @@ static int user_mod(const char* name, char* sec_grp) {
     return status;
 }
 
+/*
+ * In-process provisioning.
+ *
+ * Opt-in with "user_provisioning=native". Same updates as useradd/usermod/
+ * userdel, without exec'ing them from inside an NSS lookup: under lckpwdf(),
+ * each of ETC_GROUP, ETC_GSHADOW, ETC_SHADOW and ETC_PASSWD is backed up to
+ * "<file>-" and written to "<file>+", as the shadow tools do. Only once all
+ * four are written and synced are they renamed over the originals, ETC_PASSWD
+ * last, so a user is visible only once fully provisioned. Ids and the
+ * home directory mode come from ETC_LOGIN_DEFS, and the nscd/sssd caches
+ * are flushed afterwards.
+ */
+
+#define RADIUS_DB_ADD   0
+#define RADIUS_DB_MOD   1
+#define RADIUS_DB_DEL   2
+
+typedef struct _radius_db_op {
+    int         op;
+    const char  * name;         /* ADD, MOD */
+    const char  * groups;       /* ADD, MOD: supplementary groups */
+    const char  * gecos;        /* MOD */
+    char        ** names;       /* DEL */
+    gid_t       * gids;         /* DEL: primary group of each user */
+    int         * upg;          /* DEL: user private group removed */
+    char        ** homes;       /* DEL: home directory of each user */
+    int         count;          /* DEL */
+} RADIUS_DB_OP;
+
+typedef int (*radius_db_filter)(RADIUS_DB_OP * op, char * line, FILE * out);
+
+#if defined(TEST_RADIUS_NSS)
+
+static int radius_db_lockfd = -1;
+
+static int radius_lock_db(void) {
+    if ((radius_db_lockfd = open(".pwd.lock", O_WRONLY|O_CREAT|O_CLOEXEC,
+            0600)) == -1)
+        return -1;
+    return flock(radius_db_lockfd, LOCK_EX);
+}
+
+static void radius_unlock_db(void) {
+    close(radius_db_lockfd);
+    radius_db_lockfd = -1;
+}
+
+#else
+
+static int radius_lock_db(void) {
+    return lckpwdf();
+}
+
+static void radius_unlock_db(void) {
+    ulckpwdf();
+}
+
+#endif
+
+typedef struct _radius_login_defs {
+    long        uid_min;
+    long        uid_max;
+    long        gid_min;
+    long        gid_max;
+    mode_t      home_mode;
+} RADIUS_LOGIN_DEFS;
+
+/*
+ * The ETC_LOGIN_DEFS settings useradd allocates ids and creates home
+ * directories with. HOME_MODE defaults to 0777 & ~UMASK, as in useradd.
+ */
+static void radius_login_defs(RADIUS_LOGIN_DEFS * defs) {
+
+    FILE * fp;
+    char * line = NULL, * key, * val, * save;
+    size_t linesz = 0;
+    long umask_val = RADIUS_UMASK, home_mode = -1;
+
+    defs->uid_min = RADIUS_UID_MIN;
+    defs->uid_max = RADIUS_UID_MAX;
+    defs->gid_min = RADIUS_GID_MIN;
+    defs->gid_max = RADIUS_GID_MAX;
+
+    if ((fp = fopen(ETC_LOGIN_DEFS, "r")) != NULL) {
+        while (getline(&line, &linesz, fp) != -1) {
+            if (   ((key = strtok_r(line, " \t\r\n", &save)) == NULL)
+                || (*key == '#')
+                || ((val = strtok_r(NULL, " \t\r\n", &save)) == NULL))
+                continue;
+
+            if (strcmp(key, "UID_MIN") == 0)
+                defs->uid_min = strtol(val, NULL, 0);
+            else if (strcmp(key, "UID_MAX") == 0)
+                defs->uid_max = strtol(val, NULL, 0);
+            else if (strcmp(key, "GID_MIN") == 0)
+                defs->gid_min = strtol(val, NULL, 0);
+            else if (strcmp(key, "GID_MAX") == 0)
+                defs->gid_max = strtol(val, NULL, 0);
+            else if (strcmp(key, "UMASK") == 0)
+                umask_val = strtol(val, NULL, 8);
+            else if (strcmp(key, "HOME_MODE") == 0)
+                home_mode = strtol(val, NULL, 8);
+        }
+        free(line);
+        fclose(fp);
+    }
+
+    if (home_mode < 0)
+        home_mode = 0777 & ~umask_val;
+    defs->home_mode = home_mode & 07777;
+}
+
+/*
+ * Run cmd, as useradd does to flush the name service caches.
+ */
+static void radius_run(char * prog, const char * cmd, char * const argv[]) {
+
+    pid_t pid;
+    int wstatus;
+
+    if ((pid = fork()) == 0) {
+        execv(cmd, argv);
+        _exit(127);
+    }
+
+    if (   (pid == -1)
+        || (waitpid(pid, &wstatus, 0) == -1)
+        || !WIFEXITED(wstatus) || (WEXITSTATUS(wstatus) != 0))
+        syslog(LOG_WARNING, "%s: %s %s failed", prog, cmd, argv[1]);
+}
+
+/*
+ * Invalidate the nscd and sssd passwd and group caches, when those are
+ * installed, as useradd/usermod/userdel do after an update.
+ */
+static void radius_flush_caches(char * prog) {
+
+    char * nscd_passwd[] = { NSCD, "-i", "passwd", NULL };
+    char * nscd_group[] = { NSCD, "-i", "group", NULL };
+    char * sss_cache[] = { SSS_CACHE, "-U", "-G", NULL };
+
+    if (access(NSCD, X_OK) == 0) {
+        radius_run(prog, NSCD, nscd_passwd);
+        radius_run(prog, NSCD, nscd_group);
+    }
+
+    if ((access(SSSD_PID, F_OK) == 0) && (access(SSS_CACHE, X_OK) == 0))
+        radius_run(prog, SSS_CACHE, sss_cache);
+}
+
+/* True if the first field of line is nam.
+ */
+static int radius_db_name_is(const char * line, const char * nam) {
+    size_t len = strlen(nam);
+    return (strncmp(line, nam, len) == 0) && (line[len] == ':');
+}
+
+static int radius_db_list_has(const char * list, const char * item,
+    size_t len) {
+
+    const char * pos = list;
+
+    while (pos && *pos) {
+        size_t itemlen = strcspn(pos, ",");
+        if ((itemlen == len) && (strncmp(pos, item, len) == 0))
+            return 1;
+        pos += itemlen;
+        if (*pos == ',')
+            pos++;
+    }
+    return 0;
+}
+
+static int radius_db_deleted(RADIUS_DB_OP * op, const char * item,
+    size_t len) {
+
+    int i;
+
+    for (i = 0; i < op->count; i++) {
+        if ((strlen(op->names[i]) == len)
+            && (strncmp(op->names[i], item, len) == 0))
+            return i;
+    }
+    return -1;
+}
+
+static int radius_db_passwd_filter(RADIUS_DB_OP * op, char * line,
+    FILE * out) {
+
+    char * field[7], * pos = line;
+    size_t namlen = strcspn(line, ":");
+    int i, del;
+
+    if ((op->op == RADIUS_DB_DEL)
+        && ((del = radius_db_deleted(op, line, namlen)) != -1)) {
+
+          /* Drop the user, remember the home directory (sixth field).
+           */
+        for (i = 0; (i < 5) && pos; i++) {
+            if ((pos = strchr(pos, ':')))
+                pos++;
+        }
+        if (pos && (strcspn(pos, ":\n") > 0))
+            op->homes[del] = strndup(pos, strcspn(pos, ":\n"));
+        return 0;
+    }
+
+    if ((op->op == RADIUS_DB_MOD) && radius_db_name_is(line, op->name)) {
+        line[strcspn(line, "\n")] = 0;
+        for (i = 0; i < 7; i++) {
+            field[i] = pos;
+            if (pos && (pos = strchr(pos, ':')))
+                *(pos++) = 0;
+        }
+        if (field[6]) {
+            return fprintf(out, "%s:%s:%s:%s:%s:%s:%s\n", field[0], field[1],
+                field[2], field[3], op->gecos, field[5], field[6]) < 0;
+        }
+        return fprintf(out, "%s\n", line) < 0;
+    }
+
+    return fputs(line, out) == EOF;
+}
+
+static int radius_db_shadow_filter(RADIUS_DB_OP * op, char * line,
+    FILE * out) {
+
+    if ((op->op == RADIUS_DB_DEL)
+        && (radius_db_deleted(op, line, strcspn(line, ":")) != -1))
+        return 0;
+
+    return fputs(line, out) == EOF;
+}
+
+/* ETC_GROUP and ETC_GSHADOW both keep the members in the fourth field.
+ */
+static int radius_db_group_common(RADIUS_DB_OP * op, char * line,
+    FILE * out, int gshadow) {
+
+    char * field[4], * pos = line, * member;
+    size_t namlen = strcspn(line, ":");
+    int i, del, first = 1;
+
+    line[strcspn(line, "\n")] = 0;
+    for (i = 0; i < 4; i++) {
+        field[i] = pos;
+        if (pos && (pos = strchr(pos, ':')))
+            *(pos++) = 0;
+    }
+
+    if (field[3] == NULL) {
+        /* Not a group entry, keep it as is.
+         */
+        for (i = 1; (i < 4) && field[i]; i++)
+            field[i][-1] = ':';
+        return fprintf(out, "%s\n", line) < 0;
+    }
+
+    if ((op->op == RADIUS_DB_DEL)
+        && ((del = radius_db_deleted(op, field[0], namlen)) != -1)) {
+
+          /* User private group of a deleted user.
+           */
+        if (gshadow) {
+            if (op->upg[del])
+                return 0;
+        } else if ((gid_t) atol(field[2]) == op->gids[del]) {
+            op->upg[del] = 1;
+            return 0;
+        }
+    }
+
+    if (fprintf(out, "%s:%s:%s:", field[0], field[1], field[2]) < 0)
+        return 1;
+
+    for (member = field[3]; member && *member; ) {
+        size_t len = strcspn(member, ",");
+        int keep = 1;
+
+        if (op->op == RADIUS_DB_DEL)
+            keep = (radius_db_deleted(op, member, len) == -1);
+        else
+            keep = !((strlen(op->name) == len)
+                     && (strncmp(member, op->name, len) == 0));
+
+        if (keep && (len > 0)) {
+            if (fprintf(out, "%s%.*s", first ? "" : ",", (int) len, member)
+                    < 0)
+                return 1;
+            first = 0;
+        }
+
+        member += len;
+        if (*member == ',')
+            member++;
+    }
+
+    if ((op->op != RADIUS_DB_DEL)
+        && radius_db_list_has(op->groups, field[0], namlen)) {
+        if (fprintf(out, "%s%s", first ? "" : ",", op->name) < 0)
+            return 1;
+    }
+
+    return fputs("\n", out) == EOF;
+}
+
+static int radius_db_group_filter(RADIUS_DB_OP * op, char * line,
+    FILE * out) {
+    return radius_db_group_common(op, line, out, 0);
+}
+
+static int radius_db_gshadow_filter(RADIUS_DB_OP * op, char * line,
+    FILE * out) {
+    return radius_db_group_common(op, line, out, 1);
+}
+
+/*
+ * Copy the open filename to "<filename>-" with the same owner, mode and
+ * times, as the shadow tools do before each update. Rewinds in.
+ */
+static int radius_db_backup(const char * filename, int in, struct stat * sb) {
+
+    char bakname[PATH_MAX], buf[BUFLEN];
+    struct timespec times[2];
+    ssize_t n;
+    int out, ret = -1;
+
+    snprintf(bakname, sizeof(bakname), "%s-", filename);
+    unlink(bakname);
+
+    if ((out = open(bakname, O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC,
+            sb->st_mode & 07777)) == -1)
+        return -1;
+
+    while ((n = read(in, buf, sizeof(buf))) > 0) {
+        if (write(out, buf, n) != n) {
+            n = -1;
+            break;
+        }
+    }
+
+    times[0] = sb->st_atim;
+    times[1] = sb->st_mtim;
+
+    if (   (n == 0)
+        && (fchown(out, sb->st_uid, sb->st_gid) == 0)
+        && (fchmod(out, sb->st_mode & 07777) == 0)
+        && (futimens(out, times) == 0)
+        && (fsync(out) == 0)) {
+        ret = 0;
+    }
+
+    if (close(out) == -1)
+        ret = -1;
+
+    if (lseek(in, 0, SEEK_SET) == -1)
+        ret = -1;
+
+    return ret;
+}
+
+/*
+ * Back up filename and rewrite it through filter into "<filename>+", with
+ * append appended. Ownership and mode of filename are kept. *skip is set
+ * if an optional filename doesn't exist.
+ */
+static int radius_db_prepare(char * prog, const char * filename,
+    radius_db_filter filter, RADIUS_DB_OP * op, const char * append,
+    int optional, int * skip) {
+
+    char tmpname[PATH_MAX];
+    FILE * in = NULL, * out = NULL;
+    char * line = NULL;
+    size_t linesz = 0;
+    struct stat sb;
+    int fd, ret = -1;
+
+    *skip = 0;
+    if ((in = fopen(filename, "r")) == NULL) {
+        if (optional && (errno == ENOENT)) {
+            *skip = 1;
+            return 0;
+        }
+        syslog(LOG_ERR, "%s: fopen(\"%s\") failed: errno %d", prog, filename,
+            errno);
+        return -1;
+    }
+
+    if (   (fstat(fileno(in), &sb) == -1)
+        || (radius_db_backup(filename, fileno(in), &sb) == -1)) {
+        syslog(LOG_ERR, "%s: backup \"%s\" failed: errno %d", prog, filename,
+            errno);
+        fclose(in);
+        return -1;
+    }
+
+    snprintf(tmpname, sizeof(tmpname), "%s+", filename);
+    unlink(tmpname);
+
+    if (   ((fd = open(tmpname, O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC,
+                sb.st_mode & 07777)) == -1)) {
+        syslog(LOG_ERR, "%s: create \"%s\" failed: errno %d", prog, tmpname,
+            errno);
+        fclose(in);
+        return -1;
+    }
+
+    if ((out = fdopen(fd, "w")) == NULL) {
+        close(fd);
+        goto radius_db_prepare_exit;
+    }
+
+    while (getline(&line, &linesz, in) != -1) {
+        if (filter(op, line, out))
+            goto radius_db_prepare_exit;
+    }
+
+    if (append && (fputs(append, out) == EOF))
+        goto radius_db_prepare_exit;
+
+    if (fchown(fd, sb.st_uid, sb.st_gid) == -1)
+        syslog(LOG_WARNING, "%s: fchown(\"%s\") failed: errno %d", prog,
+            tmpname, errno);
+
+    if (   (fflush(out) == 0)
+        && (fchmod(fd, sb.st_mode & 07777) == 0)
+        && (fsync(fd) == 0)) {
+        ret = 0;
+    }
+
+radius_db_prepare_exit:
+
+    free(line);
+    fclose(in);
+    if (out && (fclose(out) == EOF))
+        ret = -1;
+
+    if (ret != 0) {
+        syslog(LOG_ERR, "%s: update \"%s\" failed: errno %d", prog, filename,
+            errno);
+        unlink(tmpname);
+    }
+
+    return ret;
+}
+
+typedef struct _radius_db_file {
+    const char          * filename;
+    radius_db_filter    filter;
+    const char          * append;
+    int                 optional;
+    int                 skip;
+} RADIUS_DB_FILE;
+
+/*
+ * Rewrite all user databases for op. Every "<file>+" is written and synced
+ * before the first rename, and renamed in order, ETC_PASSWD last. If a
+ * file can't be written, all "<file>+" are removed and nothing changes. If
+ * a rename fails, the files already renamed are restored from "<file>-".
+ */
+static int radius_db_commit(char * prog, RADIUS_DB_OP * op,
+    const char * passwd_line, const char * shadow_line,
+    const char * group_line, const char * gshadow_line) {
+
+    RADIUS_DB_FILE files[] = {
+        { ETC_GROUP, radius_db_group_filter, group_line, 0, 0 },
+        { ETC_GSHADOW, radius_db_gshadow_filter, gshadow_line, 1, 0 },
+        { ETC_SHADOW, radius_db_shadow_filter, shadow_line, 0, 0 },
+        { ETC_PASSWD, radius_db_passwd_filter, passwd_line, 0, 0 },
+    };
+    int count = sizeof(files) / sizeof(files[0]);
+    char tmpname[PATH_MAX], bakname[PATH_MAX];
+    int prepared, renamed, i;
+
+    for (prepared = 0; prepared < count; prepared++) {
+        if (radius_db_prepare(prog, files[prepared].filename,
+                files[prepared].filter, op, files[prepared].append,
+                files[prepared].optional, &files[prepared].skip))
+            break;
+    }
+
+    for (renamed = 0; (prepared == count) && (renamed < count); renamed++) {
+        if (files[renamed].skip)
+            continue;
+        snprintf(tmpname, sizeof(tmpname), "%s+", files[renamed].filename);
+        if (rename(tmpname, files[renamed].filename) == -1) {
+            syslog(LOG_ERR, "%s: rename \"%s\" failed: errno %d", prog,
+                tmpname, errno);
+            break;
+        }
+    }
+
+    if (renamed == count)
+        return 0;
+
+    for (i = 0; i < renamed; i++) {
+        if (files[i].skip)
+            continue;
+        snprintf(bakname, sizeof(bakname), "%s-", files[i].filename);
+        if (rename(bakname, files[i].filename) == -1)
+            syslog(LOG_ERR, "%s: restore \"%s\" from \"%s\" failed: errno %d",
+                prog, files[i].filename, bakname, errno);
+    }
+
+    for (i = renamed; i < prepared; i++) {
+        if (files[i].skip)
+            continue;
+        snprintf(tmpname, sizeof(tmpname), "%s+", files[i].filename);
+        unlink(tmpname);
+    }
+
+    return -1;
+}
+
+/*
+ * Scan the third field of filename, for an unused id in [min, max]. Also
+ * reports if nam is already present.
+ */
+static long radius_db_scan(const char * filename, const char * nam,
+    long want, long min, long max, int * exists) {
+
+    FILE * fp;
+    char * line = NULL, * pos;
+    size_t linesz = 0;
+    long id, next = min, want_used = 0;
+
+    *exists = 0;
+    if ((fp = fopen(filename, "r")) == NULL)
+        return -1;
+
+    while (getline(&line, &linesz, fp) != -1) {
+        if (nam && radius_db_name_is(line, nam))
+            *exists = 1;
+        if (   ((pos = strchr(line, ':')) == NULL)
+            || ((pos = strchr(pos + 1, ':')) == NULL))
+            continue;
+        id = atol(pos + 1);
+        if (id == want)
+            want_used = 1;
+        if ((min <= id) && (id <= max) && (id >= next))
+            next = id + 1;
+    }
+
+    free(line);
+    fclose(fp);
+
+    if ((min <= want) && (want <= max) && !want_used)
+        return want;
+
+    return (next <= max) ? next : -1;
+}
+
+/*
+ * Copy the regular files of ETC_SKEL into a new home directory.
+ */
+static void radius_copy_skel(char * prog, const char * home, uid_t uid,
+    gid_t gid) {
+
+    DIR * dir;
+    struct dirent * de;
+    char src[PATH_MAX], dst[PATH_MAX], buf[BUFLEN];
+    struct stat sb;
+    int in, out;
+    ssize_t n;
+
+    if ((dir = opendir(ETC_SKEL)) == NULL)
+        return;
+
+    while ((de = readdir(dir)) != NULL) {
+        if (   (snprintf(src, sizeof(src), "%s/%s", ETC_SKEL, de->d_name)
+                   >= sizeof(src))
+            || (snprintf(dst, sizeof(dst), "%s/%s", home, de->d_name)
+                   >= sizeof(dst))
+            || (lstat(src, &sb) == -1) || !S_ISREG(sb.st_mode))
+            continue;
+
+        if ((in = open(src, O_RDONLY|O_CLOEXEC)) == -1)
+            continue;
+        if ((out = open(dst, O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC,
+                sb.st_mode & 0777)) == -1) {
+            close(in);
+            continue;
+        }
+
+        while ((n = read(in, buf, sizeof(buf))) > 0) {
+            if (write(out, buf, n) != n) {
+                syslog(LOG_WARNING, "%s: copy \"%s\" failed", prog, dst);
+                break;
+            }
+        }
+
+        if (fchown(out, uid, gid) == -1)
+            syslog(LOG_WARNING, "%s: chown(\"%s\") failed", prog, dst);
+        close(out);
+        close(in);
+    }
+
+    closedir(dir);
+}
+
+/*
+ * Remove a directory tree without following symlinks, as userdel -r.
+ */
+static int radius_remove_tree(int dirfd, const char * path) {
+
+    struct stat sb;
+    struct dirent * de;
+    DIR * dir;
+    int fd, ret = 0;
+
+    if (fstatat(dirfd, path, &sb, AT_SYMLINK_NOFOLLOW) == -1)
+        return -1;
+
+    if (!S_ISDIR(sb.st_mode))
+        return unlinkat(dirfd, path, 0);
+
+    if ((fd = openat(dirfd, path, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC))
+            == -1)
+        return -1;
+
+    if ((dir = fdopendir(fd)) == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    while ((de = readdir(dir)) != NULL) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+            continue;
+        if (radius_remove_tree(fd, de->d_name) == -1)
+            ret = -1;
+    }
+
+    closedir(dir);
+
+    if (unlinkat(dirfd, path, AT_REMOVEDIR) == -1)
+        ret = -1;
+
+    return ret;
+}
+
+static int native_user_add(char * prog, const char * name, gid_t gid,
+    const char * sec_grp, const char * gecos, const char * home,
+    const char * shell, int upg) {
+
+    RADIUS_DB_OP op = { .op = RADIUS_DB_ADD, .name = name, .groups = sec_grp };
+    RADIUS_LOGIN_DEFS defs;
+    char passwd_line[BUFLEN], shadow_line[BUFLEN];
+    char group_line[BUFLEN], gshadow_line[BUFLEN];
+    long uid, upg_gid;
+    int exists, gexists, ret = -1;
+
+    radius_login_defs(&defs);
+
+    if (radius_lock_db() == -1) {
+        syslog(LOG_ERR, "%s: lock user database failed: errno %d", prog,
+            errno);
+        return -1;
+    }
+
+    if ((uid = radius_db_scan(ETC_PASSWD, name, 0, defs.uid_min,
+            defs.uid_max, &exists)) == -1) {
+        syslog(LOG_ERR, "%s: no free uid for \"%s\"", prog, name);
+        goto native_user_add_exit;
+    }
+
+    if (exists) {
+        syslog(LOG_INFO, "%s: user \"%s\" already exists", prog, name);
+        goto native_user_add_exit;
+    }
+
+    group_line[0] = gshadow_line[0] = 0;
+    if (upg) {
+
+          /* Same as useradd -U: group named after the user, gid = uid
+           * when that is free.
+           */
+        if (   ((upg_gid = radius_db_scan(ETC_GROUP, name, uid,
+                   defs.gid_min, defs.gid_max, &gexists)) == -1)
+            || gexists) {
+            syslog(LOG_ERR, "%s: can't create group \"%s\"", prog, name);
+            goto native_user_add_exit;
+        }
+        gid = upg_gid;
+        snprintf(group_line, sizeof(group_line), "%s:x:%ld:\n", name,
+            upg_gid);
+        snprintf(gshadow_line, sizeof(gshadow_line), "%s:!::\n", name);
+    }
+
+    snprintf(passwd_line, sizeof(passwd_line), "%s:x:%ld:%ld:%s:%s:%s\n",
+        name, uid, (long) gid, gecos, home, shell);
+    snprintf(shadow_line, sizeof(shadow_line), "%s:!:%ld:0:99999:7:::\n",
+        name, (long) (time(NULL) / (24 * 60 * 60)));
+
+    if (radius_db_commit(prog, &op, passwd_line, shadow_line,
+            group_line[0] ? group_line : NULL,
+            gshadow_line[0] ? gshadow_line : NULL) == 0) {
+        ret = 0;
+    }
+
+native_user_add_exit:
+
+    radius_unlock_db();
+
+    if (ret == 0) {
+        radius_flush_caches(prog);
+
+          /* Same as useradd -m: HOME_MODE, not the umask of the caller.
+           */
+        if (mkdir(home, 0) == 0) {
+            if (   (chown(home, uid, gid) == -1)
+                || (chmod(home, defs.home_mode) == -1))
+                syslog(LOG_WARNING, "%s: chown/chmod(\"%s\") failed", prog,
+                    home);
+            radius_copy_skel(prog, home, uid, gid);
+        } else if (errno != EEXIST) {
+            syslog(LOG_WARNING, "%s: mkdir(\"%s\") failed: errno %d", prog,
+                home, errno);
+        }
+    }
+
+    return ret;
+}
+
+static int native_user_mod(char * prog, const char * name,
+    const char * sec_grp) {
+
+    RADIUS_DB_OP op = {
+        .op = RADIUS_DB_MOD,
+        .name = name,
+        .groups = sec_grp,
+        .gecos = name,          /* usermod -c name, as user_mod() */
+    };
+    int ret;
+
+    if (radius_lock_db() == -1) {
+        syslog(LOG_ERR, "%s: lock user database failed: errno %d", prog,
+            errno);
+        return -1;
+    }
+
+    ret = radius_db_commit(prog, &op, NULL, NULL, NULL, NULL);
+    radius_unlock_db();
+
+    if (ret == 0)
+        radius_flush_caches(prog);
+
+    return ret;
+}
+
+/*
+ * Delete count users, with their private groups and home directories, in
+ * one update of each user database.
+ */
+static int native_user_del(char * prog, char ** names, gid_t * gids,
+    int count) {
+
+    RADIUS_DB_OP op = { .op = RADIUS_DB_DEL };
+    int i, ret;
+
+    op.names = names;
+    op.gids = gids;
+    op.count = count;
+    op.upg = calloc(count, sizeof(int));
+    op.homes = calloc(count, sizeof(char *));
+
+    if ((op.upg == NULL) || (op.homes == NULL)) {
+        free(op.upg);
+        free(op.homes);
+        return -1;
+    }
+
+    if (radius_lock_db() == -1) {
+        syslog(LOG_ERR, "%s: lock user database failed: errno %d", prog,
+            errno);
+        ret = -1;
+    } else {
+        ret = radius_db_commit(prog, &op, NULL, NULL, NULL, NULL);
+        radius_unlock_db();
+        if (ret == 0)
+            radius_flush_caches(prog);
+    }
+
+    for (i = 0; i < count; i++) {
+        if ((ret == 0) && op.homes[i] && strcmp(op.homes[i], "/")
+            && (radius_remove_tree(AT_FDCWD, op.homes[i]) == -1)
+            && (errno != ENOENT))
+            syslog(LOG_WARNING, "%s: remove \"%s\" failed: errno %d", prog,
+                op.homes[i], errno);
+        free(op.homes[i]);
+    }
+
+    free(op.homes);
+    free(op.upg);
+    return ret;
+}
+
 int parse_nss_config(RADIUS_NSS_CONF_B * conf, char * prog,
     char * file_buf, int file_buf_sz, int * errnop, int * plockfd) {
 
@@ -424,6 +1222,20 @@ int parse_nss_config(RADIUS_NSS_CONF_B * conf, char * prog,
                 syslog( LOG_WARNING, "%s: Ignorning \"%s\"", prog, line);
             }
 
+        } else if (strncmp(line, "user_provisioning=", 18) == 0) {
+
+            if (strncmp(&(line[18]), "native", 7) == 0) {
+
+                conf->provisioning = RADIUS_PROVISIONING_NATIVE;
+
+            } else if (strncmp(&(line[18]), "exec", 5) == 0) {
+
+                conf->provisioning = RADIUS_PROVISIONING_EXEC;
+
+            } else {
+                syslog( LOG_WARNING, "%s: Ignorning \"%s\"", prog, line);
+            }
+
         } else {
 
             syslog( LOG_WARNING, "%s: Ignoring \"%s\"", prog, line);
@@ -567,7 +1379,12 @@ int radius_update_user(RADIUS_NSS_CONF_B * conf, const char * user, int mpl) {
     if (conf->trace)
         dump_rnm(mpl, rnm, "update");
 
-    if(0 != user_mod(user, rnm->groups)) {
+    if (conf->provisioning == RADIUS_PROVISIONING_NATIVE)
+        status = native_user_mod(conf->prog, user, rnm->groups);
+    else
+        status = user_mod(user, rnm->groups);
+
+    if(0 != status) {
       syslog(LOG_ERR, "%s: %s %s failed", conf->prog, USERMOD, user);
         return -1;
     }
@@ -592,12 +1409,21 @@ int radius_create_user(RADIUS_NSS_CONF_B * conf, const char * user, int mpl,
 
     char sgid[10] = {0};
     char home[64] = {0};
+    int status;
     snprintf(sgid, 10, "%d", rnm->gid);
-    snprintf(home, 63, "/home/%s", user);
+    snprintf(home, 63, "%s/%s", HOME_DIR, user);
 
     snprintf(buf, sizeof(buf), "Unconfirmed-%ld", time(NULL));
 
-    if(0 != user_add(user, sgid, rnm->groups, rnm->gecos, home, rnm->shell, unconfirmed ? buf : user, conf->many_to_one)) {
+    if (conf->provisioning == RADIUS_PROVISIONING_NATIVE)
+        status = native_user_add(conf->prog, user, rnm->gid, rnm->groups,
+            conf->many_to_one ? rnm->gecos : (unconfirmed ? buf : user),
+            home, rnm->shell, !conf->many_to_one);
+    else
+        status = user_add(user, sgid, rnm->groups, rnm->gecos, home,
+            rnm->shell, unconfirmed ? buf : user, conf->many_to_one);
+
+    if(0 != status) {
       syslog(LOG_ERR, "%s: %s %s failed", conf->prog, USERADD, user);
 
         return -1;
@@ -616,40 +1442,80 @@ int radius_delete_user(RADIUS_NSS_CONF_B * conf, const char * user) {
     return 0;
 }
 
-int radius_clear_unconfirmed_users_cleanup(int status, FILE * fp) {
+int radius_clear_unconfirmed_users_cleanup(int status, FILE * fp,
+    char ** names, gid_t * gids, int count) {
+    int i;
+
     if (fp)
         fclose(fp);
+    for (i = 0; i < count; i++)
+        free(names[i]);
+    free(names);
+    free(gids);
     return status;
 }
 
+/*
+ * Delete aged out unconfirmed users, up to unconfirmed_clear_limit + 1 in
+ * one pass. With native provisioning, all of them in one update of the
+ * user databases.
+ */
 int radius_clear_unconfirmed_users(RADIUS_NSS_CONF_B * conf)
 {
     FILE *fp;
-    int status;
+    int status = 0, count = 0, i;
+    int limit = (conf->unconfirmed_clear_limit > 0)
+                    ? conf->unconfirmed_clear_limit + 1 : 1;
     time_t ts, curr = time(NULL);
     struct passwd pw, * pwd = & pw, * result = NULL;
     char buf[BUFLEN];
+    char ** names = calloc(limit, sizeof(char *));
+    gid_t * gids = calloc(limit, sizeof(gid_t));
+
+    if ((names == NULL) || (gids == NULL)) {
+        syslog(LOG_ERR, "%s: out of memory clearing %d users\n", conf->prog,
+            limit);
+        return radius_clear_unconfirmed_users_cleanup(STATUS_ENOENT, NULL,
+                   names, gids, 0);
+    }
 
     if ((fp = fopen(ETC_PASSWD, "r")) == NULL) {
         syslog(LOG_ERR, "%s: fopen(\"/etc/passwd\") failed\n", conf->prog);
-        return radius_clear_unconfirmed_users_cleanup(STATUS_ENOENT, fp);
+        return radius_clear_unconfirmed_users_cleanup(STATUS_ENOENT, fp,
+                   names, gids, 0);
     }
 
-    while((status = fgetpwent_r(fp, pwd, buf, sizeof(buf), &result)) == 0) {
+    while((count < limit)
+          && (fgetpwent_r(fp, pwd, buf, sizeof(buf), &result) == 0)) {
         if (   (result)
             && (strncmp((result)->pw_gecos, "Unconfirmed-", 12) == 0)
             && (ts = atoi(&(((result)->pw_gecos)[12])))
-            && ((curr - ts) >= conf->unconfirmed_ageout)) {
+            && ((curr - ts) >= conf->unconfirmed_ageout)
+            && ((names[count] = strdup((result)->pw_name)) != NULL)) {
 
             syslog(LOG_INFO, "%s: Deleting unconfirmed user \"%s\"",
                 conf->prog, (result)->pw_name);
+            gids[count++] = (result)->pw_gid;
+        }
+    }
+
+    fclose(fp);
 
-            return radius_clear_unconfirmed_users_cleanup(
-                       radius_delete_user(conf, (result)->pw_name), fp);
+    if (count == 0)
+        return radius_clear_unconfirmed_users_cleanup(STATUS_ESRCH, NULL,
+                   names, gids, count);
+
+    if (conf->provisioning == RADIUS_PROVISIONING_NATIVE) {
+        status = native_user_del(conf->prog, names, gids, count);
+    } else {
+        for (i = 0; i < count; i++) {
+            if (radius_delete_user(conf, names[i]))
+                status = -1;
         }
     }
 
-    return radius_clear_unconfirmed_users_cleanup(STATUS_ESRCH, fp);
+    return radius_clear_unconfirmed_users_cleanup(status, NULL,
+               names, gids, count);
 }
 
 
@@ -37,6 +37,25 @@ The term "Broadcom" refers to Broadcom Inc. and/or its subsidiaries.
 #define RADIUS_ATTR_MPL "Management-Privilege-Level"
 
 #define ETC_PASSWD "/etc/passwd"
+#define ETC_SHADOW "/etc/shadow"
+#define ETC_GROUP "/etc/group"
+#define ETC_GSHADOW "/etc/gshadow"
+#define ETC_SKEL "/etc/skel"
+#define HOME_DIR "/home"
+#define ETC_LOGIN_DEFS "/etc/login.defs"
+
+#define NSCD "/usr/sbin/nscd"
+#define SSS_CACHE "/usr/sbin/sss_cache"
+#define SSSD_PID "/var/run/sssd.pid"
+
+#define RADIUS_NSS_SHM_CACHE RADIUS_CACHE_DIR "/nss_cache"
+#define RADIUS_NSS_SHM_MAGIC            0x52534e43
+#define RADIUS_NSS_SHM_VERSION          1
+#define RADIUS_NSS_SHM_ENTRIES          256
+#define RADIUS_NSS_SHM_PROBES           8
+#define RADIUS_NSS_SHM_READ_RETRIES     16
+#define RADIUS_NSS_SHM_NAME_SZ          33
+#define RADIUS_NSS_SHM_PW_SZ            512
 
 #define USERADD "/usr/sbin/useradd"
 #define USERMOD "/usr/sbin/usermod"
@@ -50,6 +69,17 @@ The term "Broadcom" refers to Broadcom Inc. and/or its subsidiaries.
 #define RADIUS_CONFIRMED        0
 #define RADIUS_UNCONFIRMED      1
 
+#define RADIUS_PROVISIONING_EXEC    0   /* Run useradd/usermod/userdel */
+#define RADIUS_PROVISIONING_NATIVE  1   /* Update passwd/group/shadow in-process */
+
+/* login.defs(5) defaults, as in useradd.
+ */
+#define RADIUS_UID_MIN          1000
+#define RADIUS_UID_MAX          60000
+#define RADIUS_GID_MIN          1000
+#define RADIUS_GID_MAX          60000
+#define RADIUS_UMASK            022
+
 #if defined(TEST_RADIUS_NSS)
 
 #undef RADIUS_NSS_CONF
@@ -64,6 +94,25 @@ The term "Broadcom" refers to Broadcom Inc. and/or its subsidiaries.
 
 #undef ETC_PASSWD
 #define ETC_PASSWD "passwd"
+#undef ETC_SHADOW
+#define ETC_SHADOW "shadow"
+#undef ETC_GROUP
+#define ETC_GROUP "group"
+#undef ETC_GSHADOW
+#define ETC_GSHADOW "gshadow"
+#undef ETC_SKEL
+#define ETC_SKEL "skel"
+#undef HOME_DIR
+#define HOME_DIR "home"
+#undef ETC_LOGIN_DEFS
+#define ETC_LOGIN_DEFS "login.defs"
+
+#undef NSCD
+#define NSCD "nscd"
+#undef SSS_CACHE
+#define SSS_CACHE "sss_cache"
+#undef SSSD_PID
+#define SSSD_PID "sssd.pid"
 
 #undef USERADD
 #define USERADD "/bin/echo"
@@ -103,9 +152,44 @@ typedef struct _radius_nss_conf {
     char * unconfirmed_regexp;
     int unconfirmed_ageout;
     int unconfirmed_clear_limit;
+    int provisioning;
     RADIUS_NSS_MPL rnm[RADIUS_MAX_MPL];
 } RADIUS_NSS_CONF_B;
 
+/* Identity of a file, any change of the file changes one of these.
+ */
+typedef struct _radius_nss_file_version {
+    dev_t       dev;
+    ino_t       ino;
+    off_t       size;
+    struct timespec mtime;
+} RADIUS_NSS_FILE_VERSION;
+
+/* Resolved user in the shared cache. pw holds name, gecos, dir and shell,
+ * each NULL terminated. nam[0] == 0 for a free entry.
+ */
+typedef struct _radius_nss_shm_entry {
+    char        nam[RADIUS_NSS_SHM_NAME_SZ];
+    RADIUS_NSS_FILE_VERSION mpl_version;
+    uid_t       uid;
+    gid_t       gid;
+    char        pw[RADIUS_NSS_SHM_PW_SZ];
+} RADIUS_NSS_SHM_ENTRY;
+
+/* Shared cache mapped by every process doing RADIUS NSS lookups.
+ * Writers serialize with flock() on the cache file, readers use the seqlock
+ * seq (odd while an update is in progress) and never take a lock.
+ */
+typedef struct _radius_nss_shm {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int seq;
+    int         debug;
+    RADIUS_NSS_FILE_VERSION conf_version;
+    RADIUS_NSS_FILE_VERSION passwd_version;
+    RADIUS_NSS_SHM_ENTRY entries[RADIUS_NSS_SHM_ENTRIES];
+} RADIUS_NSS_SHM;
+
 int parse_nss_config( RADIUS_NSS_CONF_B * conf, char * prog,
     char * file_buf, int file_buf_sz, int * errnop, int * plockfd);
 
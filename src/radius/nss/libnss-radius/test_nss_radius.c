@@ -21,6 +21,393 @@ The term "Broadcom" refers to Broadcom Inc. and/or its subsidiaries.
 #include <ctype.h>
 #include <netdb.h>
 #include <nss.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "nss_radius_common.h"
+
+#define BENCH_PASSWD_USERS  1000
+#define BENCH_RADIUS_USERS  16
+#define BENCH_PROCS         8
+#define BENCH_LOOKUPS       2000
+
+#define PROVISION_USERS     200
+#define PROVISION_UNCONFIRMED 10
+
+extern int radius_nss_cache_enabled;
+
+enum nss_status _nss_radius_getpwnam_r( const char * nam, struct passwd * pwd,
+    char * buf, size_t buflen, int * errnop);
+
+static void bench_write(const char * filename, const char * content) {
+    FILE * fp = fopen(filename, "w");
+
+    if (fp == NULL) {
+        perror(filename);
+        exit(1);
+    }
+    fputs(content, fp);
+    fclose(fp);
+}
+
+static void bench_set_mpl_for(const char * nam, int mpl) {
+    char filename[PATH_MAX], content[16];
+
+    snprintf(filename, sizeof(filename), "user/%s", nam);
+    mkdir(filename, 0755);
+    snprintf(filename, sizeof(filename),
+        "user/%s/Management-Privilege-Level", nam);
+    snprintf(content, sizeof(content), "%d\n", mpl);
+    bench_write(filename, content);
+}
+
+static void bench_set_mpl(int user, int mpl) {
+    char nam[32];
+
+    snprintf(nam, sizeof(nam), "radius%d", user);
+    bench_set_mpl_for(nam, mpl);
+}
+
+/*
+ * Build RADIUS_NSS_CONF, ETC_PASSWD and the MPL cache in a scratch
+ * directory. Users map many_to_one to remote_user/remote_user_su, which
+ * are at the end of a large passwd.
+ */
+static void bench_setup(char * dir) {
+    FILE * fp;
+    int i;
+
+    if ((mkdtemp(dir) == NULL) || (chdir(dir) == -1)) {
+        perror(dir);
+        exit(1);
+    }
+
+    bench_write("radius_nss.conf", "many_to_one=y\n");
+
+    if ((fp = fopen("passwd", "w")) == NULL) {
+        perror("passwd");
+        exit(1);
+    }
+    for (i = 0; i < BENCH_PASSWD_USERS; i++)
+        fprintf(fp, "local%d:x:%d:%d::/home/local%d:/bin/bash\n",
+            i, 2000 + i, 2000 + i, i);
+    fprintf(fp, "remote_user:x:1001:999:remote_user:/home/remote_user:"
+        "/usr/bin/sonic-launch-shell\n");
+    fprintf(fp, "remote_user_su:x:1002:1000:remote_user_su:"
+        "/home/remote_user_su:/usr/bin/sonic-launch-shell\n");
+    fclose(fp);
+
+    mkdir("user", 0755);
+    for (i = 0; i < BENCH_RADIUS_USERS; i++)
+        bench_set_mpl(i, (i % 2) ? 15 : 1);
+}
+
+static void bench_cleanup(char * dir) {
+    char cmd[PATH_MAX + 16];
+
+    if (chdir("/") == 0) {
+        snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+        if (system(cmd) != 0)
+            fprintf(stderr, "failed to remove %s\n", dir);
+    }
+}
+
+static int bench_lookup(int user, char * expected) {
+    struct passwd pw;
+    char buf[256], nam[32];
+    int err;
+
+    snprintf(nam, sizeof(nam), "radius%d", user);
+    if (_nss_radius_getpwnam_r(nam, &pw, buf, sizeof(buf), &err)
+            != NSS_STATUS_SUCCESS)
+        return 1;
+
+    return strcmp(pw.pw_name, expected) != 0;
+}
+
+/*
+ * Run BENCH_LOOKUPS lookups in each of procs processes.
+ * Returns lookups per second, or -1 on a wrong result.
+ */
+static double bench_run(int procs, int lookups) {
+    struct timespec start, end;
+    int i, j, status, failed = 0;
+    pid_t pid;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < procs; i++) {
+        if ((pid = fork()) == 0) {
+            for (j = 0; j < lookups; j++) {
+                int user = (i + j) % BENCH_RADIUS_USERS;
+                if (bench_lookup(user,
+                        (user % 2) ? "remote_user_su" : "remote_user"))
+                    _exit(1);
+            }
+            _exit(0);
+        } else if (pid == -1) {
+            perror("fork");
+            exit(1);
+        }
+    }
+
+    while (wait(&status) > 0)
+        if (!WIFEXITED(status) || WEXITSTATUS(status))
+            failed = 1;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (failed)
+        return -1;
+
+    return (double) procs * lookups / ((end.tv_sec - start.tv_sec)
+        + (end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+/*
+ * Multi-process getpwnam benchmark, with and without the shared cache.
+ */
+static int bench(int ac, char * av[]) {
+    char dir[] = "/tmp/test_nss_radius_XXXXXX";
+    int procs = (ac > 2) ? atoi(av[2]) : BENCH_PROCS;
+    int lookups = (ac > 3) ? atoi(av[3]) : BENCH_LOOKUPS;
+    double uncached, cached;
+    int ret = 0;
+
+    bench_setup(dir);
+
+    radius_nss_cache_enabled = 0;
+    uncached = bench_run(procs, lookups);
+
+    radius_nss_cache_enabled = 1;
+    cached = bench_run(procs, lookups);
+
+    printf("%d processes x %d lookups: uncached %.0f/s, cached %.0f/s\n",
+        procs, lookups, uncached, cached);
+
+    /* A changed MPL must not be served from the cache.
+     */
+    bench_set_mpl(0, 15);
+    if ((uncached < 0) || (cached < 0) || bench_lookup(0, "remote_user_su")) {
+        printf("FAILED: wrong lookup result\n");
+        ret = 1;
+    }
+
+    bench_cleanup(dir);
+    return ret;
+}
+
+/*
+ * Temporary root for provisioning: user databases with the groups of
+ * the default MPL map, a skeleton and empty home and MPL cache directories.
+ */
+static void provision_setup(char * dir, const char * provisioning) {
+    char conf[64];
+
+    if ((mkdtemp(dir) == NULL) || (chdir(dir) == -1)) {
+        perror(dir);
+        exit(1);
+    }
+
+    snprintf(conf, sizeof(conf), "user_provisioning=%s\n", provisioning);
+    bench_write("radius_nss.conf", conf);
+    bench_write("passwd", "root:x:0:0:root:/root:/bin/bash\n"
+        "admin:x:1000:1000:admin:/home/admin:/bin/bash\n");
+    bench_write("shadow", "root:*:19000:0:99999:7:::\n"
+        "admin:*:19000:0:99999:7:::\n");
+    bench_write("group", "root:x:0:\nsudo:x:27:admin\n"
+        "docker:x:999:admin\nadmin:x:1000:\n");
+    bench_write("gshadow", "root:*::\nsudo:*::admin\n"
+        "docker:!::admin\nadmin:!::\n");
+    bench_write("login.defs", "# login.defs\nUID_MIN\t\t 2000\n"
+        "UID_MAX\t\t60000\nUMASK\t\t022\nHOME_MODE\t0750\n");
+    mkdir("skel", 0755);
+    bench_write("skel/.bashrc", "# bashrc\n");
+    mkdir("home", 0755);
+    mkdir("user", 0755);
+}
+
+/* Returns 1 if user is a member of group in filename, group or gshadow.
+ */
+static int provision_is_member(const char * filename, const char * group,
+    const char * user) {
+    FILE * fp = fopen(filename, "r");
+    char line[BUFLEN], * members, * member;
+    size_t len = strlen(group);
+    int i, found = 0;
+
+    while (fp && !found && fgets(line, sizeof(line), fp)) {
+        if ((strncmp(line, group, len) != 0) || (line[len] != ':'))
+            continue;
+        line[strcspn(line, "\n")] = 0;
+        for (i = 0, members = line; (i < 3) && members; i++) {
+            if ((members = strchr(members, ':')))
+                members++;
+        }
+        for (member = members ? strtok(members, ",") : NULL; member;
+             member = strtok(NULL, ","))
+            found |= (strcmp(member, user) == 0);
+    }
+    if (fp)
+        fclose(fp);
+    return found;
+}
+
+/* Returns 1 if filename has a line for nam.
+ */
+static int provision_has_entry(const char * filename, const char * nam) {
+    FILE * fp = fopen(filename, "r");
+    char line[BUFLEN];
+    size_t len = strlen(nam);
+    int found = 0;
+
+    while (fp && !found && fgets(line, sizeof(line), fp))
+        found = (strncmp(line, nam, len) == 0) && (line[len] == ':');
+    if (fp)
+        fclose(fp);
+    return found;
+}
+
+/* Uid of nam in passwd, or -1.
+ */
+static long provision_uid(const char * nam) {
+    FILE * fp = fopen("passwd", "r");
+    struct passwd * pw;
+    long uid = -1;
+
+    while (fp && (uid == -1) && (pw = fgetpwent(fp)))
+        if (strcmp(pw->pw_name, nam) == 0)
+            uid = pw->pw_uid;
+    if (fp)
+        fclose(fp);
+    return uid;
+}
+
+/*
+ * First login of users NSS lookups, one user created per lookup.
+ * Returns logins per second, and successful lookups in pok.
+ */
+static double provision_logins(int users, int * pok) {
+    struct timespec start, end;
+    struct passwd pw;
+    char buf[256], nam[32];
+    int i, err;
+
+    *pok = 0;
+    for (i = 0; i < users; i++) {
+        snprintf(nam, sizeof(nam), "radius%d", i);
+        bench_set_mpl_for(nam, (i % 2) ? RADIUS_MAX_MPL : RADIUS_MIN_MPL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < users; i++) {
+        snprintf(nam, sizeof(nam), "radius%d", i);
+        if (_nss_radius_getpwnam_r(nam, &pw, buf, sizeof(buf), &err)
+                == NSS_STATUS_SUCCESS)
+            (*pok)++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return users / ((end.tv_sec - start.tv_sec)
+        + (end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+/*
+ * Provisioning harness on a temporary root: logins/sec with useradd
+ * (USERADD is /bin/echo in test builds, so only fork+exec is measured)
+ * and in-process provisioning, then one pass clearing unconfirmed users.
+ */
+static int provision(int ac, char * av[]) {
+    char exec_dir[] = "/tmp/test_nss_radius_XXXXXX";
+    char native_dir[] = "/tmp/test_nss_radius_XXXXXX";
+    int users = (ac > 2) ? atoi(av[2]) : PROVISION_USERS;
+    RADIUS_NSS_CONF_B conf;
+    char file_buf[RADIUS_MAX_NSS_CONF_SZ], nam[32];
+    double exec_rate, native_rate;
+    struct stat sb;
+    int ok, i, ret = 0, stdout_fd;
+
+    /* useradd output goes to /dev/null.
+     */
+    fflush(stdout);
+    stdout_fd = dup(1);
+    i = open("/dev/null", O_WRONLY);
+    dup2(i, 1);
+    close(i);
+
+    provision_setup(exec_dir, "exec");
+    exec_rate = provision_logins(users, &ok);
+    bench_cleanup(exec_dir);
+
+    fflush(stdout);
+    dup2(stdout_fd, 1);
+    close(stdout_fd);
+
+    provision_setup(native_dir, "native");
+    native_rate = provision_logins(users, &ok);
+
+    printf("%d first logins: exec %.0f/s, native %.0f/s\n", users, exec_rate,
+        native_rate);
+
+    if (   (ok != users)
+        || !provision_has_entry("shadow", "radius0")
+        || !provision_has_entry("group", "radius0")
+        || !provision_has_entry("gshadow", "radius0")
+        || !provision_is_member("group", "docker", "radius0")
+        || provision_is_member("group", "sudo", "radius0")
+        || !provision_is_member("group", "sudo", "radius1")
+        || !provision_is_member("gshadow", "sudo", "radius1")
+        || (stat("home/radius1/.bashrc", &sb) == -1)
+        || (stat("home/radius1", &sb) == -1)
+        || ((sb.st_mode & 07777) != 0750)
+        || (provision_uid("radius0") < 2000)
+        || !provision_has_entry("passwd-", "admin")
+        || !provision_has_entry("group-", "docker")) {
+        printf("FAILED: %d of %d users provisioned\n", ok, users);
+        ret = 1;
+    }
+
+    /* Unconfirmed users, all aged out, cleared in one pass.
+     */
+    parse_nss_config(&conf, "nss", file_buf, sizeof(file_buf), NULL, NULL);
+    conf.unconfirmed_ageout = 0;
+    for (i = 0; i < PROVISION_UNCONFIRMED; i++) {
+        snprintf(nam, sizeof(nam), "unconfirmed%d", i);
+        radius_create_user(&conf, nam, RADIUS_MIN_MPL, RADIUS_UNCONFIRMED);
+    }
+
+    if (   (radius_clear_unconfirmed_users(&conf) != 0)
+        || provision_has_entry("passwd", "unconfirmed0")
+        || provision_has_entry("shadow", "unconfirmed0")
+        || provision_has_entry("group", "unconfirmed0")
+        || provision_has_entry("gshadow", "unconfirmed0")
+        || provision_is_member("group", "docker", "unconfirmed0")
+        || provision_has_entry("passwd", "unconfirmed9")
+        || (stat("home/unconfirmed9", &sb) == 0)
+        || !provision_has_entry("passwd", "radius0")
+        || !provision_is_member("group", "docker", "radius0")) {
+        printf("FAILED: unconfirmed users not cleared\n");
+        ret = 1;
+    }
+
+    /* A database that can't be written leaves all of them untouched.
+     */
+    mkdir("shadow+", 0755);
+    if (   (radius_create_user(&conf, "partial0", RADIUS_MIN_MPL, 0) == 0)
+        || provision_has_entry("group", "partial0")
+        || provision_has_entry("gshadow", "partial0")
+        || provision_has_entry("passwd", "partial0")
+        || (stat("group+", &sb) == 0)
+        || (stat("gshadow+", &sb) == 0)
+        || (stat("passwd+", &sb) == 0)) {
+        printf("FAILED: partial user database update\n");
+        ret = 1;
+    }
+    rmdir("shadow+");
+
+    bench_cleanup(native_dir);
+    return ret;
+}
 
 int main(int ac, char * av[]) {
 
@@ -33,6 +420,12 @@ int main(int ac, char * av[]) {
     char * users[] = { "admin", "user", "netops", "operator", "unknown", 0 };
     char ** u;
 
+    if ((ac > 1) && (strcmp(av[1], "bench") == 0))
+        return bench(ac, av);
+
+    if ((ac > 1) && (strcmp(av[1], "provision") == 0))
+        return provision(ac, av);
+
     printf("buf: %p, len: %lx\n", buf, sizeof(buf));
 
     for ( u = users ; *u ; u++) {
@@ -6,6 +6,9 @@
  * Copyright (c) 2021 by Cisco Systems, Inc.
  *------------------------------------------------------------------
  */
+#include <chrono>
+#include <fstream>
+#include <iostream>
 #include <mutex>
 #include <string>
 #include <sys/stat.h>
@@ -496,19 +499,24 @@ TEST_F(SsgFunctionTest, get_num_of_asic) {
 TEST_F(SsgFunctionTest, get_unit_files) {
     g_unit_file_prefix = TEST_UNIT_FILE_PREFIX.c_str();
     g_config_file = TEST_CONFIG_FILE.c_str();
-    char* unit_files[NUM_UNIT_FILES];
-    int num_unit_files = get_unit_files(unit_files);
+    char** unit_files = nullptr;
+    int num_unit_files = get_unit_files(&unit_files);
     EXPECT_EQ(num_unit_files, NUM_UNIT_FILES);
+    ASSERT_NE(unit_files, nullptr);
     for (std::string service : generated_services) {
         bool found = false;
-        for (auto& unit_file : unit_files) {
-            if(unit_file == service) {
+        for (int i = 0; i < num_unit_files; ++i) {
+            if(unit_files[i] == service) {
                 found = true;
                 break;
             }
         }
         EXPECT_TRUE(found) << "unit file not found: " << service;
     }
+    for (int i = 0; i < num_unit_files; ++i) {
+        free(unit_files[i]);
+    }
+    free(unit_files);
 }
 
 /* TEST ssg_main() argv error */
@@ -542,6 +550,142 @@ TEST_F(SsgMainTest, ssg_main_10_npu) {
 TEST_F(SsgMainTest, ssg_main_40_npu) {
     ssg_main_test(40);
 }
+/*
+ * class SsgBenchmarkTest
+ * Generates a synthetic unit tree for a multi asic platform, larger than
+ * the fixed limits systemd-sonic-generator used to have, and measures
+ * ssg_main wall time.
+ */
+class SsgBenchmarkTest : public SsgFunctionTest {
+  protected:
+    static const int BENCH_NUM_ASICS = 16;
+    static const int BENCH_NUM_MULTI_INST = 64;
+    static const int BENCH_NUM_SINGLE_INST = 128;
+
+    std::string multi_inst_name(int i) {
+        return "bench_multi_" + std::to_string(i);
+    }
+
+    std::string single_inst_name(int i) {
+        return "bench_single_" + std::to_string(i);
+    }
+
+    void write_unit_file(std::string unit_file, std::string unit_section,
+                         std::string install_section) {
+        std::ofstream file(TEST_UNIT_FILE_PREFIX + unit_file);
+        file << "[Unit]\n"
+             << "Description=Benchmark service " << unit_file << "\n"
+             << unit_section
+             << "[Service]\n"
+             << "ExecStart=/usr/bin/test.sh start\n"
+             << "[Install]\n"
+             << install_section;
+    }
+
+    /* Generates unit files and generated_services.conf, returns number of units */
+    int generate_unit_tree() {
+        std::ofstream conf(TEST_CONFIG_FILE);
+        int num_units = 0;
+
+        for (int i = 0; i < BENCH_NUM_MULTI_INST; ++i) {
+            std::string name = multi_inst_name(i);
+            write_unit_file(name + ".service", "",
+                            "WantedBy=multi-user.target\n");
+            write_unit_file(name + "@.service",
+                            "Requires=" + name + ".service\n",
+                            "WantedBy=multi-user.target\n"
+                            "RequiredBy=bench@%i.target\n");
+            conf << name << ".service\n" << name << "@.service\n";
+            num_units += 2;
+        }
+
+        for (int i = 0; i < BENCH_NUM_SINGLE_INST; ++i) {
+            std::string name = single_inst_name(i);
+            write_unit_file(name + ".service",
+                            "After=" + multi_inst_name(i % BENCH_NUM_MULTI_INST) +
+                            ".service " + single_inst_name(i + 1) + ".service\n",
+                            "WantedBy=multi-user.target\n");
+            conf << name << ".service\n";
+            num_units++;
+        }
+        return num_units;
+    }
+
+    /* Validates symlinks and rewritten dependencies for the synthetic tree */
+    void validate_unit_tree() {
+        std::string wants = TEST_OUTPUT_DIR + "multi-user.target.wants/";
+
+        for (int i = 0; i < BENCH_NUM_MULTI_INST; ++i) {
+            std::string name = multi_inst_name(i);
+            EXPECT_TRUE(fs::exists(wants + name + ".service"));
+            for (int j = 0; j < BENCH_NUM_ASICS; ++j) {
+                std::string instance = name + "@" + std::to_string(j) + ".service";
+                EXPECT_TRUE(fs::is_symlink(wants + instance))
+                    << "missing " << instance;
+                EXPECT_TRUE(fs::is_symlink(TEST_OUTPUT_DIR + "bench@" +
+                            std::to_string(j) + ".target.requires/" + instance))
+                    << "missing " << instance << " requirement";
+            }
+        }
+
+        for (int i = 0; i < BENCH_NUM_SINGLE_INST; ++i) {
+            std::string name = single_inst_name(i);
+            std::ifstream file(TEST_UNIT_FILE_PREFIX + name + ".service");
+            std::string content((std::istreambuf_iterator<char>(file)),
+                                std::istreambuf_iterator<char>());
+
+            EXPECT_TRUE(fs::is_symlink(wants + name + ".service"));
+            for (int j = 0; j < BENCH_NUM_ASICS; ++j) {
+                std::string dep = "After=" + multi_inst_name(i % BENCH_NUM_MULTI_INST) +
+                                  "@" + std::to_string(j) + ".service\n";
+                EXPECT_NE(content.find(dep), std::string::npos)
+                    << "missing " << dep << " in " << name;
+            }
+            EXPECT_NE(content.find("After=" + single_inst_name(i + 1) + ".service\n"),
+                      std::string::npos);
+        }
+    }
+};
+
+/* TEST ssg_main() on a synthetic 16 asic unit tree, reports wall time */
+TEST_F(SsgBenchmarkTest, ssg_main_16_npu_benchmark) {
+    FILE* fp;
+    std::vector<char*> argv_;
+    std::vector<std::string> arguments = {
+                "ssg_main",
+                TEST_OUTPUT_DIR.c_str()
+            };
+
+    std::string unit_file_path = fs::current_path().string() + "/" +TEST_UNIT_FILE_PREFIX;
+    g_unit_file_prefix = unit_file_path.c_str();
+    g_config_file = TEST_CONFIG_FILE.c_str();
+    g_machine_config_file = TEST_MACHINE_CONF.c_str();
+    g_asic_conf_format = TEST_ASIC_CONF_FORMAT.c_str();
+
+    fp = fopen(TEST_ASIC_CONF.c_str(), "w");
+    ASSERT_NE(fp, nullptr);
+    fputs(("NUM_ASIC=" + std::to_string(BENCH_NUM_ASICS)).c_str(), fp);
+    fclose(fp);
+
+    int num_units = generate_unit_tree();
+
+    for (const auto& arg : arguments) {
+        argv_.push_back((char*)arg.data());
+    }
+    argv_.push_back(nullptr);
+
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(ssg_main(argv_.size(), argv_.data()), 0);
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::steady_clock::now() - start);
+
+    std::cout << "[ BENCH    ] " << num_units << " units, "
+              << BENCH_NUM_ASICS << " asics: "
+              << elapsed.count() << " us" << std::endl;
+    RecordProperty("wall_time_us", std::to_string(elapsed.count()));
+
+    validate_unit_tree();
+}
 }
 
 int main(int argc, char** argv) {
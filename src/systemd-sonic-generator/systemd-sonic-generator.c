@@ -5,14 +5,13 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <linux/limits.h>
 
-#define MAX_NUM_TARGETS 48
-#define MAX_NUM_INSTALL_LINES 48
-#define MAX_NUM_UNITS 128
 #define MAX_BUF_SIZE 512
+#define NAME_TABLE_MIN_SIZE 64
 
 const char* UNIT_FILE_PREFIX = "/usr/lib/systemd/system/";
 const char* CONFIG_FILE = "/etc/sonic/generated_services.conf";
@@ -40,8 +39,54 @@ const char* get_asic_conf_format() {
 }
 
 static int num_asics;
-static char** multi_instance_services;
-static int num_multi_inst;
+
+/* Hash table entry, name is owned by the table */
+typedef struct name_entry {
+    char* name;
+    void* value;
+    struct name_entry* next;
+} name_entry_t;
+
+/* Chained hash table keyed by name */
+typedef struct {
+    name_entry_t** buckets;
+    size_t num_buckets;
+    size_t num_entries;
+} name_table_t;
+
+/* Unit listed in generated_services.conf */
+typedef struct {
+    char* name;                 /* Name as listed in generated_services.conf */
+    char* install_name;         /* Unit file installed, template is collapsed on single ASIC platform */
+    bool is_template;
+    char** targets;             /* Target directories from [Install] section */
+    int num_targets;
+    int max_targets;
+} unit_file_t;
+
+/*
+ * In-memory model of the units to be installed.
+ * Each unit file is read once into the model, all symlinks are created from it.
+ */
+typedef struct {
+    int num_asics;
+    unit_file_t** units;
+    int num_units;
+    int max_units;
+    name_table_t unit_names;    /* unit_file_t by name */
+    name_table_t multi_inst;    /* Multi-instance service names */
+    name_table_t target_dirs;   /* Target directories already created */
+} unit_model_t;
+
+/* State of a single unit file parse */
+typedef struct {
+    unit_model_t* model;
+    unit_file_t* unit;
+    FILE* out;                  /* Rewritten unit file, NULL when unit is not rewritten */
+    bool section_done;
+    bool in_install;
+    bool failed;                /* A line could not be rewritten, unit is skipped */
+} unit_parser_t;
 
 void strip_trailing_newline(char* str) {
     /***
@@ -54,144 +99,290 @@ void strip_trailing_newline(char* str) {
 }
 
 
-static int get_target_lines(char* unit_file, char* target_lines[]) {
+static uint32_t hash_name(const char* name, size_t len) {
     /***
-    Gets installation information for a given unit file
+    FNV-1a hash of the first len characters of name
+    ***/
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
 
-    Returns lines in the [Install] section of a unit file
+static name_entry_t* name_table_find(name_table_t* table, const char* name, size_t len) {
+    /***
+    Finds the entry whose name equals the first len characters of name
     ***/
-    FILE *fp;
-    char *line = NULL;
-    size_t len = 0;
-    ssize_t nread;
-    bool found_install;
-    int num_target_lines;
+    name_entry_t* entry;
+
+    if (table->num_buckets == 0)
+        return NULL;
+
+    entry = table->buckets[hash_name(name, len) & (table->num_buckets - 1)];
+    for (; entry != NULL; entry = entry->next) {
+        if (strncmp(entry->name, name, len) == 0 && entry->name[len] == '\0')
+            return entry;
+    }
+    return NULL;
+}
 
 
-    fp = fopen(unit_file, "r");
+static int name_table_grow(name_table_t* table) {
+    size_t num_buckets = table->num_buckets ? table->num_buckets * 2 : NAME_TABLE_MIN_SIZE;
+    name_entry_t** buckets = calloc(num_buckets, sizeof(name_entry_t*));
+    name_entry_t* entry;
+    name_entry_t* next;
 
-    if (fp == NULL) {
-        fprintf(stderr, "Failed to open file %s\n", unit_file);
+    if (buckets == NULL)
         return -1;
+
+    for (size_t i = 0; i < table->num_buckets; i++) {
+        for (entry = table->buckets[i]; entry != NULL; entry = next) {
+            size_t idx = hash_name(entry->name, strlen(entry->name)) & (num_buckets - 1);
+            next = entry->next;
+            entry->next = buckets[idx];
+            buckets[idx] = entry;
+        }
     }
 
-    found_install = false;
-    num_target_lines = 0;
+    free(table->buckets);
+    table->buckets = buckets;
+    table->num_buckets = num_buckets;
+    return 0;
+}
 
-    while ((nread = getline(&line, &len, fp)) != -1 ) {
-        // Assumes that [Install] is the last section of the unit file
-        if (strstr(line, "[Install]") != NULL) {
-             found_install = true;
-        }
-        else if (found_install) {
-            if (num_target_lines >= MAX_NUM_INSTALL_LINES) {
-                fprintf(stderr, "Number of lines in [Install] section of %s exceeds MAX_NUM_INSTALL_LINES\n", unit_file);
-                fputs("Extra [Install] lines will be ignored\n", stderr);
-                break;
-            }
-            target_lines[num_target_lines] = strdup(line);
-            num_target_lines++;
-        }
+
+static int name_table_insert(name_table_t* table, const char* name, size_t len, void* value) {
+    /***
+    Inserts the first len characters of name
+
+    Returns 1 if the name already exists, 0 if inserted, -1 on allocation failure
+    ***/
+    name_entry_t* entry;
+    size_t idx;
+
+    if (name_table_find(table, name, len) != NULL)
+        return 1;
+
+    if (table->num_entries >= table->num_buckets && name_table_grow(table) < 0)
+        return -1;
+
+    entry = malloc(sizeof(name_entry_t));
+    if (entry == NULL)
+        return -1;
+
+    entry->name = strndup(name, len);
+    if (entry->name == NULL) {
+        free(entry);
+        return -1;
     }
+    entry->value = value;
 
-    free(line);
+    idx = hash_name(name, len) & (table->num_buckets - 1);
+    entry->next = table->buckets[idx];
+    table->buckets[idx] = entry;
+    table->num_entries++;
+    return 0;
+}
 
-    fclose(fp);
 
-    return num_target_lines;
-}
-
-static bool is_multi_instance_service(char *service_name){
-    int i;
-    for(i=0; i < num_multi_inst; i++){
-        /*
-         * The service name may contain @.service or .service. Remove these
-         * postfixes and extract service name. Compare service name for absolute
-         * match in multi_instance_services[].
-         * This is to prevent services like database-chassis and systemd-timesyncd marked
-         * as multi instance services as they contain strings 'database' and 'syncd' respectively
-         * which are multi instance services in multi_instance_services[].
-         */
-        char *saveptr;
-        char *token = strtok_r(service_name, "@", &saveptr);
-        if (token) {
-            if (strstr(token, ".service") != NULL) {
-                /* If we are here, service_name did not have '@' delimiter but contains '.service' */
-                token = strtok_r(service_name, ".", &saveptr);
-            }
-        }
-        if (strncmp(service_name, multi_instance_services[i], strlen(service_name)) == 0) {
-            return true;
+static void name_table_release(name_table_t* table) {
+    name_entry_t* entry;
+    name_entry_t* next;
+
+    for (size_t i = 0; i < table->num_buckets; i++) {
+        for (entry = table->buckets[i]; entry != NULL; entry = next) {
+            next = entry->next;
+            free(entry->name);
+            free(entry);
         }
     }
-    return false;
+    free(table->buckets);
+    memset(table, 0, sizeof(name_table_t));
+}
+
+
+static int grow_array(void* array, int* max_items, int num_items, size_t item_size) {
+    /***
+    Makes room for one more item in a dynamically sized array
+    ***/
+    void** items = (void**)array;
+    int new_max;
+    void* new_items;
+
+    if (num_items < *max_items)
+        return 0;
+
+    new_max = *max_items ? *max_items * 2 : 16;
+    new_items = realloc(*items, new_max * item_size);
+    if (new_items == NULL) {
+        fputs("Out of memory\n", stderr);
+        return -1;
+    }
 
+    *items = new_items;
+    *max_items = new_max;
+    return 0;
 }
 
-static int get_install_targets_from_line(char* target_string, char* install_type, char* targets[], int existing_targets) {
+
+static bool is_multi_instance_service(unit_model_t* model, const char* service_name, size_t len) {
     /***
-    Helper fuction for get_install_targets
+    Compares the first len characters of service_name for absolute match
+    with the multi-instance services.
 
-    Given a space delimited string of target directories and a suffix,
-    puts each target directory plus the suffix into the targets array
+    Callers remove the @.service or .service postfixes. This is to prevent
+    services like database-chassis and systemd-timesyncd marked as multi
+    instance services as they contain strings 'database' and 'syncd'
+    respectively which are multi instance services.
+    ***/
+    return name_table_find(&model->multi_inst, service_name, len) != NULL;
+}
+
+
+static size_t get_dependency_name_len(const char* word) {
+    /***
+    Returns the length of the service name in a dependency, e.g. 'example'
+    for 'example.service'. Other unit types are compared by full name.
+    ***/
+    if (strstr(word, ".service") != NULL)
+        return strchr(word, '.') - word;
+    return strlen(word);
+}
+
+
+static int add_install_target(unit_file_t* unit, const char* target, const char* install_type) {
+    /***
+    Adds a target directory plus the install suffix to the unit
+
+    Template targets like 'example@%i.target' are installed
+    in 'example@.target' directories
+    ***/
+    const char* dot = strchr(target, '.');
+    char* final_target;
+    int r;
+
+    if (grow_array(&unit->targets, &unit->max_targets, unit->num_targets, sizeof(char*)) < 0)
+        return -1;
+
+    if ((strchr(target, '%') != NULL) && (dot != NULL) && (dot - target >= 2)) {
+        const char* suffix = dot + 1;
+
+        r = asprintf(&final_target, "%.*s.%.*s%s", (int)(dot - target - 2), target,
+                     (int)strcspn(suffix, "."), suffix, install_type);
+    }
+    else {
+        r = asprintf(&final_target, "%s%s", target, install_type);
+    }
+
+    if (r == -1) {
+        fprintf(stderr, "Error adding target %s of %s\n", target, unit->install_name);
+        return -1;
+    }
+
+    unit->targets[unit->num_targets++] = final_target;
+    return 0;
+}
+
+
+static void parse_install_line(unit_parser_t* parser, char* line) {
+    /***
+    Gets installation information from a line in the [Install] section
+
+    Given a line like 'WantedBy=a.target b.target', adds each target
+    directory plus the suffix for the install type to the unit
     ***/
-    char* token;
-    char* target;
     char* saveptr;
-    char final_target[PATH_MAX];
-    int num_targets = 0;
-
-    while ((token = strtok_r(target_string, " ", &target_string))) {
-        if (num_targets + existing_targets >= MAX_NUM_TARGETS) {
-            fputs("Number of targets found exceeds MAX_NUM_TARGETS\n", stderr);
-            fputs("Additional targets will be ignored \n", stderr);
-            return num_targets;
-        }
+    char* key;
+    char* value;
+    char* target;
+    const char* install_type;
 
-        target = strdup(token);
-        strip_trailing_newline(target);
+    key = strtok_r(line, "=", &saveptr);
+    value = strtok_r(NULL, "", &saveptr);
+    if ((key == NULL) || (value == NULL))
+        return;
 
-        if (strstr(target, "%") != NULL) {
-            char* prefix = strtok_r(target, ".", &saveptr);
-            char* suffix = strtok_r(NULL, ".", &saveptr);
-            int prefix_len = strlen(prefix);
+    if (strstr(key, "RequiredBy") != NULL) {
+        install_type = ".requires";
+    }
+    else if (strstr(key, "WantedBy") != NULL) {
+        install_type = ".wants";
+    }
+    else {
+        return;
+    }
 
-            strncpy(final_target, prefix, prefix_len - 2);
-            final_target[prefix_len - 2] = '\0';
-            strcat(final_target, ".");
-            strcat(final_target, suffix);
-        }
-        else {
-            strcpy(final_target, target);
-        }
-        strcat(final_target, install_type);
+    while ((target = strtok_r(value, " \t", &value))) {
+        add_install_target(parser->unit, target, install_type);
+    }
+}
 
-        free(target);
 
-        targets[num_targets + existing_targets] = strdup(final_target);
-        num_targets++;
+static void emit_unit_line(unit_parser_t* parser, char* line) {
+    /***
+    Hands a line of the resulting unit file to the rewritten file
+    and the [Install] section parser
+    ***/
+    if (parser->out != NULL) {
+        fputs(line, parser->out);
+        fputc('\n', parser->out);
     }
-    return num_targets;
+
+    if (parser->in_install)
+        parse_install_line(parser, line);
 }
 
-static void replace_multi_inst_dep(char *src) {
-    FILE *fp_src;
-    FILE *fp_tmp;
+
+static void replace_multi_inst_dep(unit_parser_t* parser, char* line) {
+    /***
+    Replaces dependencies on multi instance services with a dependency
+    on every instance, e.g. 'After=example.service' is replaced with
+    'After=example@0.service', 'After=example@1.service', ...
+
+    Other dependencies are split into one line each.
+    ***/
     char buf[MAX_BUF_SIZE];
-    char* line = NULL;
-    int i;
-    ssize_t len;
-    char *token;
-    char *word;
-    char *line_copy;
-    char *service_name;
-    char *type;
-    char *save_ptr1 = NULL;
-    char *save_ptr2 = NULL;
-    ssize_t nread;
-    bool section_done = false;
-    char tmp_file_path[PATH_MAX];
+    char* saveptr;
+    char* token;
+    char* word;
+    char* dot;
+
+    token = strtok_r(line, "=", &saveptr);
+    if (token == NULL)
+        return;
+
+    while ((word = strtok_r(NULL, " ", &saveptr))) {
+        dot = strchr(word, '.');
+        if ((dot == NULL) || (strchr(word, '@') != NULL) ||
+            !is_multi_instance_service(parser->model, word, get_dependency_name_len(word))) {
+            if (snprintf(buf, MAX_BUF_SIZE, "%s=%s", token, word) >= MAX_BUF_SIZE) {
+                fprintf(stderr, "Dependency line too long: %s=%s\n", token, word);
+                parser->failed = true;
+                return;
+            }
+            emit_unit_line(parser, buf);
+            continue;
+        }
+
+        for (int i = 0; i < parser->model->num_asics; i++) {
+            if (snprintf(buf, MAX_BUF_SIZE, "%s=%.*s@%d.%s", token,
+                         (int)(dot - word), word, i, dot + 1) >= MAX_BUF_SIZE) {
+                fprintf(stderr, "Dependency line too long: %s=%s\n", token, word);
+                parser->failed = true;
+                return;
+            }
+            emit_unit_line(parser, buf);
+        }
+    }
+}
+
 
+static void parse_unit_line(unit_parser_t* parser, char* line) {
     /* Assumes that the service files has 3 sections,
      * in the order: Unit, Service and Install.
      * Assumes that the timer file has 3 sections,
@@ -200,126 +391,208 @@ static void replace_multi_inst_dep(char *src) {
      * sections, replace if dependent on multi instance
      * service.
      */
-    fp_src = fopen(src, "r");
-    snprintf(tmp_file_path, PATH_MAX, "%s.tmp", src);
-    fp_tmp = fopen(tmp_file_path, "w");
-
-    while ((nread = getline(&line, &len, fp_src)) != -1 ) {
-        if ((strstr(line, "[Service]") != NULL) ||
-            (strstr(line, "[Timer]") != NULL)) {
-            section_done = true;
-            fputs(line,fp_tmp);
-        } else if (strstr(line, "[Install]") != NULL) {
-            section_done = false;
-            fputs(line,fp_tmp);
-        } else if ((strstr(line, "[Unit]") != NULL) ||
-           (strstr(line, "Description") != NULL) ||
-           (section_done == true)) {
-            fputs(line,fp_tmp);
-        } else {
-            line_copy = strdup(line);
-            token = strtok_r(line_copy, "=", &save_ptr1);
-            while ((word = strtok_r(NULL, " ", &save_ptr1))) {
-                if((strchr(word, '.') == NULL) ||
-                   (strchr(word, '@') != NULL)) {
-                    snprintf(buf, MAX_BUF_SIZE,"%s=%s\n",token, word);
-                    fputs(buf,fp_tmp);
-                } else {
-                    service_name = strdup(word);
-                    service_name = strtok_r(service_name, ".", &save_ptr2);
-                    type = strtok_r(NULL, "\n", &save_ptr2);
-                    if (is_multi_instance_service(word)) {
-                        for(i = 0; i < num_asics; i++) {
-                            snprintf(buf, MAX_BUF_SIZE, "%s=%s@%d.%s\n",
-                                    token, service_name, i, type);
-                            fputs(buf,fp_tmp);
-                        }
-                    } else {
-                        snprintf(buf, MAX_BUF_SIZE,"%s=%s.%s\n",token, service_name, type);
-                        fputs(buf, fp_tmp);
-                    }
-                    free(service_name);
-                }
-            }
-            free(line_copy);
-        }
+    if ((strstr(line, "[Service]") != NULL) ||
+        (strstr(line, "[Timer]") != NULL)) {
+        parser->section_done = true;
+        emit_unit_line(parser, line);
+    } else if (strstr(line, "[Install]") != NULL) {
+        parser->section_done = false;
+        emit_unit_line(parser, line);
+        parser->in_install = true;
+    } else if ((parser->out == NULL) ||
+               (strstr(line, "[Unit]") != NULL) ||
+               (strstr(line, "Description") != NULL) ||
+               (parser->section_done == true)) {
+        emit_unit_line(parser, line);
+    } else {
+        replace_multi_inst_dep(parser, line);
     }
-    fclose(fp_src);
-    fclose(fp_tmp);
-    free(line);
-    /* remove the .service file, rename the .service.tmp file
-     * as .service.
-     */
-    remove(src);
-    rename(tmp_file_path, src);
 }
 
-int get_install_targets(char* unit_file, char* targets[]) {
-    /***
-    Returns install targets for a unit file
 
-    Parses the information in the [Install] section of a given
-    unit file to determine which directories to install the unit in
+static char* read_unit_file(const char* path, size_t* size) {
+    /***
+    Reads a whole unit file into memory
     ***/
-    char file_path[PATH_MAX];
-    char *target_lines[MAX_NUM_INSTALL_LINES];
-    int num_target_lines;
-    int num_targets;
-    int found_targets;
-    char* token;
-    char* line = NULL;
-    bool first;
-    char* target_suffix;
-    char *instance_name;
-    char *dot_ptr;
+    FILE *fp;
+    char *content = NULL;
+    size_t len = 0;
+    ssize_t nread;
 
-    strcpy(file_path, get_unit_file_prefix());
-    strcat(file_path, unit_file);
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Failed to open file %s\n", path);
+        return NULL;
+    }
 
-    instance_name = strdup(unit_file);
-    dot_ptr = strchr(instance_name, '.');
-    *dot_ptr = '\0';
+    // Unit files don't contain NUL, read up to EOF at once
+    nread = getdelim(&content, &len, '\0', fp);
+    fclose(fp);
 
-    if((num_asics > 1) && (!is_multi_instance_service(instance_name))) {
-        replace_multi_inst_dep(file_path);
+    if (nread < 0) {
+        free(content);
+        content = strdup("");
+        nread = 0;
     }
-    free(instance_name);
 
-    num_target_lines = get_target_lines(file_path, target_lines);
-    if (num_target_lines < 0) {
-        fprintf(stderr, "Error parsing targets for %s\n", unit_file);
+    *size = nread;
+    return content;
+}
+
+
+static int write_unit_file(const char* path, const char* content, size_t size) {
+    /***
+    Replaces a unit file with the rewritten content
+    ***/
+    FILE *fp;
+    char tmp_file_path[PATH_MAX];
+    size_t written;
+
+    if (snprintf(tmp_file_path, PATH_MAX, "%s.tmp", path) >= PATH_MAX) {
+        fprintf(stderr, "Path too long: %s.tmp\n", path);
+        return -1;
+    }
+    fp = fopen(tmp_file_path, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Failed to open file %s\n", tmp_file_path);
         return -1;
     }
 
-    num_targets = 0;
+    written = fwrite(content, 1, size, fp);
+    if ((fclose(fp) != 0) || (written != size)) {
+        fprintf(stderr, "Failed to write file %s\n", tmp_file_path);
+        remove(tmp_file_path);
+        return -1;
+    }
 
-    for (int i = 0; i < num_target_lines; i++) {
-        line = target_lines[i];
-        first = true;
+    /* rename the .service.tmp file as .service */
+    if (rename(tmp_file_path, path) != 0) {
+        fprintf(stderr, "Failed to replace file %s\n", path);
+        remove(tmp_file_path);
+        return -1;
+    }
+    return 0;
+}
 
-        while ((token = strtok_r(line, "=", &line))) {
-            if (first) {
-                first = false;
 
-                if (strstr(token, "RequiredBy") != NULL) {
-                    target_suffix = ".requires";
-                }
-                else if (strstr(token, "WantedBy") != NULL) {
-                    target_suffix = ".wants";
-                }
-            }
-            else {
-                found_targets = get_install_targets_from_line(token, target_suffix, targets, num_targets);
-                num_targets += found_targets;
-            }
+static int parse_unit_file(unit_model_t* model, unit_file_t* unit) {
+    /***
+    Parses a unit file into the model in a single pass
+
+    Collects the install targets of the unit, and on multi ASIC platforms
+    rewrites dependencies on multi instance services from the same pass
+    ***/
+    unit_parser_t parser = { model, unit, NULL, false, false, false };
+    char file_path[PATH_MAX];
+    char *content;
+    char *work;
+    char *line;
+    char *end;
+    char *out_buf = NULL;
+    size_t out_size = 0;
+    size_t size;
+    int r = 0;
+
+    if (snprintf(file_path, PATH_MAX, "%s%s", get_unit_file_prefix(),
+                 unit->install_name) >= PATH_MAX) {
+        fprintf(stderr, "Path too long: %s%s\n", get_unit_file_prefix(), unit->install_name);
+        return -1;
+    }
+
+    content = read_unit_file(file_path, &size);
+    if (content == NULL)
+        return -1;
+
+    work = strdup(content);
+    if (work == NULL) {
+        free(content);
+        return -1;
+    }
+
+    if ((model->num_asics > 1) &&
+        !is_multi_instance_service(model, unit->install_name, strcspn(unit->install_name, "@."))) {
+        parser.out = open_memstream(&out_buf, &out_size);
+        if (parser.out == NULL) {
+            fprintf(stderr, "Failed to rewrite file %s\n", file_path);
+            free(work);
+            free(content);
+            return -1;
         }
-        free(target_lines[i]);
     }
-    return num_targets;
+
+    for (line = work; *line != '\0'; line = end + 1) {
+        end = strchr(line, '\n');
+        if (end != NULL)
+            *end = '\0';
+
+        parse_unit_line(&parser, line);
+
+        if (end == NULL)
+            break;
+    }
+
+    if (parser.out != NULL) {
+        fclose(parser.out);
+        if (parser.failed)
+            r = -1;
+        else if ((out_size != size) || (memcmp(out_buf, content, size) != 0))
+            r = write_unit_file(file_path, out_buf, out_size);
+        free(out_buf);
+    }
+    else if (parser.failed) {
+        r = -1;
+    }
+
+    free(work);
+    free(content);
+    return r;
+}
+
+
+static unit_file_t* add_unit_file(unit_model_t* model, const char* name) {
+    /***
+    Adds a unit listed in generated_services.conf to the model
+
+    On single ASIC platforms template units are installed as plain units,
+    e.g. 'example@.service' is installed as 'example.service'
+    ***/
+    unit_file_t* unit;
+    const char* pos = strchr(name, '@');
+    int r;
+
+    if (grow_array(&model->units, &model->max_units, model->num_units, sizeof(unit_file_t*)) < 0)
+        return NULL;
+
+    unit = calloc(1, sizeof(unit_file_t));
+    if (unit == NULL)
+        return NULL;
+
+    unit->name = strdup(name);
+    unit->is_template = (pos != NULL);
+    if ((model->num_asics == 1) && unit->is_template) {
+        r = asprintf(&unit->install_name, "%.*s%s", (int)(pos - name), name, pos + 1);
+        if (r == -1)
+            unit->install_name = NULL;
+    }
+    else {
+        unit->install_name = strdup(name);
+    }
+
+    if ((unit->name == NULL) || (unit->install_name == NULL) ||
+        (name_table_insert(&model->unit_names, name, strlen(name), unit) < 0)) {
+        fprintf(stderr, "Error adding unit %s\n", name);
+        free(unit->name);
+        free(unit->install_name);
+        free(unit);
+        return NULL;
+    }
+
+    model->units[model->num_units++] = unit;
+    return unit;
 }
 
 
-int get_unit_files(char* unit_files[]) {
+static int load_unit_files(unit_model_t* model) {
     /***
     Reads a list of unit files to be installed from /etc/sonic/generated_services.conf
     ***/
@@ -337,39 +610,125 @@ int get_unit_files(char* unit_files[]) {
         exit(EXIT_FAILURE);
     }
 
-    int num_unit_files = 0;
-    num_multi_inst = 0;
-
-    multi_instance_services = calloc(MAX_NUM_UNITS, sizeof(char *));
-
     while ((read = getline(&line, &len, fp)) != -1) {
-        if (num_unit_files >= MAX_NUM_UNITS) {
-            fprintf(stderr, "Maximum number of units exceeded, ignoring extras\n");
-            break;
-        }
         strip_trailing_newline(line);
+        if (line[0] == '\0')
+            continue;
 
         /* Get the multi-instance services */
         pos = strchr(line, '@');
         if (pos != NULL) {
-            multi_instance_services[num_multi_inst] = calloc(strlen(line), sizeof(char));
-            strncpy(multi_instance_services[num_multi_inst], line, pos-line);
-            num_multi_inst++;
+            if (name_table_insert(&model->multi_inst, line, pos - line, NULL) < 0)
+                fprintf(stderr, "Error adding multi-instance service %s\n", line);
         }
 
         /* topology service to be started only for multiasic VS platform */
         if ((strcmp(line, "topology.service") == 0) &&
-                        (num_asics == 1)) {
+                        (model->num_asics == 1)) {
             continue;
         }
-        unit_files[num_unit_files] = strdup(line);
-        num_unit_files++;
+
+        /* Unit listed more than once is installed once */
+        if (name_table_find(&model->unit_names, line, strlen(line)) != NULL)
+            continue;
+
+        add_unit_file(model, line);
     }
 
     free(line);
 
     fclose(fp);
 
+    return model->num_units;
+}
+
+
+static void release_unit_targets(unit_file_t* unit) {
+    for (int i = 0; i < unit->num_targets; i++) {
+        free(unit->targets[i]);
+    }
+    free(unit->targets);
+    unit->targets = NULL;
+    unit->num_targets = 0;
+    unit->max_targets = 0;
+}
+
+
+static void release_unit_model(unit_model_t* model) {
+    unit_file_t* unit;
+
+    for (int i = 0; i < model->num_units; i++) {
+        unit = model->units[i];
+        release_unit_targets(unit);
+        free(unit->name);
+        free(unit->install_name);
+        free(unit);
+    }
+    free(model->units);
+
+    name_table_release(&model->unit_names);
+    name_table_release(&model->multi_inst);
+    name_table_release(&model->target_dirs);
+    memset(model, 0, sizeof(unit_model_t));
+}
+
+
+int get_install_targets(char* unit_file, char*** targets) {
+    /***
+    Returns install targets for a unit file
+
+    Parses the information in the [Install] section of a given
+    unit file to determine which directories to install the unit in.
+    The targets array is allocated, caller frees it and each target.
+    ***/
+    unit_model_t model = { 0 };
+    unit_file_t unit = { 0 };
+    int num_targets = -1;
+
+    model.num_asics = num_asics;
+    load_unit_files(&model);
+
+    unit.name = unit_file;
+    unit.install_name = unit_file;
+
+    if (parse_unit_file(&model, &unit) < 0) {
+        fprintf(stderr, "Error parsing targets for %s\n", unit_file);
+        release_unit_targets(&unit);
+    }
+    else {
+        *targets = unit.targets;
+        num_targets = unit.num_targets;
+    }
+
+    release_unit_model(&model);
+    return num_targets;
+}
+
+
+int get_unit_files(char*** unit_files) {
+    /***
+    Reads a list of unit files to be installed from /etc/sonic/generated_services.conf
+
+    The unit_files array is allocated, caller frees it and each unit file.
+    ***/
+    unit_model_t model = { 0 };
+    int num_unit_files;
+
+    model.num_asics = num_asics;
+    num_unit_files = load_unit_files(&model);
+
+    *unit_files = calloc(num_unit_files ? num_unit_files : 1, sizeof(char*));
+    if (*unit_files == NULL) {
+        release_unit_model(&model);
+        return -1;
+    }
+
+    for (int i = 0; i < num_unit_files; i++) {
+        (*unit_files)[i] = model.units[i]->name;
+        model.units[i]->name = NULL;
+    }
+
+    release_unit_model(&model);
     return num_unit_files;
 }
 
@@ -405,63 +764,89 @@ char* insert_instance_number(char* unit_file, int instance) {
 }
 
 
-static int create_symlink(char* unit, char* target, char* install_dir, int instance) {
+static int prepare_target_dir(unit_model_t* model, const char* target_dir) {
+    /***
+    Creates a target directory, or fixes an existing one
+
+    Each target directory is prepared once, though many units
+    are installed in it
+    ***/
     struct stat st;
-    char src_path[PATH_MAX];
-    char dest_path[PATH_MAX];
-    char final_install_dir[PATH_MAX];
-    char* unit_instance;
     int r;
 
-    strcpy(src_path, get_unit_file_prefix());
-    strcat(src_path, unit);
-
-    if (instance < 0) {
-        unit_instance = strdup(unit);
-    }
-    else {
-        unit_instance = insert_instance_number(unit, instance);
-    }
-
-    strcpy(final_install_dir, install_dir);
-    strcat(final_install_dir, target);
-    strcpy(dest_path, final_install_dir);
-    strcat(dest_path, "/");
-    strcat(dest_path, unit_instance);
-
-    free(unit_instance);
+    if (name_table_find(&model->target_dirs, target_dir, strlen(target_dir)) != NULL)
+        return 0;
 
-    if (stat(final_install_dir, &st) == -1) {
+    if (stat(target_dir, &st) == -1) {
         // If doesn't exist, create
-        r = mkdir(final_install_dir, 0755);
+        r = mkdir(target_dir, 0755);
         if (r == -1) {
-            fprintf(stderr, "Unable to create target directory %s\n", final_install_dir);
+            fprintf(stderr, "Unable to create target directory %s\n", target_dir);
             return -1;
         }
     }
     else if (S_ISREG(st.st_mode)) {
         // If is regular file, remove and create
-        r = remove(final_install_dir);
+        r = remove(target_dir);
         if (r == -1) {
-            fprintf(stderr, "Unable to remove file with same name as target directory %s\n", final_install_dir);
+            fprintf(stderr, "Unable to remove file with same name as target directory %s\n", target_dir);
             return -1;
         }
 
-        r = mkdir(final_install_dir, 0755);
+        r = mkdir(target_dir, 0755);
         if (r == -1) {
-            fprintf(stderr, "Unable to create target directory %s\n", final_install_dir);
+            fprintf(stderr, "Unable to create target directory %s\n", target_dir);
             return -1;
         }
     }
     else if (S_ISDIR(st.st_mode)) {
         // If directory, verify correct permissions
-        r = chmod(final_install_dir, 0755);
+        r = chmod(target_dir, 0755);
         if (r == -1) {
-            fprintf(stderr, "Unable to change permissions of existing target directory %s\n", final_install_dir);
+            fprintf(stderr, "Unable to change permissions of existing target directory %s\n", target_dir);
             return -1;
         }
     }
 
+    name_table_insert(&model->target_dirs, target_dir, strlen(target_dir), NULL);
+    return 0;
+}
+
+
+static int create_symlink(unit_model_t* model, char* unit, char* target, char* install_dir, int instance) {
+    char src_path[PATH_MAX];
+    char dest_path[PATH_MAX];
+    char final_install_dir[PATH_MAX];
+    char* unit_instance;
+    int r;
+
+    if (snprintf(src_path, PATH_MAX, "%s%s", get_unit_file_prefix(), unit) >= PATH_MAX) {
+        fprintf(stderr, "Path too long: %s%s\n", get_unit_file_prefix(), unit);
+        return -1;
+    }
+
+    if (instance < 0) {
+        unit_instance = strdup(unit);
+    }
+    else {
+        unit_instance = insert_instance_number(unit, instance);
+    }
+
+    if (unit_instance == NULL)
+        return -1;
+
+    if ((snprintf(final_install_dir, PATH_MAX, "%s%s", install_dir, target) >= PATH_MAX) ||
+        (snprintf(dest_path, PATH_MAX, "%s/%s", final_install_dir, unit_instance) >= PATH_MAX)) {
+        fprintf(stderr, "Path too long: %s%s/%s\n", install_dir, target, unit_instance);
+        free(unit_instance);
+        return -1;
+    }
+
+    free(unit_instance);
+
+    if (prepare_target_dir(model, final_install_dir) < 0)
+        return -1;
+
     r = symlink(src_path, dest_path);
 
     if (r < 0) {
@@ -476,7 +861,7 @@ static int create_symlink(char* unit, char* target, char* install_dir, int insta
 }
 
 
-static int install_unit_file(char* unit_file, char* target, char* install_dir) {
+static int install_unit_file(unit_model_t* model, unit_file_t* unit, char* target, char* install_dir) {
     /***
     Creates a symlink for a unit file installation
 
@@ -487,18 +872,17 @@ static int install_unit_file(char* unit_file, char* target, char* install_dir) {
     If a multi ASIC platform is detected, enables multi-instance
     services as well
     ***/
+    char* unit_file = unit->install_name;
     char* target_instance;
-    char* prefix;
-    char* suffix;
     int r;
 
     assert(unit_file);
     assert(target);
 
 
-    if ((num_asics > 1) && strstr(unit_file, "@") != NULL) {
+    if ((model->num_asics > 1) && unit->is_template) {
 
-        for (int i = 0; i < num_asics; i++) {
+        for (int i = 0; i < model->num_asics; i++) {
 
             if (strstr(target, "@") != NULL) {
                 target_instance = insert_instance_number(target, i);
@@ -507,7 +891,10 @@ static int install_unit_file(char* unit_file, char* target, char* install_dir) {
                 target_instance = strdup(target);
             }
 
-            r = create_symlink(unit_file, target_instance, install_dir, i);
+            if (target_instance == NULL)
+                continue;
+
+            r = create_symlink(model, unit_file, target_instance, install_dir, i);
             if (r < 0)
                 fprintf(stderr, "Error installing %s for target %s\n", unit_file, target_instance);
 
@@ -516,7 +903,7 @@ static int install_unit_file(char* unit_file, char* target, char* install_dir) {
         }
     }
     else {
-        r = create_symlink(unit_file, target, install_dir, -1);
+        r = create_symlink(model, unit_file, target, install_dir, -1);
         if (r < 0)
             fprintf(stderr, "Error installing %s for target %s\n", unit_file, target);
     }
@@ -583,16 +970,9 @@ int get_num_of_asic() {
 }
 
 int ssg_main(int argc, char **argv) {
-    char* unit_files[MAX_NUM_UNITS];
+    unit_model_t model = { 0 };
+    unit_file_t* unit;
     char install_dir[PATH_MAX];
-    char* targets[MAX_NUM_TARGETS];
-    char* unit_instance;
-    char* prefix;
-    char* suffix;
-    char* saveptr;
-    int num_unit_files;
-    int num_targets;
-    int r;
 
     if (argc <= 1) {
         fputs("Installation directory required as argument\n", stderr);
@@ -600,47 +980,33 @@ int ssg_main(int argc, char **argv) {
     }
 
     num_asics = get_num_of_asic();
-    strcpy(install_dir, argv[1]);
-    strcat(install_dir, "/");
-    num_unit_files = get_unit_files(unit_files);
-
-    // For each unit file, get the installation targets and install the unit
-    for (int i = 0; i < num_unit_files; i++) {
-        unit_instance = strdup(unit_files[i]);
-        if ((num_asics == 1) && strstr(unit_instance, "@") != NULL) {
-            prefix = strdup(strtok_r(unit_instance, "@", &saveptr));
-            suffix = strdup(strtok_r(NULL, "@", &saveptr));
-
-            strcpy(unit_instance, prefix);
-            strcat(unit_instance, suffix);
+    if (snprintf(install_dir, PATH_MAX, "%s/", argv[1]) >= PATH_MAX) {
+        fprintf(stderr, "Installation directory too long: %s\n", argv[1]);
+        return 1;
+    }
 
-            free(prefix);
-            free(suffix);
-        }
+    model.num_asics = num_asics;
+    load_unit_files(&model);
 
-        num_targets = get_install_targets(unit_instance, targets);
-        if (num_targets < 0) {
-            fprintf(stderr, "Error parsing %s\n", unit_instance);
-            free(unit_instance);
-            free(unit_files[i]);
-            continue;
+    // Parse each unit file once, collecting its installation targets
+    for (int i = 0; i < model.num_units; i++) {
+        unit = model.units[i];
+        if (parse_unit_file(&model, unit) < 0) {
+            fprintf(stderr, "Error parsing %s\n", unit->install_name);
+            release_unit_targets(unit);
         }
+    }
 
-        for (int j = 0; j < num_targets; j++) {
-            if (install_unit_file(unit_instance, targets[j], install_dir) != 0)
-                fprintf(stderr, "Error installing %s to target directory %s\n", unit_instance, targets[j]);
-
-            free(targets[j]);
+    // Install every unit, and every instance of template units, from the model
+    for (int i = 0; i < model.num_units; i++) {
+        unit = model.units[i];
+        for (int j = 0; j < unit->num_targets; j++) {
+            if (install_unit_file(&model, unit, unit->targets[j], install_dir) != 0)
+                fprintf(stderr, "Error installing %s to target directory %s\n", unit->install_name, unit->targets[j]);
         }
-
-        free(unit_instance);
-        free(unit_files[i]);
     }
 
-    for (int i = 0; i < num_multi_inst; i++) {
-        free(multi_instance_services[i]);
-    }
-    free(multi_instance_services);
+    release_unit_model(&model);
 
     return 0;
 }
@@ -28,8 +28,8 @@ extern const char* get_asic_conf_format();
 extern char* insert_instance_number(char* unit_file, int instance);
 extern int ssg_main(int argc, char** argv);
 extern int get_num_of_asic();
-extern int get_install_targets(char* unit_file, char* targets[]);
-extern int get_unit_files(char* unit_files[]);
+extern int get_install_targets(char* unit_file, char*** targets);
+extern int get_unit_files(char*** unit_files);
 #ifdef __cplusplus
 }
 #endif
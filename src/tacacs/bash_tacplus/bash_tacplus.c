@@ -0,0 +1,2048 @@
+/* MAP_NORESERVE and MADV_REMOVE for authorization cache memory */
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pwd.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <syslog.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Remote user gecos prefix, which been assigned by nss_tacplus */
+#define REMOTE_USER_GECOS_PREFIX      "remote_user"
+
+/* Default value for _SC_GETPW_R_SIZE_MAX */
+#define DEFAULT_SC_GETPW_R_SIZE_MAX     1024
+
+/* Plugin state, Tacacs+ lib */
+#include "bash_tacplus.h"
+
+/* Tacacs+ support lib */
+#include <libtac/support.h>
+
+/* Output syslog to mock method when build with UT */
+#if defined (BASH_PLUGIN_UT)
+#define syslog mock_syslog
+#endif
+
+/* Tacacs+ log format */
+#define  TACACS_LOG_FORMAT "TACACS+: %s"
+
+/* Tacacs+ config file timestamp string format */
+#define  CONFIG_FILE_TIME_STAMP_FORMAT "%d.%m.%Y %H:%M:%S"
+
+/* Tacacs+ config file timestamp string length */
+#define  CONFIG_FILE_TIME_STAMP_LEN  100
+
+/* Tacacs+ config file splitter, same as libtacsupport */
+#define  CONFIG_FILE_SPLITTER " ,\t\n\r\f"
+
+/* Plugin config item: keep authorization connection open and reuse it across commands */
+#define  CONFIG_SINGLE_CONNECTION          "single_connection"
+
+/* Plugin config item: idle seconds before a kept connection will be re-established */
+#define  CONFIG_SINGLE_CONNECTION_IDLE     "single_connection_idle="
+
+/* Default idle seconds of kept connection, TACACS+ servers usually drop idle connection after several minutes */
+#define  DEFAULT_SINGLE_CONNECTION_IDLE    60
+
+/* Plugin config item: how to connect to multiple servers, sequential, parallel or hedged */
+#define  CONFIG_AUTHORIZATION_MODE         "authorization_mode="
+
+/* Plugin config item: milliseconds before hedged mode connect to next server */
+#define  CONFIG_HEDGE_DELAY                "hedge_delay="
+
+/* Default milliseconds before hedged mode connect to next server */
+#define  DEFAULT_HEDGE_DELAY               200
+
+/* Connect timeout in milliseconds when tac_timeout not set, same as libtac default */
+#define  DEFAULT_CONNECT_TIMEOUT           5000
+
+/* Exponential backoff seconds for server failed to connect */
+#define  SERVER_BACKOFF_BASE               1
+#define  SERVER_BACKOFF_MAX                64
+
+/* Plugin config item: cache authorization decision locally */
+#define  CONFIG_AUTHORIZATION_CACHE        "authorization_cache"
+
+/* Plugin config item: seconds of cached authorization decision valid */
+#define  CONFIG_AUTHORIZATION_CACHE_TTL    "authorization_cache_ttl="
+
+/* Plugin config item: max cached authorization decision count */
+#define  CONFIG_AUTHORIZATION_CACHE_SIZE   "authorization_cache_size="
+
+/* Default authorization cache setting */
+#define  DEFAULT_AUTHORIZATION_CACHE_TTL   60
+#define  DEFAULT_AUTHORIZATION_CACHE_SIZE  128
+
+/* Max argument length in cache key, same as cmd-arg length limit in send_authorization_message */
+#define  AUTHORIZATION_CACHE_ARG_LEN       247
+
+/* Authorization cache memory size, pages only taken by used entries */
+#define  AUTHORIZATION_CACHE_MEMORY_SIZE   (AUTHORIZATION_CACHE_MAX_SIZE * sizeof(authorization_cache_entry_t))
+
+/* Max kept connections in connection mailbox */
+#define  MAX_KEPT_CONNECTIONS              TAC_PLUS_MAXSERVERS
+
+/* inotify event buffer size */
+#define  CONFIG_WATCH_BUFFER_SIZE          4096
+
+/* Server state in concurrent authorization */
+#define  SERVER_NOT_STARTED                0
+#define  SERVER_CONNECTING                 1
+#define  SERVER_CONNECTED                  2
+#define  SERVER_WAITING_REPLY              3
+#define  SERVER_FINISHED                   4
+
+/*
+    Convert log to a string because va args resoursive issue:
+    http://www.c-faq.com/varargs/handoff.html
+*/
+#define GENERATE_LOG_FROM_VA(logBufferName)                 \
+    char logBufferName[512];                                \
+    va_list args;                                           \
+    va_start(args, format);                                 \
+    vsnprintf(logBufferName, sizeof(logBufferName), format, args);  \
+    va_end(args);
+
+/* Config file path */
+const char *tacacs_config_file = "/etc/tacplus_nss.conf";
+
+/* Unknown user name */
+const char *unknown_username = "UNKNOWN";
+
+
+/* Config file attribute */
+struct stat config_file_attr;
+
+/* Tacacs server config data */
+typedef struct {
+    struct addrinfo *address;
+    const char *key;
+} tacacs_server_t;
+
+/* Tacacs control flag */
+int tacacs_ctrl;
+
+/* Per-shell plugin state, replaced with shared memory by init_plugin_state */
+plugin_state_t local_plugin_state = { .lock = PTHREAD_MUTEX_INITIALIZER };
+plugin_state_t *plugin_state = &local_plugin_state;
+
+/* Config generation loaded by current process */
+unsigned int loaded_config_generation = 0;
+
+/* inotify fd watching config file directory, -1 when not watching */
+int config_watch_fd = -1;
+
+/* Kept connection info, sent to connection mailbox with connection fd */
+typedef struct {
+    int server_idx;
+    unsigned int config_generation;
+    time_t last_used;
+} kept_connection_t;
+
+/*
+ * Server in concurrent authorization, deadline is connect or reply timeout in monotonic milliseconds.
+ * libtac keep session id of last sent request in global session_id, reply with other session id rejected,
+ * so session id saved after request sent and restored before reply read.
+ */
+typedef struct {
+    int state;
+    int fd;
+    int reused;
+    long deadline;
+    int session_id;
+} concurrent_server_t;
+
+/*
+ * Connection mailbox, socket pair created by shell.
+ * Command process fork from shell take kept connection from mailbox, and put it back after use.
+ */
+int connection_mailbox[2] = { -1, -1 };
+
+/* Single connection mode setting */
+int single_connection_enabled = 0;
+int single_connection_idle = DEFAULT_SINGLE_CONNECTION_IDLE;
+
+/* Multiple servers authorization setting */
+int authorization_mode = AUTHORIZATION_MODE_SEQUENTIAL;
+int hedge_delay = DEFAULT_HEDGE_DELAY;
+
+/* Authorization cache setting */
+int authorization_cache_enabled = 0;
+int authorization_cache_ttl = DEFAULT_AUTHORIZATION_CACHE_TTL;
+int authorization_cache_size = DEFAULT_AUTHORIZATION_CACHE_SIZE;
+
+/* Authorization cache entries, shared with commands forked by shell, NULL when not created */
+authorization_cache_entry_t *authorization_cache = NULL;
+
+/* Addresses restored from shared config, libtac globals point to them after restore */
+struct addrinfo restored_server_addr[TAC_PLUS_MAXSERVERS];
+struct sockaddr_storage restored_server_sock_addr[TAC_PLUS_MAXSERVERS];
+struct addrinfo restored_source_addr;
+struct sockaddr_storage restored_source_sock_addr;
+char restored_vrf_name[TACACS_CONFIG_NAME_LEN];
+
+/*
+ * Output error message.
+ */
+void output_error(const char *format, ...)
+{
+    GENERATE_LOG_FROM_VA(logBuffer);
+
+    if (tacacs_ctrl & PAM_TAC_DEBUG) {
+        fprintf(stderr, TACACS_LOG_FORMAT, logBuffer);
+    }
+
+    syslog(LOG_ERR, TACACS_LOG_FORMAT, logBuffer);
+}
+
+/*
+ * Output debug message.
+ */
+void output_debug(const char *format, ...)
+{
+    if ((tacacs_ctrl & PAM_TAC_DEBUG) == 0) {
+        return;
+    }
+
+    GENERATE_LOG_FROM_VA(logBuffer);
+    fprintf(stderr, TACACS_LOG_FORMAT, logBuffer);
+    syslog(LOG_DEBUG, TACACS_LOG_FORMAT, logBuffer);
+}
+
+
+/*
+ * Lock plugin state, recover state when a command killed while holding the lock.
+ */
+void lock_plugin_state()
+{
+    if (pthread_mutex_lock(&plugin_state->lock) == EOWNERDEAD) {
+        pthread_mutex_consistent(&plugin_state->lock);
+    }
+}
+
+/*
+ * Unlock plugin state.
+ */
+void unlock_plugin_state()
+{
+    pthread_mutex_unlock(&plugin_state->lock);
+}
+
+/*
+ * Move plugin state to memory shared with commands forked by shell.
+ * Plugin still works with process local state when failed.
+ */
+void init_plugin_state()
+{
+    plugin_state_t *shared_state = mmap(NULL, sizeof(plugin_state_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared_state == MAP_FAILED) {
+        output_error("failed to allocate shared plugin state: %s\n", strerror(errno));
+        return;
+    }
+
+    pthread_mutexattr_t lock_attr;
+    pthread_mutexattr_init(&lock_attr);
+    pthread_mutexattr_setpshared(&lock_attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&lock_attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&shared_state->lock, &lock_attr);
+    pthread_mutexattr_destroy(&lock_attr);
+
+    plugin_state = shared_state;
+
+    // kept connections should not leak to commands executed by shell.
+    if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, connection_mailbox) < 0) {
+        output_error("failed to create connection mailbox: %s\n", strerror(errno));
+        connection_mailbox[0] = connection_mailbox[1] = -1;
+    }
+
+    // cache memory has no fd, so other processes can't forge decisions through /proc/<pid>/fd.
+    // pages only allocated when entries written, shell never touch them.
+    void *cache = mmap(NULL, AUTHORIZATION_CACHE_MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (cache == MAP_FAILED) {
+        output_error("failed to create authorization cache: %s\n", strerror(errno));
+        return;
+    }
+
+    authorization_cache = cache;
+}
+
+/*
+ * Release plugin state.
+ */
+void release_plugin_state()
+{
+    if (connection_mailbox[0] >= 0) {
+        close(connection_mailbox[0]);
+        close(connection_mailbox[1]);
+        connection_mailbox[0] = connection_mailbox[1] = -1;
+    }
+
+    if (authorization_cache != NULL) {
+        munmap(authorization_cache, AUTHORIZATION_CACHE_MEMORY_SIZE);
+        authorization_cache = NULL;
+    }
+
+    if (plugin_state != &local_plugin_state) {
+        munmap(plugin_state, sizeof(plugin_state_t));
+        plugin_state = &local_plugin_state;
+    }
+}
+
+/*
+ * Put connection to mailbox, connection closed in current process after put.
+ */
+int put_kept_tacacs_connection(const kept_connection_t *connection, int server_fd)
+{
+    if (connection_mailbox[1] < 0) {
+        return -1;
+    }
+
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct iovec message_data = { (void *)connection, sizeof(kept_connection_t) };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &message_data;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    struct cmsghdr *control_message = CMSG_FIRSTHDR(&message);
+    control_message->cmsg_level = SOL_SOCKET;
+    control_message->cmsg_type = SCM_RIGHTS;
+    control_message->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(control_message), &server_fd, sizeof(int));
+
+    if (sendmsg(connection_mailbox[1], &message, MSG_DONTWAIT) < 0) {
+        output_debug("failed to keep connection to server %d: %s\n", connection->server_idx, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Take a connection from mailbox, return fd or -1 when mailbox empty.
+ */
+int take_kept_tacacs_connection(kept_connection_t *connection)
+{
+    if (connection_mailbox[0] < 0) {
+        return -1;
+    }
+
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec message_data = { connection, sizeof(kept_connection_t) };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &message_data;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t received = recvmsg(connection_mailbox[0], &message, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    struct cmsghdr *control_message = received > 0 ? CMSG_FIRSTHDR(&message) : NULL;
+    if (control_message == NULL
+            || control_message->cmsg_level != SOL_SOCKET
+            || control_message->cmsg_type != SCM_RIGHTS) {
+        return -1;
+    }
+
+    int server_fd;
+    memcpy(&server_fd, CMSG_DATA(control_message), sizeof(int));
+    if (received != sizeof(kept_connection_t)) {
+        close(server_fd);
+        return -1;
+    }
+
+    return server_fd;
+}
+
+/*
+ * Close all kept connections, server list may change after config reload.
+ */
+void close_all_tacacs_connections()
+{
+    kept_connection_t connection;
+    int server_fd;
+    while ((server_fd = take_kept_tacacs_connection(&connection)) >= 0) {
+        output_debug("close connection to server %d\n", connection.server_idx);
+        close(server_fd);
+    }
+}
+
+/*
+ * Check if kept connection still usable.
+ * An idle TACACS+ connection never has pending data, so readable or hangup means server closed it.
+ */
+int is_tacacs_connection_alive(int fd)
+{
+    struct pollfd connection_poll;
+    connection_poll.fd = fd;
+    connection_poll.events = POLLIN;
+    connection_poll.revents = 0;
+
+    int result = poll(&connection_poll, 1, 0);
+    if (result < 0) {
+        output_debug("poll kept connection failed: %s\n", strerror(errno));
+        return 0;
+    }
+
+    return (connection_poll.revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL)) == 0;
+}
+
+/*
+ * Set libtac secret for server.
+ * libtac keep secret of last connected server in global variable, restore it when connection not created by tac_connect_single.
+ */
+void select_tacacs_server_secret(int server_idx)
+{
+    tac_secret = tac_srv[server_idx].key;
+    tac_encryption = (tac_secret != NULL && *tac_secret) ? 1 : 0;
+}
+
+/*
+ * Get kept connection to tacacs server when it's still healthy, reused will be set when found.
+ * Connections to other servers put back to mailbox, expired connections closed.
+ */
+int get_kept_tacacs_connection(int server_idx, int *reused)
+{
+    kept_connection_t other_connections[MAX_KEPT_CONNECTIONS];
+    int other_fds[MAX_KEPT_CONNECTIONS];
+    int other_count = 0, taken, server_fd = -1;
+    time_t now = time(NULL);
+    *reused = 0;
+
+    if (!single_connection_enabled) {
+        return -1;
+    }
+
+    for (taken = 0; taken < MAX_KEPT_CONNECTIONS && server_fd < 0; taken++) {
+        kept_connection_t connection;
+        int fd = take_kept_tacacs_connection(&connection);
+        if (fd < 0) {
+            break;
+        }
+
+        if (connection.config_generation != loaded_config_generation
+                || now - connection.last_used > single_connection_idle
+                || !is_tacacs_connection_alive(fd)) {
+            output_debug("kept connection to server %d expired or closed by server\n", connection.server_idx);
+            close(fd);
+        }
+        else if (connection.server_idx != server_idx) {
+            other_connections[other_count] = connection;
+            other_fds[other_count++] = fd;
+        }
+        else {
+            server_fd = fd;
+        }
+    }
+
+    while (other_count-- > 0) {
+        put_kept_tacacs_connection(&other_connections[other_count], other_fds[other_count]);
+        close(other_fds[other_count]);
+    }
+
+    if (server_fd >= 0) {
+        select_tacacs_server_secret(server_idx);
+        *reused = 1;
+    }
+
+    return server_fd;
+}
+
+/*
+ * Get connection to tacacs server.
+ * In single connection mode, return kept connection when it's still healthy, otherwise create new connection.
+ */
+int get_tacacs_connection(int server_idx, int *reused)
+{
+    int server_fd = get_kept_tacacs_connection(server_idx, reused);
+    if (*reused) {
+        return server_fd;
+    }
+
+    return tac_connect_single(tac_srv[server_idx].addr, tac_srv[server_idx].key, tac_source_addr, tac_timeout, __vrfname);
+}
+
+/*
+ * Release connection to tacacs server.
+ * Connection will be kept when last request successed and server accepted single connection, otherwise closed.
+ */
+void release_tacacs_connection(int server_idx, int server_fd, int keep_connection)
+{
+    if (keep_connection) {
+        kept_connection_t connection;
+        connection.server_idx = server_idx;
+        connection.config_generation = loaded_config_generation;
+        connection.last_used = time(NULL);
+        put_kept_tacacs_connection(&connection, server_fd);
+    }
+
+    close(server_fd);
+}
+
+
+/*
+ * Check if server failed recently and still in backoff.
+ * Server health updated without lock, a stale read only cause one more or less connect attempt.
+ */
+int is_tacacs_server_in_backoff(int server_idx)
+{
+    tacacs_server_health_t *health = &plugin_state->server_health[server_idx];
+    return health->failures > 0 && time(NULL) < health->retry_after;
+}
+
+/*
+ * Mark server dead, retry time grows exponentially with continuous failures.
+ */
+void mark_tacacs_server_dead(int server_idx)
+{
+    tacacs_server_health_t *health = &plugin_state->server_health[server_idx];
+    int backoff = SERVER_BACKOFF_MAX;
+    if (health->failures < 16 && (SERVER_BACKOFF_BASE << health->failures) < SERVER_BACKOFF_MAX) {
+        backoff = SERVER_BACKOFF_BASE << health->failures;
+    }
+
+    health->failures++;
+    health->retry_after = time(NULL) + backoff;
+    output_debug("server %d marked dead, retry after %d seconds\n", server_idx, backoff);
+}
+
+/*
+ * Mark server alive.
+ */
+void mark_tacacs_server_alive(int server_idx)
+{
+    plugin_state->server_health[server_idx].failures = 0;
+    plugin_state->server_health[server_idx].retry_after = 0;
+}
+
+/*
+ * Reset all server health, server list may change after config reload.
+ */
+void reset_tacacs_server_health()
+{
+    memset(plugin_state->server_health, 0, sizeof(plugin_state->server_health));
+}
+
+/*
+ * Get servers should be used for authorization, servers in backoff will be skipped unless all servers in backoff.
+ */
+int get_tacacs_server_order(int *server_order)
+{
+    int server_idx, server_count = 0;
+    for (server_idx = 0; server_idx < tac_srv_no; server_idx++) {
+        if (is_tacacs_server_in_backoff(server_idx)) {
+            output_debug("skip server %d because it's in backoff\n", server_idx);
+            continue;
+        }
+
+        server_order[server_count++] = server_idx;
+    }
+
+    if (server_count == 0) {
+        // all servers dead, still try all of them.
+        for (server_idx = 0; server_idx < tac_srv_no; server_idx++) {
+            server_order[server_count++] = server_idx;
+        }
+    }
+
+    return server_count;
+}
+
+/*
+ * Get monotonic time in milliseconds.
+ */
+long get_monotonic_time_ms()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/*
+ * Start non-blocking connection to tacacs server, with same socket setting as tac_connect_single.
+ * Return fd, connected will be set when connection established immediately.
+ */
+int start_tacacs_connection(int server_idx, int *connected)
+{
+    const struct addrinfo *server = tac_srv[server_idx].addr;
+    *connected = 0;
+
+    int server_fd = socket(server->ai_family, server->ai_socktype, server->ai_protocol);
+    if (server_fd < 0) {
+        return -1;
+    }
+
+    if (__vrfname != NULL
+            && setsockopt(server_fd, SOL_SOCKET, SO_BINDTODEVICE, __vrfname, strlen(__vrfname) + 1) < 0) {
+        // do not fail if the bind fails, connection may still succeed, same as libtac.
+        output_debug("binding socket to device %s failed: %s\n", __vrfname, strerror(errno));
+    }
+
+    if (tac_source_addr != NULL
+            && bind(server_fd, tac_source_addr->ai_addr, tac_source_addr->ai_addrlen) < 0) {
+        output_error("failed to bind source address: %s\n", strerror(errno));
+        close(server_fd);
+        return -1;
+    }
+
+    int flags = fcntl(server_fd, F_GETFL, 0);
+    fcntl(server_fd, F_SETFL, flags | O_NONBLOCK);
+    if (connect(server_fd, server->ai_addr, server->ai_addrlen) == 0) {
+        *connected = 1;
+    }
+    else if (errno != EINPROGRESS) {
+        int connect_errno = errno;
+        close(server_fd);
+        errno = connect_errno;
+        return -1;
+    }
+
+    return server_fd;
+}
+
+/*
+ * Finish non-blocking connection, restore socket to blocking mode which libtac expected.
+ */
+int finish_tacacs_connection(int server_idx, int server_fd)
+{
+    int connect_errno = 0;
+    socklen_t errno_len = sizeof(connect_errno);
+    if (getsockopt(server_fd, SOL_SOCKET, SO_ERROR, &connect_errno, &errno_len) < 0) {
+        return -1;
+    }
+
+    if (connect_errno != 0) {
+        errno = connect_errno;
+        return -1;
+    }
+
+    int flags = fcntl(server_fd, F_GETFL, 0);
+    fcntl(server_fd, F_SETFL, flags & ~O_NONBLOCK);
+    select_tacacs_server_secret(server_idx);
+    return 0;
+}
+
+/*
+ * Write whole buffer to server.
+ */
+int write_to_tacacs_server(int tac_fd, const char *buffer, size_t length)
+{
+    while (length > 0) {
+        ssize_t written = send(tac_fd, buffer, length, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (written <= 0) {
+            return -1;
+        }
+
+        buffer += written;
+        length -= written;
+    }
+
+    return 0;
+}
+
+/*
+ * Send authorization packet built by libtac with TAC_PLUS_SINGLE_CONNECT_FLAG set.
+ * libtac build packet header internally, so packet is built into a relay socket, and flag set when forward to server.
+ * Header flags not covered by MD5 pad, encrypted body still valid after flag set.
+ */
+int send_single_connection_packet(int tac_fd, const char *user, const char *tty, const char *host, struct tac_attrib *attr)
+{
+    int relay[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, relay) < 0) {
+        return -1;
+    }
+
+    // whole packet buffered in relay socket, close write side so read stop at end of packet.
+    int result = tac_author_send(relay[1], (char *)user, (char *)tty, (char *)host, attr);
+    close(relay[1]);
+
+    char buffer[4096];
+    size_t forwarded = 0;
+    ssize_t length;
+    while (result >= 0 && (length = read(relay[0], buffer, sizeof(buffer))) > 0) {
+        if (forwarded <= offsetof(HDR, flags) && forwarded + length > offsetof(HDR, flags)) {
+            buffer[offsetof(HDR, flags) - forwarded] |= TAC_PLUS_SINGLE_CONNECT_FLAG;
+        }
+
+        result = write_to_tacacs_server(tac_fd, buffer, length);
+        forwarded += length;
+    }
+
+    close(relay[0]);
+    return forwarded < TAC_PLUS_HDR_SIZE ? -1 : result;
+}
+
+/*
+ * Check if server accept single connection, server set TAC_PLUS_SINGLE_CONNECT_FLAG in reply header when accept.
+ * Reply header peeked, libtac still read the whole reply.
+ */
+int is_single_connection_accepted(int tac_fd)
+{
+    struct pollfd reply_poll;
+    reply_poll.fd = tac_fd;
+    reply_poll.events = POLLIN;
+    reply_poll.revents = 0;
+
+    HDR header;
+    int timeout = tac_timeout > 0 ? tac_timeout * 1000 : DEFAULT_CONNECT_TIMEOUT;
+    if (poll(&reply_poll, 1, timeout) <= 0
+            || recv(tac_fd, &header, TAC_PLUS_HDR_SIZE, MSG_PEEK | MSG_WAITALL) != TAC_PLUS_HDR_SIZE) {
+        return 0;
+    }
+
+    return (header.flags & TAC_PLUS_SINGLE_CONNECT_FLAG) != 0;
+}
+
+/*
+ * Send authorization request, request will ask for single connection in single connection mode.
+ * This method based on send_auth_msg in https://github.com/daveolson53/tacplus-auth/blob/master/tacplus-auth.c
+ */
+int send_authorization_request(
+    int tac_fd,
+    const char *user,
+    const char *tty,
+    const char *host,
+    uint16_t taskid,
+    const char *cmd,
+    char **args,
+    int argc)
+{
+    char buf[128];
+    struct tac_attrib *attr;
+    int retval;
+    int i;
+
+    attr=(struct tac_attrib *)xcalloc(1, sizeof(struct tac_attrib));
+
+    snprintf(buf, sizeof buf, "%hu", taskid);
+    tac_add_attrib(&attr, "task_id", buf);
+    tac_add_attrib(&attr, "protocol", "ssh");
+    tac_add_attrib(&attr, "service", "shell");
+
+    tac_add_attrib(&attr, "cmd", (char*)cmd);
+
+    for(i=1; i<argc; i++) {
+        // TACACS protocol allow max 255 bytes per argument. 'cmd-arg' will take 7 bytes.
+        char tbuf[248];
+        const char *arg;
+        if(strlen(args[i]) >= sizeof(tbuf)) {
+            snprintf(tbuf, sizeof tbuf, "%s", args[i]);
+            arg = tbuf;
+        }
+        else {
+            arg = args[i];
+        }
+
+        tac_add_attrib(&attr, "cmd-arg", (char *)arg);
+    }
+
+    output_debug("send authorizatiom message with user: %s, tty: %s, host: %s\n", user, tty, host);
+    if (single_connection_enabled) {
+        retval = send_single_connection_packet(tac_fd, user, tty, host, attr);
+    }
+    else {
+        retval = tac_author_send(tac_fd, (char *)user, (char *)tty, (char *)host, attr);
+    }
+
+    output_debug("authorization result: %d\n", retval);
+    if(retval < 0) {
+        output_error("send of authorization message failed: %s\n", strerror(errno));
+    }
+
+    tac_free_attrib(&attr);
+    return retval;
+}
+
+/*
+ * Read authorization response, keep_connection will be set when server accept single connection.
+ */
+int read_authorization_response(int tac_fd, int *keep_connection)
+{
+    int retval;
+    struct areply re;
+
+    *keep_connection = single_connection_enabled && is_single_connection_accepted(tac_fd);
+
+    re.msg = NULL;
+    retval = tac_author_read(tac_fd, &re);
+    if (retval < 0) {
+        output_debug("authorization response failed: %d\n", retval);
+    }
+    else if(re.status == AUTHOR_STATUS_PASS_ADD ||
+                re.status == AUTHOR_STATUS_PASS_REPL) {
+        retval = 0;
+    }
+    else  {
+        output_debug("command not authorized (%d)\n", re.status);
+        retval = 1;
+    }
+
+    if(re.msg != NULL) {
+        free(re.msg);
+    }
+
+    return retval;
+}
+
+/*
+ * Send authorization message and read response.
+ */
+int send_authorization_message(
+    int tac_fd,
+    const char *user,
+    const char *tty,
+    const char *host,
+    uint16_t taskid,
+    const char *cmd,
+    char **args,
+    int argc,
+    int *keep_connection)
+{
+    *keep_connection = 0;
+    int retval = send_authorization_request(tac_fd, user, tty, host, taskid, cmd, args, argc);
+    if (retval < 0) {
+        return retval;
+    }
+
+    return read_authorization_response(tac_fd, keep_connection);
+}
+
+/*
+ * Output authorization result from server.
+ */
+void output_authorization_result(int server_idx, const char *cmd, int result)
+{
+    if(result) {
+        // authorization failed
+        output_debug("%s not authorized from %s\n", cmd, tac_ntop(tac_srv[server_idx].addr->ai_addr));
+    }
+    else {
+        // authorization successed
+        output_debug("%s authorized from %s\n", cmd, tac_ntop(tac_srv[server_idx].addr->ai_addr));
+    }
+}
+
+/*
+ * Request authorization with connected server, connection will be released after request.
+ * Kept connection will be retried once with new connection when server closed it.
+ */
+int request_authorization_with_server(
+    int server_idx,
+    int server_fd,
+    int reused,
+    const char *user,
+    const char *tty,
+    const char *host,
+    const char *cmd,
+    char **args,
+    int argc)
+{
+    uint16_t task_id = (uint16_t)getpid();
+    int keep_connection;
+    int result = send_authorization_message(server_fd, user, tty, host, task_id, cmd, args, argc, &keep_connection);
+    if (result < 0 && reused) {
+        // server may close kept connection at any time, retry once with new connection.
+        output_debug("kept connection to %s failed, reconnecting\n", tac_ntop(tac_srv[server_idx].addr->ai_addr));
+        close(server_fd);
+        server_fd = get_tacacs_connection(server_idx, &reused);
+        if(server_fd < 0) {
+            output_error("Failed to connecting to %s to request authorization for %s: %s\n", tac_ntop(tac_srv[server_idx].addr->ai_addr), cmd, strerror(errno));
+            mark_tacacs_server_dead(server_idx);
+            return result;
+        }
+
+        result = send_authorization_message(server_fd, user, tty, host, task_id, cmd, args, argc, &keep_connection);
+    }
+
+    release_tacacs_connection(server_idx, server_fd, result >= 0 && keep_connection);
+    output_authorization_result(server_idx, cmd, result);
+    return result;
+}
+
+/*
+ * Send tacacs authorization request to servers one by one.
+ * This method based on send_tacacs_auth in https://github.com/daveolson53/tacplus-auth/blob/master/tacplus-auth.c
+ */
+int sequential_tacacs_authorization(
+    const char *user,
+    const char *tty,
+    const char *host,
+    const char *cmd,
+    char **args,
+    int argc,
+    int *connected_servers)
+{
+    int result = 1, order_idx, server_fd;
+    int server_order[TAC_PLUS_MAXSERVERS];
+    int server_count = get_tacacs_server_order(server_order);
+
+    for(order_idx = 0; order_idx < server_count; order_idx++) {
+        int reused, server_idx = server_order[order_idx];
+        server_fd = get_tacacs_connection(server_idx, &reused);
+        if(server_fd < 0) {
+            // connect to tacacs server failed
+            output_error("Failed to connecting to %s to request authorization for %s: %s\n", tac_ntop(tac_srv[server_idx].addr->ai_addr), cmd, strerror(errno));
+            mark_tacacs_server_dead(server_idx);
+            continue;
+        }
+
+        // increase connected servers
+        (*connected_servers)++;
+        mark_tacacs_server_alive(server_idx);
+        result = request_authorization_with_server(server_idx, server_fd, reused, user, tty, host, cmd, args, argc);
+        if (result == 0) {
+            break;
+        }
+    }
+
+    return result;
+}
+
+/*
+ * Start connection to server in concurrent authorization, kept connection used when allowed and still healthy.
+ * Return 0 when connection established or in progress, otherwise server marked dead.
+ */
+int start_concurrent_connection(int server_idx, concurrent_server_t *server, int allow_reuse, const char *cmd)
+{
+    int connected;
+    server->reused = 0;
+    server->fd = allow_reuse ? get_kept_tacacs_connection(server_idx, &server->reused) : -1;
+    if (server->reused) {
+        server->state = SERVER_CONNECTED;
+        return 0;
+    }
+
+    server->fd = start_tacacs_connection(server_idx, &connected);
+    if (server->fd < 0) {
+        output_error("Failed to connecting to %s to request authorization for %s: %s\n", tac_ntop(tac_srv[server_idx].addr->ai_addr), cmd, strerror(errno));
+        mark_tacacs_server_dead(server_idx);
+        server->state = SERVER_FINISHED;
+        return -1;
+    }
+
+    server->deadline = get_monotonic_time_ms() + (tac_timeout > 0 ? tac_timeout * 1000L : DEFAULT_CONNECT_TIMEOUT);
+    server->state = SERVER_CONNECTING;
+    if (connected) {
+        finish_tacacs_connection(server_idx, server->fd);
+        server->state = SERVER_CONNECTED;
+    }
+
+    return 0;
+}
+
+/*
+ * Close failed connection in concurrent authorization, kept connection retried once with new connection.
+ * Return 1 when retried.
+ */
+int retry_concurrent_connection(int server_idx, concurrent_server_t *server, const char *cmd)
+{
+    close(server->fd);
+    server->fd = -1;
+    server->state = SERVER_FINISHED;
+    if (!server->reused) {
+        return 0;
+    }
+
+    // server may close kept connection at any time, retry once with new connection.
+    output_debug("kept connection to %s failed, reconnecting\n", tac_ntop(tac_srv[server_idx].addr->ai_addr));
+    return start_concurrent_connection(server_idx, server, 0, cmd) == 0;
+}
+
+/*
+ * Send tacacs authorization request to servers concurrently.
+ * Connections to all servers start at once, or one by one with hedge delay.
+ * Request sent to every connected server, first permitted reply accepted.
+ * Server only marked dead when connect failed or timeout, server slower than hedge delay is not dead.
+ */
+int concurrent_tacacs_authorization(
+    const char *user,
+    const char *tty,
+    const char *host,
+    const char *cmd,
+    char **args,
+    int argc,
+    int *connected_servers,
+    int connect_delay)
+{
+    int result = -1, denied = 0, order_idx, server_idx, started = 0, retried;
+    int server_order[TAC_PLUS_MAXSERVERS];
+    concurrent_server_t servers[TAC_PLUS_MAXSERVERS];
+    int server_count = get_tacacs_server_order(server_order);
+    long start_time = get_monotonic_time_ms();
+    long request_timeout = tac_timeout > 0 ? tac_timeout * 1000L : DEFAULT_CONNECT_TIMEOUT;
+    uint16_t task_id = (uint16_t)getpid();
+
+    memset(servers, 0, sizeof(servers));
+    while (result != 0) {
+        long now = get_monotonic_time_ms();
+
+        // start next server when hedge delay passed, or no other server in progress.
+        int active = 0;
+        for (order_idx = 0; order_idx < started; order_idx++) {
+            server_idx = server_order[order_idx];
+            active += servers[server_idx].state != SERVER_FINISHED;
+        }
+
+        while (started < server_count
+                    && (active == 0 || now - start_time >= (long)started * connect_delay)) {
+            server_idx = server_order[started++];
+            if (start_concurrent_connection(server_idx, &servers[server_idx], 1, cmd) == 0) {
+                active++;
+            }
+        }
+
+        // send request to every connected server, and wait reply.
+        struct pollfd server_polls[TAC_PLUS_MAXSERVERS];
+        int poll_servers[TAC_PLUS_MAXSERVERS];
+        int poll_count = 0;
+        long poll_timeout = started < server_count ? start_time + (long)started * connect_delay - now : request_timeout;
+        retried = 0;
+        for (order_idx = 0; order_idx < started; order_idx++) {
+            server_idx = server_order[order_idx];
+            concurrent_server_t *server = &servers[server_idx];
+            if (server->state == SERVER_CONNECTED) {
+                (*connected_servers)++;
+                mark_tacacs_server_alive(server_idx);
+                select_tacacs_server_secret(server_idx);
+                if (send_authorization_request(server->fd, user, tty, host, task_id, cmd, args, argc) < 0) {
+                    // retried connection handled in next round.
+                    retried |= retry_concurrent_connection(server_idx, server, cmd);
+                    continue;
+                }
+
+                server->session_id = session_id;
+                server->deadline = get_monotonic_time_ms() + request_timeout;
+                server->state = SERVER_WAITING_REPLY;
+            }
+
+            if (server->state == SERVER_FINISHED) {
+                continue;
+            }
+
+            if (server->deadline <= now) {
+                // connect timeout is server failure, reply timeout is request failure same as libtac.
+                output_debug("%s to %s timeout\n", server->state == SERVER_CONNECTING ? "connect" : "request", tac_ntop(tac_srv[server_idx].addr->ai_addr));
+                if (server->state == SERVER_CONNECTING) {
+                    mark_tacacs_server_dead(server_idx);
+                }
+
+                close(server->fd);
+                server->state = SERVER_FINISHED;
+                continue;
+            }
+
+            if (server->deadline - now < poll_timeout) {
+                poll_timeout = server->deadline - now;
+            }
+
+            server_polls[poll_count].fd = server->fd;
+            server_polls[poll_count].events = server->state == SERVER_CONNECTING ? POLLOUT : POLLIN;
+            server_polls[poll_count].revents = 0;
+            poll_servers[poll_count++] = server_idx;
+        }
+
+        if (poll_count == 0) {
+            if (started == server_count && !retried) {
+                // all servers finished
+                break;
+            }
+
+            // start next server or handle retried connection without wait.
+            continue;
+        }
+
+        if (poll(server_polls, poll_count, poll_timeout < 0 ? 0 : (int)poll_timeout) < 0 && errno != EINTR) {
+            output_error("poll servers failed: %s\n", strerror(errno));
+            break;
+        }
+
+        int poll_idx;
+        for (poll_idx = 0; poll_idx < poll_count && result != 0; poll_idx++) {
+            server_idx = poll_servers[poll_idx];
+            concurrent_server_t *server = &servers[server_idx];
+            if (server_polls[poll_idx].revents == 0) {
+                continue;
+            }
+
+            if (server->state == SERVER_CONNECTING) {
+                if (finish_tacacs_connection(server_idx, server->fd) < 0) {
+                    output_error("Failed to connecting to %s to request authorization for %s: %s\n", tac_ntop(tac_srv[server_idx].addr->ai_addr), cmd, strerror(errno));
+                    mark_tacacs_server_dead(server_idx);
+                    close(server->fd);
+                    server->state = SERVER_FINISHED;
+                }
+                else {
+                    server->state = SERVER_CONNECTED;
+                }
+
+                continue;
+            }
+
+            // libtac use secret of last connected server and session of last sent request.
+            int keep_connection;
+            select_tacacs_server_secret(server_idx);
+            session_id = server->session_id;
+            int server_result = read_authorization_response(server->fd, &keep_connection);
+            if (server_result < 0 && retry_concurrent_connection(server_idx, server, cmd)) {
+                continue;
+            }
+
+            if (server_result >= 0) {
+                release_tacacs_connection(server_idx, server->fd, keep_connection);
+            }
+
+            // failed connection already closed, server not polled again.
+            server->state = SERVER_FINISHED;
+
+            output_authorization_result(server_idx, cmd, server_result);
+            if (server_result == 0) {
+                result = 0;
+            }
+            else if (server_result == 1) {
+                denied = 1;
+            }
+        }
+    }
+
+    // abandon servers still in progress, slower server is not dead.
+    for (server_idx = 0; server_idx < TAC_PLUS_MAXSERVERS; server_idx++) {
+        if (servers[server_idx].state != SERVER_NOT_STARTED && servers[server_idx].state != SERVER_FINISHED) {
+            close(servers[server_idx].fd);
+        }
+    }
+
+    if (result != 0 && denied) {
+        result = 1;
+    }
+
+    return result;
+}
+
+/*
+ * Send tacacs authorization request.
+ */
+int tacacs_authorization(
+    const char *user,
+    const char *tty,
+    const char *host,
+    const char *cmd,
+    char **args,
+    int argc)
+{
+    int result, connected_servers=0;
+    switch (authorization_mode) {
+        case AUTHORIZATION_MODE_PARALLEL:
+            result = concurrent_tacacs_authorization(user, tty, host, cmd, args, argc, &connected_servers, 0);
+        break;
+        case AUTHORIZATION_MODE_HEDGED:
+            result = concurrent_tacacs_authorization(user, tty, host, cmd, args, argc, &connected_servers, hedge_delay);
+        break;
+        default:
+            result = sequential_tacacs_authorization(user, tty, host, cmd, args, argc, &connected_servers);
+        break;
+    }
+
+    // can't connect to any server
+    if(!connected_servers) {
+        result = -2;
+        output_error("Failed to connect to TACACS server(s)\n");
+    }
+
+    return result;
+}
+
+/*
+ * Send authorization request.
+ * This method based on build_auth_req in https://github.com/daveolson53/tacplus-auth/blob/master/tacplus-auth.c
+ */
+int authorization_with_host_and_tty(const char *user, const char *cmd, char **argv, int argc)
+{
+    // try get host name
+    char hostname[64];
+    memset(&hostname, 0, sizeof(hostname));
+
+    (void)gethostname(hostname, sizeof(hostname) -1);
+    if (!hostname[0]) {
+        snprintf(hostname, sizeof(hostname), "UNK");
+        output_error("Failed to determine hostname, passing %s\n", hostname);
+    }
+
+    // try get tty name
+    char ttyname[64];
+    memset(&ttyname, 0, sizeof(ttyname));
+
+    int i;
+    for(i=0; i<3; i++) {
+        int result;
+        if (isatty(i)) {
+            result = ttyname_r(i, ttyname, sizeof(ttyname) -1);
+            if (result) {
+                output_error("Failed to get tty name for fd %d: %s\n", i, strerror(result));
+            }
+            break;
+        }
+    }
+
+    if (!ttyname[0]) {
+        snprintf(ttyname, sizeof(ttyname), "UNK");
+        output_error("Failed to determine tty, passing %s\n", ttyname);
+    }
+
+    // send tacacs authorization request
+    return tacacs_authorization(user, ttyname, hostname, cmd, argv, argc);
+}
+
+/*
+ * Build authorization cache key with user, command and arguments in key buffer.
+ * Arguments truncated same as send_authorization_message, because server only get truncated arguments.
+ * Return key length, or 0 when key too long to cache.
+ */
+size_t build_authorization_cache_key(const char *user, const char *cmd, char **argv, int argc, char *key)
+{
+    int i;
+    size_t length = strlen(user) + 1 + strlen(cmd) + 1;
+    for (i = 1; i < argc; i++) {
+        size_t arg_len = strlen(argv[i]);
+        length += (arg_len > AUTHORIZATION_CACHE_ARG_LEN ? AUTHORIZATION_CACHE_ARG_LEN : arg_len) + 1;
+    }
+
+    if (length > AUTHORIZATION_CACHE_KEY_LEN) {
+        return 0;
+    }
+
+    char *key_position = key;
+    key_position = stpcpy(key_position, user) + 1;
+    key_position = stpcpy(key_position, cmd) + 1;
+    for (i = 1; i < argc; i++) {
+        size_t arg_len = strnlen(argv[i], AUTHORIZATION_CACHE_ARG_LEN);
+        memcpy(key_position, argv[i], arg_len);
+        key_position[arg_len] = 0;
+        key_position += arg_len + 1;
+    }
+
+    return length;
+}
+
+/*
+ * FNV-1a hash of cache key.
+ */
+uint64_t hash_authorization_cache_key(const char *key, size_t key_len)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i;
+    for (i = 0; i < key_len; i++) {
+        hash ^= (unsigned char)key[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+/*
+ * Get authorization cache capacity, cache size limited by cache memory size.
+ */
+int get_authorization_cache_capacity()
+{
+    if (authorization_cache_size > AUTHORIZATION_CACHE_MAX_SIZE) {
+        return AUTHORIZATION_CACHE_MAX_SIZE;
+    }
+
+    return authorization_cache_size;
+}
+
+/*
+ * Clear authorization cache, cached decision can't be used after config changed.
+ * Cache pages removed under lock, so memory of cached entries released and no process read half cleared entries.
+ */
+void clear_authorization_cache()
+{
+    if (authorization_cache == NULL) {
+        return;
+    }
+
+    lock_plugin_state();
+    if (madvise(authorization_cache, AUTHORIZATION_CACHE_MEMORY_SIZE, MADV_REMOVE) < 0) {
+        output_debug("failed to release authorization cache memory: %s\n", strerror(errno));
+        memset(authorization_cache, 0, AUTHORIZATION_CACHE_MEMORY_SIZE);
+    }
+
+    unlock_plugin_state();
+}
+
+/*
+ * Output authorization cache statistics.
+ */
+void output_authorization_cache_stats()
+{
+    output_debug("authorization cache hits: %lu, misses: %lu, expired: %lu, evictions: %lu\n",
+                    plugin_state->authorization_cache_stats.hits,
+                    plugin_state->authorization_cache_stats.misses,
+                    plugin_state->authorization_cache_stats.expired,
+                    plugin_state->authorization_cache_stats.evictions);
+}
+
+/*
+ * Find cached authorization decision, return cache entry or NULL, caller should hold plugin state lock.
+ */
+authorization_cache_entry_t *find_authorization_cache_entry(const char *key, size_t key_len, uint64_t hash)
+{
+    int entry_idx, capacity = get_authorization_cache_capacity();
+    for (entry_idx = 0; entry_idx < capacity; entry_idx++) {
+        authorization_cache_entry_t *entry = &authorization_cache[entry_idx];
+        if (entry->key_len == key_len
+                && entry->hash == hash
+                && memcmp(entry->key, key, key_len) == 0) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Lookup cached authorization decision.
+ * Return 1 and set result when found valid cached decision, otherwise return 0.
+ */
+int lookup_authorization_cache(const char *key, size_t key_len, uint64_t hash, int *result)
+{
+    authorization_cache_stats_t *stats = &plugin_state->authorization_cache_stats;
+    time_t now = time(NULL);
+    lock_plugin_state();
+    authorization_cache_entry_t *entry = find_authorization_cache_entry(key, key_len, hash);
+    if (entry != NULL && now - entry->created >= authorization_cache_ttl) {
+        stats->expired++;
+        memset(entry, 0, sizeof(authorization_cache_entry_t));
+        entry = NULL;
+    }
+
+    int found = 0;
+    if (entry == NULL) {
+        stats->misses++;
+    }
+    else {
+        entry->last_used = now;
+        stats->hits++;
+        *result = entry->result;
+        found = 1;
+    }
+
+    unlock_plugin_state();
+    output_authorization_cache_stats();
+    return found;
+}
+
+/*
+ * Save authorization decision to cache.
+ * Least recently used entry will be evicted when cache full.
+ */
+void update_authorization_cache(const char *key, size_t key_len, uint64_t hash, int result)
+{
+    int capacity = get_authorization_cache_capacity();
+    if (capacity == 0) {
+        return;
+    }
+
+    lock_plugin_state();
+    authorization_cache_entry_t *entry = find_authorization_cache_entry(key, key_len, hash);
+    if (entry == NULL) {
+        int entry_idx;
+        entry = &authorization_cache[0];
+        for (entry_idx = 0; entry_idx < capacity; entry_idx++) {
+            if (authorization_cache[entry_idx].key_len == 0) {
+                entry = &authorization_cache[entry_idx];
+                break;
+            }
+
+            if (authorization_cache[entry_idx].last_used < entry->last_used) {
+                entry = &authorization_cache[entry_idx];
+            }
+        }
+
+        if (entry->key_len != 0) {
+            plugin_state->authorization_cache_stats.evictions++;
+        }
+    }
+
+    memcpy(entry->key, key, key_len);
+    entry->hash = hash;
+    entry->key_len = key_len;
+    entry->result = result;
+    entry->created = time(NULL);
+    entry->last_used = entry->created;
+    unlock_plugin_state();
+}
+
+/*
+ * Send authorization request, answer repeated request with cached decision when authorization cache enabled.
+ */
+int cached_authorization_with_host_and_tty(const char *user, const char *cmd, char **argv, int argc)
+{
+    if (!authorization_cache_enabled || authorization_cache == NULL) {
+        return authorization_with_host_and_tty(user, cmd, argv, argc);
+    }
+
+    char key[AUTHORIZATION_CACHE_KEY_LEN];
+    size_t key_len = build_authorization_cache_key(user, cmd, argv, argc, key);
+    if (key_len == 0) {
+        output_debug("%s arguments too long, skip authorization cache.\n", cmd);
+        return authorization_with_host_and_tty(user, cmd, argv, argc);
+    }
+
+    int result;
+    uint64_t hash = hash_authorization_cache_key(key, key_len);
+    if (lookup_authorization_cache(key, key_len, hash, &result)) {
+        output_debug("%s authorization result %d from cache\n", cmd, result);
+        return result;
+    }
+
+    result = authorization_with_host_and_tty(user, cmd, argv, argc);
+    if (result == 0 || result == 1) {
+        // only cache decision from server, connection or protocol errors should be retried.
+        update_authorization_cache(key, key_len, hash, result);
+    }
+
+    return result;
+}
+
+/*
+ * Parse plugin config item, libtacsupport does not handle these items.
+ */
+void parse_plugin_config_item(const char *config_item)
+{
+    if (!strcmp(config_item, CONFIG_SINGLE_CONNECTION)) {
+        single_connection_enabled = 1;
+    }
+    else if (!strncmp(config_item, CONFIG_SINGLE_CONNECTION_IDLE, strlen(CONFIG_SINGLE_CONNECTION_IDLE))) {
+        single_connection_idle = atoi(config_item + strlen(CONFIG_SINGLE_CONNECTION_IDLE));
+        if (single_connection_idle < 0) {
+            single_connection_idle = 0;
+        }
+    }
+    else if (!strncmp(config_item, CONFIG_AUTHORIZATION_MODE, strlen(CONFIG_AUTHORIZATION_MODE))) {
+        const char *mode = config_item + strlen(CONFIG_AUTHORIZATION_MODE);
+        if (!strcmp(mode, "parallel")) {
+            authorization_mode = AUTHORIZATION_MODE_PARALLEL;
+        }
+        else if (!strcmp(mode, "hedged")) {
+            authorization_mode = AUTHORIZATION_MODE_HEDGED;
+        }
+        else {
+            authorization_mode = AUTHORIZATION_MODE_SEQUENTIAL;
+        }
+    }
+    else if (!strncmp(config_item, CONFIG_HEDGE_DELAY, strlen(CONFIG_HEDGE_DELAY))) {
+        hedge_delay = atoi(config_item + strlen(CONFIG_HEDGE_DELAY));
+        if (hedge_delay < 0) {
+            hedge_delay = 0;
+        }
+    }
+    else if (!strcmp(config_item, CONFIG_AUTHORIZATION_CACHE)) {
+        authorization_cache_enabled = 1;
+    }
+    else if (!strncmp(config_item, CONFIG_AUTHORIZATION_CACHE_TTL, strlen(CONFIG_AUTHORIZATION_CACHE_TTL))) {
+        authorization_cache_ttl = atoi(config_item + strlen(CONFIG_AUTHORIZATION_CACHE_TTL));
+        if (authorization_cache_ttl < 0) {
+            authorization_cache_ttl = 0;
+        }
+    }
+    else if (!strncmp(config_item, CONFIG_AUTHORIZATION_CACHE_SIZE, strlen(CONFIG_AUTHORIZATION_CACHE_SIZE))) {
+        authorization_cache_size = atoi(config_item + strlen(CONFIG_AUTHORIZATION_CACHE_SIZE));
+        if (authorization_cache_size < 0) {
+            authorization_cache_size = 0;
+        }
+    }
+}
+
+/*
+ * Load plugin config from tacacs config file.
+ */
+void load_plugin_config()
+{
+    single_connection_enabled = 0;
+    single_connection_idle = DEFAULT_SINGLE_CONNECTION_IDLE;
+    authorization_mode = AUTHORIZATION_MODE_SEQUENTIAL;
+    hedge_delay = DEFAULT_HEDGE_DELAY;
+    authorization_cache_enabled = 0;
+    authorization_cache_ttl = DEFAULT_AUTHORIZATION_CACHE_TTL;
+    authorization_cache_size = DEFAULT_AUTHORIZATION_CACHE_SIZE;
+
+    FILE *config_file = fopen(tacacs_config_file, "r");
+    if (config_file == NULL) {
+        output_debug("failed to open config file %s: %s\n", tacacs_config_file, strerror(errno));
+        return;
+    }
+
+    char line_buffer[256];
+    while (fgets(line_buffer, sizeof line_buffer, config_file)) {
+        if (*line_buffer == '#' || isspace(*line_buffer)) {
+            // skip comments and blank line.
+            continue;
+        }
+
+        char *save_pointer;
+        char *config_item = strtok_r(line_buffer, CONFIG_FILE_SPLITTER, &save_pointer);
+        while (config_item != NULL) {
+            parse_plugin_config_item(config_item);
+            config_item = strtok_r(NULL, CONFIG_FILE_SPLITTER, &save_pointer);
+        }
+    }
+
+    fclose(config_file);
+}
+
+/*
+ * Save address in libtac addrinfo to shared config.
+ */
+void save_shared_address(shared_address_t *shared_address, const struct addrinfo *address)
+{
+    shared_address->family = address->ai_family;
+    shared_address->socktype = address->ai_socktype;
+    shared_address->protocol = address->ai_protocol;
+    shared_address->address_len = address->ai_addrlen;
+    memset(&shared_address->address, 0, sizeof(shared_address->address));
+    memcpy(&shared_address->address, address->ai_addr, address->ai_addrlen);
+}
+
+/*
+ * Restore address from shared config to addrinfo used by libtac.
+ */
+void restore_shared_address(const shared_address_t *shared_address, struct addrinfo *address, struct sockaddr_storage *sock_addr)
+{
+    memset(address, 0, sizeof(struct addrinfo));
+    address->ai_family = shared_address->family;
+    address->ai_socktype = shared_address->socktype;
+    address->ai_protocol = shared_address->protocol;
+    address->ai_addrlen = shared_address->address_len;
+    memcpy(sock_addr, &shared_address->address, sizeof(struct sockaddr_storage));
+    address->ai_addr = (struct sockaddr *)sock_addr;
+}
+
+/*
+ * Save config parsed for generation to shared config, following commands restore it without parse config file.
+ * Config not saved when config file changed again during parse.
+ */
+void save_shared_config(unsigned int generation)
+{
+    lock_plugin_state();
+    if (plugin_state->config_generation != generation) {
+        unlock_plugin_state();
+        return;
+    }
+
+    shared_config_t *config = &plugin_state->config;
+    config->tacacs_ctrl = tacacs_ctrl;
+    config->server_count = tac_srv_no;
+    int server_idx;
+    for (server_idx = 0; server_idx < tac_srv_no; server_idx++) {
+        save_shared_address(&config->server_address[server_idx], tac_srv[server_idx].addr);
+        snprintf(config->server_key[server_idx], TACACS_SERVER_KEY_LEN, "%s", tac_srv[server_idx].key);
+    }
+
+    config->has_source_address = tac_source_addr != NULL;
+    if (tac_source_addr != NULL) {
+        save_shared_address(&config->source_address, tac_source_addr);
+    }
+
+    config->timeout = tac_timeout;
+    config->readtimeout_enable = tac_readtimeout_enable;
+    config->has_vrf_name = __vrfname != NULL;
+    snprintf(config->vrf_name, TACACS_CONFIG_NAME_LEN, "%s", __vrfname != NULL ? __vrfname : "");
+    snprintf(config->login, TACACS_CONFIG_NAME_LEN, "%s", tac_login);
+
+    config->single_connection_enabled = single_connection_enabled;
+    config->single_connection_idle = single_connection_idle;
+    config->authorization_mode = authorization_mode;
+    config->hedge_delay = hedge_delay;
+    config->authorization_cache_enabled = authorization_cache_enabled;
+    config->authorization_cache_ttl = authorization_cache_ttl;
+    config->authorization_cache_size = authorization_cache_size;
+
+    config->generation = generation;
+    config->valid = 1;
+    unlock_plugin_state();
+}
+
+/*
+ * Restore config parsed by other process for current generation.
+ * Return 0 when restored, -1 when config of current generation not parsed yet.
+ */
+int restore_shared_config()
+{
+    lock_plugin_state();
+    shared_config_t *config = &plugin_state->config;
+    if (!config->valid || config->generation != plugin_state->config_generation) {
+        unlock_plugin_state();
+        return -1;
+    }
+
+    tacacs_ctrl = config->tacacs_ctrl;
+    tac_srv_no = config->server_count;
+    int server_idx;
+    for (server_idx = 0; server_idx < tac_srv_no; server_idx++) {
+        restore_shared_address(&config->server_address[server_idx], &restored_server_addr[server_idx], &restored_server_sock_addr[server_idx]);
+        tac_srv[server_idx].addr = &restored_server_addr[server_idx];
+        snprintf(tac_srv[server_idx].key, sizeof(tac_srv[server_idx].key), "%s", config->server_key[server_idx]);
+    }
+
+    tac_source_addr = NULL;
+    if (config->has_source_address) {
+        restore_shared_address(&config->source_address, &restored_source_addr, &restored_source_sock_addr);
+        tac_source_addr = &restored_source_addr;
+    }
+
+    tac_timeout = config->timeout;
+    tac_readtimeout_enable = config->readtimeout_enable;
+    __vrfname = NULL;
+    if (config->has_vrf_name) {
+        snprintf(restored_vrf_name, TACACS_CONFIG_NAME_LEN, "%s", config->vrf_name);
+        __vrfname = restored_vrf_name;
+    }
+
+    snprintf(tac_login, TACACS_CONFIG_NAME_LEN, "%s", config->login);
+
+    single_connection_enabled = config->single_connection_enabled;
+    single_connection_idle = config->single_connection_idle;
+    authorization_mode = config->authorization_mode;
+    hedge_delay = config->hedge_delay;
+    authorization_cache_enabled = config->authorization_cache_enabled;
+    authorization_cache_ttl = config->authorization_cache_ttl;
+    authorization_cache_size = config->authorization_cache_size;
+
+    loaded_config_generation = config->generation;
+    unlock_plugin_state();
+    return 0;
+}
+
+/*
+ * Output loaded tacacs config.
+ */
+void output_tacacs_config()
+{
+    output_debug("tacacs config updated, generation: %u\n", loaded_config_generation);
+    int server_idx;
+    for(server_idx = 0; server_idx < tac_srv_no; server_idx++) {
+        output_debug("Server %d, address:%s, key length:%d\n", server_idx, tac_ntop(tac_srv[server_idx].addr->ai_addr),strlen(tac_srv[server_idx].key));
+    }
+
+    output_debug("TACACS+ control flag: 0x%x\n", tacacs_ctrl);
+
+    if (tacacs_ctrl & AUTHORIZATION_FLAG_TACACS) {
+        output_debug("TACACS+ per-command authorization enabled.\n");
+    }
+
+    if (tacacs_ctrl & AUTHORIZATION_FLAG_LOCAL) {
+        output_debug("Local per-command authorization enabled.\n");
+    }
+
+    if (tacacs_ctrl & PAM_TAC_DEBUG) {
+        output_debug("TACACS+ debug enabled.\n");
+    }
+
+    if (single_connection_enabled) {
+        output_debug("TACACS+ single connection enabled, idle timeout: %d seconds.\n", single_connection_idle);
+    }
+
+    if (authorization_mode == AUTHORIZATION_MODE_PARALLEL) {
+        output_debug("TACACS+ parallel authorization enabled.\n");
+    }
+    else if (authorization_mode == AUTHORIZATION_MODE_HEDGED) {
+        output_debug("TACACS+ hedged authorization enabled, hedge delay: %d milliseconds.\n", hedge_delay);
+    }
+
+    if (authorization_cache_enabled) {
+        output_debug("TACACS+ authorization cache enabled, TTL: %d seconds, size: %d.\n", authorization_cache_ttl, authorization_cache_size);
+    }
+}
+
+/*
+ * Load tacacs config from config file, and share it with other processes forked from shell.
+ */
+void load_tacacs_config()
+{
+    // kept connections of old config closed when taken from mailbox.
+    loaded_config_generation = plugin_state->config_generation;
+
+    // load config file: tacacs_config_file
+    tacacs_ctrl = parse_config_file (tacacs_config_file);
+    load_plugin_config();
+    save_shared_config(loaded_config_generation);
+    output_tacacs_config();
+}
+
+/*
+ * Start new config generation.
+ * Server list may change, server health and cached decisions can't be used anymore.
+ */
+void start_config_generation()
+{
+    lock_plugin_state();
+    plugin_state->config_generation++;
+    unlock_plugin_state();
+
+    reset_tacacs_server_health();
+    clear_authorization_cache();
+}
+
+/*
+ * Watch config file directory, config file may be replaced by rename.
+ * Config file change checked with stat when watch failed.
+ */
+void init_config_watch()
+{
+    char config_dir[PATH_MAX];
+    snprintf(config_dir, sizeof(config_dir), "%s", tacacs_config_file);
+    char *config_name = strrchr(config_dir, '/');
+    if (config_name == NULL) {
+        snprintf(config_dir, sizeof(config_dir), ".");
+    }
+    else if (config_name == config_dir) {
+        config_dir[1] = 0;
+    }
+    else {
+        *config_name = 0;
+    }
+
+    config_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (config_watch_fd < 0) {
+        output_debug("failed to watch config file: %s\n", strerror(errno));
+        return;
+    }
+
+    if (inotify_add_watch(config_watch_fd, config_dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_ATTRIB) < 0) {
+        output_debug("failed to watch config directory %s: %s\n", config_dir, strerror(errno));
+        close(config_watch_fd);
+        config_watch_fd = -1;
+    }
+}
+
+/*
+ * Release config file watch.
+ */
+void release_config_watch()
+{
+    if (config_watch_fd >= 0) {
+        close(config_watch_fd);
+        config_watch_fd = -1;
+    }
+}
+
+/*
+ * Check config file change with inotify events, only one read syscall when nothing changed.
+ * Events consumed by any process forked from shell, so change recorded in shared config generation.
+ */
+int is_watched_config_changed()
+{
+    const char *config_name = strrchr(tacacs_config_file, '/');
+    config_name = config_name ? config_name + 1 : tacacs_config_file;
+
+    char events[CONFIG_WATCH_BUFFER_SIZE] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    int changed = 0;
+    ssize_t length;
+    while ((length = read(config_watch_fd, events, sizeof(events))) > 0) {
+        char *position = events;
+        while (position < events + length) {
+            struct inotify_event *event = (struct inotify_event *)position;
+            if ((event->mask & IN_Q_OVERFLOW)
+                    || (event->len > 0 && strcmp(event->name, config_name) == 0)) {
+                changed = 1;
+            }
+
+            position += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    return changed;
+}
+
+/*
+ * Check config file change with last modified time.
+ */
+int is_stat_config_changed()
+{
+    struct stat attr;
+    // get config file stat, check if file changed, missing config file has different time stamp with any existing file.
+    if (stat(tacacs_config_file, &attr) < 0) {
+        attr.st_mtime = (time_t)-1;
+    }
+
+    char date[CONFIG_FILE_TIME_STAMP_LEN] = "";
+    if (tacacs_ctrl & PAM_TAC_DEBUG) {
+        strftime(date, sizeof(date), CONFIG_FILE_TIME_STAMP_FORMAT, localtime(&(attr.st_mtime)));
+    }
+
+    lock_plugin_state();
+    int changed = difftime(attr.st_mtime, plugin_state->config_mtime) != 0;
+    plugin_state->config_mtime = attr.st_mtime;
+    unlock_plugin_state();
+
+    if (!changed) {
+        output_debug("tacacs config file not change: last modified time: %s.\n", date);
+        return 0;
+    }
+
+    output_debug("tacacs config file changed: last modified time: %s.\n", date);
+
+    // config file changed, update file stat.
+    config_file_attr = attr;
+    return 1;
+}
+
+/*
+ * Load tacacs config when config file changed, or other process forked from shell found config file changed.
+ * Config parsed by other process restored from shared config.
+ */
+void check_and_load_changed_tacacs_config()
+{
+    int changed = config_watch_fd >= 0 ? is_watched_config_changed() : is_stat_config_changed();
+    if (changed) {
+        start_config_generation();
+    }
+
+    if (loaded_config_generation == plugin_state->config_generation) {
+        return;
+    }
+
+    // shell and commands forked from it only parse config once for each generation.
+    if (restore_shared_config() == 0) {
+        output_debug("tacacs config restored, generation: %u\n", loaded_config_generation);
+        return;
+    }
+
+    // load config file
+    load_tacacs_config();
+}
+
+/*
+ * Tacacs plugin initialization.
+ */
+void plugin_init()
+{
+    // commands forked from shell share state with shell.
+    init_plugin_state();
+
+    // get config file stat, will use this to check config file changed
+    if (stat(tacacs_config_file, &config_file_attr) < 0) {
+        config_file_attr.st_mtime = (time_t)-1;
+    }
+
+    plugin_state->config_mtime = config_file_attr.st_mtime;
+    init_config_watch();
+
+    // load config file: tacacs_config_file
+    load_tacacs_config();
+
+    output_debug("tacacs plugin initialized.\n");
+}
+
+/*
+ * Tacacs plugin release.
+ */
+void plugin_uninit()
+{
+    output_debug("tacacs plugin un-initialize.\n");
+    output_authorization_cache_stats();
+    close_all_tacacs_connections();
+    release_config_watch();
+    release_plugin_state();
+}
+
+/*
+ * Check if current user is local user with getpwnam_r.
+ */
+int check_local_user(const char *user)
+{
+    struct passwd pwd;
+    struct passwd *pwdresult;
+    char *buf;
+    size_t bufsize = sysconf(_SC_GETPW_R_SIZE_MAX);
+    if (bufsize == -1) {
+        bufsize = DEFAULT_SC_GETPW_R_SIZE_MAX;
+    }
+
+    buf = malloc(bufsize);
+    if (buf == NULL) {
+       output_error("failed to allocate getpwnam_r buffer.\n");
+       return ERROR_CHECK_LOCAL_USER;
+    }
+
+    int s = getpwnam_r(user, &pwd, buf, bufsize, &pwdresult);
+    int result = IS_LOCAL_USER;
+    if (pwdresult == NULL) {
+        if (s == 0)
+            output_error("get user information user failed, user: %s not found\n", user);
+        else {
+            output_error("get user information failed, user: %s, errorno: %d\n", user, s);
+        }
+
+        result = ERROR_CHECK_LOCAL_USER;
+    }
+    else if (strncmp(pwd.pw_gecos, REMOTE_USER_GECOS_PREFIX, strlen(REMOTE_USER_GECOS_PREFIX)) == 0) {
+        output_debug("user: %s, UID: %d, GECOS: %s is remote user.\n", user, pwd.pw_uid, pwd.pw_gecos);
+        result = IS_REMOTE_USER;
+    }
+    else {
+        output_debug("user: %s, UID: %d, GECOS: %s is local user.\n", user, pwd.pw_uid, pwd.pw_gecos);
+        result = IS_LOCAL_USER;
+    }
+
+    free(buf);
+    return result;
+}
+
+/*
+ * Check if current user is local user.
+ * Result memoized in plugin state, user of a shell never change, so only first command lookup user database.
+ */
+int is_local_user(char *user)
+{
+    if (user == unknown_username) {
+        // for unknown user name, when tacacs enabled, always authorization with tacacs.
+        return IS_REMOTE_USER;
+    }
+
+    int result = ERROR_CHECK_LOCAL_USER;
+    lock_plugin_state();
+    if (strcmp(plugin_state->local_user_name, user) == 0) {
+        result = plugin_state->local_user_result;
+    }
+    unlock_plugin_state();
+
+    if (result != ERROR_CHECK_LOCAL_USER) {
+        return result;
+    }
+
+    result = check_local_user(user);
+    if (result != ERROR_CHECK_LOCAL_USER && strlen(user) < LOCAL_USER_NAME_LEN) {
+        // error not memoized, user information may become available later.
+        lock_plugin_state();
+        strcpy(plugin_state->local_user_name, user);
+        plugin_state->local_user_result = result;
+        unlock_plugin_state();
+    }
+
+    return result;
+}
+
+/*
+ * Get user name.
+ */
+char* get_user_name(char *user)
+{
+    if (user != NULL && strlen(user) != 0) {
+        return user;
+    }
+
+    // uid is the real user id: https://man7.org/linux/man-pages/man2/geteuid.2.html
+    output_debug("Login user name is empty, try get user name by euid.\n");
+    uid_t uid = getuid();
+    struct passwd* userwd = getpwuid(uid);
+    if (userwd != NULL && userwd->pw_name != NULL) {
+        return userwd->pw_name;
+    }
+
+    // euid is the effective user name, may not match real user id: https://man7.org/linux/man-pages/man2/geteuid.2.html
+    output_debug("Login user name is empty, try get user name by euid.\n");
+    uid_t euid = geteuid();
+    struct passwd* euserwd = getpwuid(euid);
+    if (euserwd != NULL && euserwd->pw_name != NULL) {
+        return euserwd->pw_name;
+    }
+
+    // if can't find user name by both euid or ruid, return UNKNOWN.
+    return unknown_username;
+}
+
+/*
+ * Tacacs authorization.
+ */
+int on_shell_execve (char *user, int shell_level, char *cmd, char **argv)
+{
+    char* user_namd = get_user_name(user);
+    output_debug("Authorization parameters:\n");
+    output_debug("    Shell level: %d\n", shell_level);
+    output_debug("    Current user: %s\n", user_namd);
+    output_debug("    Command full path: %s\n", cmd);
+    output_debug("    Parameters:\n");
+    char **parameter_array_pointer = argv;
+    int argc = 0;
+    while (*parameter_array_pointer != NULL) {
+        // output parameter
+        output_debug("        %s\n", *parameter_array_pointer);
+
+        // move to next parameter
+        parameter_array_pointer++;
+        argc++;
+    }
+
+    if (shell_level > 2) {
+        // when shell_level > 1, it's a recursive command in shell script.
+        output_debug("Recursive command %s ignored.\n", cmd);
+        return 0;
+    }
+
+    // check local user before config, local user command should not pay for config check.
+    int check_local_user_result = is_local_user(user_namd);
+    if (check_local_user_result != IS_REMOTE_USER) {
+        /*
+            Return 0 to check with linux permission control in following 2 scenario:
+                1: ERROR_CHECK_LOCAL_USER: check if user is local user failed because can't get user information.
+                        In this case, as failback, check with linux permission control.
+                2: IS_LOCAL_USER: user login as local user.
+                        In this case, tacacs authorization disabled for local user.
+        */
+        output_debug("ignore TACACS+ authorization for current user, check with local permission.\n");
+        return 0;
+    }
+
+    // reload config file when tacacs config changed
+    check_and_load_changed_tacacs_config();
+
+    if (tacacs_ctrl & AUTHORIZATION_FLAG_TACACS) {
+        output_debug("start TACACS+ authorization for command %s with given arguments\n", cmd);
+        int ret = cached_authorization_with_host_and_tty(user_namd, cmd, argv, argc);
+        switch (ret) {
+            case 0:
+            break;
+            case -2:
+                // -2 means no servers, so not authorized
+                fprintf(stdout, "%s not authorized by TACACS+ with given arguments, not executing\n", cmd);
+            break;
+            default:
+                fprintf(stdout, "%s authorize failed by TACACS+ with given arguments, not executing\n", cmd);
+            break;
+        }
+
+        if ((tacacs_ctrl & AUTHORIZATION_FLAG_LOCAL) == 0) {
+            // when local authorization disabled, tacacs authorization failed will block user from run current command
+            output_debug("local authorization disabled, TACACS+ authorization result: %d\n", ret);
+            return ret;
+        }
+    }
+
+    // return 0, so bash will continue run user command and will check user permission with linux permission check.
+    output_debug("start local authorization for command %s with given arguments\n", cmd);
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,134 @@
+/* bash_tacplus.h - per-shell state of bash TACACS+ plugin. */
+
+#if !defined (_BASH_TACPLUS_H_)
+#define _BASH_TACPLUS_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/socket.h>
+
+/* Tacacs+ lib */
+#include <libtac/libtac.h>
+
+/* Return value for is_local_user method */
+#define IS_LOCAL_USER              0
+#define IS_REMOTE_USER             1
+#define ERROR_CHECK_LOCAL_USER     2
+
+/* Authorization mode */
+#define  AUTHORIZATION_MODE_SEQUENTIAL     0
+#define  AUTHORIZATION_MODE_PARALLEL       1
+#define  AUTHORIZATION_MODE_HEDGED         2
+
+/* Max cached authorization decision count, cache memory sized for max count but only used entries take memory */
+#define  AUTHORIZATION_CACHE_MAX_SIZE      256
+
+/* Max authorization cache key length, longer command will not be cached */
+#define  AUTHORIZATION_CACHE_KEY_LEN       512
+
+/* Max user name length of local user check memo */
+#define  LOCAL_USER_NAME_LEN               64
+
+/* Max server key length, same as tacplus_server_t in libtacsupport */
+#define  TACACS_SERVER_KEY_LEN             256
+
+/* Max VRF name and login type length */
+#define  TACACS_CONFIG_NAME_LEN            64
+
+/* Server health, dead server will be skipped until retry_after */
+typedef struct {
+    int failures;
+    time_t retry_after;
+} tacacs_server_health_t;
+
+/* Cached authorization decision, key is user, command and arguments split by '\0', key_len is 0 when entry not used */
+typedef struct {
+    uint64_t hash;
+    size_t key_len;
+    int result;
+    time_t created;
+    time_t last_used;
+    char key[AUTHORIZATION_CACHE_KEY_LEN];
+} authorization_cache_entry_t;
+
+/* Address of tacacs server or source address, libtac keep address in addrinfo */
+typedef struct {
+    int family;
+    int socktype;
+    int protocol;
+    socklen_t address_len;
+    struct sockaddr_storage address;
+} shared_address_t;
+
+/*
+ * Tacacs config parsed by libtacsupport and plugin.
+ * Config parsed once by the first process found config changed, other processes restore it without parse config file.
+ */
+typedef struct {
+    /* Config generation this config parsed for, valid is 0 before first parse */
+    int valid;
+    unsigned int generation;
+
+    /* libtacsupport config */
+    int tacacs_ctrl;
+    int server_count;
+    shared_address_t server_address[TAC_PLUS_MAXSERVERS];
+    char server_key[TAC_PLUS_MAXSERVERS][TACACS_SERVER_KEY_LEN];
+    int has_source_address;
+    shared_address_t source_address;
+    int timeout;
+    int readtimeout_enable;
+    int has_vrf_name;
+    char vrf_name[TACACS_CONFIG_NAME_LEN];
+    char login[TACACS_CONFIG_NAME_LEN];
+
+    /* plugin config */
+    int single_connection_enabled;
+    int single_connection_idle;
+    int authorization_mode;
+    int hedge_delay;
+    int authorization_cache_enabled;
+    int authorization_cache_ttl;
+    int authorization_cache_size;
+} shared_config_t;
+
+/* Authorization cache statistics */
+typedef struct {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long expired;
+    unsigned long evictions;
+} authorization_cache_stats_t;
+
+/*
+ * Per-shell plugin state.
+ * Bash invokes plugin in the child process forked for each command, so the state is
+ * placed in memory shared with the shell by plugin_init, and every command see the
+ * state updated by previous commands.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+
+    /* Increased when config file changed, cached state belongs to old config dropped */
+    unsigned int config_generation;
+    time_t config_mtime;
+
+    /* Config parsed for current generation */
+    shared_config_t config;
+
+    /* Server health, index is same as tac_srv */
+    tacacs_server_health_t server_health[TAC_PLUS_MAXSERVERS];
+
+    /* Authorization cache statistics, cache entries in separate shared memory only touched when cache enabled */
+    authorization_cache_stats_t authorization_cache_stats;
+
+    /* Local user check memo */
+    char local_user_name[LOCAL_USER_NAME_LEN];
+    int local_user_result;
+} plugin_state_t;
+
+/* Per-shell plugin state */
+extern plugin_state_t *plugin_state;
+
+#endif /* _BASH_TACPLUS_H_ */
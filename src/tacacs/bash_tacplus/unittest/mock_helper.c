@@ -0,0 +1,500 @@
+/* mock_helper.c -- mock helper for bash plugin UT. */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <CUnit/CUnit.h>
+#include <CUnit/Basic.h>
+
+/* Tacacs+ lib */
+#include <libtac/libtac.h>
+
+#include "mock_helper.h"
+
+// define BASH_PLUGIN_UT_DEBUG to output UT debug message.
+#if defined (BASH_PLUGIN_UT_DEBUG)
+#define debug_printf printf
+#define debug_vprintf vprintf
+#else
+#define debug_printf
+#define debug_vprintf
+#endif
+
+/* Mock syslog buffer */
+char mock_syslog_message_buffer[1024];
+
+/* Control flag returned by mock parse_config_file. */
+int mock_parse_config_result;
+
+/* Mock parse_config_file call count. */
+int mock_parse_config_count;
+
+/* define test scenarios for mock functions return different value by scenario. */
+int test_scenario;
+
+/* Mock tac_netop method result buffer. */
+char tac_natop_result_buffer[128];
+
+/* Mock tacplus_server_t. */
+typedef struct {
+    struct addrinfo *addr;
+    char key[256];
+} tacplus_server_t;
+
+/* Mock VRF name. */
+char *__vrfname = "MOCK VRF name";
+
+/* Mock tac timeout setting. */
+int tac_timeout = 10;
+int tac_readtimeout_enable = 0;
+
+/* Mock tac login type. */
+char tac_login[64];
+
+/* Mock TACACS servers. */
+int tac_srv_no = 3;
+tacplus_server_t tac_srv[TAC_PLUS_MAXSERVERS];
+struct addrinfo tac_srv_addr[TAC_PLUS_MAXSERVERS];
+struct sockaddr tac_sock_addr[TAC_PLUS_MAXSERVERS];
+
+/* Mock tac_source_addr, NULL when source ip not configured. */
+struct addrinfo *tac_source_addr = NULL;
+
+/* Mock libtac secret and encryption setting. */
+const char *tac_secret;
+int tac_encryption;
+
+/* Mock libtac session id, every request start new session same as libtac. */
+int session_id;
+int mock_session_count;
+
+/* Stand-in servers, index is same as tac_srv. */
+#define STAND_IN_SERVER_MAX_CONNECTIONS  64
+#define STAND_IN_SERVER_BLACKHOLE_BACKLOG  4
+typedef struct {
+	int fd;
+	int behavior;
+	pthread_t thread;
+	int backlog_fds[STAND_IN_SERVER_BLACKHOLE_BACKLOG];
+	struct addrinfo original_addr;
+	struct sockaddr original_sock_addr;
+} stand_in_server_t;
+stand_in_server_t stand_in_servers[TAC_PLUS_MAXSERVERS];
+typedef struct {
+	int fd;
+	int behavior;
+} stand_in_connection_t;
+int stand_in_connections[STAND_IN_SERVER_MAX_CONNECTIONS];
+int stand_in_connection_count;
+pthread_mutex_t stand_in_server_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* define memory allocate counter. */
+int memory_allocate_count;
+
+/* Initialize tacacs servers for test*/
+void initialize_tacacs_servers()
+{
+	for (int idx=0; idx < tac_srv_no; idx++)
+	{
+		// generate address with index
+		struct addrinfo hints, *servers;
+		char buffer[128];
+		memset(&hints, 0, sizeof(hints));
+		snprintf(buffer, sizeof(buffer), "1.2.3.%d", idx);
+		getaddrinfo(buffer, "49", &hints, &servers);
+		tac_srv[idx].addr = &(tac_srv_addr[idx]);
+		memcpy(tac_srv[idx].addr, servers, sizeof(struct addrinfo));
+
+        tac_srv[idx].addr->ai_addr = &(tac_sock_addr[idx]);
+        memcpy(tac_srv[idx].addr->ai_addr, servers->ai_addr, sizeof(struct sockaddr));
+
+		snprintf(tac_srv[idx].key, sizeof(tac_srv[idx].key), "key%d", idx);
+        freeaddrinfo(servers);
+
+		debug_printf("MOCK: initialize_tacacs_servers with index: %d, address: %p\n", idx, tac_srv[idx].addr);
+	}
+}
+
+/* Set test scenario for test*/
+void set_test_scenario(int scenario)
+{
+  test_scenario = scenario;
+}
+
+/* Get test scenario for test*/
+int get_test_scenario()
+{
+  return test_scenario;
+}
+
+/* Set memory allocate count for test*/
+void set_memory_allocate_count(int count)
+{
+  memory_allocate_count = count;
+}
+
+/* Get memory allocate count for test*/
+int get_memory_allocate_count()
+{
+  return memory_allocate_count;
+}
+
+/* Stand-in server connection handler: answer every header only request with same header, single connection flag kept when accepted. */
+void *stand_in_connection_handler(void *arg)
+{
+	stand_in_connection_t connection = *(stand_in_connection_t *)arg;
+	free(arg);
+
+	HDR request;
+	while (recv(connection.fd, &request, TAC_PLUS_HDR_SIZE, MSG_WAITALL) == TAC_PLUS_HDR_SIZE)
+	{
+		if (STAND_IN_SERVER_SLOW == connection.behavior)
+		{
+			usleep(STAND_IN_SERVER_SLOW_REPLY_MS * 1000);
+		}
+
+		if (STAND_IN_SERVER_NO_SINGLE_CONNECTION == connection.behavior)
+		{
+			request.flags &= ~TAC_PLUS_SINGLE_CONNECT_FLAG;
+		}
+
+		// client may close connection without read reply.
+		if (send(connection.fd, &request, TAC_PLUS_HDR_SIZE, MSG_NOSIGNAL) != TAC_PLUS_HDR_SIZE)
+		{
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/* Stand-in server accept loop. */
+void *stand_in_server_handler(void *arg)
+{
+	stand_in_server_t *server = (stand_in_server_t *)arg;
+	while (1)
+	{
+		int connection_fd = accept(server->fd, NULL, NULL);
+		if (connection_fd < 0)
+		{
+			break;
+		}
+
+		pthread_mutex_lock(&stand_in_server_lock);
+		stand_in_connections[stand_in_connection_count % STAND_IN_SERVER_MAX_CONNECTIONS] = connection_fd;
+		stand_in_connection_count++;
+		pthread_mutex_unlock(&stand_in_server_lock);
+
+		stand_in_connection_t *connection = malloc(sizeof(stand_in_connection_t));
+		connection->fd = connection_fd;
+		connection->behavior = server->behavior;
+
+		pthread_t connection_thread;
+		pthread_create(&connection_thread, NULL, stand_in_connection_handler, connection);
+		pthread_detach(connection_thread);
+	}
+
+	return NULL;
+}
+
+/* Start local stand-in TACACS+ server for test, tacacs server address will be replaced with stand-in server address*/
+int start_stand_in_server(int server_idx, int behavior)
+{
+	stand_in_server_t *server = &stand_in_servers[server_idx];
+	struct sockaddr_in address;
+	socklen_t address_len = sizeof(address);
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	server->behavior = behavior;
+	server->fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (server->fd < 0
+		|| bind(server->fd, (struct sockaddr *)&address, sizeof(address)) < 0
+		|| getsockname(server->fd, (struct sockaddr *)&address, &address_len) < 0)
+	{
+		return -1;
+	}
+
+	// replace tacacs server address
+	memcpy(&server->original_addr, tac_srv[server_idx].addr, sizeof(struct addrinfo));
+	memcpy(&server->original_sock_addr, tac_srv[server_idx].addr->ai_addr, sizeof(struct sockaddr));
+	tac_srv[server_idx].addr->ai_family = AF_INET;
+	tac_srv[server_idx].addr->ai_socktype = SOCK_STREAM;
+	tac_srv[server_idx].addr->ai_protocol = 0;
+	tac_srv[server_idx].addr->ai_addrlen = sizeof(address);
+	memcpy(tac_srv[server_idx].addr->ai_addr, &address, sizeof(address));
+	debug_printf("MOCK: stand-in server %d listen on port: %d\n", server_idx, ntohs(address.sin_port));
+
+	if (STAND_IN_SERVER_REFUSE == behavior)
+	{
+		// bound but not listening port refuses connection.
+		return 0;
+	}
+
+	if (STAND_IN_SERVER_BLACKHOLE == behavior)
+	{
+		// fill accept queue without accept, kernel will drop following SYN.
+		if (listen(server->fd, 0) < 0)
+		{
+			return -1;
+		}
+
+		for (int idx=0; idx < STAND_IN_SERVER_BLACKHOLE_BACKLOG; idx++)
+		{
+			server->backlog_fds[idx] = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+			connect(server->backlog_fds[idx], (struct sockaddr *)&address, sizeof(address));
+		}
+
+		usleep(100 * 1000);
+		return 0;
+	}
+
+	if (listen(server->fd, 16) < 0)
+	{
+		return -1;
+	}
+
+	return pthread_create(&server->thread, NULL, stand_in_server_handler, server);
+}
+
+/* Stop all local stand-in TACACS+ servers, and restore tacacs server address*/
+void stop_stand_in_servers()
+{
+	drop_stand_in_connections();
+	for (int idx=0; idx < TAC_PLUS_MAXSERVERS; idx++)
+	{
+		stand_in_server_t *server = &stand_in_servers[idx];
+		if (server->fd <= 0)
+		{
+			continue;
+		}
+
+		shutdown(server->fd, SHUT_RDWR);
+		if (STAND_IN_SERVER_REFUSE != server->behavior && STAND_IN_SERVER_BLACKHOLE != server->behavior)
+		{
+			pthread_join(server->thread, NULL);
+		}
+
+		if (STAND_IN_SERVER_BLACKHOLE == server->behavior)
+		{
+			for (int backlog_idx=0; backlog_idx < STAND_IN_SERVER_BLACKHOLE_BACKLOG; backlog_idx++)
+			{
+				close(server->backlog_fds[backlog_idx]);
+			}
+		}
+
+		close(server->fd);
+		server->fd = 0;
+
+		memcpy(tac_srv[idx].addr, &server->original_addr, sizeof(struct addrinfo));
+		memcpy(tac_srv[idx].addr->ai_addr, &server->original_sock_addr, sizeof(struct sockaddr));
+	}
+
+	reset_stand_in_connection_count();
+}
+
+/* Close all connections accepted by stand-in server, simulate server drop idle connections*/
+void drop_stand_in_connections()
+{
+	pthread_mutex_lock(&stand_in_server_lock);
+	int count = stand_in_connection_count < STAND_IN_SERVER_MAX_CONNECTIONS ? stand_in_connection_count : STAND_IN_SERVER_MAX_CONNECTIONS;
+	for (int idx=0; idx < count; idx++)
+	{
+		// shutdown wakes up connection handler, client side will get EOF.
+		shutdown(stand_in_connections[idx], SHUT_RDWR);
+	}
+	pthread_mutex_unlock(&stand_in_server_lock);
+}
+
+/* Get connection count created to stand-in server*/
+int get_stand_in_connection_count()
+{
+	return stand_in_connection_count;
+}
+
+/* Reset connection count created to stand-in server*/
+void reset_stand_in_connection_count()
+{
+	pthread_mutex_lock(&stand_in_server_lock);
+	stand_in_connection_count = 0;
+	pthread_mutex_unlock(&stand_in_server_lock);
+}
+
+/* Connect to stand-in server with timeout in seconds, same as tac_connect_single*/
+int connect_stand_in_server(const struct addrinfo *address, int timeout)
+{
+	int server_fd = socket(address->ai_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (server_fd < 0)
+	{
+		return -1;
+	}
+
+	if (connect(server_fd, address->ai_addr, address->ai_addrlen) < 0 && errno != EINPROGRESS)
+	{
+		close(server_fd);
+		return -1;
+	}
+
+	struct pollfd connection_poll = { .fd = server_fd, .events = POLLOUT };
+	int connect_errno = 0;
+	socklen_t errno_len = sizeof(connect_errno);
+	if (poll(&connection_poll, 1, timeout * 1000) <= 0
+		|| getsockopt(server_fd, SOL_SOCKET, SO_ERROR, &connect_errno, &errno_len) < 0
+		|| connect_errno != 0)
+	{
+		close(server_fd);
+		return -1;
+	}
+
+	fcntl(server_fd, F_SETFL, fcntl(server_fd, F_GETFL, 0) & ~O_NONBLOCK);
+	return server_fd;
+}
+
+/* Mock xcalloc method */
+void *xcalloc(size_t count, size_t size)
+{
+	memory_allocate_count++;
+	debug_printf("MOCK: xcalloc memory count: %d\n", memory_allocate_count);
+	return malloc(count*size);
+}
+
+/* Mock tac_free_attrib method */
+void tac_add_attrib(struct tac_attrib **attr, char *attrname, char *attrvalue)
+{
+	debug_printf("MOCK: tac_add_attrib add attribute: %s, value: %s\n", attrname, attrvalue);
+}
+
+/* Mock tac_free_attrib method */
+void tac_free_attrib(struct tac_attrib **attr)
+{
+	memory_allocate_count--;
+	debug_printf("MOCK: tac_free_attrib memory count: %d\n", memory_allocate_count);
+
+	// the mock code here only free first allocated memory, because the mock tac_add_attrib implementation not allocate new memory.
+	free(*attr);
+}
+
+/* Mock tac_author_send method */
+int tac_author_send(int tac_fd, const char *user, char *tty, char *host,struct tac_attrib *attr)
+{
+	debug_printf("MOCK: tac_author_send with fd: %d, user:%s, tty:%s, host:%s, attr:%p\n", tac_fd, user, tty, host, attr);
+	session_id = ++mock_session_count;
+	if(TEST_SCEANRIO_CONNECTION_SEND_FAILED_RESULT == test_scenario)
+	{
+		// send auth message failed
+		return -1;
+	}
+
+	if (TEST_SCEANRIO_STAND_IN_SERVER == test_scenario)
+	{
+		// header only request, libtac set no header flag.
+		HDR request;
+		memset(&request, 0, sizeof(request));
+		request.type = TAC_PLUS_AUTHOR;
+		request.session_id = htonl(session_id);
+		return send(tac_fd, &request, TAC_PLUS_HDR_SIZE, MSG_NOSIGNAL) == TAC_PLUS_HDR_SIZE ? 0 : -1;
+	}
+
+	return 0;
+}
+
+/* Mock tac_author_read method */
+int tac_author_read(int tac_fd, struct areply *reply)
+{
+	// TODO: fill reply message here for test
+	debug_printf("MOCK: tac_author_read with fd: %d\n", tac_fd);
+	if (TEST_SCEANRIO_CONNECTION_SEND_SUCCESS_READ_FAILED == test_scenario)
+	{
+		return -1;
+	}
+
+	if (TEST_SCEANRIO_STAND_IN_SERVER == test_scenario)
+	{
+		HDR reply_header;
+		if (recv(tac_fd, &reply_header, TAC_PLUS_HDR_SIZE, MSG_WAITALL) != TAC_PLUS_HDR_SIZE)
+		{
+			return -1;
+		}
+
+		// libtac reject reply not belong to current session.
+		if (ntohl(reply_header.session_id) != (uint32_t)session_id)
+		{
+			debug_printf("MOCK: reply session id %u not match %d\n", ntohl(reply_header.session_id), session_id);
+			return LIBTAC_STATUS_PROTOCOL_ERR;
+		}
+	}
+
+	if (TEST_SCEANRIO_CONNECTION_SEND_DENINED_RESULT == test_scenario)
+	{
+		reply->status = AUTHOR_STATUS_FAIL;
+	}
+	else
+	{
+		reply->status = AUTHOR_STATUS_PASS_REPL;
+	}
+
+	return 0;
+}
+
+/* Mock tac_connect_single method */
+int tac_connect_single(const struct addrinfo *address, const char *key, struct addrinfo *source_address, int timeout, char *vrfname)
+{
+	debug_printf("MOCK: tac_connect_single with address: %p\n", address);
+
+	switch (test_scenario)
+	{
+		case TEST_SCEANRIO_CONNECTION_ALL_FAILED:
+			return -1;
+		case TEST_SCEANRIO_STAND_IN_SERVER:
+			return connect_stand_in_server(address, timeout);
+	}
+	return 0;
+}
+
+/* Mock tac_ntop method */
+char *tac_ntop(const struct sockaddr *address)
+{
+	for (int idx=0; idx < tac_srv_no; idx++)
+	{
+		// server address replaced when config restored from shared config.
+		if (address == tac_srv[idx].addr->ai_addr)
+		{
+			snprintf(tac_natop_result_buffer, sizeof(tac_natop_result_buffer), "TestAddress%d", idx);
+			return tac_natop_result_buffer;
+		}
+	}
+
+	return "UnknownTestAddress";
+}
+
+/* Mock parse_config_file method */
+int parse_config_file(const char *file)
+{
+	debug_printf("MOCK: parse_config_file: %s\n", file);
+	mock_parse_config_count++;
+	return mock_parse_config_result;
+}
+
+/* Mock syslog method */
+void mock_syslog(int priority, const char *format, ...)
+{
+  // set mock message data to buffer for UT.
+  memset(mock_syslog_message_buffer, 0, sizeof(mock_syslog_message_buffer));
+
+  va_list args;
+  va_start (args, format);
+  // save message to buffer to UT check later
+  vsnprintf(mock_syslog_message_buffer, sizeof(mock_syslog_message_buffer), format, args);
+  va_end (args);
+
+  debug_printf("MOCK: syslog: %s\n", mock_syslog_message_buffer);
+}
\ No newline at end of file
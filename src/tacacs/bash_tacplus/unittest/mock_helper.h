@@ -0,0 +1,78 @@
+/* plugin.h - functions from plugin.c. */
+
+/* Copyright (C) 1993-2015 Free Software Foundation, Inc.
+
+   This file is part of GNU Bash, the Bourne Again SHell.
+
+   Bash is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Bash is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Bash.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined (_MOCK_HELPER_H_)
+#define _MOCK_HELPER_H_
+
+/* Mock syslog buffer */
+extern char mock_syslog_message_buffer[1024];
+
+/* Control flag returned by mock parse_config_file */
+extern int mock_parse_config_result;
+
+/* Mock parse_config_file call count */
+extern int mock_parse_config_count;
+
+#define TEST_SCEANRIO_CONNECTION_ALL_FAILED				1
+#define TEST_SCEANRIO_CONNECTION_SEND_FAILED_RESULT			2
+#define TEST_SCEANRIO_CONNECTION_SEND_SUCCESS_READ_FAILED			3
+#define TEST_SCEANRIO_CONNECTION_SEND_DENINED_RESULT			4
+#define TEST_SCEANRIO_CONNECTION_SEND_SUCCESS_RESULT			5
+#define TEST_SCEANRIO_STAND_IN_SERVER			6
+
+/* Set test scenario for test*/
+void set_test_scenario(int scenario);
+
+/* Get test scenario for test*/
+int get_test_scenario();
+
+/* Set memory allocate count for test*/
+void set_memory_allocate_count(int count);
+
+/* Get memory allocate count for test*/
+int get_memory_allocate_count();
+
+/* Stand-in server behaviors */
+#define STAND_IN_SERVER_NORMAL			0
+#define STAND_IN_SERVER_SLOW			1
+#define STAND_IN_SERVER_REFUSE			2
+#define STAND_IN_SERVER_BLACKHOLE			3
+#define STAND_IN_SERVER_NO_SINGLE_CONNECTION			4
+
+/* Stand-in slow server reply delay */
+#define STAND_IN_SERVER_SLOW_REPLY_MS			300
+
+/* Start local stand-in TACACS+ server for test, tacacs server address will be replaced with stand-in server address*/
+int start_stand_in_server(int server_idx, int behavior);
+
+/* Stop all local stand-in TACACS+ servers, and restore tacacs server address*/
+void stop_stand_in_servers();
+
+/* Close all connections accepted by stand-in server, simulate server drop idle connections*/
+void drop_stand_in_connections();
+
+/* Get connection count created to stand-in server*/
+int get_stand_in_connection_count();
+
+/* Reset connection count created to stand-in server*/
+void reset_stand_in_connection_count();
+
+
+#endif /* _MOCK_HELPER_H_ */
\ No newline at end of file
@@ -0,0 +1,848 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <CUnit/CUnit.h>
+#include <CUnit/Basic.h>
+#include "mock_helper.h"
+#include "bash_tacplus.h"
+#include <libtac/support.h>
+
+/* tacacs debug flag */
+extern int tacacs_ctrl;
+
+/* single connection mode setting */
+extern int single_connection_enabled;
+
+/* multiple servers authorization setting */
+extern int authorization_mode;
+extern int hedge_delay;
+extern int tac_timeout;
+
+/* hedge delay for test */
+#define TEST_HEDGE_DELAY	100
+
+/* authorization cache setting */
+extern int authorization_cache_enabled;
+extern int authorization_cache_ttl;
+extern int authorization_cache_size;
+extern authorization_cache_entry_t *authorization_cache;
+
+/* config file path and watch */
+extern const char *tacacs_config_file;
+extern int config_watch_fd;
+extern unsigned int loaded_config_generation;
+
+/* authorization count for benchmark */
+#define BENCHMARK_AUTHORIZATION_COUNT	500
+
+/* command count for on_shell_execve benchmark */
+#define BENCHMARK_COMMAND_COUNT	100000
+
+int clean_up() {
+  release_plugin_state();
+  return 0;
+}
+
+int start_up() {
+  init_plugin_state();
+  initialize_tacacs_servers();
+  tacacs_ctrl = PAM_TAC_DEBUG;
+  mock_parse_config_result = PAM_TAC_DEBUG | AUTHORIZATION_FLAG_TACACS;
+  return 0;
+}
+
+/* Test tacacs_authorization all tacacs server connect failed case */
+void testcase_tacacs_authorization_all_failed() {
+	char *testargv[2];
+	testargv[0] = "arg1";
+	testargv[1] = "arg2";
+
+
+	// test connection failed case
+	set_test_scenario(TEST_SCEANRIO_CONNECTION_ALL_FAILED);
+	int result = tacacs_authorization("test_user","tty0","test_host","test_command",testargv,2);
+
+	CU_ASSERT_STRING_EQUAL(mock_syslog_message_buffer, "TACACS+: Failed to connect to TACACS server(s)\n");
+
+	// check return value, -2 for all server not reachable
+	CU_ASSERT_EQUAL(result, -2);
+}
+
+/* Test tacacs_authorization get failed result case */
+void testcase_tacacs_authorization_faled() {
+	char *testargv[2];
+	testargv[0] = "arg1";
+	testargv[1] = "arg2";
+
+	// test connection failed case
+	set_test_scenario(TEST_SCEANRIO_CONNECTION_SEND_FAILED_RESULT);
+	int result = tacacs_authorization("test_user","tty0","test_host","test_command",testargv,2);
+
+    // send auth message failed.
+	CU_ASSERT_EQUAL(result, -1);
+}
+
+/* Test tacacs_authorization read failed case */
+void testcase_tacacs_authorization_read_failed() {
+	char *testargv[2];
+	testargv[0] = "arg1";
+	testargv[1] = "arg2";
+
+	// test connection failed case
+	set_test_scenario(TEST_SCEANRIO_CONNECTION_SEND_SUCCESS_READ_FAILED);
+	int result = tacacs_authorization("test_user","tty0","test_host","test_command",testargv,2);
+
+	CU_ASSERT_STRING_EQUAL(mock_syslog_message_buffer, "TACACS+: test_command not authorized from TestAddress2\n");
+
+    // read auth message failed.
+	CU_ASSERT_EQUAL(result, -1);
+}
+
+/* Test tacacs_authorization get denined case */
+void testcase_tacacs_authorization_denined() {
+	char *testargv[2];
+	testargv[0] = "arg1";
+	testargv[1] = "arg2";
+
+	// test connection denined case
+	set_test_scenario(TEST_SCEANRIO_CONNECTION_SEND_DENINED_RESULT);
+	int result = tacacs_authorization("test_user","tty0","test_host","test_command",testargv,2);
+
+	CU_ASSERT_STRING_EQUAL(mock_syslog_message_buffer, "TACACS+: test_command not authorized from TestAddress2\n");
+
+    // send auth message denined.
+	CU_ASSERT_EQUAL(result, 1);
+}
+
+/* Test tacacs_authorization get success case */
+void testcase_tacacs_authorization_success() {
+	char *testargv[2];
+	testargv[0] = "arg1";
+	testargv[1] = "arg2";
+
+	// test connection success case
+	set_test_scenario(TEST_SCEANRIO_CONNECTION_SEND_SUCCESS_RESULT);
+	int result = tacacs_authorization("test_user","tty0","test_host","test_command",testargv,2);
+
+	CU_ASSERT_STRING_EQUAL(mock_syslog_message_buffer, "TACACS+: test_command authorized from TestAddress0\n");
+
+	// wuthorization success
+	CU_ASSERT_EQUAL(result, 0);
+}
+
+/* Test authorization_with_host_and_tty get success case */
+void testcase_authorization_with_host_and_tty_success() {
+	char *testargv[2];
+	testargv[0] = "arg1";
+	testargv[1] = "arg2";
+
+	// test connection success case
+	set_test_scenario(TEST_SCEANRIO_CONNECTION_SEND_SUCCESS_RESULT);
+	int result = authorization_with_host_and_tty("test_user","test_command",testargv,2);
+
+	// wuthorization success
+	CU_ASSERT_EQUAL(result, 0);
+}
+
+/* Test check_and_load_changed_tacacs_config */
+void testcase_check_and_load_changed_tacacs_config() {
+
+	// test connection failed case
+	check_and_load_changed_tacacs_config();
+
+    // check server config updated.
+	CU_ASSERT_EQUAL(loaded_config_generation, plugin_state->config_generation);
+	CU_ASSERT_EQUAL(tacacs_ctrl, mock_parse_config_result);
+
+	// check and load file again.
+	check_and_load_changed_tacacs_config();
+
+    // check server config not update.
+	char* configNotChangeLog = "TACACS+: tacacs config file not change: last modified time";
+	CU_ASSERT_TRUE(strncmp(mock_syslog_message_buffer, configNotChangeLog, strlen(configNotChangeLog)) == 0);
+}
+
+/* Run on_shell_execve as remote user, return authorization result */
+int run_on_shell_execve_as_remote_user() {
+	char *testargv[3];
+	testargv[0] = "arg1";
+	testargv[1] = "arg2";
+	testargv[2] = 0;
+
+	// test_user not exist on test machine, memo it as remote user.
+	strcpy(plugin_state->local_user_name, "test_user");
+	plugin_state->local_user_result = IS_REMOTE_USER;
+	int result = on_shell_execve("test_user", 1, "test_command", testargv);
+	memset(plugin_state->local_user_name, 0, sizeof(plugin_state->local_user_name));
+	return result;
+}
+
+/* Test on_shell_execve authorization successed */
+void testcase_on_shell_execve_success() {
+	// test connection success case
+	set_test_scenario(TEST_SCEANRIO_CONNECTION_SEND_SUCCESS_RESULT);
+	int result = run_on_shell_execve_as_remote_user();
+
+    // check authorized success.
+	CU_ASSERT_EQUAL(result, 0);
+	CU_ASSERT_STRING_EQUAL(mock_syslog_message_buffer, "TACACS+: local authorization disabled, TACACS+ authorization result: 0\n");
+}
+
+/* Test on_shell_execve authorization denined */
+void testcase_on_shell_execve_denined() {
+	// test connection denined case
+	set_test_scenario(TEST_SCEANRIO_CONNECTION_SEND_DENINED_RESULT);
+	int result = run_on_shell_execve_as_remote_user();
+
+    // check authorized failed.
+	CU_ASSERT_EQUAL(result, 1);
+	CU_ASSERT_STRING_EQUAL(mock_syslog_message_buffer, "TACACS+: local authorization disabled, TACACS+ authorization result: 1\n");
+}
+
+/* Test on_shell_execve authorization failed */
+void testcase_on_shell_execve_failed() {
+	// test connection failed case
+	set_test_scenario(TEST_SCEANRIO_CONNECTION_ALL_FAILED);
+	int result = run_on_shell_execve_as_remote_user();
+
+    // check not authorized.
+	CU_ASSERT_EQUAL(result, -2);
+	CU_ASSERT_STRING_EQUAL(mock_syslog_message_buffer, "TACACS+: local authorization disabled, TACACS+ authorization result: -2\n");
+}
+
+/* Run authorization with stand-in server, return average latency in microseconds */
+double run_stand_in_authorization(int count) {
+	char *testargv[3];
+	testargv[0] = "show";
+	testargv[1] = "version";
+	testargv[2] = 0;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int idx=0; idx < count; idx++) {
+		int result = tacacs_authorization("test_user","tty0","test_host","show",testargv,2);
+		CU_ASSERT_EQUAL(result, 0);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double elapsed = (end.tv_sec - start.tv_sec) * 1000000.0 + (end.tv_nsec - start.tv_nsec) / 1000.0;
+	return elapsed / count;
+}
+
+/* Test single connection reuse kept connection */
+void testcase_single_connection_reuse() {
+	set_test_scenario(TEST_SCEANRIO_STAND_IN_SERVER);
+	CU_ASSERT_EQUAL(start_stand_in_server(0, STAND_IN_SERVER_NORMAL), 0);
+
+	single_connection_enabled = 1;
+	run_stand_in_authorization(10);
+
+	// only first server used, and only one connection created.
+	CU_ASSERT_EQUAL(get_stand_in_connection_count(), 1);
+
+	// server close idle connection, plugin should reconnect.
+	drop_stand_in_connections();
+	run_stand_in_authorization(10);
+	CU_ASSERT_EQUAL(get_stand_in_connection_count(), 2);
+
+	close_all_tacacs_connections();
+	single_connection_enabled = 0;
+	stop_stand_in_servers();
+}
+
+/* Test connection not kept when server not accept single connection */
+void testcase_single_connection_not_accepted() {
+	set_test_scenario(TEST_SCEANRIO_STAND_IN_SERVER);
+	CU_ASSERT_EQUAL(start_stand_in_server(0, STAND_IN_SERVER_NO_SINGLE_CONNECTION), 0);
+
+	single_connection_enabled = 1;
+	run_stand_in_authorization(10);
+
+	// server reply without single connection flag, connection closed after each command.
+	CU_ASSERT_EQUAL(get_stand_in_connection_count(), 10);
+
+	close_all_tacacs_connections();
+	single_connection_enabled = 0;
+	stop_stand_in_servers();
+}
+
+/* Test kept connection shared with commands forked from shell */
+void testcase_single_connection_across_fork() {
+	set_test_scenario(TEST_SCEANRIO_STAND_IN_SERVER);
+	CU_ASSERT_EQUAL(start_stand_in_server(0, STAND_IN_SERVER_NORMAL), 0);
+
+	single_connection_enabled = 1;
+	for (int idx=0; idx < 3; idx++) {
+		// command process forked from shell, authorize and exit.
+		pid_t pid = fork();
+		if (pid == 0) {
+			run_stand_in_authorization(1);
+			_exit(CU_get_number_of_failures());
+		}
+
+		int status = -1;
+		waitpid(pid, &status, 0);
+		CU_ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	}
+
+	// connection kept by first command used by following commands.
+	CU_ASSERT_EQUAL(get_stand_in_connection_count(), 1);
+
+	close_all_tacacs_connections();
+	single_connection_enabled = 0;
+	stop_stand_in_servers();
+}
+
+/* Benchmark per-command authorization latency with and without single connection */
+void testcase_single_connection_benchmark() {
+	set_test_scenario(TEST_SCEANRIO_STAND_IN_SERVER);
+	CU_ASSERT_EQUAL(start_stand_in_server(0, STAND_IN_SERVER_NORMAL), 0);
+
+	// disable debug output, benchmark should not measure log output.
+	int original_ctrl = tacacs_ctrl;
+	tacacs_ctrl = 0;
+
+	single_connection_enabled = 0;
+	double connection_per_command = run_stand_in_authorization(BENCHMARK_AUTHORIZATION_COUNT);
+	CU_ASSERT_EQUAL(get_stand_in_connection_count(), BENCHMARK_AUTHORIZATION_COUNT);
+
+	reset_stand_in_connection_count();
+	single_connection_enabled = 1;
+	double single_connection = run_stand_in_authorization(BENCHMARK_AUTHORIZATION_COUNT);
+	CU_ASSERT_EQUAL(get_stand_in_connection_count(), 1);
+
+	printf("authorization latency for %d commands: connection per command %.1f us, single connection %.1f us\n",
+			BENCHMARK_AUTHORIZATION_COUNT, connection_per_command, single_connection);
+
+	close_all_tacacs_connections();
+	single_connection_enabled = 0;
+	tacacs_ctrl = original_ctrl;
+	stop_stand_in_servers();
+}
+
+/* Run one authorization with stand-in servers, return latency in milliseconds */
+double run_one_stand_in_authorization(int *result) {
+	char *testargv[3];
+	testargv[0] = "show";
+	testargv[1] = "version";
+	testargv[2] = 0;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	*result = tacacs_authorization("test_user","tty0","test_host","show",testargv,2);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+/* Test sequential authorization skip dead server in following commands */
+void testcase_sequential_authorization_skip_dead_server() {
+	int result;
+	set_test_scenario(TEST_SCEANRIO_STAND_IN_SERVER);
+	CU_ASSERT_EQUAL(start_stand_in_server(0, STAND_IN_SERVER_REFUSE), 0);
+	CU_ASSERT_EQUAL(start_stand_in_server(1, STAND_IN_SERVER_NORMAL), 0);
+	reset_tacacs_server_health();
+
+	run_one_stand_in_authorization(&result);
+	CU_ASSERT_EQUAL(result, 0);
+	CU_ASSERT_TRUE(is_tacacs_server_in_backoff(0));
+	CU_ASSERT_FALSE(is_tacacs_server_in_backoff(1));
+
+	stop_stand_in_servers();
+	reset_tacacs_server_health();
+}
+
+/* Test parallel authorization with refused and slow servers */
+void testcase_parallel_authorization_refuse_and_slow() {
+	int result;
+	set_test_scenario(TEST_SCEANRIO_STAND_IN_SERVER);
+	CU_ASSERT_EQUAL(start_stand_in_server(0, STAND_IN_SERVER_REFUSE), 0);
+	CU_ASSERT_EQUAL(start_stand_in_server(1, STAND_IN_SERVER_SLOW), 0);
+	CU_ASSERT_EQUAL(start_stand_in_server(2, STAND_IN_SERVER_NORMAL), 0);
+	reset_tacacs_server_health();
+	authorization_mode = AUTHORIZATION_MODE_PARALLEL;
+
+	// request sent to all servers at once, normal server answers before slow server.
+	double latency = run_one_stand_in_authorization(&result);
+	CU_ASSERT_EQUAL(result, 0);
+	CU_ASSERT_TRUE(latency < STAND_IN_SERVER_SLOW_REPLY_MS);
+	CU_ASSERT_TRUE(is_tacacs_server_in_backoff(0));
+	CU_ASSERT_FALSE(is_tacacs_server_in_backoff(1));
+
+	authorization_mode = AUTHORIZATION_MODE_SEQUENTIAL;
+	stop_stand_in_servers();
+	reset_tacacs_server_health();
+}
+
+/* Test parallel authorization read reply of first sent request, each server has its own session */
+void testcase_parallel_authorization_session_per_server() {
+	int result;
+	set_test_scenario(TEST_SCEANRIO_STAND_IN_SERVER);
+	CU_ASSERT_EQUAL(start_stand_in_server(0, STAND_IN_SERVER_NORMAL), 0);
+	CU_ASSERT_EQUAL(start_stand_in_server(1, STAND_IN_SERVER_SLOW), 0);
+	reset_tacacs_server_health();
+	authorization_mode = AUTHORIZATION_MODE_PARALLEL;
+
+	// request to slow server sent last, reply of normal server still accepted without wait slow server.
+	double latency = run_one_stand_in_authorization(&result);
+	CU_ASSERT_EQUAL(result, 0);
+	CU_ASSERT_TRUE(latency < STAND_IN_SERVER_SLOW_REPLY_MS);
+	CU_ASSERT_FALSE(is_tacacs_server_in_backoff(0));
+	CU_ASSERT_FALSE(is_tacacs_server_in_backoff(1));
+
+	authorization_mode = AUTHORIZATION_MODE_SEQUENTIAL;
+	stop_stand_in_servers();
+	reset_tacacs_server_health();
+}
+
+/* Test hedged authorization with blackhole server, blackhole server only marked dead when connect timeout */
+void testcase_hedged_authorization_blackhole() {
+	int result;
+	int original_timeout = tac_timeout;
+	set_test_scenario(TEST_SCEANRIO_STAND_IN_SERVER);
+	CU_ASSERT_EQUAL(start_stand_in_server(0, STAND_IN_SERVER_BLACKHOLE), 0);
+	CU_ASSERT_EQUAL(start_stand_in_server(1, STAND_IN_SERVER_NORMAL), 0);
+	reset_tacacs_server_health();
+	authorization_mode = AUTHORIZATION_MODE_HEDGED;
+	hedge_delay = TEST_HEDGE_DELAY;
+	tac_timeout = 2;
+
+	// blackhole server delays authorization by hedge delay, not connect timeout.
+	double latency = run_one_stand_in_authorization(&result);
+	CU_ASSERT_EQUAL(result, 0);
+	CU_ASSERT_TRUE(latency >= TEST_HEDGE_DELAY);
+	CU_ASSERT_TRUE(latency < tac_timeout * 1000);
+
+	// server slower than hedge delay is not dead.
+	CU_ASSERT_FALSE(is_tacacs_server_in_backoff(0));
+	printf("hedged authorization latency with blackhole server: %.1f ms\n", latency);
+
+	// blackhole server marked dead when connect timeout.
+	int original_server_count = tac_srv_no;
+	tac_srv_no = 1;
+	tac_timeout = 1;
+	run_one_stand_in_authorization(&result);
+	CU_ASSERT_NOT_EQUAL(result, 0);
+	CU_ASSERT_TRUE(is_tacacs_server_in_backoff(0));
+	tac_srv_no = original_server_count;
+
+	tac_timeout = original_timeout;
+	authorization_mode = AUTHORIZATION_MODE_SEQUENTIAL;
+	stop_stand_in_servers();
+	reset_tacacs_server_health();
+}
+
+/* Run cached authorization with stand-in server */
+int run_cached_authorization(char *command, char *argument) {
+	char *testargv[3];
+	testargv[0] = command;
+	testargv[1] = argument;
+	testargv[2] = 0;
+
+	return cached_authorization_with_host_and_tty("test_user", command, testargv, 2);
+}
+
+/* Test authorization cache answer repeated command locally */
+void testcase_authorization_cache_hit() {
+	set_test_scenario(TEST_SCEANRIO_STAND_IN_SERVER);
+	CU_ASSERT_EQUAL(start_stand_in_server(0, STAND_IN_SERVER_NORMAL), 0);
+	reset_tacacs_server_health();
+	memset(&plugin_state->authorization_cache_stats, 0, sizeof(authorization_cache_stats_t));
+
+	// cache not used when cache disabled
+	CU_ASSERT_EQUAL(run_cached_authorization("show", "version"), 0);
+	CU_ASSERT_EQUAL(plugin_state->authorization_cache_stats.misses, 0);
+	reset_stand_in_connection_count();
+
+	authorization_cache_enabled = 1;
+	authorization_cache_ttl = 60;
+
+	CU_ASSERT_EQUAL(run_cached_authorization("show", "version"), 0);
+	CU_ASSERT_PTR_NOT_NULL(authorization_cache);
+	CU_ASSERT_EQUAL(run_cached_authorization("show", "version"), 0);
+	CU_ASSERT_EQUAL(get_stand_in_connection_count(), 1);
+	CU_ASSERT_EQUAL(plugin_state->authorization_cache_stats.hits, 1);
+	CU_ASSERT_EQUAL(plugin_state->authorization_cache_stats.misses, 1);
+
+	// different argument is different cache key
+	CU_ASSERT_EQUAL(run_cached_authorization("show", "interfaces"), 0);
+	CU_ASSERT_EQUAL(get_stand_in_connection_count(), 2);
+	CU_ASSERT_EQUAL(plugin_state->authorization_cache_stats.misses, 2);
+
+	clear_authorization_cache();
+	authorization_cache_enabled = 0;
+	stop_stand_in_servers();
+}
+
+/* Test authorization cache expired and invalidated */
+void testcase_authorization_cache_expire_and_invalidate() {
+	set_test_scenario(TEST_SCEANRIO_STAND_IN_SERVER);
+	CU_ASSERT_EQUAL(start_stand_in_server(0, STAND_IN_SERVER_NORMAL), 0);
+	reset_tacacs_server_health();
+	memset(&plugin_state->authorization_cache_stats, 0, sizeof(authorization_cache_stats_t));
+	authorization_cache_enabled = 1;
+	authorization_cache_ttl = 60;
+
+	CU_ASSERT_EQUAL(run_cached_authorization("show", "version"), 0);
+
+	// cached decision expired when TTL passed
+	authorization_cache_ttl = 0;
+	CU_ASSERT_EQUAL(run_cached_authorization("show", "version"), 0);
+	CU_ASSERT_EQUAL(plugin_state->authorization_cache_stats.expired, 1);
+	CU_ASSERT_EQUAL(get_stand_in_connection_count(), 2);
+
+	// decision cached again after expired
+	authorization_cache_ttl = 60;
+	CU_ASSERT_EQUAL(run_cached_authorization("show", "version"), 0);
+	CU_ASSERT_EQUAL(plugin_state->authorization_cache_stats.hits, 1);
+	CU_ASSERT_EQUAL(get_stand_in_connection_count(), 2);
+
+	// cached decision invalidated when config changed
+	clear_authorization_cache();
+	CU_ASSERT_EQUAL(run_cached_authorization("show", "version"), 0);
+	CU_ASSERT_EQUAL(plugin_state->authorization_cache_stats.hits, 1);
+	CU_ASSERT_EQUAL(get_stand_in_connection_count(), 3);
+
+	clear_authorization_cache();
+	authorization_cache_enabled = 0;
+	stop_stand_in_servers();
+}
+
+/* Test authorization cache evict least recently used decision */
+void testcase_authorization_cache_eviction() {
+	set_test_scenario(TEST_SCEANRIO_STAND_IN_SERVER);
+	CU_ASSERT_EQUAL(start_stand_in_server(0, STAND_IN_SERVER_NORMAL), 0);
+	reset_tacacs_server_health();
+	memset(&plugin_state->authorization_cache_stats, 0, sizeof(authorization_cache_stats_t));
+	authorization_cache_enabled = 1;
+	authorization_cache_ttl = 60;
+	authorization_cache_size = 2;
+
+	CU_ASSERT_EQUAL(run_cached_authorization("show", "version"), 0);
+	CU_ASSERT_EQUAL(run_cached_authorization("show", "interfaces"), 0);
+	CU_ASSERT_EQUAL(run_cached_authorization("show", "ip"), 0);
+	CU_ASSERT_EQUAL(plugin_state->authorization_cache_stats.evictions, 1);
+
+	// latest decisions still cached
+	CU_ASSERT_EQUAL(run_cached_authorization("show", "ip"), 0);
+	CU_ASSERT_EQUAL(plugin_state->authorization_cache_stats.hits, 1);
+	CU_ASSERT_EQUAL(get_stand_in_connection_count(), 3);
+
+	clear_authorization_cache();
+	authorization_cache_size = 128;
+	authorization_cache_enabled = 0;
+	stop_stand_in_servers();
+}
+
+/* Overwrite every regular file opened by current process, return overwritten file count */
+int overwrite_opened_files(const void *data, size_t length) {
+	int overwritten = 0;
+	DIR *fd_dir = opendir("/proc/self/fd");
+	CU_ASSERT_PTR_NOT_NULL_FATAL(fd_dir);
+
+	struct dirent *fd_entry;
+	while ((fd_entry = readdir(fd_dir)) != NULL) {
+		struct stat attr;
+		int fd = atoi(fd_entry->d_name);
+		if (fd <= STDERR_FILENO || fstat(fd, &attr) < 0 || !S_ISREG(attr.st_mode)) {
+			continue;
+		}
+
+		char path[PATH_MAX];
+		snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+		int file_fd = open(path, O_WRONLY);
+		if (file_fd < 0) {
+			continue;
+		}
+
+		if (pwrite(file_fd, data, length, 0) == (ssize_t)length) {
+			overwritten++;
+		}
+
+		close(file_fd);
+	}
+
+	closedir(fd_dir);
+	return overwritten;
+}
+
+/* Test cached decision can't be changed by writing files through /proc/<pid>/fd */
+void testcase_authorization_cache_not_forgeable() {
+	set_test_scenario(TEST_SCEANRIO_STAND_IN_SERVER);
+	CU_ASSERT_EQUAL(start_stand_in_server(0, STAND_IN_SERVER_NORMAL), 0);
+	reset_tacacs_server_health();
+	memset(&plugin_state->authorization_cache_stats, 0, sizeof(authorization_cache_stats_t));
+	authorization_cache_enabled = 1;
+	authorization_cache_ttl = 60;
+
+	CU_ASSERT_EQUAL(run_cached_authorization("show", "version"), 0);
+
+	// forge deny decision for every cache slot.
+	int entry_idx;
+	authorization_cache_entry_t *forged_cache = calloc(AUTHORIZATION_CACHE_MAX_SIZE, sizeof(authorization_cache_entry_t));
+	CU_ASSERT_PTR_NOT_NULL_FATAL(forged_cache);
+	for (entry_idx = 0; entry_idx < AUTHORIZATION_CACHE_MAX_SIZE; entry_idx++) {
+		if (authorization_cache[entry_idx].key_len != 0) {
+			forged_cache[0] = authorization_cache[entry_idx];
+		}
+	}
+
+	forged_cache[0].result = 1;
+	for (entry_idx = 1; entry_idx < AUTHORIZATION_CACHE_MAX_SIZE; entry_idx++) {
+		forged_cache[entry_idx] = forged_cache[0];
+	}
+
+	overwrite_opened_files(forged_cache, AUTHORIZATION_CACHE_MAX_SIZE * sizeof(authorization_cache_entry_t));
+	free(forged_cache);
+
+	// cached decision not changed
+	CU_ASSERT_EQUAL(run_cached_authorization("show", "version"), 0);
+	CU_ASSERT_EQUAL(plugin_state->authorization_cache_stats.hits, 1);
+
+	clear_authorization_cache();
+	authorization_cache_enabled = 0;
+	stop_stand_in_servers();
+}
+
+/* Test kept connection and cached decision shared with commands forked from shell */
+void testcase_shared_state_across_fork() {
+	set_test_scenario(TEST_SCEANRIO_STAND_IN_SERVER);
+	CU_ASSERT_EQUAL(start_stand_in_server(0, STAND_IN_SERVER_NORMAL), 0);
+	reset_tacacs_server_health();
+	memset(&plugin_state->authorization_cache_stats, 0, sizeof(authorization_cache_stats_t));
+	single_connection_enabled = 1;
+	authorization_cache_enabled = 1;
+	authorization_cache_ttl = 60;
+
+	// command process forked from shell, authorize and exit.
+	pid_t pid = fork();
+	if (pid == 0) {
+		_exit(run_cached_authorization("show", "version"));
+	}
+
+	int status = -1;
+	waitpid(pid, &status, 0);
+	CU_ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	// decision cached by previous command
+	CU_ASSERT_EQUAL(run_cached_authorization("show", "version"), 0);
+	CU_ASSERT_EQUAL(plugin_state->authorization_cache_stats.hits, 1);
+
+	// connection kept by previous command
+	CU_ASSERT_EQUAL(run_cached_authorization("show", "interfaces"), 0);
+	CU_ASSERT_EQUAL(get_stand_in_connection_count(), 1);
+
+	close_all_tacacs_connections();
+	clear_authorization_cache();
+	authorization_cache_enabled = 0;
+	single_connection_enabled = 0;
+	stop_stand_in_servers();
+}
+
+/* Test config parsed by command process restored by shell without parse config file */
+void testcase_shared_config_across_fork() {
+	struct sockaddr server_address = *tac_srv[2].addr->ai_addr;
+	start_config_generation();
+
+	// command process found config changed, parse config file and exit.
+	pid_t pid = fork();
+	if (pid == 0) {
+		check_and_load_changed_tacacs_config();
+		_exit(loaded_config_generation == plugin_state->config_generation ? 0 : 1);
+	}
+
+	int status = -1;
+	waitpid(pid, &status, 0);
+	CU_ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	int parse_count = mock_parse_config_count;
+	tacacs_ctrl = 0;
+	check_and_load_changed_tacacs_config();
+
+	// config restored from shared config
+	CU_ASSERT_EQUAL(mock_parse_config_count, parse_count);
+	CU_ASSERT_EQUAL(loaded_config_generation, plugin_state->config_generation);
+	CU_ASSERT_EQUAL(tacacs_ctrl, mock_parse_config_result);
+	CU_ASSERT_EQUAL(memcmp(tac_srv[2].addr->ai_addr, &server_address, sizeof(server_address)), 0);
+	CU_ASSERT_STRING_EQUAL(tac_srv[2].key, "key2");
+}
+
+/* Write test config file */
+void write_test_config(const char *path, const char *content) {
+	FILE *file = fopen(path, "w");
+	CU_ASSERT_PTR_NOT_NULL_FATAL(file);
+	fputs(content, file);
+	fclose(file);
+}
+
+/* Test config file change detected with inotify */
+void testcase_config_watch() {
+	char config_dir[] = "/tmp/bash_tacplus_test_XXXXXX";
+	CU_ASSERT_PTR_NOT_NULL_FATAL(mkdtemp(config_dir));
+
+	char config_path[PATH_MAX], other_path[PATH_MAX];
+	snprintf(config_path, sizeof(config_path), "%s/tacplus_nss.conf", config_dir);
+	snprintf(other_path, sizeof(other_path), "%s/other.conf", config_dir);
+	write_test_config(config_path, "debug\n");
+
+	const char *original_config_file = tacacs_config_file;
+	tacacs_config_file = config_path;
+	init_config_watch();
+	CU_ASSERT_TRUE(config_watch_fd >= 0);
+	check_and_load_changed_tacacs_config();
+	unsigned int generation = plugin_state->config_generation;
+
+	// config file not change
+	check_and_load_changed_tacacs_config();
+	CU_ASSERT_EQUAL(plugin_state->config_generation, generation);
+
+	// other file in config directory changed
+	write_test_config(other_path, "debug\n");
+	check_and_load_changed_tacacs_config();
+	CU_ASSERT_EQUAL(plugin_state->config_generation, generation);
+
+	// config file changed, config reloaded once
+	write_test_config(config_path, "debug\nsingle_connection\n");
+	check_and_load_changed_tacacs_config();
+	CU_ASSERT_EQUAL(plugin_state->config_generation, generation + 1);
+	CU_ASSERT_EQUAL(loaded_config_generation, plugin_state->config_generation);
+	CU_ASSERT_EQUAL(single_connection_enabled, 1);
+
+	check_and_load_changed_tacacs_config();
+	CU_ASSERT_EQUAL(plugin_state->config_generation, generation + 1);
+
+	release_config_watch();
+	tacacs_config_file = original_config_file;
+	single_connection_enabled = 0;
+	unlink(config_path);
+	unlink(other_path);
+	rmdir(config_dir);
+}
+
+/* Run on_shell_execve, return average overhead in nanoseconds */
+double run_on_shell_execve(char *user, int count) {
+	char *testargv[3];
+	testargv[0] = "show";
+	testargv[1] = "version";
+	testargv[2] = 0;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int idx=0; idx < count; idx++) {
+		CU_ASSERT_EQUAL(on_shell_execve(user, 1, "show", testargv), 0);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double elapsed = (end.tv_sec - start.tv_sec) * 1000000000.0 + (end.tv_nsec - start.tv_nsec);
+	return elapsed / count;
+}
+
+/* Benchmark on_shell_execve overhead for local user and remote user without TACACS+ authorization */
+void testcase_on_shell_execve_benchmark() {
+	char config_dir[] = "/tmp/bash_tacplus_test_XXXXXX";
+	CU_ASSERT_PTR_NOT_NULL_FATAL(mkdtemp(config_dir));
+
+	char config_path[PATH_MAX];
+	snprintf(config_path, sizeof(config_path), "%s/tacplus_nss.conf", config_dir);
+	write_test_config(config_path, "\n");
+
+	const char *original_config_file = tacacs_config_file;
+	int original_ctrl = tacacs_ctrl;
+	tacacs_config_file = config_path;
+	init_config_watch();
+
+	// first command lookup user database and load config.
+	run_on_shell_execve("root", 1);
+	strcpy(plugin_state->local_user_name, "test_remote_user");
+	plugin_state->local_user_result = IS_REMOTE_USER;
+	run_on_shell_execve("test_remote_user", 1);
+	tacacs_ctrl = 0;
+
+	strcpy(plugin_state->local_user_name, "root");
+	plugin_state->local_user_result = IS_LOCAL_USER;
+	double local_user = run_on_shell_execve("root", BENCHMARK_COMMAND_COUNT);
+
+	strcpy(plugin_state->local_user_name, "test_remote_user");
+	plugin_state->local_user_result = IS_REMOTE_USER;
+	double remote_user = run_on_shell_execve("test_remote_user", BENCHMARK_COMMAND_COUNT);
+
+	printf("on_shell_execve overhead for %d commands: local user %.1f ns, remote user %.1f ns\n",
+			BENCHMARK_COMMAND_COUNT, local_user, remote_user);
+
+	memset(plugin_state->local_user_name, 0, sizeof(plugin_state->local_user_name));
+	release_config_watch();
+	tacacs_config_file = original_config_file;
+	tacacs_ctrl = original_ctrl;
+	unlink(config_path);
+	rmdir(config_dir);
+}
+
+int main(void) {
+  if (CUE_SUCCESS != CU_initialize_registry()) {
+    return CU_get_error();
+  }
+
+  CU_pSuite ste = CU_add_suite("plugin_test", start_up, clean_up);
+  if (NULL == ste) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if (CU_get_error() != CUE_SUCCESS) {
+    fprintf(stderr, "Error creating suite: (%d)%s\n", CU_get_error(), CU_get_error_msg());
+    return CU_get_error();
+  }
+
+  if (!CU_add_test(ste, "Test testcase_tacacs_authorization_all_failed()...\n", testcase_tacacs_authorization_all_failed)
+	  || !CU_add_test(ste, "Test testcase_tacacs_authorization_faled()...\n", testcase_tacacs_authorization_faled)
+	  || !CU_add_test(ste, "Test testcase_tacacs_authorization_read_failed()...\n", testcase_tacacs_authorization_read_failed)
+	  || !CU_add_test(ste, "Test testcase_tacacs_authorization_denined()...\n", testcase_tacacs_authorization_denined)
+	  || !CU_add_test(ste, "Test testcase_tacacs_authorization_success()...\n", testcase_tacacs_authorization_success)
+	  || !CU_add_test(ste, "Test testcase_authorization_with_host_and_tty_success()...\n", testcase_authorization_with_host_and_tty_success)
+	  || !CU_add_test(ste, "Test testcase_check_and_load_changed_tacacs_config()...\n", testcase_check_and_load_changed_tacacs_config)
+	  || !CU_add_test(ste, "Test testcase_on_shell_execve_success()...\n", testcase_on_shell_execve_success)
+	  || !CU_add_test(ste, "Test testcase_on_shell_execve_denined()...\n", testcase_on_shell_execve_denined)
+	  || !CU_add_test(ste, "Test testcase_on_shell_execve_failed()...\n", testcase_on_shell_execve_failed)
+	  || !CU_add_test(ste, "Test testcase_single_connection_reuse()...\n", testcase_single_connection_reuse)
+	  || !CU_add_test(ste, "Test testcase_single_connection_not_accepted()...\n", testcase_single_connection_not_accepted)
+	  || !CU_add_test(ste, "Test testcase_single_connection_across_fork()...\n", testcase_single_connection_across_fork)
+	  || !CU_add_test(ste, "Test testcase_single_connection_benchmark()...\n", testcase_single_connection_benchmark)
+	  || !CU_add_test(ste, "Test testcase_sequential_authorization_skip_dead_server()...\n", testcase_sequential_authorization_skip_dead_server)
+	  || !CU_add_test(ste, "Test testcase_parallel_authorization_refuse_and_slow()...\n", testcase_parallel_authorization_refuse_and_slow)
+	  || !CU_add_test(ste, "Test testcase_parallel_authorization_session_per_server()...\n", testcase_parallel_authorization_session_per_server)
+	  || !CU_add_test(ste, "Test testcase_hedged_authorization_blackhole()...\n", testcase_hedged_authorization_blackhole)
+	  || !CU_add_test(ste, "Test testcase_authorization_cache_hit()...\n", testcase_authorization_cache_hit)
+	  || !CU_add_test(ste, "Test testcase_authorization_cache_expire_and_invalidate()...\n", testcase_authorization_cache_expire_and_invalidate)
+	  || !CU_add_test(ste, "Test testcase_authorization_cache_eviction()...\n", testcase_authorization_cache_eviction)
+	  || !CU_add_test(ste, "Test testcase_authorization_cache_not_forgeable()...\n", testcase_authorization_cache_not_forgeable)
+	  || !CU_add_test(ste, "Test testcase_shared_state_across_fork()...\n", testcase_shared_state_across_fork)
+	  || !CU_add_test(ste, "Test testcase_shared_config_across_fork()...\n", testcase_shared_config_across_fork)
+	  || !CU_add_test(ste, "Test testcase_config_watch()...\n", testcase_config_watch)
+	  || !CU_add_test(ste, "Test testcase_on_shell_execve_benchmark()...\n", testcase_on_shell_execve_benchmark)) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if (CU_get_error() != CUE_SUCCESS) {
+    fprintf(stderr, "Error adding test: (%d)%s\n", CU_get_error(), CU_get_error_msg());
+  }
+
+  // run all test
+  CU_basic_set_mode(CU_BRM_VERBOSE);
+  CU_ErrorCode run_errors = CU_basic_run_suite(ste);
+  if (run_errors != CUE_SUCCESS) {
+    fprintf(stderr, "Error running tests: (%d)%s\n", run_errors, CU_get_error_msg());
+  }
+
+  CU_basic_show_failures(CU_get_failure_list());
+
+  // use failed UT count as return value
+  return CU_get_number_of_failure_records();
+}
\ No newline at end of file